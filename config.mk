@@ -49,7 +49,7 @@ INCFLAGS=-Iinclude
 
 # Add here your -l linker options
 # Remember to add -lstdc++ when linking C++ code
-# LDLIBS=
+LDLIBS=-lpthread
 
 # Add here the static libraries (*.a files) you want to link
 # 
@@ -100,8 +100,13 @@ AUTHOR=Andrea Pepe
 # Not to include any directory, just leave the variable empty
 # EXTRA_DIRS=
 # SUBTARGETS_DIRS=
+# TEST=1 builds every subtarget, tests and benchmarks included; BENCH=1 only
+# the benchmarks, from src/*/bench
 ifeq ($(TEST),)
-SUBTARGETS_DIRS=
+SUBTARGETS_DIRS=./src/module-log-binary/decode
+ifneq ($(BENCH),)
+SUBTARGETS_DIRS+=$(wildcard ./src/*/bench)
+endif
 endif
 
 # Uncomment (and eventually change the header file name)
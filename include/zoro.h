@@ -8,10 +8,29 @@
 #define __ZORO_H__
 
 #include <zoro/compiler.h>
+#include <zoro/atomic.h>
+#include <zoro/clock.h>
 #include <zoro/log.h>
+#include <zoro/binlog.h>
+#include <zoro/sink.h>
 #include <zoro/test.h>
+#include <zoro/bench.h>
+#include <zoro/hash.h>
+#include <zoro/hashtable.h>
+#include <zoro/epoch.h>
+#include <zoro/chashtable.h>
+#include <zoro/skiplist.h>
+#include <zoro/pool.h>
+#include <zoro/perf.h>
+#include <zoro/stats.h>
+#include <zoro/percpu.h>
+#include <zoro/workqueue.h>
 #include <zoro/linux/rwonce.h>
 #include <zoro/linux/list.h>
 #include <zoro/linux/hlist.h>
+#include <zoro/linux/hash.h>
+#include <zoro/linux/llist.h>
+#include <zoro/linux/rcupdate.h>
+#include <zoro/linux/rculist.h>
 
 #endif /* __ZORO_H__ */
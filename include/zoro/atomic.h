@@ -0,0 +1,271 @@
+/**
+ * @file atomic.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief SMP memory barriers and atomic operations.
+ *
+ * Same semantics as their Linux kernel counterparts. The barriers are
+ * written per architecture, with the cheapest instruction that provides the
+ * required ordering:
+ *
+ *              x86-64                  arm64           others
+ * smp_mb()     lock addl to the stack  dmb ish         seq_cst fence
+ * smp_rmb()    compiler barrier        dmb ishld       acquire fence
+ * smp_wmb()    compiler barrier        dmb ishst       release fence
+ *
+ * The other operations are built on the __atomic builtins, that already
+ * pick the best sequence for the target (e.g. ldar/stlr on arm64, plain
+ * moves on x86-64 for acquire and release).
+ *
+ * Like in the kernel, atomic operations that do not return a value are
+ * relaxed, while those that do are fully ordered, unless their name says
+ * otherwise (_relaxed, _acquire, _release).
+ */
+
+#pragma once
+#ifndef __ZORO_ATOMIC_H__
+#define __ZORO_ATOMIC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zoro/compiler.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * A locked instruction orders everything like mfence, except for non
+ * temporal stores and write-combining memory, that we do not use, and it is
+ * cheaper. Only the store-load reordering needs it: x86 is TSO otherwise.
+ */
+#ifdef __x86_64__
+#define smp_mb()	__asm__ __volatile__("lock; addl $0,-4(%%rsp)" ::: "memory", "cc")
+#else
+#define smp_mb()	__asm__ __volatile__("lock; addl $0,-4(%%esp)" ::: "memory", "cc")
+#endif
+#define smp_rmb()	barrier()
+#define smp_wmb()	barrier()
+#define cpu_relax()	__asm__ __volatile__("pause" ::: "memory")
+#define __smp_mb__atomic()	barrier()
+
+#elif defined(__aarch64__)
+#define smp_mb()	__asm__ __volatile__("dmb ish" ::: "memory")
+#define smp_rmb()	__asm__ __volatile__("dmb ishld" ::: "memory")
+#define smp_wmb()	__asm__ __volatile__("dmb ishst" ::: "memory")
+#define cpu_relax()	__asm__ __volatile__("yield" ::: "memory")
+#define __smp_mb__atomic()	smp_mb()
+
+#else
+#define smp_mb()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define cpu_relax()	barrier()
+#define __smp_mb__atomic()	smp_mb()
+#endif
+
+/* Only Alpha ever needed it */
+#define smp_read_barrier_depends()	barrier()
+
+/**
+ * @brief Full barrier around a relaxed atomic operation (e.g. atomic_inc()):
+ *        free on x86, where locked instructions are barriers already.
+ */
+#define smp_mb__before_atomic()	__smp_mb__atomic()
+#define smp_mb__after_atomic()	__smp_mb__atomic()
+
+/**
+ * @brief Load @a *p; later memory accesses are not moved before it.
+ */
+#define smp_load_acquire(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+/**
+ * @brief Store @a v into @a *p; earlier memory accesses are not moved after
+ *        it.
+ */
+#define smp_store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @brief Store @a v into @a *p, then a full barrier.
+ */
+#define smp_store_mb(p, v) do {						\
+	__atomic_store_n((p), (v), __ATOMIC_RELAXED);			\
+	smp_mb();							\
+} while (0)
+
+/**
+ * @brief Exchange @a *p with @a v, fully ordered.
+ *
+ * @return The previous value of @a *p.
+ */
+#define xchg(p, v)		__atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define xchg_relaxed(p, v)	__atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#define xchg_acquire(p, v)	__atomic_exchange_n((p), (v), __ATOMIC_ACQUIRE)
+#define xchg_release(p, v)	__atomic_exchange_n((p), (v), __ATOMIC_RELEASE)
+
+#define __cmpxchg(p, o, n, s, f) ({					\
+	typeof(*(p)) __cx_old = (o);					\
+	__atomic_compare_exchange_n((p), &__cx_old, (n), false, (s), (f));\
+	__cx_old; })
+
+/**
+ * @brief Set @a *p to @a n if it equals @a o, fully ordered.
+ *
+ * @return The value of @a *p before the operation: it equals @a o on success.
+ */
+#define cmpxchg(p, o, n) \
+	__cmpxchg((p), (o), (n), __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define cmpxchg_relaxed(p, o, n) \
+	__cmpxchg((p), (o), (n), __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define cmpxchg_acquire(p, o, n) \
+	__cmpxchg((p), (o), (n), __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)
+#define cmpxchg_release(p, o, n) \
+	__cmpxchg((p), (o), (n), __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+
+/**
+ * @brief Set @a *p to @a n if it equals @a *po, fully ordered; on failure
+ *        set @a *po to the current value of @a *p. Cheaper than cmpxchg() in
+ *        loops.
+ *
+ * @return true on success; false otherwise.
+ */
+#define try_cmpxchg(p, po, n)						\
+	__atomic_compare_exchange_n((p), (po), (n), false,		\
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define try_cmpxchg_relaxed(p, po, n)					\
+	__atomic_compare_exchange_n((p), (po), (n), false,		\
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define try_cmpxchg_acquire(p, po, n)					\
+	__atomic_compare_exchange_n((p), (po), (n), false,		\
+				    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)
+#define try_cmpxchg_release(p, po, n)					\
+	__atomic_compare_exchange_n((p), (po), (n), false,		\
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+typedef struct {
+	int64_t counter;
+} atomic64_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define ATOMIC64_INIT(i)	{ (i) }
+
+/*
+ * The counter operations, for both atomic_t and atomic64_t: t is the type
+ * prefix, v the value type.
+ */
+#define __ZORO_ATOMIC_OPS(t, v)						\
+static inline v t##_read(const t##_t *a)				\
+{									\
+	return __atomic_load_n(&a->counter, __ATOMIC_RELAXED);		\
+}									\
+static inline v t##_read_acquire(const t##_t *a)			\
+{									\
+	return __atomic_load_n(&a->counter, __ATOMIC_ACQUIRE);		\
+}									\
+static inline void t##_set(t##_t *a, v i)				\
+{									\
+	__atomic_store_n(&a->counter, i, __ATOMIC_RELAXED);		\
+}									\
+static inline void t##_set_release(t##_t *a, v i)			\
+{									\
+	__atomic_store_n(&a->counter, i, __ATOMIC_RELEASE);		\
+}									\
+static inline void t##_add(v i, t##_t *a)				\
+{									\
+	__atomic_fetch_add(&a->counter, i, __ATOMIC_RELAXED);		\
+}									\
+static inline void t##_sub(v i, t##_t *a)				\
+{									\
+	__atomic_fetch_sub(&a->counter, i, __ATOMIC_RELAXED);		\
+}									\
+static inline void t##_inc(t##_t *a)					\
+{									\
+	__atomic_fetch_add(&a->counter, 1, __ATOMIC_RELAXED);		\
+}									\
+static inline void t##_dec(t##_t *a)					\
+{									\
+	__atomic_fetch_sub(&a->counter, 1, __ATOMIC_RELAXED);		\
+}									\
+static inline v t##_add_return(v i, t##_t *a)				\
+{									\
+	return __atomic_add_fetch(&a->counter, i, __ATOMIC_SEQ_CST);	\
+}									\
+static inline v t##_add_return_relaxed(v i, t##_t *a)			\
+{									\
+	return __atomic_add_fetch(&a->counter, i, __ATOMIC_RELAXED);	\
+}									\
+static inline v t##_sub_return(v i, t##_t *a)				\
+{									\
+	return __atomic_sub_fetch(&a->counter, i, __ATOMIC_SEQ_CST);	\
+}									\
+static inline v t##_fetch_add(v i, t##_t *a)				\
+{									\
+	return __atomic_fetch_add(&a->counter, i, __ATOMIC_SEQ_CST);	\
+}									\
+static inline v t##_fetch_add_relaxed(v i, t##_t *a)			\
+{									\
+	return __atomic_fetch_add(&a->counter, i, __ATOMIC_RELAXED);	\
+}									\
+static inline v t##_fetch_sub(v i, t##_t *a)				\
+{									\
+	return __atomic_fetch_sub(&a->counter, i, __ATOMIC_SEQ_CST);	\
+}									\
+static inline v t##_inc_return(t##_t *a)				\
+{									\
+	return t##_add_return(1, a);					\
+}									\
+static inline v t##_dec_return(t##_t *a)				\
+{									\
+	return t##_sub_return(1, a);					\
+}									\
+static inline bool t##_inc_and_test(t##_t *a)				\
+{									\
+	return t##_add_return(1, a) == 0;				\
+}									\
+static inline bool t##_dec_and_test(t##_t *a)				\
+{									\
+	return t##_sub_return(1, a) == 0;				\
+}									\
+static inline v t##_xchg(t##_t *a, v i)					\
+{									\
+	return xchg(&a->counter, i);					\
+}									\
+static inline v t##_cmpxchg(t##_t *a, v o, v n)				\
+{									\
+	return cmpxchg(&a->counter, o, n);				\
+}									\
+static inline bool t##_try_cmpxchg(t##_t *a, v *o, v n)			\
+{									\
+	return try_cmpxchg(&a->counter, o, n);				\
+}									\
+/* Add @a i unless the counter is @a u; return whether it was added */	\
+static inline bool t##_add_unless(t##_t *a, v i, v u)			\
+{									\
+	v c = t##_read(a);						\
+									\
+	do {								\
+		if (unlikely(c == u))					\
+			return false;					\
+	} while (!t##_try_cmpxchg(a, &c, c + i));			\
+	return true;							\
+}									\
+static inline bool t##_inc_not_zero(t##_t *a)				\
+{									\
+	return t##_add_unless(a, 1, 0);					\
+}
+
+__ZORO_ATOMIC_OPS(atomic, int)
+__ZORO_ATOMIC_OPS(atomic64, int64_t)
+
+#undef __ZORO_ATOMIC_OPS
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_ATOMIC_H__ */
@@ -0,0 +1,200 @@
+/**
+ * @file bench.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Microbenchmark helpers, the timing companion of test.h.
+ *
+ * A benchmark is a @a zorobench_fn_t running the operation to measure a
+ * given number of times. zorobench_run() first grows that number until a run
+ * lasts ZOROBENCH_MIN_RUN_NS, which also warms caches, branch predictors and
+ * CPU frequency up (for ZOROBENCH_WARMUP_NS at least), then times
+ * ZOROBENCH_RUNS runs of it and reports the min, median and 99th percentile
+ * of the time per operation; optionally, also hardware counters per
+ * operation, see zorobench_set_perf().
+ *
+ * @code
+ *	static void bench_add(uint64_t iters, void *arg)
+ *	{
+ *		while (iters--)
+ *			zorobench_do_not_optimize(add(arg));
+ *	}
+ *
+ *	struct zorobench_result res;
+ *
+ *	if (!zorobench_run("add", bench_add, &ctx, &res))
+ *		zorobench_report(&res);
+ * @endcode
+ */
+
+#pragma once
+#ifndef __ZORO_BENCH_H__
+#define __ZORO_BENCH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <zoro/clock.h>
+#include <zoro/compiler.h>
+#include <zoro/perf.h>
+
+#ifndef ZOROBENCH_MIN_RUN_NS
+    /**
+     * @brief Minimum duration of a timed run, in nanoseconds: long enough
+     * for the clock resolution and overhead not to matter. It takes effect
+     * when building the library.
+     */
+    #define ZOROBENCH_MIN_RUN_NS 10000000ULL
+#endif
+
+#ifndef ZOROBENCH_WARMUP_NS
+    /**
+     * @brief Minimum time spent running a benchmark before timing it, in
+     * nanoseconds. It takes effect when building the library.
+     */
+    #define ZOROBENCH_WARMUP_NS 100000000ULL
+#endif
+
+#ifndef ZOROBENCH_RUNS
+    /**
+     * @brief Default number of timed runs of each benchmark, see
+     * zorobench_set_runs(). It takes effect when building the library.
+     */
+    #define ZOROBENCH_RUNS 30
+#endif
+
+#ifndef ZOROBENCH_USE_TSC
+    /**
+     * @brief Time the runs with rdtsc, calibrated against
+     * CLOCK_MONOTONIC_RAW, instead of CLOCK_MONOTONIC_RAW itself; only on
+     * x86, and only meaningful with an invariant TSC. It takes effect when
+     * building the library.
+     */
+    #define ZOROBENCH_USE_TSC 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZOROBENCH_FORMAT_TEXT	0
+/* One JSON object per line, with the fields of struct zorobench_result */
+#define ZOROBENCH_FORMAT_JSON	1
+
+/**
+ * @brief A benchmark: run the operation to measure @a iters times.
+ */
+typedef void (*zorobench_fn_t)(uint64_t iters, void *arg);
+
+struct zorobench_result {
+	const char *name;
+	/* Operations per timed run, and number of runs */
+	uint64_t iters;
+	unsigned int runs;
+	/* Time per operation, in nanoseconds */
+	double min_ns;
+	double median_ns;
+	double p99_ns;
+	double mean_ns;
+	/* Operations per second, from the median */
+	double ops_per_sec;
+	/* Events counted (see zorobench_set_perf()), per operation */
+	unsigned int perf_mask;
+	double perf[ZOROPERF_NR_EVENTS];
+};
+
+/**
+ * @brief Have the compiler think the value @a _v is used, so that computing
+ *        it is not optimized away; it costs nothing at run time.
+ */
+#define zorobench_do_not_optimize(_v) do {				\
+	typeof(_v) __zb_v = (_v);					\
+	__asm__ __volatile__("" : : "r,m"(__zb_v) : "memory");		\
+} while (0)
+
+/**
+ * @brief Have the compiler think all memory is read and written here, so
+ *        that stores before it are not optimized away.
+ */
+#define zorobench_clobber_memory() __asm__ __volatile__("" : : : "memory")
+
+/**
+ * @brief CLOCK_MONOTONIC_RAW time, in nanoseconds.
+ */
+static inline uint64_t zorobench_now_ns(void)
+{
+	return __zorolog_clock_sys_ns(CLOCK_MONOTONIC_RAW);
+}
+
+/**
+ * @fn int zorobench_run(const char *name, zorobench_fn_t fn, void *arg,
+ *                       struct zorobench_result *res)
+ * @brief Calibrate, warm up and time the benchmark @a fn.
+ *
+ * @param name   Name of the benchmark, stored in @a res
+ * @param fn     The benchmark
+ * @param arg    Passed to @a fn
+ * @param res    Filled with the results
+ *
+ * @return 0 on success; -ERANGE if @a fn is too fast to be timed (e.g. it
+ *         ignores @a iters); -ENOMEM if the samples cannot be allocated.
+ */
+int zorobench_run(const char *name, zorobench_fn_t fn, void *arg,
+		  struct zorobench_result *res);
+
+/**
+ * @fn void zorobench_pause_timing(void)
+ * @brief Stop counting time from within a benchmark, e.g. to set up the
+ *        input of the next operation; zorobench_resume_timing() restarts it.
+ *        Each call costs a clock read: keep them out of nanosecond loops.
+ */
+void zorobench_pause_timing(void);
+
+/**
+ * @fn void zorobench_resume_timing(void)
+ * @brief Count time again, after zorobench_pause_timing().
+ */
+void zorobench_resume_timing(void);
+
+/**
+ * @fn void zorobench_set_runs(unsigned int runs)
+ * @brief Set the number of timed runs of the next zorobench_run() calls;
+ *        0 restores ZOROBENCH_RUNS. Fewer runs for benchmarks whose single
+ *        operation lasts seconds.
+ */
+void zorobench_set_runs(unsigned int runs);
+
+/**
+ * @fn void zorobench_set_perf(unsigned int events)
+ * @brief Count the ZOROPERF_* @a events during the timed runs of the next
+ *        zorobench_run() calls, threads created by the benchmark included;
+ *        0 to stop. Until called, the environment variable ZOROBENCH_PERF
+ *        set (and not "0") selects ZOROPERF_DEFAULT.
+ *
+ * Counting adds a system call around each run, and at each pause and
+ * resume. Events the machine cannot count are left out of the results.
+ */
+void zorobench_set_perf(unsigned int events);
+
+/**
+ * @fn void zorobench_set_output(FILE *out, int format)
+ * @brief Set where and how zorobench_report() prints the results.
+ *
+ * Until called, results go to the standard output, as text, or as JSON if
+ * the environment variable ZOROBENCH_FORMAT is "json".
+ *
+ * @param out    Stream the results are printed to; NULL for stdout
+ * @param format ZOROBENCH_FORMAT_TEXT or ZOROBENCH_FORMAT_JSON
+ */
+void zorobench_set_output(FILE *out, int format);
+
+/**
+ * @fn void zorobench_report(const struct zorobench_result *res)
+ * @brief Print @a res on one line, as set by zorobench_set_output().
+ */
+void zorobench_report(const struct zorobench_result *res);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_BENCH_H__ */
@@ -0,0 +1,446 @@
+/**
+ * @file binlog.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Binary log records with deferred formatting.
+ *
+ * The zorolog_bin_* macros do not format anything: the call site stores the
+ * identifier of its static format string, a timestamp and the raw bytes of
+ * its arguments into a per-thread staging ring. A background thread moves
+ * the records to the binary log file, which can be rendered to text later on
+ * with zorolog_bin_decode() or with the zorolog-decode tool.
+ *
+ * Supported arguments are integers, floating point numbers, strings (copied,
+ * up to ZOROLOG_BIN_MAX_STRING bytes) and pointers; at most
+ * ZOROLOG_BIN_MAX_ARGS arguments per call.
+ * While no binary log file is open, the macros fall back to the text
+ * zorolog_* ones.
+ */
+
+#pragma once
+#ifndef __ZORO_BINLOG_H__
+#define __ZORO_BINLOG_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <zoro/compiler.h>
+#include <zoro/clock.h>
+#include <zoro/log.h>
+#include <zoro/linux/list.h>
+
+#ifndef ZOROLOG_BIN_MAX_STRING
+    /**
+     * @brief Strings longer than this are truncated.
+     */
+    #define ZOROLOG_BIN_MAX_STRING 1024
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZOROLOG_BIN_MAX_ARGS	16
+
+/* Argument types, as stored in the log file */
+#define ZOROLOG_BIN_T_I32	1
+#define ZOROLOG_BIN_T_U32	2
+#define ZOROLOG_BIN_T_I64	3
+#define ZOROLOG_BIN_T_U64	4
+#define ZOROLOG_BIN_T_DBL	5
+#define ZOROLOG_BIN_T_STR	6
+#define ZOROLOG_BIN_T_PTR	7
+
+/* zorolog_bin_open() flags; ZOROLOG_APPEND is accepted as well */
+#define ZOROLOG_BIN_DROP	0x2
+
+/**
+ * @brief Static descriptor of a call site; registered in the log file the
+ * first time the call site is hit.
+ */
+struct zorolog_bin_site {
+	uint32_t id;
+	uint8_t nargs;
+	uint8_t types[ZOROLOG_BIN_MAX_ARGS];
+	const char *format;
+};
+
+/**
+ * @brief Record header; records are 8 bytes aligned.
+ */
+struct zorolog_bin_hdr {
+	uint32_t id;
+	uint32_t size;
+	uint64_t ts;
+};
+
+/**
+ * @brief Per-thread SPSC staging ring: only the owner thread moves @a head,
+ * only the background writer moves @a tail.
+ */
+struct zorolog_bin_ring {
+	uint64_t head;
+	uint64_t tail_cache;
+	uint64_t mask;
+	char *data;
+	uint64_t tail ____cacheline_aligned;
+	struct list_head list;
+	int dead;
+};
+
+extern __thread struct zorolog_bin_ring *__zorolog_bin_ring;
+extern int __zorolog_bin_enabled;
+
+/**
+ * @fn int zorolog_bin_open(const char *path, size_t ring_size, int flags)
+ * @brief Open the binary log file and start the background writer.
+ *
+ * @param path      The binary log file path
+ * @param ring_size Size in bytes of each per-thread staging ring; it must be
+ *                  a power of two, at least 64 KiB. Use 0 for the default.
+ * @param flags     ZOROLOG_APPEND to append to an existing log file;
+ *                  ZOROLOG_BIN_DROP to drop records when the ring of a thread
+ *                  is full, rather than waiting for room.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zorolog_bin_open(const char *path, size_t ring_size, int flags);
+
+/**
+ * @fn int zorolog_bin_flush(void)
+ * @brief Wait until all the records logged so far are in the log file.
+ *
+ * @return 0 on success; -EINVAL if no binary log file is open.
+ */
+int zorolog_bin_flush(void);
+
+/**
+ * @fn void zorolog_bin_close(void)
+ * @brief Flush all the records, stop the background writer and close the
+ *        binary log file. Automatically called at process exit.
+ */
+void zorolog_bin_close(void);
+
+/**
+ * @fn int zorolog_bin_decode(int fd, FILE *out)
+ * @brief Render the binary log read from @a fd as text to @a out.
+ *
+ * @return The number of records rendered; a negative errno value on error.
+ */
+int zorolog_bin_decode(int fd, FILE *out);
+
+struct zorolog_bin_hdr *__zorolog_bin_reserve_slow(struct zorolog_bin_site *site,
+						   uint32_t size);
+
+/**
+ * @brief Test whether a binary log file is open.
+ */
+static inline int zorolog_bin_active(void)
+{
+	return __atomic_load_n(&__zorolog_bin_enabled, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t __zorolog_bin_now(void)
+{
+	return zorolog_clock_ns();
+}
+
+static inline struct zorolog_bin_hdr *
+__zorolog_bin_reserve(struct zorolog_bin_site *site, uint32_t size)
+{
+	struct zorolog_bin_ring *r = __zorolog_bin_ring;
+	uint64_t off;
+
+	if (likely(r && __atomic_load_n(&site->id, __ATOMIC_RELAXED) &&
+		   zorolog_bin_active())) {
+		off = r->head & r->mask;
+		if (likely(off + size <= r->mask + 1 &&
+			   r->head + size - r->tail_cache <= r->mask + 1))
+			return (struct zorolog_bin_hdr *)(r->data + off);
+	}
+	return __zorolog_bin_reserve_slow(site, size);
+}
+
+static inline void __zorolog_bin_commit(uint32_t size)
+{
+	struct zorolog_bin_ring *r = __zorolog_bin_ring;
+
+	__atomic_store_n(&r->head, r->head + size, __ATOMIC_RELEASE);
+}
+
+/*
+ * Length stored for the string @a s, computed once per call: the record is
+ * reserved for it, whatever the string becomes meanwhile. @a max is the size
+ * of the array @a s points in, when known.
+ */
+static inline uint16_t __zorolog_bin_strlen(const char *s, size_t max)
+{
+	if (!s)
+		return 6;
+	if (max > ZOROLOG_BIN_MAX_STRING)
+		max = ZOROLOG_BIN_MAX_STRING;
+	return strnlen(s, max);
+}
+
+static inline char *__zorolog_bin_put_i32(char *p, int32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline char *__zorolog_bin_put_u32(char *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline char *__zorolog_bin_put_i64(char *p, int64_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline char *__zorolog_bin_put_u64(char *p, uint64_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline char *__zorolog_bin_put_dbl(char *p, double v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline char *__zorolog_bin_put_ptr(char *p, const void *v)
+{
+	uint64_t u = (uintptr_t)v;
+
+	memcpy(p, &u, sizeof(u));
+	return p + sizeof(u);
+}
+
+/* Strings go through __zorolog_bin_put_str(), with their length */
+static inline char *__zorolog_bin_put_none(char *p, const char *s)
+{
+	(void)s;
+	return p;
+}
+
+static inline char *__zorolog_bin_put_str(char *p, const char *s,
+					   uint16_t len)
+{
+	if (!s)
+		s = "(null)";
+	memcpy(p, &len, sizeof(len));
+	memcpy(p + sizeof(len), s, len);
+	return p + sizeof(len) + len;
+}
+
+#define __zorolog_bin_type(x) _Generic((x),				\
+	_Bool: ZOROLOG_BIN_T_I32,					\
+	char: ZOROLOG_BIN_T_I32,					\
+	signed char: ZOROLOG_BIN_T_I32,					\
+	unsigned char: ZOROLOG_BIN_T_U32,				\
+	short: ZOROLOG_BIN_T_I32,					\
+	unsigned short: ZOROLOG_BIN_T_U32,				\
+	int: ZOROLOG_BIN_T_I32,						\
+	unsigned int: ZOROLOG_BIN_T_U32,				\
+	long: ZOROLOG_BIN_T_I64,					\
+	unsigned long: ZOROLOG_BIN_T_U64,				\
+	long long: ZOROLOG_BIN_T_I64,					\
+	unsigned long long: ZOROLOG_BIN_T_U64,				\
+	float: ZOROLOG_BIN_T_DBL,					\
+	double: ZOROLOG_BIN_T_DBL,					\
+	long double: ZOROLOG_BIN_T_DBL,					\
+	char *: ZOROLOG_BIN_T_STR,					\
+	const char *: ZOROLOG_BIN_T_STR,				\
+	default: ZOROLOG_BIN_T_PTR)
+
+#define __zorolog_bin_put(p, x) _Generic((x),				\
+	_Bool: __zorolog_bin_put_i32,					\
+	char: __zorolog_bin_put_i32,					\
+	signed char: __zorolog_bin_put_i32,				\
+	unsigned char: __zorolog_bin_put_u32,				\
+	short: __zorolog_bin_put_i32,					\
+	unsigned short: __zorolog_bin_put_u32,				\
+	int: __zorolog_bin_put_i32,					\
+	unsigned int: __zorolog_bin_put_u32,				\
+	long: __zorolog_bin_put_i64,					\
+	unsigned long: __zorolog_bin_put_u64,				\
+	long long: __zorolog_bin_put_i64,				\
+	unsigned long long: __zorolog_bin_put_u64,			\
+	float: __zorolog_bin_put_dbl,					\
+	double: __zorolog_bin_put_dbl,					\
+	long double: __zorolog_bin_put_dbl,				\
+	char *: __zorolog_bin_put_none,					\
+	const char *: __zorolog_bin_put_none,				\
+	default: __zorolog_bin_put_ptr)(p, x)
+
+#define __zorolog_bin_str(x) _Generic((x),				\
+	char *: (x),							\
+	const char *: (x),						\
+	default: "")
+
+#define __zorolog_bin_size(x, len)					\
+	(__zorolog_bin_type(x) == ZOROLOG_BIN_T_STR ? 2 + (len) :	\
+	 __zorolog_bin_type(x) <= ZOROLOG_BIN_T_U32 ? 4 : 8)
+
+/* Count up to ZOROLOG_BIN_MAX_ARGS macro arguments */
+#define __ZOROLOG_BIN_NARGS(args...)					\
+	___ZOROLOG_BIN_NARGS(0, ##args, 16, 15, 14, 13, 12, 11, 10, 9,	\
+			     8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define ___ZOROLOG_BIN_NARGS(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9,	\
+			     _10, _11, _12, _13, _14, _15, _16, N, ...) N
+
+/*
+ * Apply m(i, arg) to each argument, in order; i is a unique index used to
+ * name the temporaries.
+ */
+#define __ZOROLOG_BIN_MAP(m, args...)					\
+	__PASTE(__ZOROLOG_BIN_MAP_, __ZOROLOG_BIN_NARGS(args))(m, ##args)
+#define __ZOROLOG_BIN_MAP_0(m)
+#define __ZOROLOG_BIN_MAP_1(m, a)	m(1, a)
+#define __ZOROLOG_BIN_MAP_2(m, a, args...)  m(2, a) __ZOROLOG_BIN_MAP_1(m, args)
+#define __ZOROLOG_BIN_MAP_3(m, a, args...)  m(3, a) __ZOROLOG_BIN_MAP_2(m, args)
+#define __ZOROLOG_BIN_MAP_4(m, a, args...)  m(4, a) __ZOROLOG_BIN_MAP_3(m, args)
+#define __ZOROLOG_BIN_MAP_5(m, a, args...)  m(5, a) __ZOROLOG_BIN_MAP_4(m, args)
+#define __ZOROLOG_BIN_MAP_6(m, a, args...)  m(6, a) __ZOROLOG_BIN_MAP_5(m, args)
+#define __ZOROLOG_BIN_MAP_7(m, a, args...)  m(7, a) __ZOROLOG_BIN_MAP_6(m, args)
+#define __ZOROLOG_BIN_MAP_8(m, a, args...)  m(8, a) __ZOROLOG_BIN_MAP_7(m, args)
+#define __ZOROLOG_BIN_MAP_9(m, a, args...)  m(9, a) __ZOROLOG_BIN_MAP_8(m, args)
+#define __ZOROLOG_BIN_MAP_10(m, a, args...) m(10, a) __ZOROLOG_BIN_MAP_9(m, args)
+#define __ZOROLOG_BIN_MAP_11(m, a, args...) m(11, a) __ZOROLOG_BIN_MAP_10(m, args)
+#define __ZOROLOG_BIN_MAP_12(m, a, args...) m(12, a) __ZOROLOG_BIN_MAP_11(m, args)
+#define __ZOROLOG_BIN_MAP_13(m, a, args...) m(13, a) __ZOROLOG_BIN_MAP_12(m, args)
+#define __ZOROLOG_BIN_MAP_14(m, a, args...) m(14, a) __ZOROLOG_BIN_MAP_13(m, args)
+#define __ZOROLOG_BIN_MAP_15(m, a, args...) m(15, a) __ZOROLOG_BIN_MAP_14(m, args)
+#define __ZOROLOG_BIN_MAP_16(m, a, args...) m(16, a) __ZOROLOG_BIN_MAP_15(m, args)
+
+#define __ZOROLOG_BIN_ARG(i, x)		__PASTE(__zba, i)
+#define __ZOROLOG_BIN_LEN(i, x)		__PASTE(__zbl, i)
+#define __ZOROLOG_BIN_TYPE(i, x)	__zorolog_bin_type(x),
+/*
+ * The arguments are evaluated once; so are the string lengths, bounded by
+ * the array the argument points in (__builtin_object_size() does not
+ * evaluate it again).
+ */
+#define __ZOROLOG_BIN_CAPTURE(i, x)					\
+	__auto_type __ZOROLOG_BIN_ARG(i, x) = (x);			\
+	uint16_t __ZOROLOG_BIN_LEN(i, x) =				\
+		__zorolog_bin_type(x) != ZOROLOG_BIN_T_STR ? 0 :	\
+		__zorolog_bin_strlen(__zorolog_bin_str(__ZOROLOG_BIN_ARG(i, x)),\
+			__builtin_object_size(__zorolog_bin_str(x), 1));
+#define __ZOROLOG_BIN_SIZE(i, x)					\
+	+ __zorolog_bin_size(__ZOROLOG_BIN_ARG(i, x), __ZOROLOG_BIN_LEN(i, x))
+#define __ZOROLOG_BIN_PUT(i, x)						\
+	__zbp = __zorolog_bin_type(__ZOROLOG_BIN_ARG(i, x)) ==		\
+		ZOROLOG_BIN_T_STR ?					\
+		__zorolog_bin_put_str(__zbp,				\
+			__zorolog_bin_str(__ZOROLOG_BIN_ARG(i, x)),	\
+			__ZOROLOG_BIN_LEN(i, x)) :			\
+		__zorolog_bin_put(__zbp, __ZOROLOG_BIN_ARG(i, x));
+#define __ZOROLOG_BIN_FWD(i, x)		, __ZOROLOG_BIN_ARG(i, x)
+
+/* One more expansion step, to split the forwarded arguments */
+#define __zorolog_bin_fallback(_level, args...) __zorolog_print(_level, args)
+
+/* Begin functions */
+#define __zorolog_bin_print(_level, _format, args...) ({		\
+	static struct zorolog_bin_site __zbs = {			\
+		.nargs = __ZOROLOG_BIN_NARGS(args),			\
+		.types = { __ZOROLOG_BIN_MAP(__ZOROLOG_BIN_TYPE, ##args) },\
+		.format = ZOROLOG_PREFIX_##_level _format,		\
+	};								\
+	struct zorolog_bin_hdr *__zbh;					\
+	uint32_t __zbsz;						\
+	char *__zbp;							\
+	int __r = 0;							\
+									\
+	if (0)								\
+		__zorolog_check_format(_format, ##args);		\
+	if (__zorolog_enabled(_level, ZOROLOG_CATEGORY_MASK)) {		\
+		__ZOROLOG_BIN_MAP(__ZOROLOG_BIN_CAPTURE, ##args)	\
+		__zbsz = sizeof(*__zbh)					\
+			__ZOROLOG_BIN_MAP(__ZOROLOG_BIN_SIZE, ##args);	\
+		__zbsz = (__zbsz + 7) & ~7U;				\
+		__zbh = __zorolog_bin_reserve(&__zbs, __zbsz);		\
+		if (likely(__zbh)) {					\
+			__zbh->id = __zbs.id;				\
+			__zbh->size = __zbsz;				\
+			__zbh->ts = __zorolog_bin_now();		\
+			__zbp = (char *)(__zbh + 1);			\
+			__ZOROLOG_BIN_MAP(__ZOROLOG_BIN_PUT, ##args)	\
+			(void)__zbp;					\
+			__zorolog_bin_commit(__zbsz);			\
+		} else if (!zorolog_bin_active()) {			\
+			__r = __zorolog_bin_fallback(_level, _format	\
+				__ZOROLOG_BIN_MAP(__ZOROLOG_BIN_FWD, ##args));\
+		}							\
+	}								\
+	__r; })
+
+#if ZOROLOG_LEVEL_INFO >= ZOROLOG_MIN_LEVEL
+/**
+ * @brief Log a binary INFO level record.
+ *
+ * @param _format   Format string; it must be a string literal
+ * @param args      Extra arguments
+ *
+ * @return          0 on Success; a value different from zero otherwise.
+ */
+#define zorolog_bin_info(_format, args...) \
+            __zorolog_bin_print(INFO, _format, ##args)
+#else
+#define zorolog_bin_info(_format, args...) \
+            __zorolog_discard(_format, ##args)
+#endif
+
+#if ZOROLOG_LEVEL_WARNING >= ZOROLOG_MIN_LEVEL
+/**
+ * @brief Log a binary WARNING level record.
+ *
+ * @param _format   Format string; it must be a string literal
+ * @param args      Extra arguments
+ *
+ * @return          0 on Success; a value different from zero otherwise.
+ */
+#define zorolog_bin_warning(_format, args...) \
+            __zorolog_bin_print(WARNING, _format, ##args)
+#else
+#define zorolog_bin_warning(_format, args...) \
+            __zorolog_discard(_format, ##args)
+#endif
+
+/**
+ * @brief Log a binary ERROR level record.
+ *
+ * @param _format   Format string; it must be a string literal
+ * @param args      Extra arguments
+ *
+ * @return          0 on Success; a value different from zero otherwise.
+ */
+#define zorolog_bin_error(_format, args...) \
+            __zorolog_bin_print(ERROR, _format, ##args)
+
+#if ZOROLOG_LEVEL_DEBUG >= ZOROLOG_MIN_LEVEL && !defined(NDEBUG)
+    /**
+     * @brief Log a binary DEBUG level record.
+     *
+     * @param _format   Format string; it must be a string literal
+     * @param args      Extra arguments
+     *
+     * @return          0 on Success; a value different from zero otherwise.
+     */
+    #define zorolog_bin_debug(_format, args...) \
+                __zorolog_bin_print(DEBUG, _format, ##args)
+#else
+    #define zorolog_bin_debug(_format, args...) \
+                __zorolog_discard(_format, ##args)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_BINLOG_H__ */
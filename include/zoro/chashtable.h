@@ -0,0 +1,243 @@
+/**
+ * @file chashtable.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Concurrent intrusive hash table, with lockless readers.
+ *
+ * Same layout as the tables of hashtable.h (entries embed a @a struct
+ * @a hlist_node and are looked up by a key member) but safe to share among
+ * threads: writers serialize on striped spinlocks, one every few buckets,
+ * while readers take no lock at all, and never write to shared memory.
+ *
+ * Lookups and iterations must be done within zoroepoch_enter() and
+ * zoroepoch_exit(); the entries found are valid until zoroepoch_exit().
+ * A removed entry can still be seen by the readers already in progress: it
+ * can be freed (or added again) only after a grace period, e.g. with
+ * zoroepoch_call(). Keys must not change while the entry is in the table.
+ *
+ * Moving entries between bucket arrays would hide them from the readers in
+ * progress, so the table is not resized: size it for the expected number of
+ * entries at zorocht_init().
+ */
+
+#pragma once
+#ifndef __ZORO_CHASHTABLE_H__
+#define __ZORO_CHASHTABLE_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zoro/compiler.h>
+#include <zoro/epoch.h>
+#include <zoro/hashtable.h>
+#include <zoro/linux/hlist.h>
+#include <zoro/linux/rwonce.h>
+#include <zoro/percpu.h>
+
+#ifndef ZOROCHT_LOCK_BITS
+    /**
+     * @brief Log2 of the max number of bucket locks of a table. It takes
+     * effect when building the library.
+     */
+    #define ZOROCHT_LOCK_BITS 10
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One lock per cache line: writers of unrelated buckets never collide */
+struct zorocht_lock {
+	pthread_spinlock_t lock;
+} ____cacheline_aligned;
+
+struct zorocht {
+	struct hlist_head *buckets;
+	unsigned int bits;
+	struct zorocht_lock *locks;
+	unsigned int lock_bits;
+	/*
+	 * Entries added minus entries removed on each CPU, int64_t each:
+	 * the line read by every lookup is never written
+	 */
+	struct zoropercpu count;
+	/* Layout of the entries */
+	size_t node_off;
+	size_t key_off;
+	size_t key_len;
+	zoroht_hash_t hash;
+};
+
+/**
+ * @fn int __zorocht_init(struct zorocht *ht, unsigned int bits,
+ *                        size_t node_off, size_t key_off, size_t key_len,
+ *                        zoroht_hash_t hash)
+ * @brief Use zorocht_init() instead.
+ */
+int __zorocht_init(struct zorocht *ht, unsigned int bits, size_t node_off,
+		   size_t key_off, size_t key_len, zoroht_hash_t hash);
+
+/**
+ * @brief Initialize a concurrent hash table of entries of type @a _type.
+ *
+ * @param _ht    Pointer to the @a struct @a zorocht
+ * @param _bits  Log2 of the number of buckets
+ * @param _type  Type of the entries
+ * @param _node  Name of the @a struct @a hlist_node member of @a _type
+ * @param _key   Name of the key member of @a _type
+ * @param _hash  Hash function; NULL for zoroht_hash_default()
+ *
+ * @return 0 on success; -ENOMEM if the table cannot be allocated.
+ */
+#define zorocht_init(_ht, _bits, _type, _node, _key, _hash)		\
+	__zorocht_init((_ht), (_bits), offset_of(_type, _node),	\
+		       offset_of(_type, _key),				\
+		       sizeof(((_type *)0)->_key), (_hash))
+
+/**
+ * @fn void zorocht_destroy(struct zorocht *ht)
+ * @brief Free the table, that must not be in use anymore. The entries are
+ *        not touched.
+ */
+void zorocht_destroy(struct zorocht *ht);
+
+/**
+ * @fn int __zorocht_insert(struct zorocht *ht, struct hlist_node *node)
+ * @brief Use zorocht_insert() instead.
+ */
+int __zorocht_insert(struct zorocht *ht, struct hlist_node *node);
+
+/**
+ * @fn int __zorocht_del(struct zorocht *ht, struct hlist_node *node)
+ * @brief Use zorocht_del() instead.
+ */
+int __zorocht_del(struct zorocht *ht, struct hlist_node *node);
+
+/**
+ * @fn struct hlist_node *__zorocht_remove(struct zorocht *ht,
+ *                                         const void *key)
+ * @brief Use zorocht_remove() instead.
+ */
+struct hlist_node *__zorocht_remove(struct zorocht *ht, const void *key);
+
+static inline struct hlist_head *__zorocht_bucket(const struct zorocht *ht,
+						  const void *key)
+{
+	return &ht->buckets[ht->hash(key, ht->key_len) &
+			    ((1UL << ht->bits) - 1)];
+}
+
+/* Lockless lookup: pairs with the release store publishing the entries */
+static inline struct hlist_node *__zorocht_find(const struct zorocht *ht,
+						const void *key)
+{
+	struct hlist_node *node;
+
+	for (node = READ_ONCE(__zorocht_bucket(ht, key)->first); node;
+	     node = READ_ONCE(node->next))
+		if (!memcmp((const char *)node - ht->node_off + ht->key_off,
+			    key, ht->key_len))
+			return node;
+	return NULL;
+}
+
+/**
+ * @brief Add the entry @a _obj, unless an entry with the same key is
+ *        already there.
+ *
+ * @param _ht     Pointer to the @a struct @a zorocht
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a hlist_node member of the entry
+ *
+ * @return 0 on success; -EEXIST if the key is already in the table.
+ */
+#define zorocht_insert(_ht, _obj, _member) \
+	__zorocht_insert((_ht), &(_obj)->_member)
+
+/**
+ * @brief Remove the entry @a _obj.
+ *
+ * @param _ht     Pointer to the @a struct @a zorocht
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a hlist_node member of the entry
+ *
+ * @return 0 on success; -ENOENT if the entry is not in the table (e.g.
+ *         removed by another thread meanwhile). An entry never inserted must
+ *         have its node initialized with INIT_HLIST_NODE().
+ */
+#define zorocht_del(_ht, _obj, _member) \
+	__zorocht_del((_ht), &(_obj)->_member)
+
+/**
+ * @brief Remove the entry with key @a _key.
+ *
+ * @param _ht     Pointer to the @a struct @a zorocht
+ * @param _key    Pointer to the key
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a hlist_node member of @a _type
+ *
+ * @return A pointer to the entry removed; NULL if not found.
+ */
+#define zorocht_remove(_ht, _key, _type, _member) \
+	hlist_entry_safe(__zorocht_remove((_ht), (_key)), _type, _member)
+
+/**
+ * @brief Look up an entry by key; within an epoch read section.
+ *
+ * @param _ht     Pointer to the @a struct @a zorocht
+ * @param _key    Pointer to the key
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a hlist_node member of @a _type
+ *
+ * @return A pointer to the entry; NULL if not found.
+ */
+#define zorocht_find(_ht, _key, _type, _member) \
+	hlist_entry_safe(__zorocht_find((_ht), (_key)), _type, _member)
+
+/**
+ * @brief Test whether an entry found by a reader was removed meanwhile.
+ *
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a hlist_node member of the entry
+ */
+#define zorocht_unhashed(_obj, _member) \
+	hlist_unhashed_lockless(&(_obj)->_member)
+
+/**
+ * @brief Number of entries in the table; only a snapshot while writers run.
+ */
+static inline size_t zorocht_count(const struct zorocht *ht)
+{
+	int64_t sum = 0, *n;
+	unsigned int cpu;
+
+	zoropercpu_for_each(n, cpu, &ht->count)
+		sum += __atomic_load_n(n, __ATOMIC_RELAXED);
+	return sum > 0 ? (size_t)sum : 0;
+}
+
+/**
+ * @brief Iterate over the entries of the table, within an epoch read
+ *        section. Entries added or removed meanwhile may be seen or not.
+ *
+ * @param _ht     Pointer to the @a struct @a zorocht
+ * @param _bkt    A @a size_t to use as bucket cursor
+ * @param _pos    The type * to use as a loop cursor
+ * @param _member Name of the @a struct @a hlist_node member of the entries
+ */
+#define zorocht_for_each_entry(_ht, _bkt, _pos, _member)		\
+	for ((_bkt) = 0; (_bkt) < (1UL << (_ht)->bits); (_bkt)++)	\
+		for (_pos = hlist_entry_safe(				\
+			READ_ONCE((_ht)->buckets[_bkt].first),		\
+			typeof(*(_pos)), _member);			\
+		     _pos;						\
+		     _pos = hlist_entry_safe(				\
+			READ_ONCE((_pos)->_member.next),		\
+			typeof(*(_pos)), _member))
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_CHASHTABLE_H__ */
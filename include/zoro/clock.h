@@ -0,0 +1,197 @@
+/**
+ * @file clock.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Cached clock for log timestamps.
+ *
+ * A background ticker thread samples CLOCK_MONOTONIC and CLOCK_REALTIME once
+ * per tick and publishes them, along with the current date already rendered
+ * as a string, under a sequence lock. On x86 CPUs with an invariant TSC, the
+ * nanoseconds elapsed since the last tick are computed from rdtsc, scaled by
+ * a factor the ticker calibrates against CLOCK_MONOTONIC; elsewhere the
+ * resolution is the tick itself.
+ * Readers never enter the kernel, nor format any date.
+ *
+ * The ticker is started by the first reader; until it runs, and in a forked
+ * child until its first read, the readers fall back to clock_gettime().
+ */
+
+#pragma once
+#ifndef __ZORO_CLOCK_H__
+#define __ZORO_CLOCK_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <zoro/compiler.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef ZOROLOG_CLOCK_TICK_USEC
+    /**
+     * @brief Ticker period, in microseconds. Without a usable TSC, this is
+     * also the timestamp resolution. It takes effect when building the
+     * library.
+     */
+    #define ZOROLOG_CLOCK_TICK_USEC 1000
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Length of the rendered date, as ctime() without the trailing newline */
+#define ZOROLOG_CLOCK_DATE_LEN	24
+
+#define ZOROLOG_CLOCK_OFF	0
+#define ZOROLOG_CLOCK_RUNNING	1
+#define ZOROLOG_CLOCK_DISABLED	2
+
+/**
+ * @brief Published clock state; written by the ticker only.
+ */
+struct zorolog_clock {
+	uint64_t seq;
+	int state;
+	int tsc;
+	uint32_t mult;
+	uint32_t shift;
+	uint64_t tsc_base;
+	uint64_t mono_ns;
+	uint64_t real_ns;
+	char date[ZOROLOG_CLOCK_DATE_LEN + 1];
+} ____cacheline_aligned;
+
+extern struct zorolog_clock __zorolog_clock;
+
+/**
+ * @fn int zorolog_clock_start(void)
+ * @brief Start the ticker thread; implicitly called by the first reader.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zorolog_clock_start(void);
+
+/**
+ * @fn void zorolog_clock_stop(void)
+ * @brief Stop the ticker thread: readers go back to clock_gettime().
+ */
+void zorolog_clock_stop(void);
+
+static inline uint64_t __zorolog_clock_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static inline uint64_t __zorolog_clock_sys_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int __zorolog_clock_ready(void)
+{
+	int state = __atomic_load_n(&__zorolog_clock.state, __ATOMIC_ACQUIRE);
+
+	if (likely(state == ZOROLOG_CLOCK_RUNNING))
+		return 1;
+	return state == ZOROLOG_CLOCK_OFF && !zorolog_clock_start();
+}
+
+/* Read the ns base of @a real or monotonic time, plus the TSC offset */
+static inline uint64_t __zorolog_clock_read(int real)
+{
+	struct zorolog_clock *c = &__zorolog_clock;
+	uint64_t seq, ns, delta;
+
+	do {
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		ns = __atomic_load_n(real ? &c->real_ns : &c->mono_ns,
+				     __ATOMIC_RELAXED);
+		if (__atomic_load_n(&c->tsc, __ATOMIC_RELAXED)) {
+			delta = __zorolog_clock_tsc() -
+				__atomic_load_n(&c->tsc_base, __ATOMIC_RELAXED);
+			ns += (uint64_t)(((unsigned __int128)delta *
+					  __atomic_load_n(&c->mult, __ATOMIC_RELAXED)) >>
+					 __atomic_load_n(&c->shift, __ATOMIC_RELAXED));
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (unlikely((seq & 1) ||
+			  seq != __atomic_load_n(&c->seq, __ATOMIC_RELAXED)));
+	return ns;
+}
+
+/**
+ * @brief CLOCK_MONOTONIC time, in nanoseconds.
+ */
+static inline uint64_t zorolog_clock_ns(void)
+{
+	if (unlikely(!__zorolog_clock_ready()))
+		return __zorolog_clock_sys_ns(CLOCK_MONOTONIC);
+	return __zorolog_clock_read(0);
+}
+
+/**
+ * @brief CLOCK_REALTIME time, in nanoseconds.
+ */
+static inline uint64_t zorolog_clock_real_ns(void)
+{
+	if (unlikely(!__zorolog_clock_ready()))
+		return __zorolog_clock_sys_ns(CLOCK_REALTIME);
+	return __zorolog_clock_read(1);
+}
+
+/**
+ * @brief CLOCK_MONOTONIC time, as a timespec.
+ */
+static inline void zorolog_clock_gettime(struct timespec *ts)
+{
+	uint64_t ns = zorolog_clock_ns();
+
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/**
+ * @brief Copy the current local date, formatted as by ctime() without the
+ *        trailing newline, to @a buf.
+ *
+ * @return @a buf
+ */
+static inline char *zorolog_clock_date(char buf[ZOROLOG_CLOCK_DATE_LEN + 1])
+{
+	struct zorolog_clock *c = &__zorolog_clock;
+	char tmp[26]; /* size got from ctime man page */
+	time_t now;
+	uint64_t seq;
+
+	if (unlikely(!__zorolog_clock_ready())) {
+		now = time(NULL);
+		ctime_r(&now, tmp);
+		memcpy(buf, tmp, ZOROLOG_CLOCK_DATE_LEN);
+		buf[ZOROLOG_CLOCK_DATE_LEN] = '\0';
+		return buf;
+	}
+
+	do {
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		memcpy(buf, c->date, ZOROLOG_CLOCK_DATE_LEN + 1);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (unlikely((seq & 1) ||
+			  seq != __atomic_load_n(&c->seq, __ATOMIC_RELAXED)));
+	return buf;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_CLOCK_H__ */
@@ -35,9 +35,73 @@
 /* The "volatile" is due to gcc bugs */
 # define barrier() __asm__ __volatile__("": : :"memory")
 #endif
-#define smp_mb()			barrier()
-#define smp_wmb()			barrier()
-#define smp_read_barrier_depends()	barrier()
+
+#ifndef ZORO_CACHELINE_SIZE
+    /**
+     * @brief Size of a cache line, in bytes: data written by different
+     * threads must be this far apart not to share lines. It defaults to the
+     * one of the target architecture; zoropercpu_cacheline_size() tells the
+     * one of the running CPU. It changes the layout of structures, so it must
+     * be the same for the library and the code using it.
+     */
+# if defined(__powerpc64__)
+#  define ZORO_CACHELINE_SIZE 128
+# elif defined(__s390x__)
+#  define ZORO_CACHELINE_SIZE 256
+# else
+#  define ZORO_CACHELINE_SIZE 64
+# endif
+#endif
+
+/* Extracted from include/linux/cache.h in kernel 5.16.11 */
+
+#define L1_CACHE_BYTES		ZORO_CACHELINE_SIZE
+#define SMP_CACHE_BYTES		L1_CACHE_BYTES
+#define L1_CACHE_ALIGN(x)	(((x) + L1_CACHE_BYTES - 1) &		\
+				 ~((typeof(x))L1_CACHE_BYTES - 1))
+
+#ifndef ____cacheline_aligned
+# define ____cacheline_aligned __attribute__((__aligned__(SMP_CACHE_BYTES)))
+#endif
+#ifndef ____cacheline_aligned_in_smp
+# define ____cacheline_aligned_in_smp ____cacheline_aligned
+#endif
+
+/*
+ * After ZONE_PADDING() of include/linux/mmzone.h: a member that takes no room
+ * but starts a new cache line, so that the members before it and the ones
+ * after it never share a line. E.g. between the fields of the producers and
+ * the ones of the consumer of a ring.
+ */
+struct zoro_cacheline_padding {
+	char x[0];
+} ____cacheline_aligned;
+#define CACHELINE_PADDING(name)	struct zoro_cacheline_padding name
+
+/* Extracted from include/linux/prefetch.h in kernel 5.16.11 */
+
+/*
+ * prefetch(x) attempts to pre-emptively get the memory pointed to by address
+ * "x" into the CPU L1 cache; prefetchw(x) does the same, in view of writing
+ * it. They never fault, whatever "x" is.
+ */
+#ifndef prefetch
+# define prefetch(x)	__builtin_prefetch(x)
+#endif
+#ifndef prefetchw
+# define prefetchw(x)	__builtin_prefetch(x, 1)
+#endif
+#define PREFETCH_STRIDE	L1_CACHE_BYTES
+
+/* Prefetch the @len bytes at @addr, one cache line at a time */
+static inline void prefetch_range(void *addr, size_t len)
+{
+	char *cp;
+	char *end = (char *)addr + len;
+
+	for (cp = (char *)addr; cp < end; cp += PREFETCH_STRIDE)
+		prefetch(cp);
+}
 
 #if defined(__STDC__)
 # if defined(__STDC_VERSION__)
@@ -96,4 +160,7 @@ static inline void *reallocarray(void *ptr, size_t nmemb, size_t size)
 }
 #endif
 
+/* SMP barriers, now per architecture; they need barrier() above */
+#include <zoro/atomic.h>
+
 #endif
@@ -0,0 +1,174 @@
+/**
+ * @file epoch.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Epoch based reclamation of memory shared with lockless readers.
+ *
+ * Readers wrap their accesses between zoroepoch_enter() and zoroepoch_exit():
+ * entering takes a store and a full barrier on a cache line of the thread
+ * itself, so readers of different cores never share anything.
+ *
+ * Writers unlink an object so that no new reader can find it, then either
+ * wait for a grace period with zoroepoch_synchronize(), after which no
+ * reader can still hold it, or defer its release with zoroepoch_call().
+ * Deferred callbacks run in batches, by the writer that fills a batch or
+ * calls zoroepoch_barrier().
+ *
+ * Threads that read all the time, e.g. the workers of an event loop, can
+ * instead go online with zoroepoch_qsbr_online() (quiescent state based
+ * reclamation): their read sections then cost nothing, not even the
+ * barrier, and they report with zoroepoch_quiescent() the points where they
+ * hold no reference, e.g. once per loop iteration. Grace periods wait for
+ * every online thread to report one, so a thread that blocks for long must
+ * go offline first.
+ */
+
+#pragma once
+#ifndef __ZORO_EPOCH_H__
+#define __ZORO_EPOCH_H__
+
+#include <stdint.h>
+#include <zoro/atomic.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+
+#ifndef ZOROEPOCH_BATCH
+    /**
+     * @brief Number of deferred callbacks that triggers a grace period. It
+     * takes effect when building the library.
+     */
+    #define ZOROEPOCH_BATCH 128
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Per-thread reader state.
+ */
+struct zoroepoch_thread {
+	/* Epoch observed on entering, 0 when outside of read sections */
+	uint64_t epoch;
+	unsigned int nest;
+	/* Online with zoroepoch_qsbr_online() */
+	int qsbr;
+	struct list_head list;
+} ____cacheline_aligned;
+
+/**
+ * @brief Callback head, to be embedded in the objects to reclaim.
+ */
+struct zoroepoch_head {
+	struct zoroepoch_head *next;
+	void (*func)(struct zoroepoch_head *head);
+};
+
+extern uint64_t __zoroepoch_global;
+extern __thread struct zoroepoch_thread *__zoroepoch_self;
+
+/* Allocate and register the state of the calling thread */
+struct zoroepoch_thread *__zoroepoch_register(void);
+
+/**
+ * @brief Enter a read section; read sections can nest.
+ *
+ * @note Registering the thread, on its first call, can fail for lack of
+ * memory: the process is then aborted, since no read section would be safe.
+ */
+static inline void zoroepoch_enter(void)
+{
+	struct zoroepoch_thread *t = __zoroepoch_self;
+
+	if (unlikely(!t))
+		t = __zoroepoch_register();
+	if (t->nest++ || t->qsbr)
+		return;
+
+	__atomic_store_n(&t->epoch,
+			 __atomic_load_n(&__zoroepoch_global, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	/* Pairs with the one of zoroepoch_synchronize() */
+	smp_mb();
+}
+
+/**
+ * @brief Exit a read section: from now on, the thread holds no reference to
+ *        the objects it found in it.
+ */
+static inline void zoroepoch_exit(void)
+{
+	struct zoroepoch_thread *t = __zoroepoch_self;
+
+	if (--t->nest || t->qsbr)
+		return;
+	smp_store_release(&t->epoch, 0);
+}
+
+/**
+ * @fn void zoroepoch_qsbr_online(void)
+ * @brief Have the calling thread read without announcing its read sections:
+ *        from now on, until zoroepoch_qsbr_offline(), grace periods wait for
+ *        it to call zoroepoch_quiescent(). It must not be called within a
+ *        read section.
+ */
+void zoroepoch_qsbr_online(void);
+
+/**
+ * @fn void zoroepoch_qsbr_offline(void)
+ * @brief Go back to announced read sections, e.g. before blocking or
+ *        exiting; grace periods no longer wait for the calling thread.
+ */
+void zoroepoch_qsbr_offline(void);
+
+/**
+ * @brief Report a quiescent state: an online thread holds no reference to
+ *        the objects it found so far; nothing for threads not online. It
+ *        takes two full barriers: call it between batches of work, not
+ *        around every read.
+ */
+static inline void zoroepoch_quiescent(void)
+{
+	struct zoroepoch_thread *t = __zoroepoch_self;
+
+	if (unlikely(!t || !t->qsbr))
+		return;
+	/* Reads so far are done before the report... */
+	smp_mb();
+	__atomic_store_n(&t->epoch,
+			 __atomic_load_n(&__zoroepoch_global, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	/* ...and the next ones are done after */
+	smp_mb();
+}
+
+/**
+ * @fn void zoroepoch_synchronize(void)
+ * @brief Wait for the read sections in progress to exit, and for the online
+ *        threads to report a quiescent state. It must not be called within
+ *        a read section; called by an online thread, it reports one itself.
+ */
+void zoroepoch_synchronize(void);
+
+/**
+ * @fn void zoroepoch_call(struct zoroepoch_head *head,
+ *                         void (*func)(struct zoroepoch_head *head))
+ * @brief Have @a func called on @a head once the read sections in progress
+ *        have exited. It might run a batch of callbacks, so it must not be
+ *        called within a read section.
+ */
+void zoroepoch_call(struct zoroepoch_head *head,
+		    void (*func)(struct zoroepoch_head *head));
+
+/**
+ * @fn void zoroepoch_barrier(void)
+ * @brief Wait for a grace period and run all the deferred callbacks. It must
+ *        not be called within a read section.
+ */
+void zoroepoch_barrier(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_EPOCH_H__ */
@@ -0,0 +1,236 @@
+/**
+ * @file hash.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Fast non-cryptographic hash functions, for hash tables.
+ *
+ * zorohash_bytes() hashes byte strings after wyhash (version 4, by Wang Yi,
+ * released in the public domain): it consumes 16 or 48 bytes per round,
+ * each folded by a 64x64 -> 128 bit multiplication, and short keys take a
+ * single round. On 64 bit CPUs, where that multiplication takes a few
+ * cycles, it is as fast as vectorized hashes (e.g. XXH3) on the short keys
+ * of hash tables, without their code size; it passes SMHasher.
+ *
+ * Integers do not need a hash of their bytes: zorohash_u32() and
+ * zorohash_u64() are bijective finalizers, so that distinct keys never
+ * collide before reduction, while every input bit changes every output bit
+ * half of the time. zoro/linux/hash.h adds the multiplicative hashes of the
+ * kernel, hash_32() and hash_64(), which go straight from a value to a
+ * bucket when its low bits carry the entropy (ids, counters, pointers).
+ *
+ * A hash of any of these is reduced to a bucket by masking its low bits
+ * for power-of-two tables, or by zorohash_reduce() for tables of any size.
+ *
+ * Hashes are not meant to be stored or sent: they depend on the byte order
+ * of the host. None of them resists collision attacks: use a secret seed for
+ * keys chosen by untrusted parties.
+ */
+
+#pragma once
+#ifndef __ZORO_HASH_H__
+#define __ZORO_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/hash.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Secret of wyhash: odd constants with 32 bits set, and distant bytes */
+#define __ZOROHASH_P0	0x2d358dccaa6c78a5ULL
+#define __ZOROHASH_P1	0x8bb84b93962eacc9ULL
+#define __ZOROHASH_P2	0x4b33a62ed433d4a3ULL
+#define __ZOROHASH_P3	0x4d5a2da51de1aa47ULL
+
+/* 128 bit product of @a *a and @a *b: low half in @a *a, high in @a *b */
+static inline void __zorohash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)*a * *b;
+
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl, lo;
+
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t __zorohash_mix(uint64_t a, uint64_t b)
+{
+	__zorohash_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t __zorohash_r8(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t __zorohash_r4(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/* 1 to 3 bytes: the first, middle and last one */
+static inline uint64_t __zorohash_r3(const uint8_t *p, size_t k)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+/**
+ * @brief Hash of the @a len bytes at @a key.
+ *
+ * @param key  The bytes to hash
+ * @param len  Their number
+ * @param seed Any value, 0 if none; a different seed gives unrelated hashes
+ */
+static inline uint64_t zorohash_bytes(const void *key, size_t len,
+				      uint64_t seed)
+{
+	const uint8_t *p = (const uint8_t *)key;
+	uint64_t a, b, see1, see2;
+	size_t i = len;
+
+	seed ^= __zorohash_mix(seed ^ __ZOROHASH_P0, __ZOROHASH_P1);
+	if (likely(len <= 16)) {
+		if (likely(len >= 4)) {
+			/* Two overlapping 4 byte reads from each end */
+			a = (__zorohash_r4(p) << 32) |
+			    __zorohash_r4(p + ((len >> 3) << 2));
+			b = (__zorohash_r4(p + len - 4) << 32) |
+			    __zorohash_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (likely(len > 0)) {
+			a = __zorohash_r3(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (unlikely(i >= 48)) {
+			/* Three independent lanes, for the multipliers */
+			see1 = seed;
+			see2 = seed;
+			do {
+				seed = __zorohash_mix(
+					__zorohash_r8(p) ^ __ZOROHASH_P1,
+					__zorohash_r8(p + 8) ^ seed);
+				see1 = __zorohash_mix(
+					__zorohash_r8(p + 16) ^ __ZOROHASH_P2,
+					__zorohash_r8(p + 24) ^ see1);
+				see2 = __zorohash_mix(
+					__zorohash_r8(p + 32) ^ __ZOROHASH_P3,
+					__zorohash_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (likely(i >= 48));
+			seed ^= see1 ^ see2;
+		}
+		while (unlikely(i > 16)) {
+			seed = __zorohash_mix(__zorohash_r8(p) ^ __ZOROHASH_P1,
+					      __zorohash_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		/* The last 16 bytes, overlapping the previous round */
+		a = __zorohash_r8(p + i - 16);
+		b = __zorohash_r8(p + i - 8);
+	}
+
+	a ^= __ZOROHASH_P1;
+	b ^= seed;
+	__zorohash_mum(&a, &b);
+	return __zorohash_mix(a ^ __ZOROHASH_P0 ^ len, b ^ __ZOROHASH_P1);
+}
+
+/**
+ * @brief Hash of the NUL terminated string @a s, NUL excluded.
+ */
+static inline uint64_t zorohash_str(const char *s, uint64_t seed)
+{
+	return zorohash_bytes(s, strlen(s), seed);
+}
+
+/**
+ * @brief Hash of a 64 bit integer: the finalizer of SplitMix64, a
+ *        bijection.
+ */
+static inline uint64_t zorohash_u64(uint64_t v)
+{
+	v ^= v >> 30;
+	v *= 0xbf58476d1ce4e5b9ULL;
+	v ^= v >> 27;
+	v *= 0x94d049bb133111ebULL;
+	v ^= v >> 31;
+	return v;
+}
+
+/**
+ * @brief Hash of a 32 bit integer: "lowbias32" by Chris Wellons, a
+ *        bijection.
+ */
+static inline uint32_t zorohash_u32(uint32_t v)
+{
+	v ^= v >> 16;
+	v *= 0x7feb352dU;
+	v ^= v >> 15;
+	v *= 0x846ca68bU;
+	v ^= v >> 16;
+	return v;
+}
+
+/**
+ * @brief Hash of the address @a ptr, e.g. for tables keyed by object.
+ */
+static inline uint64_t zorohash_ptr(const void *ptr)
+{
+	return zorohash_u64((uintptr_t)ptr);
+}
+
+/**
+ * @brief Fold the hash @a v of a member into the hash @a h of the previous
+ *        members of a composite key, in order.
+ */
+static inline uint64_t zorohash_combine(uint64_t h, uint64_t v)
+{
+	return __zorohash_mix(h ^ __ZOROHASH_P0, v ^ __ZOROHASH_P1);
+}
+
+/**
+ * @brief Reduce the hash @a h to [0, @a n), for tables whose size is not a
+ *        power of two: a multiplication by @a n keeping the high half
+ *        (D. Lemire's "fastrange"), instead of a division.
+ *
+ * It uses the high bits of @a h: fine for any of the hashes of this file
+ * but the ones of zoro/linux/hash.h, which are already reduced.
+ */
+static inline uint64_t zorohash_reduce(uint64_t h, uint64_t n)
+{
+	uint64_t lo = h;
+
+	__zorohash_mum(&lo, &n);
+	return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_HASH_H__ */
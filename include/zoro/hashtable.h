@@ -0,0 +1,291 @@
+/**
+ * @file hashtable.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Resizable intrusive hash table, on top of hlist.
+ *
+ * Entries embed a @a struct @a hlist_node and are looked up by a key member,
+ * compared bytewise; the table knows where both are from zoroht_init().
+ * Bucket arrays are power-of-two sized.
+ *
+ * The table grows once it holds more entries than buckets (and shrinks once
+ * it holds less than one every 8): the new bucket array is allocated, and
+ * the entries are moved to it a few buckets at a time, by the following
+ * zoroht_add() and zoroht_del() calls. Lookups check the one bucket, old or
+ * new, an entry can be in; no operation ever rehashes the whole table.
+ *
+ * The table is not thread safe. Lookups and iterations do not change it:
+ * they only need to be serialized with the changes (e.g. by a rwlock).
+ */
+
+#pragma once
+#ifndef __ZORO_HASHTABLE_H__
+#define __ZORO_HASHTABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/hlist.h>
+
+#ifndef ZOROHT_MIGRATE_STEP
+    /**
+     * @brief Number of old buckets moved by each change while resizing.
+     * It must be at least 2, for a resize to complete before the next one is
+     * due. It takes effect when building the library.
+     */
+    #define ZOROHT_MIGRATE_STEP 4
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Smallest bucket array, as a power of two */
+#define ZOROHT_MIN_BITS		4
+
+/**
+ * @brief Hash function, of the @a len bytes of @a key.
+ */
+typedef uint64_t (*zoroht_hash_t)(const void *key, size_t len);
+
+struct zoroht {
+	struct hlist_head *buckets;
+	unsigned int bits;
+	/* Bucket array being migrated, NULL if none */
+	struct hlist_head *old;
+	unsigned int old_bits;
+	/* Old buckets below this index are already migrated */
+	size_t migrated;
+	size_t count;
+	unsigned int min_bits;
+	/* Layout of the entries */
+	size_t node_off;
+	size_t key_off;
+	size_t key_len;
+	zoroht_hash_t hash;
+};
+
+/**
+ * @fn uint64_t zoroht_hash_default(const void *key, size_t len)
+ * @brief Default hash function: keys of 1, 2, 4 or 8 bytes go through
+ *        zorohash_u64(), the others through zorohash_bytes() (see
+ *        zoro/hash.h).
+ */
+uint64_t zoroht_hash_default(const void *key, size_t len);
+
+/**
+ * @fn int __zoroht_init(struct zoroht *ht, unsigned int bits,
+ *                       size_t node_off, size_t key_off, size_t key_len,
+ *                       zoroht_hash_t hash)
+ * @brief Use zoroht_init() instead.
+ */
+int __zoroht_init(struct zoroht *ht, unsigned int bits, size_t node_off,
+		  size_t key_off, size_t key_len, zoroht_hash_t hash);
+
+/**
+ * @brief Initialize a hash table of entries of type @a _type.
+ *
+ * @param _ht    Pointer to the @a struct @a zoroht
+ * @param _bits  Log2 of the initial (and minimum) number of buckets; at
+ *               least ZOROHT_MIN_BITS is used
+ * @param _type  Type of the entries
+ * @param _node  Name of the @a struct @a hlist_node member of @a _type
+ * @param _key   Name of the key member of @a _type
+ * @param _hash  Hash function; NULL for zoroht_hash_default()
+ *
+ * @return 0 on success; -ENOMEM if the bucket array cannot be allocated.
+ */
+#define zoroht_init(_ht, _bits, _type, _node, _key, _hash)		\
+	__zoroht_init((_ht), (_bits), offset_of(_type, _node),	\
+		      offset_of(_type, _key),				\
+		      sizeof(((_type *)0)->_key), (_hash))
+
+/**
+ * @fn void zoroht_destroy(struct zoroht *ht)
+ * @brief Free the bucket arrays. The entries are not touched.
+ */
+void zoroht_destroy(struct zoroht *ht);
+
+/**
+ * @fn size_t zoroht_migrate(struct zoroht *ht, size_t nbuckets)
+ * @brief Move up to @a nbuckets old buckets of a resize in progress; the
+ *        changes do it anyway, this is for tables that are mostly read.
+ *
+ * @return The number of old buckets still to move.
+ */
+size_t zoroht_migrate(struct zoroht *ht, size_t nbuckets);
+
+/* Continue a resize, or start one; called by the changes */
+void __zoroht_rehash(struct zoroht *ht);
+
+static inline uint64_t __zoroht_hash(const struct zoroht *ht, const void *key)
+{
+	return ht->hash(key, ht->key_len);
+}
+
+/* The bucket of @a hash: in the old array, unless already migrated */
+static inline struct hlist_head *__zoroht_bucket(const struct zoroht *ht,
+						 uint64_t hash)
+{
+	size_t i;
+
+	if (unlikely(ht->old)) {
+		i = hash & ((1UL << ht->old_bits) - 1);
+		if (i >= ht->migrated)
+			return &ht->old[i];
+	}
+	return &ht->buckets[hash & ((1UL << ht->bits) - 1)];
+}
+
+static inline const void *__zoroht_key(const struct zoroht *ht,
+				       const struct hlist_node *node)
+{
+	return (const char *)node - ht->node_off + ht->key_off;
+}
+
+static inline int __zoroht_unbalanced(const struct zoroht *ht)
+{
+	return ht->old || ht->count > (1UL << ht->bits) ||
+	       (ht->bits > ht->min_bits && ht->count < (1UL << ht->bits) / 8);
+}
+
+/**
+ * @brief Look up the node of the entry with key @a key; use zoroht_find().
+ */
+static inline struct hlist_node *__zoroht_find(const struct zoroht *ht,
+					       const void *key)
+{
+	struct hlist_node *node;
+
+	hlist_for_each(node, __zoroht_bucket(ht, __zoroht_hash(ht, key)))
+		if (!memcmp(__zoroht_key(ht, node), key, ht->key_len))
+			return node;
+	return NULL;
+}
+
+/**
+ * @brief Add @a node to the table; use zoroht_add().
+ */
+static inline void __zoroht_add(struct zoroht *ht, struct hlist_node *node)
+{
+	hlist_add_head(node, __zoroht_bucket(ht, __zoroht_hash(ht,
+				__zoroht_key(ht, node))));
+	ht->count++;
+	if (unlikely(__zoroht_unbalanced(ht)))
+		__zoroht_rehash(ht);
+}
+
+/**
+ * @brief Remove @a node from the table; use zoroht_del().
+ */
+static inline void __zoroht_del(struct zoroht *ht, struct hlist_node *node)
+{
+	hlist_del_init(node);
+	ht->count--;
+	if (unlikely(__zoroht_unbalanced(ht)))
+		__zoroht_rehash(ht);
+}
+
+/**
+ * @brief Add the entry @a _obj. Keys are not checked for duplicates: with
+ *        more entries with the same key, lookups find the last one added,
+ *        resizes keeping their order.
+ *
+ * @param _ht     Pointer to the @a struct @a zoroht
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a hlist_node member of the entry
+ */
+#define zoroht_add(_ht, _obj, _member) \
+	__zoroht_add((_ht), &(_obj)->_member)
+
+/**
+ * @brief Remove the entry @a _obj, which must be in the table.
+ *
+ * @param _ht     Pointer to the @a struct @a zoroht
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a hlist_node member of the entry
+ */
+#define zoroht_del(_ht, _obj, _member) \
+	__zoroht_del((_ht), &(_obj)->_member)
+
+/**
+ * @brief Same as zoroht_del(), but never moves other entries: for removals
+ *        within zoroht_for_each_entry_safe(). The resize is caught up by
+ *        the next changes.
+ */
+#define zoroht_del_norehash(_ht, _obj, _member) do {	\
+	hlist_del_init(&(_obj)->_member);		\
+	(_ht)->count--;					\
+} while (0)
+
+/**
+ * @brief Look up an entry by key.
+ *
+ * @param _ht     Pointer to the @a struct @a zoroht
+ * @param _key    Pointer to the key
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a hlist_node member of @a _type
+ *
+ * @return A pointer to the entry; NULL if not found.
+ */
+#define zoroht_find(_ht, _key, _type, _member) \
+	hlist_entry_safe(__zoroht_find((_ht), (_key)), _type, _member)
+
+/**
+ * @brief Number of entries in the table.
+ */
+static inline size_t zoroht_count(const struct zoroht *ht)
+{
+	return ht->count;
+}
+
+/* Old and new buckets, seen as a single array by the iterators */
+static inline size_t __zoroht_nheads(const struct zoroht *ht)
+{
+	return (1UL << ht->bits) + (ht->old ? 1UL << ht->old_bits : 0);
+}
+
+static inline struct hlist_head *__zoroht_head(const struct zoroht *ht,
+					       size_t i)
+{
+	if (i < (1UL << ht->bits))
+		return &ht->buckets[i];
+	return &ht->old[i - (1UL << ht->bits)];
+}
+
+/**
+ * @brief Iterate over all the entries of the table, in no particular order.
+ *
+ * @param _ht     Pointer to the @a struct @a zoroht
+ * @param _bkt    A @a size_t to use as bucket cursor
+ * @param _pos    The type * to use as a loop cursor
+ * @param _member Name of the @a struct @a hlist_node member of the entries
+ */
+#define zoroht_for_each_entry(_ht, _bkt, _pos, _member)			\
+	for ((_bkt) = 0; (_bkt) < __zoroht_nheads(_ht); (_bkt)++)	\
+		hlist_for_each_entry(_pos, __zoroht_head((_ht), (_bkt)),\
+				     _member)
+
+/**
+ * @brief Iterate over all the entries of the table, safe against the
+ *        removal of the current entry with zoroht_del_norehash() (but not
+ *        with zoroht_del(), that might move the entries around).
+ *
+ * @param _ht     Pointer to the @a struct @a zoroht
+ * @param _bkt    A @a size_t to use as bucket cursor
+ * @param _pos    The type * to use as a loop cursor
+ * @param _tmp    A @a struct @a hlist_node * to use as temporary storage
+ * @param _member Name of the @a struct @a hlist_node member of the entries
+ */
+#define zoroht_for_each_entry_safe(_ht, _bkt, _pos, _tmp, _member)	\
+	for ((_bkt) = 0; (_bkt) < __zoroht_nheads(_ht); (_bkt)++)	\
+		hlist_for_each_entry_safe(_pos, _tmp,			\
+					  __zoroht_head((_ht), (_bkt)),	\
+					  _member)
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_HASHTABLE_H__ */
@@ -0,0 +1,101 @@
+/**
+ * @file linux/hash.h
+ * @author Andrea Pepe
+ * @copyright Copyright (c) 2024
+ *
+ * @brief Fast hashing routine for ints, longs and pointers.
+ *
+ * Multiplicative (Fibonacci) hashing: the value is multiplied by a constant
+ * close to 2^32 (or 2^64) divided by the golden ratio, and the top @a bits
+ * bits of the product are the hash, i.e. the index of a bucket in a table of
+ * 2^bits buckets. High bits are the most random ones of a product: never
+ * mask the low bits of __hash_32() instead.
+ *
+ * It spreads sequential and strided values, such as ids or aligned
+ * pointers, evenly over the buckets, but it is no bit mixer: see
+ * zorohash_u64() in zoro/hash.h for values that are not random in their
+ * high bits either.
+ *
+ * Extracted from include/linux/hash.h in Linux kernel 5.16.11
+ */
+
+#ifndef __ZORO_LINUX_HASH_H__
+#define __ZORO_LINUX_HASH_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BITS_PER_LONG (__SIZEOF_LONG__ * 8)
+
+/*
+ * This hash multiplies the input by a large odd number and takes the
+ * high bits.  Since multiplication propagates changes to the most
+ * significant end only, it is essential that the high bits of the
+ * product be used for the hash value.
+ *
+ * Although a random odd number will do, it turns out that the golden
+ * ratio phi = (sqrt(5)-1)/2, or its negative, has particularly nice
+ * properties.  (See Knuth vol 3, section 6.4, exercise 9.)
+ *
+ * These are the negative, (1 - phi) = phi**2 = (3 - sqrt(5))/2,
+ * which is very slightly easier to multiply by and makes no
+ * difference to the hash distribution.
+ */
+#define GOLDEN_RATIO_32 0x61C88647
+#define GOLDEN_RATIO_64 0x61C8864680B583EBull
+
+#if BITS_PER_LONG == 32
+#define GOLDEN_RATIO_PRIME GOLDEN_RATIO_32
+#define hash_long(val, bits) hash_32(val, bits)
+#elif BITS_PER_LONG == 64
+#define hash_long(val, bits) hash_64(val, bits)
+#define GOLDEN_RATIO_PRIME GOLDEN_RATIO_64
+#else
+#error Wordsize not 32 or 64
+#endif
+
+static inline uint32_t __hash_32(uint32_t val)
+{
+	return val * GOLDEN_RATIO_32;
+}
+
+static inline uint32_t hash_32(uint32_t val, unsigned int bits)
+{
+	/* High bits are more random, so use them. */
+	return __hash_32(val) >> (32 - bits);
+}
+
+static inline uint32_t hash_64(uint64_t val, unsigned int bits)
+{
+#if BITS_PER_LONG == 64
+	/* 64x64-bit multiply is efficient on all 64-bit processors */
+	return val * GOLDEN_RATIO_64 >> (64 - bits);
+#else
+	/* Hash 64 bits using only 32x32-bit multiply. */
+	return hash_32((uint32_t)val ^ __hash_32(val >> 32), bits);
+#endif
+}
+
+static inline uint32_t hash_ptr(const void *ptr, unsigned int bits)
+{
+	return hash_long((unsigned long)ptr, bits);
+}
+
+/* This really should be called fold32_ptr; it does no hashing to speak of. */
+static inline uint32_t hash32_ptr(const void *ptr)
+{
+	unsigned long val = (unsigned long)ptr;
+
+#if BITS_PER_LONG == 64
+	val ^= (val >> 32);
+#endif
+	return (uint32_t)val;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_LINUX_HASH_H__ */
@@ -346,6 +346,45 @@ static inline void hlist_move_list(struct hlist_head *old,
 	for (pos = hlist_entry_safe((head)->first, typeof(*pos), member);\
 	     pos && ({ n = pos->member.next; 1; });			\
 	     pos = hlist_entry_safe(n, typeof(*pos), member))
+
+/* Advance the lookahead cursor of the *_prefetch iterators by one node */
+static inline struct hlist_node *__hlist_prefetch_next(struct hlist_node *ahead)
+{
+	if (ahead) {
+		ahead = ahead->next;
+		prefetch(ahead);
+	}
+	return ahead;
+}
+
+/* Set the lookahead cursor LIST_PREFETCH_DISTANCE nodes after the first */
+static inline struct hlist_node *__hlist_prefetch_init(struct hlist_head *head)
+{
+	struct hlist_node *ahead = head->first;
+	unsigned int i;
+
+	for (i = 0; i < LIST_PREFETCH_DISTANCE; i++)
+		ahead = __hlist_prefetch_next(ahead);
+	return ahead;
+}
+
+/**
+ * @brief Iterate over list of given type, prefetching the nodes ahead.
+ *
+ * Same as list_for_each_entry_prefetch(), for hlists: worth it on long
+ * chains, not on the short ones of a well sized hash table.
+ *
+ * @param pos	        the type * to use as a loop cursor
+ * @param ahead	        a &struct hlist_node * to use as lookahead cursor
+ * @param head	        the head for your list
+ * @param member	the name of the hlist_node within the struct
+ */
+#define hlist_for_each_entry_prefetch(pos, ahead, head, member)		\
+	for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member),\
+	     ahead = __hlist_prefetch_init(head);			\
+	     pos;							\
+	     pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member),\
+	     ahead = __hlist_prefetch_next(ahead))
 /** @} */
 
 #ifdef __cplusplus
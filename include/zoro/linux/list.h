@@ -11,10 +11,19 @@
 #ifndef __ZORO_LINUX_LIST_H__
 #define __ZORO_LINUX_LIST_H__
 
+#include <stddef.h>
 #include <linux/types.h>
 #include <zoro/compiler.h>
 #include <zoro/linux/rwonce.h>
 
+#ifndef LIST_PREFETCH_DISTANCE
+    /**
+     * @brief How many nodes ahead of the cursor the *_prefetch iterators
+     * prefetch. It takes effect when building the code that uses them.
+     */
+    #define LIST_PREFETCH_DISTANCE 4
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -766,6 +775,51 @@ static inline void list_splice_tail_init(struct list_head *list,
 	     !list_entry_is_head(pos, head, member);			\
 	     pos = list_next_entry(pos, member))
 
+/* Advance the lookahead cursor of the *_prefetch iterators by one node */
+static inline struct list_head *__list_prefetch_next(struct list_head *ahead,
+						     const struct list_head *head)
+{
+	if (ahead != head) {
+		ahead = ahead->next;
+		prefetch(ahead);
+	}
+	return ahead;
+}
+
+/* Set the lookahead cursor LIST_PREFETCH_DISTANCE nodes after the first */
+static inline struct list_head *__list_prefetch_init(struct list_head *head)
+{
+	struct list_head *ahead = head->next;
+	unsigned int i;
+
+	for (i = 0; i < LIST_PREFETCH_DISTANCE; i++)
+		ahead = __list_prefetch_next(ahead, head);
+	return ahead;
+}
+
+/**
+ * @brief Iterate over list of given type, prefetching the nodes ahead.
+ *
+ * A second cursor runs @a LIST_PREFETCH_DISTANCE nodes ahead of @a pos and
+ * prefetches every node it reaches, so that the cache misses of the walk
+ * overlap with the work of the loop body. It pays off on long lists that are
+ * not in cache, when the body does some work on each entry; on short or hot
+ * lists it only costs a second pointer walk: use list_for_each_entry().
+ *
+ * The list must not change during the walk.
+ *
+ * @param pos	        the type * to use as a loop cursor
+ * @param ahead	        a &struct list_head * to use as lookahead cursor
+ * @param head	        the head for your list
+ * @param member	the name of the list_head within the struct
+ */
+#define list_for_each_entry_prefetch(pos, ahead, head, member)		\
+	for (pos = list_first_entry(head, typeof(*pos), member),	\
+	     ahead = __list_prefetch_init(head);			\
+	     !list_entry_is_head(pos, head, member);			\
+	     pos = list_next_entry(pos, member),			\
+	     ahead = __list_prefetch_next(ahead, head))
+
 /**
  * @brief Iterate backwards over list of given type.
  * @param pos	        the type * to use as a loop cursor
@@ -966,6 +1020,106 @@ typedef int __attribute__((nonnull(2,3))) (*list_cmp_func_t)(void *,
 __attribute__((nonnull(2,3)))
 void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp);
 
+/**
+ * @brief Sort a doubly linked list, taking advantage of the sorted runs in
+ *        it (natural merge sort).
+ *
+ * Same semantics as @a list_sort(), but the input is split into its
+ * maximal ascending (or strictly descending, which are reversed) runs, that
+ * are then merged like @a list_sort() merges single elements. A list made of
+ * k runs is sorted with O(n log k) comparisons: n - 1 for a list already
+ * sorted, or sorted the other way round. On random input, finding the runs
+ * costs a few percent more comparisons than @a list_sort().
+ *
+ * @param priv          private data, opaque to @a list_sort_natural(), passed
+ *                      to @a cmp
+ * @param head          the list to sort
+ * @param cmp           the elements comparison function
+ */
+__attribute__((nonnull(2,3)))
+void list_sort_natural(void *priv, struct list_head *head, list_cmp_func_t cmp);
+
+/**
+ * @brief Merge the sorted list @a list into the sorted list @a head, in a
+ *        single linear pass; @a list is left empty.
+ *
+ * Both lists must be sorted according to @a cmp, with the same semantics as
+ * in @a list_sort(). The merge is stable: elements of @a head comparing
+ * equal to elements of @a list come first. Merging m elements into a list of
+ * n costs at most n + m - 1 comparisons, against the O(n * m) of inserting
+ * them one at a time.
+ *
+ * @param priv          private data, opaque to @a list_merge_sorted(),
+ *                      passed to @a cmp
+ * @param head          the sorted list to merge into
+ * @param list          the sorted list to merge, emptied
+ * @param cmp           the elements comparison function
+ */
+__attribute__((nonnull(2,3,4)))
+void list_merge_sorted(void *priv, struct list_head *head,
+		       struct list_head *list, list_cmp_func_t cmp);
+
+#ifndef LIST_SORT_PARALLEL_MIN
+    /**
+     * @brief Minimum number of elements of each chunk of
+     * @a list_sort_parallel(): below it, handing chunks to the workers costs
+     * more than it saves. It takes effect when building the library.
+     */
+    #define LIST_SORT_PARALLEL_MIN 32768
+#endif
+
+/**
+ * @brief Sort a doubly linked list using up to @a nthreads threads.
+ *
+ * Same semantics as @a list_sort(), stability included, but @a cmp is called
+ * concurrently from several threads, so it must be thread safe with respect
+ * to @a priv. The list is split into up to @a nthreads chunks, sorted
+ * concurrently by the calling thread and by work items of zorowq_system(),
+ * then merged pairwise in a tree, with the merges of each level running
+ * concurrently; only the last one is done by the calling thread. No worker
+ * waits for another one: it can be called from a work item too.
+ *
+ * Lists of less than 2 * @a LIST_SORT_PARALLEL_MIN elements, or lack of
+ * memory, fall back to @a list_sort(); the chunks no worker takes, e.g. if
+ * the system work queue cannot be created or is busy, are sorted by the
+ * calling thread.
+ *
+ * @param priv          private data, opaque to @a list_sort_parallel(),
+ *                      passed to @a cmp
+ * @param head          the list to sort
+ * @param cmp           the elements comparison function
+ * @param nthreads      max number of threads, including the calling one;
+ *                      <= 0 for one per online CPU
+ */
+__attribute__((nonnull(2,3)))
+void list_sort_parallel(void *priv, struct list_head *head,
+			list_cmp_func_t cmp, int nthreads);
+
+typedef uint64_t __attribute__((nonnull(2))) (*list_key_func_t)(void *,
+		const struct list_head *);
+
+/**
+ * @brief Sort a doubly linked list by an integer key.
+ *
+ * The @a (key, element) pairs are gathered into an array, sorted there with a
+ * radix sort (one pass per byte of the keys that is not the same for all of
+ * them), then the list is relinked in one pass: no pointer chasing and no
+ * indirect calls while sorting. It is stable, and @a key is called once per
+ * element, but it needs 32 bytes of memory per element; if they cannot be
+ * allocated, it falls back to @a list_sort() on the keys.
+ *
+ * Keys are sorted in ascending unsigned order: flip the sign bit of signed
+ * keys (@a key ^ (1ULL << 63)), and complement them (~@a key) for a
+ * descending sort.
+ *
+ * @param priv          private data, opaque to @a list_sort_key(), passed to
+ *                      @a key
+ * @param head          the list to sort
+ * @param key           returns the sort key of an element
+ */
+__attribute__((nonnull(2,3)))
+void list_sort_key(void *priv, struct list_head *head, list_key_func_t key);
+
 #ifdef __cplusplus
 }
 #endif
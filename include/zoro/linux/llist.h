@@ -0,0 +1,286 @@
+/**
+ * @file linux/llist.h
+ * @author Andrea Pepe
+ * @copyright Copyright (c) 2024
+ *
+ * @brief Lock-less NULL terminated singly linked list.
+ *
+ * Cases where locking is not needed:
+ * If there are multiple producers and multiple consumers, llist_add can be
+ * used in producers and llist_del_all can be used in consumers simultaneously
+ * without locking. Also a single consumer can use llist_del_first while
+ * multiple producers simultaneously use llist_add, without any locking.
+ *
+ * Cases where locking is needed:
+ * If we have multiple consumers with llist_del_first used in one consumer,
+ * and llist_del_first or llist_del_all used in other consumers, then a lock
+ * is needed. This is because llist_del_first depends on list->first->next
+ * not changing, but without lock protection, there's no way to be sure
+ * about that if a preemption happens in the middle of the delete operation
+ * and on being preempted back, the list->first is the same as before
+ * causing the cmpxchg in llist_del_first to succeed. For example, while a
+ * llist_del_first operation is in progress in one consumer, then a
+ * llist_del_first, llist_add, llist_add (or llist_del_all, llist_add,
+ * llist_add) sequence in another consumer may cause violations.
+ *
+ * This can be summarized as follows:
+ *
+ *           |   add    | del_first |  del_all
+ * add       |    -     |     -     |     -
+ * del_first |          |     L     |     L
+ * del_all   |          |           |     -
+ *
+ * Where, a particular row's operation can happen concurrently with a column's
+ * operation, with "-" being no lock needed, while "L" being lock is needed.
+ *
+ * The list entries deleted via llist_del_all can be traversed with
+ * traversing function such as llist_for_each etc. But the list entries can
+ * not be traversed safely before deleted from the list. The order of deleted
+ * entries is from the newest to the oldest added one. If you want to
+ * traverse from the oldest to the newest, you must reverse the order by
+ * yourself before traversing.
+ *
+ * Extracted from include/linux/llist.h and lib/llist.c in Linux kernel
+ * 5.16.11
+ */
+
+#ifndef __ZORO_LINUX_LLIST_H__
+#define __ZORO_LINUX_LLIST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zoro/atomic.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+#include <zoro/linux/rwonce.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct llist_head {
+	struct llist_node *first;
+};
+
+struct llist_node {
+	struct llist_node *next;
+};
+
+#define LLIST_HEAD_INIT(name)	{ NULL }
+#define LLIST_HEAD(name)	struct llist_head name = LLIST_HEAD_INIT(name)
+
+/**
+ * @brief Initialize lock-less list head.
+ *
+ * @param list          the head for your lock-less list
+ */
+static inline void init_llist_head(struct llist_head *list)
+{
+	list->first = NULL;
+}
+
+/**
+ * @brief Get the struct of this entry.
+ *
+ * @param ptr           the &struct llist_node pointer.
+ * @param type          the type of the struct this is embedded in.
+ * @param member        the name of the llist_node within the struct.
+ */
+#define llist_entry(ptr, type, member)		\
+	container_of(ptr, type, member)
+
+/**
+ * @brief Check whether the address of a member is not NULL.
+ *
+ * Unlike simply checking the pointer itself, this does not require the
+ * member to be the first one of its struct.
+ *
+ * @param ptr           the pointer to the struct.
+ * @param member        the name of the member within the struct.
+ */
+#define member_address_is_nonnull(ptr, member)	\
+	((uintptr_t)(ptr) + offsetof(typeof(*(ptr)), member) != 0)
+
+/**
+ * @brief Iterate over some deleted entries of a lock-less list.
+ *
+ * In general, some entries of the lock-less list can be traversed safely
+ * only after being deleted from list, so start with an entry instead of
+ * list head.
+ *
+ * If being used on entries deleted from lock-less list directly, the
+ * traverse order is from the newest to the oldest added entry. If you want
+ * to traverse from the oldest to the newest, you must reverse the order by
+ * yourself before traversing.
+ *
+ * @param pos           the &struct llist_node to use as a loop cursor
+ * @param node          the first entry of deleted list entries
+ */
+#define llist_for_each(pos, node)			\
+	for ((pos) = (node); pos; (pos) = (pos)->next)
+
+/**
+ * @brief Iterate over some deleted entries of a lock-less list, safe
+ *        against removal of list entry.
+ *
+ * @param pos           the &struct llist_node to use as a loop cursor
+ * @param n             another &struct llist_node to use as temporary storage
+ * @param node          the first entry of deleted list entries
+ */
+#define llist_for_each_safe(pos, n, node)			\
+	for ((pos) = (node); (pos) && ((n) = (pos)->next, true); (pos) = (n))
+
+/**
+ * @brief Iterate over some deleted entries of lock-less list of given type.
+ *
+ * @param pos           the type * to use as a loop cursor.
+ * @param node          the first entry of deleted list entries.
+ * @param member        the name of the llist_node within the struct.
+ */
+#define llist_for_each_entry(pos, node, member)				\
+	for ((pos) = llist_entry((node), typeof(*(pos)), member);	\
+	     member_address_is_nonnull(pos, member);			\
+	     (pos) = llist_entry((pos)->member.next, typeof(*(pos)), member))
+
+/**
+ * @brief Iterate over some deleted entries of lock-less list of given type,
+ *        safe against removal of list entry.
+ *
+ * @param pos           the type * to use as a loop cursor.
+ * @param n             another type * to use as temporary storage
+ * @param node          the first entry of deleted list entries.
+ * @param member        the name of the llist_node within the struct.
+ */
+#define llist_for_each_entry_safe(pos, n, node, member)			       \
+	for (pos = llist_entry((node), typeof(*pos), member);		       \
+	     member_address_is_nonnull(pos, member) &&			       \
+	        (n = llist_entry(pos->member.next, typeof(*n), member), true); \
+	     pos = n)
+
+/**
+ * @brief Test whether a lock-less list is empty.
+ *
+ * The result is only a snapshot: with concurrent adds and deletes, it may be
+ * out of date as soon as it is returned.
+ *
+ * @param head          the list to test
+ *
+ * @return true if the list is empty; false otherwise.
+ */
+static inline bool llist_empty(const struct llist_head *head)
+{
+	return __atomic_load_n(&head->first, __ATOMIC_RELAXED) == NULL;
+}
+
+static inline struct llist_node *llist_next(struct llist_node *node)
+{
+	return node->next;
+}
+
+/**
+ * @brief Add several linked entries in batch.
+ *
+ * @param new_first     first entry in batch to be added
+ * @param new_last      last entry in batch to be added
+ * @param head          the head for your lock-less list
+ *
+ * @return Whether the list was empty before adding.
+ */
+static inline bool llist_add_batch(struct llist_node *new_first,
+				   struct llist_node *new_last,
+				   struct llist_head *head)
+{
+	struct llist_node *first;
+
+	first = __atomic_load_n(&head->first, __ATOMIC_RELAXED);
+
+	/* Release: the entries are written out before being reachable */
+	do {
+		new_last->next = first;
+	} while (!try_cmpxchg_release(&head->first, &first, new_first));
+
+	return !first;
+}
+
+/* Same as llist_add_batch(), for a list with no concurrent access */
+static inline bool __llist_add_batch(struct llist_node *new_first,
+				     struct llist_node *new_last,
+				     struct llist_head *head)
+{
+	new_last->next = head->first;
+	head->first = new_first;
+	return new_last->next == NULL;
+}
+
+/**
+ * @brief Add a new entry.
+ *
+ * @param new           new entry to be added
+ * @param head          the head for your lock-less list
+ *
+ * @return Whether the list was empty before adding.
+ */
+static inline bool llist_add(struct llist_node *new, struct llist_head *head)
+{
+	return llist_add_batch(new, new, head);
+}
+
+static inline bool __llist_add(struct llist_node *new, struct llist_head *head)
+{
+	return __llist_add_batch(new, new, head);
+}
+
+/**
+ * @brief Delete all entries from lock-less list.
+ *
+ * If list is empty, return NULL, otherwise, delete all entries and return
+ * the pointer to the first entry. The order of entries deleted is from the
+ * newest to the oldest added one.
+ *
+ * @param head          the head of lock-less list to delete all entries
+ */
+static inline struct llist_node *llist_del_all(struct llist_head *head)
+{
+	/* Acquire: pairs with the release of the adds */
+	return xchg_acquire(&head->first, NULL);
+}
+
+static inline struct llist_node *__llist_del_all(struct llist_head *head)
+{
+	struct llist_node *first = head->first;
+
+	head->first = NULL;
+	return first;
+}
+
+/**
+ * @brief Delete the first entry of lock-less list.
+ *
+ * Only one llist_del_first user can be used simultaneously with multiple
+ * llist_add users without lock. Because otherwise llist_del_first,
+ * llist_add, llist_add (or llist_del_all, llist_add, llist_add) sequence in
+ * another user may change @a head->first->next, but keep @a head->first.
+ * If multiple consumers are needed, please use llist_del_all or use lock
+ * between consumers.
+ *
+ * @param head          the head for your lock-less list
+ *
+ * @return The first entry deleted; NULL if the list is empty.
+ */
+struct llist_node *llist_del_first(struct llist_head *head);
+
+/**
+ * @brief Reverse the order of a chain of llist entries.
+ *
+ * @param head          first item of the list to be reversed
+ *
+ * @return The new first entry (i.e. the former last one).
+ */
+struct llist_node *llist_reverse_order(struct llist_node *head);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZORO_LINUX_LLIST_H__ */
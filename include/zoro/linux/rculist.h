@@ -0,0 +1,456 @@
+/**
+ * @file linux/rculist.h
+ * @author Andrea Pepe
+ * @copyright Copyright (c) 2024
+ *
+ * @brief RCU variants of the list and hlist functions.
+ *
+ * Writers change the lists with the _rcu functions below, serialized by a
+ * lock of their own, while readers walk them with the _rcu iterators within
+ * rcu_read_lock() and rcu_read_unlock(): the iterators only take plain
+ * loads. Entries removed with list_del_rcu() or hlist_del_rcu() can still be
+ * walked by the readers that found them, so they must be freed after a grace
+ * period only, with synchronize_rcu() or call_rcu(), and not reinitialized
+ * meanwhile.
+ *
+ * Extracted from include/linux/rculist.h in Linux kernel 5.16.11
+ */
+
+#ifndef __ZORO_LINUX_RCULIST_H__
+#define __ZORO_LINUX_RCULIST_H__
+
+#include <zoro/compiler.h>
+#include <zoro/linux/hlist.h>
+#include <zoro/linux/list.h>
+#include <zoro/linux/rcupdate.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Initialize a list_head visible to RCU readers.
+ *
+ * @param list          list to be initialized
+ */
+static inline void INIT_LIST_HEAD_RCU(struct list_head *list)
+{
+	WRITE_ONCE(list->next, list);
+	WRITE_ONCE(list->prev, list);
+}
+
+/* The next pointer of @a list, as RCU protected pointer */
+#define list_next_rcu(list)	(*((struct list_head __rcu **)(&(list)->next)))
+
+/* The tail pointer of @a head, as RCU protected pointer */
+#define list_tail_rcu(head)	(*((struct list_head __rcu **)(&(head)->prev)))
+
+/*
+ * Insert a new entry between two known consecutive entries.
+ *
+ * This is only for internal list manipulation where we know the prev/next
+ * entries already!
+ */
+static inline void __list_add_rcu(struct list_head *_new,
+				  struct list_head *prev,
+				  struct list_head *next)
+{
+	_new->next = next;
+	_new->prev = prev;
+	rcu_assign_pointer(list_next_rcu(prev), _new);
+	next->prev = _new;
+}
+
+/**
+ * @brief Add a new entry to an RCU protected list, after the specified head.
+ *
+ * It may run concurrently with the readers of the list, but not with the
+ * other writers: they must hold the same lock.
+ *
+ * @param _new          new entry to be added
+ * @param head          list head to add it after
+ */
+static inline void list_add_rcu(struct list_head *_new, struct list_head *head)
+{
+	__list_add_rcu(_new, head, head->next);
+}
+
+/**
+ * @brief Add a new entry to an RCU protected list, before the specified
+ *        head: useful for implementing queues.
+ *
+ * @param _new          new entry to be added
+ * @param head          list head to add it before
+ */
+static inline void list_add_tail_rcu(struct list_head *_new,
+				     struct list_head *head)
+{
+	__list_add_rcu(_new, head->prev, head);
+}
+
+/**
+ * @brief Delete an entry from an RCU protected list.
+ *
+ * @a entry->next is left intact, so that readers walking the list across
+ * @a entry can go on; @a entry must not be freed nor reused before a grace
+ * period.
+ *
+ * @param entry         the element to delete from the list
+ */
+static inline void list_del_rcu(struct list_head *entry)
+{
+	__list_del_entry(entry);
+	entry->prev = (struct list_head *)LIST_POISON2;
+}
+
+/**
+ * @brief Replace @a old with @a _new in an RCU protected list: readers see
+ *        either of them, never neither. @a old must be freed after a grace
+ *        period.
+ *
+ * @param old           the element to be replaced
+ * @param _new          the new element to insert
+ */
+static inline void list_replace_rcu(struct list_head *old,
+				    struct list_head *_new)
+{
+	_new->next = old->next;
+	_new->prev = old->prev;
+	rcu_assign_pointer(list_next_rcu(_new->prev), _new);
+	_new->next->prev = _new;
+	old->prev = (struct list_head *)LIST_POISON2;
+}
+
+/*
+ * Splice an RCU protected list into an existing list, waiting for a grace
+ * period with @a sync before touching the entries.
+ */
+static inline void __list_splice_init_rcu(struct list_head *list,
+					  struct list_head *prev,
+					  struct list_head *next,
+					  void (*sync)(void))
+{
+	struct list_head *first = list->next;
+	struct list_head *last = list->prev;
+
+	/*
+	 * "first" and "last" track the list, so reinitialize it: readers
+	 * walking it from the head end the walk
+	 */
+	INIT_LIST_HEAD_RCU(list);
+
+	/* Wait for the readers of the old list to be done */
+	sync();
+
+	/* Readers are finished with the source list, so splice it in */
+	last->next = next;
+	rcu_assign_pointer(list_next_rcu(prev), first);
+	first->prev = prev;
+	next->prev = last;
+}
+
+/**
+ * @brief Splice an RCU protected list into an existing list, designed for
+ *        stacks; @a list is reinitialized.
+ *
+ * @param list          the RCU protected list to splice
+ * @param head          the place in the existing list to splice the first
+ *                      list into
+ * @param sync          synchronize_rcu(), or similar
+ */
+static inline void list_splice_init_rcu(struct list_head *list,
+					struct list_head *head,
+					void (*sync)(void))
+{
+	if (!list_empty(list))
+		__list_splice_init_rcu(list, head, head->next, sync);
+}
+
+/**
+ * @brief Splice an RCU protected list into an existing list, designed for
+ *        queues; @a list is reinitialized.
+ *
+ * @param list          the RCU protected list to splice
+ * @param head          the place in the existing list to splice the first
+ *                      list into
+ * @param sync          synchronize_rcu(), or similar
+ */
+static inline void list_splice_tail_init_rcu(struct list_head *list,
+					     struct list_head *head,
+					     void (*sync)(void))
+{
+	if (!list_empty(list))
+		__list_splice_init_rcu(list, head->prev, head, sync);
+}
+
+/**
+ * @brief Get the struct for this entry, from a read section.
+ *
+ * @param ptr           the &struct list_head pointer
+ * @param type          the type of the struct this is embedded in
+ * @param member        the name of the list_head within the struct
+ */
+#define list_entry_rcu(ptr, type, member) \
+	container_of(READ_ONCE(ptr), type, member)
+
+/**
+ * @brief Get the first element from an RCU protected list, from a read
+ *        section.
+ *
+ * @param ptr           the list head to take the element from
+ * @param type          the type of the struct this is embedded in
+ * @param member        the name of the list_head within the struct
+ *
+ * @return A pointer to the entry; NULL if the list is empty.
+ */
+#define list_first_or_null_rcu(ptr, type, member) ({			\
+	struct list_head *__ptr = (ptr);				\
+	struct list_head *__next = READ_ONCE(__ptr->next);		\
+	likely(__ptr != __next) ? list_entry_rcu(__next, type, member) : NULL; \
+})
+
+/**
+ * @brief Get the next element from an RCU protected list, from a read
+ *        section.
+ *
+ * @param head          the head of the list
+ * @param ptr           the list_head to take the next element from
+ * @param type          the type of the struct this is embedded in
+ * @param member        the name of the list_head within the struct
+ *
+ * @return A pointer to the entry; NULL if @a ptr is the last one.
+ */
+#define list_next_or_null_rcu(head, ptr, type, member) ({		\
+	struct list_head *__head = (head);				\
+	struct list_head *__ptr = (ptr);				\
+	struct list_head *__next = READ_ONCE(__ptr->next);		\
+	likely(__next != __head) ? list_entry_rcu(__next, type,		\
+						  member) : NULL;	\
+})
+
+/**
+ * @brief Iterate over an RCU protected list of given type, from a read
+ *        section (or under the lock of the writers).
+ *
+ * @param pos           the type * to use as a loop cursor
+ * @param head          the head for your list
+ * @param member        the name of the list_head within the struct
+ */
+#define list_for_each_entry_rcu(pos, head, member)			\
+	for (pos = list_entry_rcu((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry_rcu(pos->member.next, typeof(*pos), member))
+
+/**
+ * @brief Continue the iteration over an RCU protected list of given type,
+ *        after the current position.
+ *
+ * @param pos           the type * to use as a loop cursor
+ * @param head          the head for your list
+ * @param member        the name of the list_head within the struct
+ */
+#define list_for_each_entry_continue_rcu(pos, head, member)		\
+	for (pos = list_entry_rcu(pos->member.next, typeof(*pos), member); \
+	     &pos->member != (head);					\
+	     pos = list_entry_rcu(pos->member.next, typeof(*pos), member))
+
+/**
+ * @brief Iterate over an RCU protected list of given type, from the current
+ *        position.
+ *
+ * @param pos           the type * to use as a loop cursor
+ * @param head          the head for your list
+ * @param member        the name of the list_head within the struct
+ */
+#define list_for_each_entry_from_rcu(pos, head, member)			\
+	for (; &(pos)->member != (head);				\
+	     pos = list_entry_rcu(pos->member.next, typeof(*(pos)), member))
+
+/* The first pointer of @a head, and the next one of @a node, as RCU protected */
+#define hlist_first_rcu(head)	(*((struct hlist_node __rcu **)(&(head)->first)))
+#define hlist_next_rcu(node)	(*((struct hlist_node __rcu **)(&(node)->next)))
+#define hlist_pprev_rcu(node)	(*((struct hlist_node __rcu **)((node)->pprev)))
+
+/**
+ * @brief Delete an entry from an RCU protected hlist and leave it unhashed:
+ *        hlist_unhashed() is true on it. Same as hlist_del_rcu() otherwise.
+ *
+ * @param n             the element to delete from the hash list
+ */
+static inline void hlist_del_init_rcu(struct hlist_node *n)
+{
+	if (!hlist_unhashed(n)) {
+		__hlist_del(n);
+		WRITE_ONCE(n->pprev, NULL);
+	}
+}
+
+/**
+ * @brief Delete an entry from an RCU protected hlist.
+ *
+ * @a n->next is left intact, so that readers walking the list across
+ * @a n can go on; @a n must not be freed nor reused before a grace period.
+ *
+ * @param n             the element to delete from the hash list
+ */
+static inline void hlist_del_rcu(struct hlist_node *n)
+{
+	__hlist_del(n);
+	WRITE_ONCE(n->pprev, (struct hlist_node **)LIST_POISON2);
+}
+
+/**
+ * @brief Replace @a old with @a _new in an RCU protected hlist: readers see
+ *        either of them, never neither.
+ *
+ * @param old           the element to be replaced
+ * @param _new          the new element to insert
+ */
+static inline void hlist_replace_rcu(struct hlist_node *old,
+				     struct hlist_node *_new)
+{
+	struct hlist_node *next = old->next;
+
+	_new->next = next;
+	WRITE_ONCE(_new->pprev, old->pprev);
+	rcu_assign_pointer(*(struct hlist_node __rcu **)_new->pprev, _new);
+	if (next)
+		WRITE_ONCE(_new->next->pprev, &_new->next);
+	WRITE_ONCE(old->pprev, (struct hlist_node **)LIST_POISON2);
+}
+
+/**
+ * @brief Add a new entry at the beginning of an RCU protected hlist.
+ *
+ * It may run concurrently with the readers of the list, but not with the
+ * other writers: they must hold the same lock.
+ *
+ * @param n             the element to add to the hash list
+ * @param h             the list to add to
+ */
+static inline void hlist_add_head_rcu(struct hlist_node *n,
+				      struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	WRITE_ONCE(n->pprev, &h->first);
+	rcu_assign_pointer(hlist_first_rcu(h), n);
+	if (first)
+		WRITE_ONCE(first->pprev, &n->next);
+}
+
+/**
+ * @brief Add a new entry at the end of an RCU protected hlist; it walks the
+ *        whole list.
+ *
+ * @param n             the element to add to the hash list
+ * @param h             the list to add to
+ */
+static inline void hlist_add_tail_rcu(struct hlist_node *n,
+				      struct hlist_head *h)
+{
+	struct hlist_node *i, *last = NULL;
+
+	for (i = h->first; i; i = i->next)
+		last = i;
+
+	if (last) {
+		n->next = last->next;
+		WRITE_ONCE(n->pprev, &last->next);
+		rcu_assign_pointer(hlist_next_rcu(last), n);
+	} else {
+		hlist_add_head_rcu(n, h);
+	}
+}
+
+/**
+ * @brief Add a new entry before the specified one of an RCU protected
+ *        hlist.
+ *
+ * @param n             the new element to add to the hash list
+ * @param next          the existing element to add the new element before
+ */
+static inline void hlist_add_before_rcu(struct hlist_node *n,
+					struct hlist_node *next)
+{
+	WRITE_ONCE(n->pprev, next->pprev);
+	n->next = next;
+	rcu_assign_pointer(hlist_pprev_rcu(n), n);
+	WRITE_ONCE(next->pprev, &n->next);
+}
+
+/**
+ * @brief Add a new entry after the specified one of an RCU protected hlist.
+ *
+ * @param n             the new element to add to the hash list
+ * @param prev          the existing element to add the new element after
+ */
+static inline void hlist_add_behind_rcu(struct hlist_node *n,
+					struct hlist_node *prev)
+{
+	n->next = prev->next;
+	WRITE_ONCE(n->pprev, &prev->next);
+	rcu_assign_pointer(hlist_next_rcu(prev), n);
+	if (n->next)
+		WRITE_ONCE(n->next->pprev, &n->next);
+}
+
+/**
+ * @brief Iterate over the nodes of an RCU protected hlist, from a read
+ *        section.
+ *
+ * @param pos           the &struct hlist_node to use as a loop cursor
+ * @param head          the head for your list
+ */
+#define __hlist_for_each_rcu(pos, head)					\
+	for (pos = rcu_dereference(hlist_first_rcu(head));		\
+	     pos;							\
+	     pos = rcu_dereference(hlist_next_rcu(pos)))
+
+/**
+ * @brief Iterate over an RCU protected hlist of given type, from a read
+ *        section (or under the lock of the writers).
+ *
+ * @param pos           the type * to use as a loop cursor
+ * @param head          the head for your list
+ * @param member        the name of the hlist_node within the struct
+ */
+#define hlist_for_each_entry_rcu(pos, head, member)			\
+	for (pos = hlist_entry_safe(rcu_dereference_raw(hlist_first_rcu(head)),\
+			typeof(*(pos)), member);			\
+	     pos;							\
+	     pos = hlist_entry_safe(rcu_dereference_raw(hlist_next_rcu(	\
+			&(pos)->member)), typeof(*(pos)), member))
+
+/**
+ * @brief Continue the iteration over an RCU protected hlist of given type,
+ *        after the current position.
+ *
+ * @param pos           the type * to use as a loop cursor
+ * @param member        the name of the hlist_node within the struct
+ */
+#define hlist_for_each_entry_continue_rcu(pos, member)			\
+	for (pos = hlist_entry_safe(rcu_dereference_raw(hlist_next_rcu(	\
+			&(pos)->member)), typeof(*(pos)), member);	\
+	     pos;							\
+	     pos = hlist_entry_safe(rcu_dereference_raw(hlist_next_rcu(	\
+			&(pos)->member)), typeof(*(pos)), member))
+
+/**
+ * @brief Iterate over an RCU protected hlist of given type, from the
+ *        current position.
+ *
+ * @param pos           the type * to use as a loop cursor
+ * @param member        the name of the hlist_node within the struct
+ */
+#define hlist_for_each_entry_from_rcu(pos, member)			\
+	for (; pos;							\
+	     pos = hlist_entry_safe(rcu_dereference_raw(hlist_next_rcu(	\
+			&(pos)->member)), typeof(*(pos)), member))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZORO_LINUX_RCULIST_H__ */
@@ -0,0 +1,189 @@
+/**
+ * @file linux/rcupdate.h
+ * @author Andrea Pepe
+ * @copyright Copyright (c) 2024
+ *
+ * @brief Read-copy update primitives, on top of zoro/epoch.h.
+ *
+ * Readers traverse the data between rcu_read_lock() and rcu_read_unlock()
+ * and load the pointers writers publish with rcu_dereference(), that is a
+ * plain load: no atomic instruction and no lock. Writers, serialized among
+ * themselves by a lock of their own, publish new objects with
+ * rcu_assign_pointer() and free the unlinked ones after a grace period,
+ * either waited for with synchronize_rcu() or deferred with call_rcu().
+ *
+ * Read sections cost a store and a full barrier on a cache line of the
+ * thread; threads that go online with rcu_thread_online() skip even those,
+ * reporting quiescent states with rcu_quiescent_state() instead (QSBR, as
+ * liburcu calls it).
+ *
+ * Extracted from include/linux/rcupdate.h in Linux kernel 5.16.11, with the
+ * QSBR flavor API of liburcu
+ */
+
+#ifndef __ZORO_LINUX_RCUPDATE_H__
+#define __ZORO_LINUX_RCUPDATE_H__
+
+#include <zoro/atomic.h>
+#include <zoro/compiler.h>
+#include <zoro/epoch.h>
+#include <zoro/linux/rwonce.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pointers read by RCU readers; only an annotation, as in the kernel */
+#ifndef __rcu
+#define __rcu
+#endif
+
+/*
+ * Callback head, embedded in the objects to free with call_rcu(): it is the
+ * one of the epochs, under the name of the kernel
+ */
+#define rcu_head zoroepoch_head
+
+/**
+ * @brief Enter an RCU read section; read sections can nest.
+ */
+static inline void rcu_read_lock(void)
+{
+	zoroepoch_enter();
+}
+
+/**
+ * @brief Exit an RCU read section.
+ */
+static inline void rcu_read_unlock(void)
+{
+	zoroepoch_exit();
+}
+
+/**
+ * @brief Wait for the RCU read sections in progress to exit: the objects
+ *        unlinked before the call can be freed on return. It must not be
+ *        called within a read section.
+ */
+static inline void synchronize_rcu(void)
+{
+	zoroepoch_synchronize();
+}
+
+/**
+ * @brief Have @a func called on @a head after a grace period, e.g. to free
+ *        the object @a head is embedded in. It must not be called within a
+ *        read section.
+ *
+ * @param head          the rcu_head embedded in the object
+ * @param func          the callback, which finds the object with
+ *                      container_of()
+ */
+static inline void call_rcu(struct rcu_head *head,
+			    void (*func)(struct rcu_head *head))
+{
+	zoroepoch_call(head, func);
+}
+
+/**
+ * @brief Wait for all the callbacks queued by call_rcu() to run.
+ */
+static inline void rcu_barrier(void)
+{
+	zoroepoch_barrier();
+}
+
+/**
+ * @brief Have the calling thread read with no cost at all, see
+ *        zoroepoch_qsbr_online(); it must then call rcu_quiescent_state()
+ *        periodically.
+ */
+static inline void rcu_thread_online(void)
+{
+	zoroepoch_qsbr_online();
+}
+
+/**
+ * @brief Go back to announced read sections, before blocking for long.
+ */
+static inline void rcu_thread_offline(void)
+{
+	zoroepoch_qsbr_offline();
+}
+
+/**
+ * @brief Report that an online thread holds no RCU protected reference.
+ */
+static inline void rcu_quiescent_state(void)
+{
+	zoroepoch_quiescent();
+}
+
+/**
+ * @brief Fetch an RCU protected pointer, to dereference within a read
+ *        section. It relies on the address dependency of the accesses
+ *        through the pointer, which all the supported CPUs order.
+ *
+ * @param p             the pointer to read
+ */
+#define rcu_dereference(p)	READ_ONCE(p)
+
+/* Same as rcu_dereference(), with no checks in the kernel either */
+#define rcu_dereference_raw(p)	READ_ONCE(p)
+
+/**
+ * @brief Fetch an RCU protected pointer, not to dereference it: e.g. to
+ *        compare it against NULL, outside of read sections too.
+ *
+ * @param p             the pointer to read
+ */
+#define rcu_access_pointer(p)	READ_ONCE(p)
+
+/**
+ * @brief Fetch an RCU protected pointer where it cannot change, e.g. by the
+ *        writers, under their lock.
+ *
+ * @param p             the pointer to read
+ * @param c             the condition under which it cannot change; only
+ *                      documentation
+ */
+#define rcu_dereference_protected(p, c)	(p)
+
+/**
+ * @brief Publish the object @a v through the RCU protected pointer @a p:
+ *        readers finding it through @a p see it initialized.
+ *
+ * @param p             the pointer to assign to
+ * @param v             the value to assign
+ */
+#define rcu_assign_pointer(p, v)	smp_store_release(&(p), (v))
+
+/**
+ * @brief Assign to an RCU protected pointer with no ordering: to NULL, or
+ *        while no reader can access it.
+ *
+ * @param p             the pointer to assign to
+ * @param v             the value to assign
+ */
+#define RCU_INIT_POINTER(p, v)		WRITE_ONCE(p, v)
+
+/**
+ * @brief Replace the RCU protected pointer @a p with @a v, and return its
+ *        old value, to free after a grace period.
+ *
+ * @param p             the pointer to replace
+ * @param v             the new value
+ * @param c             the condition under which @a p cannot change
+ *                      otherwise; only documentation
+ */
+#define rcu_replace_pointer(p, v, c) ({					\
+	typeof(p) __rcu_old = rcu_dereference_protected((p), (c));	\
+	rcu_assign_pointer((p), (v));					\
+	__rcu_old;							\
+})
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZORO_LINUX_RCUPDATE_H__ */
@@ -10,6 +10,7 @@
 
 #pragma once
 #ifndef __ZORO_LOG_H__
+#define __ZORO_LOG_H__
 
 /*
  * To customize zorolog you may work on the following defines. Note that
@@ -24,6 +25,13 @@
     #define ZOROLOG_BACKTRACE_SIZE 100
 #endif
 
+/*
+ * By default ZOROLOG_PRINT_TIME and ZOROLOG_PRINT_DATE read the cached clock
+ * of zoro/clock.h, which is CLOCK_MONOTONIC/CLOCK_REALTIME based. Define
+ * ZOROLOG_NO_CACHED_CLOCK to call clock_gettime() on every log line instead,
+ * with the clocks selected below.
+ */
+
 #ifndef ZOROLOG_DATE_CLOCK_TYPE
     /**
      * @brief Needs to be set to either CLOCK_REALTIME or 
@@ -70,21 +78,101 @@
     #define ZOROLOG_TIME_RESOLUTION 3
 #endif
 
+#ifndef ZOROLOG_MIN_LEVEL
+    /**
+     * @brief Calls of a lower level compile away entirely: set it to one of
+     * ZOROLOG_LEVEL_DEBUG, ZOROLOG_LEVEL_VERBOSE, ZOROLOG_LEVEL_INFO,
+     * ZOROLOG_LEVEL_WARNING or ZOROLOG_LEVEL_ERROR.
+     * Default is ZOROLOG_LEVEL_VERBOSE with NDEBUG, ZOROLOG_LEVEL_DEBUG
+     * otherwise.
+     */
+    #ifdef NDEBUG
+        #define ZOROLOG_MIN_LEVEL ZOROLOG_LEVEL_VERBOSE
+    #else
+        #define ZOROLOG_MIN_LEVEL ZOROLOG_LEVEL_DEBUG
+    #endif
+#endif
+
+#ifndef ZOROLOG_CATEGORY
+    /**
+     * @brief Category, between 0 and 63, of the calls of a translation unit.
+     * Define it before including this header to filter a module at runtime on
+     * its own (see zorolog_set_level()).
+     */
+    #define ZOROLOG_CATEGORY 0
+#endif
+
+#ifndef ZOROLOG_RATELIMIT_INTERVAL_MS
+    /**
+     * @brief Default window of the *_ratelimited() calls, in milliseconds.
+     */
+    #define ZOROLOG_RATELIMIT_INTERVAL_MS 5000
+#endif
+
+#ifndef ZOROLOG_RATELIMIT_BURST
+    /**
+     * @brief Default number of messages each *_ratelimited() call site can
+     * print over a window.
+     */
+    #define ZOROLOG_RATELIMIT_BURST 10
+#endif
+
 /* ======= Configuration end: do not make change below this line ======= */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <alloca.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <zoro/compiler.h>
 
 #if defined(ZOROLOG_PRINT_TIME) || defined(ZOROLOG_PRINT_DATE)
 /* Note that to use this function you must link with -lrt */
-#include <time.h>
 #if _POSIX_C_SOURCE < 199309L
 #error "_POSIX_C_SOURCE too old to build with ZOROLOG_PRINT_TIME/DATE defined"
 #endif
+#ifndef ZOROLOG_NO_CACHED_CLOCK
+#include <zoro/clock.h>
+#endif
+#endif
+
+/*
+ * Define ZOROLOG_ASYNC to have the zorolog_* macros append their records to
+ * the asynchronous backend ring buffer (see zorolog_async_start()) instead of
+ * writing them synchronously.
+ */
+#if defined(ZOROLOG_ASYNC) && !defined(zoro_fprintf)
+#define zoro_fprintf zorolog_async_fprintf
+#endif
+
+/*
+ * Define ZOROLOG_TLS_BUFFER to have every thread collect its records in its
+ * own buffers, written out with a single system call on flush (see
+ * zorolog_tls_setup()).
+ */
+#if defined(ZOROLOG_TLS_BUFFER)
+#if defined(ZOROLOG_ASYNC)
+#error "ZOROLOG_TLS_BUFFER and ZOROLOG_ASYNC are mutually exclusive"
+#endif
+#ifndef zoro_fprintf
+#define zoro_fprintf zorolog_tls_fprintf
+#endif
+#endif
+
+/*
+ * Define ZOROLOG_MMAP to have the zorolog_* macros copy their records into a
+ * memory mapped log file, with no system call (see zorolog_mmap_start()).
+ */
+#if defined(ZOROLOG_MMAP)
+#if defined(ZOROLOG_ASYNC) || defined(ZOROLOG_TLS_BUFFER)
+#error "ZOROLOG_MMAP, ZOROLOG_ASYNC and ZOROLOG_TLS_BUFFER are mutually exclusive"
+#endif
+#ifndef zoro_fprintf
+#define zoro_fprintf zorolog_mmap_fprintf
+#endif
 #endif
 
 #ifndef zoro_fprintf
@@ -107,10 +195,85 @@
 extern "C" {
 #endif
 
+#define ZOROLOG_LEVEL_DEBUG	0
+#define ZOROLOG_LEVEL_VERBOSE	1
+#define ZOROLOG_LEVEL_INFO	2
+#define ZOROLOG_LEVEL_WARNING	3
+#define ZOROLOG_LEVEL_ERROR	4
+#define ZOROLOG_LEVELS		5
+
+#define ZOROLOG_CATEGORY_MASK	(1ULL << (ZOROLOG_CATEGORY))
+#define ZOROLOG_ALL_CATEGORIES	(~0ULL)
+
+#if ZOROLOG_MIN_LEVEL > ZOROLOG_LEVEL_ERROR
+#error "ZOROLOG_MIN_LEVEL cannot be higher than ZOROLOG_LEVEL_ERROR"
+#endif
+
+/* Whether the calls of a level are built at all */
+#ifdef NDEBUG
+#define __ZOROLOG_BUILD_DEBUG	0
+#else
+#define __ZOROLOG_BUILD_DEBUG	(ZOROLOG_LEVEL_DEBUG >= ZOROLOG_MIN_LEVEL)
+#endif
+#define __ZOROLOG_BUILD_VERBOSE	(ZOROLOG_LEVEL_VERBOSE >= ZOROLOG_MIN_LEVEL)
+#define __ZOROLOG_BUILD_INFO	(ZOROLOG_LEVEL_INFO >= ZOROLOG_MIN_LEVEL)
+#define __ZOROLOG_BUILD_WARNING	(ZOROLOG_LEVEL_WARNING >= ZOROLOG_MIN_LEVEL)
+#define __ZOROLOG_BUILD_ERROR	1
+
+/*
+ * For each level, the mask of the categories whose calls are enabled; read
+ * with a single relaxed load per call.
+ */
+extern uint64_t __zorolog_masks[ZOROLOG_LEVELS];
+
+/**
+ * @brief Test whether calls of @a level are enabled for any of the
+ *        categories in @a cats.
+ */
+static inline int zorolog_enabled(int level, uint64_t cats)
+{
+	return !!(__atomic_load_n(&__zorolog_masks[level], __ATOMIC_RELAXED) &
+		  cats);
+}
+
+/**
+ * @fn void zorolog_set_level(int category, int level)
+ * @brief Enable the calls of @a category from @a level up, and disable the
+ *        lower ones. Calls compiled away by ZOROLOG_MIN_LEVEL stay disabled.
+ *
+ * @param category The category, or -1 for all of them
+ * @param level    One of the ZOROLOG_LEVEL_* values
+ */
+void zorolog_set_level(int category, int level);
+
+/**
+ * @fn void zorolog_set_mask(int level, uint64_t mask)
+ * @brief Set the mask of the categories enabled for @a level.
+ */
+void zorolog_set_mask(int level, uint64_t mask);
+
+/**
+ * @fn uint64_t zorolog_get_mask(int level)
+ * @brief Get the mask of the categories enabled for @a level.
+ */
+uint64_t zorolog_get_mask(int level);
+
+/**
+ * @fn int zorolog_level_signal(int signo)
+ * @brief Install a handler of @a signo that enables all the levels of all
+ *        the categories, and restores the previous masks on the next
+ *        delivery; e.g. <tt>kill -USR1 pid</tt> to get the verbose output of
+ *        a running process.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zorolog_level_signal(int signo);
+
 #define ZOROLOG_DUP_STDOUT	0x1
 #define ZOROLOG_DUP_STDERR	0x2
 
 #define ZOROLOG_APPEND		0x1
+#define ZOROLOG_DUP_THREAD	0x2
 
 /**
  * @fn int zorolog_duplicate(const char *logfile, uint8_t stds, int flags)
@@ -118,19 +281,240 @@ extern "C" {
  *        to a log file. What is written to the standards is actually 
  *        maintained; only a copy is written to the log file.
  *
+ * By default the copy is done by a forked logger process. With
+ * ZOROLOG_DUP_THREAD it is done by a thread of the calling process instead;
+ * at exit, the standards are restored once everything written so far reached
+ * the log file. Children forked meanwhile do not delay the exit, but their
+ * duplicated standards have no reader afterwards (writes fail with EPIPE).
+ * Only one thread mode duplication can be active at a time.
+ *
  * @param logfile The filepath of the log file
  * @param stds Flag to specify standards to duplicate; use ZOROLOG_DUP_STDOUT
  *             and/or ZOROLOG_DUP_STDERR
- * @param flags Writing type flag (append or overwrite)
+ * @param flags Writing type flag (ZOROLOG_APPEND to append rather than
+ *              overwrite), optionally ORed with ZOROLOG_DUP_THREAD
  *
- * @return -1 if some error occurred; 0 otherwise.
+ * @return -1 if some error occurred; -EBUSY if a thread mode duplication is
+ *         already active; 0 otherwise.
  */
 int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
 
+/**
+ * @fn int zorolog_duplicate_setup(size_t pipe_size, size_t buffer_size)
+ * @brief Configure the next zorolog_duplicate() calls.
+ *
+ * @param pipe_size   Capacity of the pipes standing in for the standards, so
+ *                    that bursts of output do not block the writers; it is
+ *                    capped by /proc/sys/fs/pipe-max-size. Use 0 to keep the
+ *                    system default (usually 64 KiB).
+ * @param buffer_size Size of the logger copy buffer, which is also the max
+ *                    number of bytes moved per system call; at least 4096.
+ *                    Use 0 for the default (64 KiB).
+ *
+ * @return 0 on success; -EINVAL on invalid sizes.
+ */
+int zorolog_duplicate_setup(size_t pipe_size, size_t buffer_size);
+
+/* zorolog_duplicate_rotation() flags */
+#define ZOROLOG_ROTATE_COMPRESS	0x1
+
+/**
+ * @fn int zorolog_duplicate_rotation(size_t max_size, unsigned int max_sec,
+ *                                    unsigned int keep, int flags)
+ * @brief Have the logger of the next zorolog_duplicate() calls rotate the log
+ *        file, once it reaches @a max_size bytes or is @a max_sec seconds
+ *        old.
+ *
+ * The log file is renamed to <tt>logfile.YYYYmmdd-HHMMSS</tt>, and a new one
+ * takes its name: the switch does not copy anything, nor does it block the
+ * writers, since the new file is created ahead of time by a helper thread
+ * of the logger (as <tt>logfile.next</tt>). With @a max_size, each file is
+ * preallocated to that size with fallocate(2), so that appending never waits
+ * for the filesystem to allocate extents; the unused space is released once
+ * the file is rotated.
+ *
+ * @param max_size Size that triggers a rotation; 0 for no size limit
+ * @param max_sec  Age that triggers a rotation; 0 for no time limit
+ * @param keep     Number of rotated segments to keep; 0 to keep them all
+ * @param flags    ZOROLOG_ROTATE_COMPRESS to gzip the rotated segments, in
+ *                 the background
+ *
+ * @return 0 on success; -EINVAL on invalid flags.
+ */
+int zorolog_duplicate_rotation(size_t max_size, unsigned int max_sec,
+			       unsigned int keep, int flags);
+
+#define ZOROLOG_ASYNC_DROP	0x1
+#define ZOROLOG_ASYNC_URING	0x2
+#define ZOROLOG_ASYNC_WORKQUEUE	0x4
+
+/**
+ * @fn int zorolog_async_start(size_t slots, int flags)
+ * @brief Start the asynchronous log backend.
+ *
+ * Records passed to zorolog_async_fprintf() are formatted by the caller into
+ * a lock-free MPSC ring buffer and written out in batches by a dedicated drain
+ * thread. Until the backend is started (and after it is stopped)
+ * zorolog_async_fprintf() behaves like fprintf().
+ * The drain thread is stopped, and the ring flushed, at process exit.
+ *
+ * @param slots Number of records the ring can hold; it must be a power of two.
+ *              Use 0 for the default.
+ * @param flags Use ZOROLOG_ASYNC_DROP to drop (and count) new records when
+ *              the ring is full, rather than waiting for room;
+ *              ZOROLOG_ASYNC_URING to have the drain thread submit its writes
+ *              through io_uring sinks (see zoro/sink.h), when available;
+ *              records alternating between file descriptors then wait for
+ *              the writes of the previous one, to stay in order should both
+ *              be the same file;
+ *              ZOROLOG_ASYNC_WORKQUEUE to drain the ring from a work item of
+ *              zorowq_system() (see zoro/workqueue.h), queued when records
+ *              are published, instead of a dedicated thread. Producers
+ *              waiting for room, flushers and zorolog_async_stop() then
+ *              drain it themselves: they may be work items of that queue
+ *              too.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zorolog_async_start(size_t slots, int flags);
+
+/**
+ * @fn int zorolog_async_flush(void)
+ * @brief Wait until all the records queued so far have been written out.
+ *
+ * @return 0 on success; -EINVAL if the asynchronous backend is not running.
+ */
+int zorolog_async_flush(void);
+
+/**
+ * @fn void zorolog_async_stop(void)
+ * @brief Flush the ring, stop the drain thread and go back to synchronous
+ *        logging.
+ */
+void zorolog_async_stop(void);
+
+/**
+ * @fn int zorolog_async_fprintf(FILE *stream, const char *format, ...)
+ * @brief fprintf() replacement queuing the record to the asynchronous backend.
+ *
+ * The record is written to the file descriptor underlying @a stream, therefore
+ * bypassing its stdio buffer.
+ *
+ * @return The number of characters of the record.
+ */
+int zorolog_async_fprintf(FILE *stream, const char *format, ...)
+		__attribute__((format(printf, 2, 3)));
+
+/**
+ * @fn int zorolog_tls_setup(size_t size, unsigned int lines, unsigned int msec)
+ * @brief Configure the per-thread log buffers.
+ *
+ * A thread buffer is flushed when it gets full, when it holds @a lines lines,
+ * when its oldest record is older than @a msec milliseconds (checked when a
+ * new record is appended), or when the thread exits. All the buffers are also
+ * flushed at process exit.
+ *
+ * @param size  Size of each buffer in bytes, applied to threads which did not
+ *              log yet; use 0 for the default (4 KiB)
+ * @param lines Line count flush trigger; 0 to disable it
+ * @param msec  Age flush trigger; 0 to disable it
+ *
+ * @return 0 on success; -EINVAL if @a size is too small.
+ */
+int zorolog_tls_setup(size_t size, unsigned int lines, unsigned int msec);
+
+/**
+ * @fn void zorolog_tls_flush(void)
+ * @brief Flush the buffers of the calling thread.
+ */
+void zorolog_tls_flush(void);
+
+/**
+ * @fn void zorolog_tls_flush_all(void)
+ * @brief Flush the buffers of all the threads, i.e. from a periodic timer to
+ *        bound the latency of idle threads records.
+ */
+void zorolog_tls_flush_all(void);
+
+/**
+ * @fn int zorolog_tls_fprintf(FILE *stream, const char *format, ...)
+ * @brief fprintf() replacement appending the record to a per-thread buffer.
+ *
+ * The buffer is written to the file descriptor underlying @a stream, therefore
+ * bypassing its stdio buffer.
+ *
+ * @return The number of characters of the record.
+ */
+int zorolog_tls_fprintf(FILE *stream, const char *format, ...)
+		__attribute__((format(printf, 2, 3)));
+
+/* Wait for the records to reach the disk on every tick, see below */
+#define ZOROLOG_MMAP_SYNC	0x1
+
+/**
+ * @fn int zorolog_mmap_start(const char *path, size_t size, int flags)
+ * @brief Start the memory mapped log backend.
+ *
+ * Records passed to zorolog_mmap_fprintf() are copied into segments of a log
+ * file, preallocated and mapped in memory: threads reserve room with a
+ * single atomic fetch-add and copy their record there, with no lock and no
+ * system call. A background thread maps the next segments ahead of time,
+ * and writes back and drops from memory the records behind, every 100 ms.
+ *
+ * Segments are named @a path.NNNNNN, numbered after the ones already there,
+ * which are never overwritten. A record may straddle two segments: their
+ * concatenation (e.g. with cat) is the log. Since the segments are shared
+ * memory, records copied survive a crash of the process, as a flight
+ * recorder; the last segment then ends with zero bytes, instead of being
+ * trimmed, and the ones mapped ahead are left empty. Until the backend is
+ * started (and after it is stopped) zorolog_mmap_fprintf() behaves like
+ * fprintf(). The backend is stopped at process exit.
+ *
+ * @param path  Prefix of the segment files
+ * @param size  Size of a segment, rounded up to pages; use 0 for the default
+ *              (16 MiB). Up to three segments are mapped at once.
+ * @param flags Use ZOROLOG_MMAP_SYNC to have the background thread wait for
+ *              the records to reach the disk, rather than only starting
+ *              their writeback, so that they survive a crash of the system
+ *              too, within a tick.
+ *
+ * @return 0 on success; a negative errno value otherwise, e.g. if the first
+ *         segment cannot be created.
+ */
+int zorolog_mmap_start(const char *path, size_t size, int flags);
+
+/**
+ * @fn int zorolog_mmap_flush(void)
+ * @brief Wait until the records logged so far have reached the disk.
+ *
+ * @return 0 on success; -EINVAL if the memory mapped backend is not running;
+ *         another negative errno value if writing back failed.
+ */
+int zorolog_mmap_flush(void);
+
+/**
+ * @fn void zorolog_mmap_stop(void)
+ * @brief Trim and close the last segment, stop the background thread and go
+ *        back to synchronous logging.
+ */
+void zorolog_mmap_stop(void);
+
+/**
+ * @fn int zorolog_mmap_fprintf(FILE *stream, const char *format, ...)
+ * @brief fprintf() replacement copying the record into the memory mapped log.
+ *
+ * The records of every stream go to the same log; @a stream is only used
+ * when the backend is not running.
+ *
+ * @return The number of characters of the record.
+ */
+int zorolog_mmap_fprintf(FILE *stream, const char *format, ...)
+		__attribute__((format(printf, 2, 3)));
+
 /**
  * @brief Print backtrace to standard error
  */
-#define epylog_print_backtrace() do {                           \
+#define zorolog_print_backtrace() do {                          \
     int __ret;                                                  \
     void *__bt_buff[ZOROLOG_BACKTRACE_SIZE];                    \
     __ret = backtrace(__bt_buff, ZOROLOG_BACKTRACE_SIZE);       \
@@ -143,6 +527,9 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
     backtrace_symbols_fd(__bt_buff, __ret, STDERR_FILENO);      \
 } while (0)
 
+/* Old name, still supported */
+#define epylog_print_backtrace() zorolog_print_backtrace()
+
 #if ZOROLOG_TIME_RESOLUTION==0
 #undef ZOROLOG_TIME_NSEC_DIV
 #elif ZOROLOG_TIME_RESOLUTION==1
@@ -170,28 +557,42 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
 
 #ifdef ZOROLOG_PRINT_TIME
 
+#ifdef ZOROLOG_NO_CACHED_CLOCK
 #define ZOROLOG_TD_INIT \
     struct timespec __tdts; \
     clock_gettime(ZOROLOG_TIME_CLOCK_TYPE, &__tdts);
+#else
+#define ZOROLOG_TD_INIT \
+    struct timespec __tdts; \
+    zorolog_clock_gettime(&__tdts);
+#endif
 
 #if ZOROLOG_TIME_RESOLUTION==0
     #define ZOROLOG_TD_FORMAT "[%"__stringify(ZOROLOG_TIME_SEC_DIGITS)"lu] "
-    #define ZOROLOG_TD_ARGS ,__tdts.tv_sec &((1<<ZOROZOROLOG_TIME_SEC_BITS)-1)
+    #define ZOROLOG_TD_ARGS ,(unsigned long)__tdts.tv_sec & \
+                ((1UL<<ZOROLOG_TIME_SEC_BITS)-1)
 #else
     #define ZOROLOG_TD_FORMAT "[%"__stringify(ZOROLOG_TIME_SEC_DIGITS) \
-                "lu.%0"__stringify(ZOROLOG_TIMEZOROLOG_TIME_RESOLUTION)"lu] "
-    #define ZOROLOG_TD_ARGS ,__tdts.tv_sec &((1<<ZOROZOROLOG_TIME_SEC_BITS)-1), \
-                __tdts.tv_nsec/ZOROZOROLOG_TIME_NSEC_DIV
+                "lu.%0"__stringify(ZOROLOG_TIME_RESOLUTION)"lu] "
+    #define ZOROLOG_TD_ARGS ,(unsigned long)__tdts.tv_sec & \
+                ((1UL<<ZOROLOG_TIME_SEC_BITS)-1), \
+                (unsigned long)__tdts.tv_nsec/ZOROLOG_TIME_NSEC_DIV
 #endif
 
 #elif defined(ZOROLOG_PRINT_DATE)
 
+#ifdef ZOROLOG_NO_CACHED_CLOCK
 #define ZOROLOG_TD_INIT \
-    struct timespec __tdts;
+    struct timespec __tdts; \
     char __tdstr[26]; /* size got from ctime man page */ \
-    clock_gettime(ZOROZOROLOG_DATE_CLOCK_TYPE, &__tdts); \
+    clock_gettime(ZOROLOG_DATE_CLOCK_TYPE, &__tdts); \
     ctime_r(&__tdts.tv_sec, __tdstr); \
     __tdstr[24] = 0; /*overriding '\n' */
+#else
+#define ZOROLOG_TD_INIT \
+    char __tdstr[ZOROLOG_CLOCK_DATE_LEN + 1]; \
+    zorolog_clock_date(__tdstr);
+#endif
 
 #define ZOROLOG_TD_FORMAT "[%s] "
 #define ZOROLOG_TD_ARGS ,__tdstr
@@ -255,50 +656,111 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
 #define ZOROLOG_ARGS_ERROR
 #endif
 
+/* Levels expected to be mostly disabled are checked behind unlikely() */
+#define __ZOROLOG_HINT_DEBUG(_x)    unlikely(_x)
+#define __ZOROLOG_HINT_VERBOSE(_x)  unlikely(_x)
+#define __ZOROLOG_HINT_INFO(_x)     likely(_x)
+#define __ZOROLOG_HINT_WARNING(_x)  likely(_x)
+#define __ZOROLOG_HINT_ERROR(_x)    likely(_x)
+
+#define __zorolog_enabled(_level, _cats) \
+    __ZOROLOG_HINT_##_level(zorolog_enabled(ZOROLOG_LEVEL_##_level, (_cats)))
+
+static inline void __attribute__((format(printf, 1, 2)))
+__zorolog_check_format(const char *format, ...)
+{
+	(void)format;
+}
+
+/* A call compiled away: arguments are type checked, never evaluated */
+#define __zorolog_discard(_format, args...) ({     \
+    if (0)                                          \
+        __zorolog_check_format(_format, ##args);    \
+    0; })
+
 /* Begin functions */
-#define __zorolog_print(_level, _format, args...) ({ \
-    int __r;            \
-    ZOROLOG_TD_INIT     \
-    __r = zoro_fprintf(ZOROLOG_STREAM_##_level,  \
-        ZOROLOG_TD_FORMAT                       \
-        ZOROLOG_FORMAT_##_level                 \
-        _format                                 \
-        ZOROLOG_TD_ARGS                         \
-        ZOROLOG_ARGS_##_level,                  \
-        ##args);                                \
+#define __zorolog_print_cats(_level, _cats, _format, args...) ({ \
+    int __r = 0;        \
+    if (__zorolog_enabled(_level, _cats)) {     \
+        ZOROLOG_TD_INIT \
+        __r = zoro_fprintf(ZOROLOG_STREAM_##_level,  \
+            ZOROLOG_TD_FORMAT                       \
+            ZOROLOG_FORMAT_##_level                 \
+            _format                                 \
+            ZOROLOG_TD_ARGS                         \
+            ZOROLOG_ARGS_##_level,                  \
+            ##args);                                \
+    }                   \
+    __r;})
+
+#define __zorolog_continue_cats(_level, _cats, _format, args...) ({ \
+    int __r = 0;        \
+    if (__zorolog_enabled(_level, _cats))       \
+        __r = zoro_fprintf(ZOROLOG_STREAM_##_level, _format, ##args); \
     __r;})
 
+#define __zorolog_print(_level, _format, args...) \
+    __zorolog_print_cats(_level, ZOROLOG_CATEGORY_MASK, _format, ##args)
+
 #define __zorolog_continue(_level, _format, args...) \
-            zoro_fprintf(ZOROLOG_STREAM_##_level, _format, ##args)
-
-#ifndef ZOROLOG_VERBOSE
-    #define DEFINE_ZOROLOG_VERBOSE(_x)
-    #define epylog_set_verbose(_x) do {} while(0)
-    #define epylog_verbose_enabled(_x) (0)
-    #define epylog_verbose(_mask, _format, args...) do {} while(0)
-    #define epylog_verbose_continue(_mask, _format, args...) do {} while(0)
+    __zorolog_continue_cats(_level, ZOROLOG_CATEGORY_MASK, _format, ##args)
+
+/**
+ * @brief Set the initial verbose mask, i.e. the categories whose verbose
+ *        calls are enabled at startup; use it once, at file scope.
+ */
+#define DEFINE_ZOROLOG_VERBOSE(_x)                                      \
+    static void __attribute__((constructor)) __zorolog_verbose_init(void) \
+    {                                                                   \
+        zorolog_set_mask(ZOROLOG_LEVEL_VERBOSE, (_x));                  \
+    }
+
+/**
+ * @brief Set the verbose mask, i.e. the categories whose verbose calls are
+ *        enabled.
+ */
+#define zorolog_set_verbose(_x) zorolog_set_mask(ZOROLOG_LEVEL_VERBOSE, (_x))
+
+/**
+ * @brief Test whether the verbose calls of any category in @a _x are enabled.
+ */
+#define zorolog_verbose_enabled(_x) \
+    __zorolog_enabled(VERBOSE, (_x))
+
+#if ZOROLOG_LEVEL_VERBOSE >= ZOROLOG_MIN_LEVEL
+    /**
+     * @brief Log a VERBOSE level message, if any of the categories in
+     *        @a _mask is enabled.
+     *
+     * @param _mask     Categories mask
+     * @param _format   Format string
+     * @param args      Extra arguments
+     *
+     * @return          0 on Success; a value different from zero otherwise.
+     */
+    #define zorolog_verbose(_mask, _format, args...) \
+                __zorolog_print_cats(VERBOSE, (_mask), _format, ##args)
+
+    /**
+     * @brief Log a VERBOSE level message without log prefixes.
+     *
+     * @param _mask     Categories mask
+     * @param _format   Format string
+     * @param args      Extra arguments
+     *
+     * @return          0 on Success; a value different from zero otherwise.
+     */
+    #define zorolog_verbose_continue(_mask, _format, args...) \
+                __zorolog_continue_cats(VERBOSE, (_mask), _format, ##args)
 #else
-    extern unsigned long __zorolog_verbose;
-    #define DEFINE_ZOROLOG_VERBOSE(_x) unsigned long __zorolog_verbose__ = (_x)
-    #define epylog_set_verbose(_x) (__zorolog_verbose__ = (_x))
-    #define epylog_verbose_enabled(_x) ((_x) & __zorolog_verbose__)
-    #define epylog_verbose(_mask, _format, args...) ({       \
-        int __r;                                             \
-        if (zorolog_verbose_enabled(_mask))                  \
-            __r = __zorolog_print(VERBOSE, _format, ##args); \
-        else                                                 \
-            __r = 0;                                         \
-        __r; })
-    #define epylog_verbose_continue(_mask, _format, args...) ({     \
-        int __r;                                                    \
-        if (epylepylog_verbose_enabled(_mask))                      \
-            __r = __epylog_continue(VERBOSE, _format, ##args);      \
-        else                                                        \
-            __r = 0;                                                \
-        __r; })
+    #define zorolog_verbose(_mask, _format, args...) \
+                __zorolog_discard(_format, ##args)
+    #define zorolog_verbose_continue(_mask, _format, args...) \
+                __zorolog_discard(_format, ##args)
 #endif
 
 
+#if ZOROLOG_LEVEL_INFO >= ZOROLOG_MIN_LEVEL
 /**
  * @brief Log an INFO level message.
  *
@@ -319,7 +781,13 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
  */
 #define zorolog_info_continue(_format, args...) \
             __zorolog_continue(INFO, _format, ##args)
+#else
+#define zorolog_info(_format, args...) __zorolog_discard(_format, ##args)
+#define zorolog_info_continue(_format, args...) \
+            __zorolog_discard(_format, ##args)
+#endif
 
+#if ZOROLOG_LEVEL_WARNING >= ZOROLOG_MIN_LEVEL
 /**
  * @brief Log a WARNING level message.
  *
@@ -341,6 +809,11 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
  */
 #define zorolog_warning_continue(_format, args...) \
             __zorolog_continue(WARNING, _format, ##args)
+#else
+#define zorolog_warning(_format, args...) __zorolog_discard(_format, ##args)
+#define zorolog_warning_continue(_format, args...) \
+            __zorolog_discard(_format, ##args)
+#endif
 
 /**
  * @brief Log an ERROR level message.
@@ -363,10 +836,7 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
 #define zorolog_error_continue(_format, args...) \
             __zorolog_continue(ERROR, _format, ##args)
 
-#ifdef NDEBUG
-    #define epylog_debug(_format, args...)               do {} while (0)
-    #define epylog_debug_continue(_format, args...)      do {} while (0)
-#else
+#if ZOROLOG_LEVEL_DEBUG >= ZOROLOG_MIN_LEVEL && !defined(NDEBUG)
     /**
      * @brief Log a DEBUG level message.
      *
@@ -388,8 +858,23 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
      */
     #define zorolog_debug_continue(_format, args...) \
                 __zorolog_continue(DEBUG, _format, ##args)
+#else
+    #define zorolog_debug(_format, args...) __zorolog_discard(_format, ##args)
+    #define zorolog_debug_continue(_format, args...) \
+                __zorolog_discard(_format, ##args)
 #endif
 
+/* Old names, still supported */
+#define epylog_set_verbose(_x) zorolog_set_verbose(_x)
+#define epylog_verbose_enabled(_x) zorolog_verbose_enabled(_x)
+#define epylog_verbose(_mask, _format, args...) \
+            zorolog_verbose(_mask, _format, ##args)
+#define epylog_verbose_continue(_mask, _format, args...) \
+            zorolog_verbose_continue(_mask, _format, ##args)
+#define epylog_debug(_format, args...) zorolog_debug(_format, ##args)
+#define epylog_debug_continue(_format, args...) \
+            zorolog_debug_continue(_format, ##args)
+
 /**
  * @brief Call zorolog_error() and then exit with error.
  *
@@ -426,6 +911,216 @@ int zorolog_duplicate(const char *logfile, uint8_t stds, int flags);
     exit(EXIT_FAILURE);                                 \
 } while(0)
 
+/**
+ * @brief Rate limit state, as a token bucket: up to @c burst messages can
+ *        go through at once, then one every <tt>interval / burst</tt>.
+ *
+ * It is kept as the time at which the bucket would be full again (i.e. the
+ * generic cell rate algorithm), so a single compare and swap updates it.
+ *
+ * On the first suppression, the state is handed to a reporter thread that
+ * prints how many messages were suppressed whenever an interval rolls over,
+ * and once more at exit; the tail of the state is its own.
+ */
+struct zorolog_ratelimit {
+	uint64_t tat;
+	uint64_t missed;
+	uint64_t interval_ns;
+	uint32_t burst;
+
+	char *prefix;
+	FILE *stream;
+	int (*print)(FILE *, const char *, ...);
+	uint64_t reported;
+	struct zorolog_ratelimit *next;
+};
+
+#define ZOROLOG_RATELIMIT_INIT(_interval_ms, _burst) {	\
+	.tat = 0,					\
+	.missed = 0,					\
+	.interval_ns = (_interval_ms) * 1000000ULL,	\
+	.burst = (_burst),				\
+}
+
+/**
+ * @brief Define a rate limit state @a _name, to be shared among call sites.
+ */
+#define DEFINE_ZOROLOG_RATELIMIT(_name, _interval_ms, _burst) \
+	struct zorolog_ratelimit _name = ZOROLOG_RATELIMIT_INIT(_interval_ms, _burst)
+
+static inline uint64_t __zorolog_ratelimit_now(void)
+{
+	struct timespec ts;
+
+	/* Tick resolution is plenty, and the vDSO never enters the kernel */
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Take a token from @a rs; lock free.
+ *
+ * @return 1 if the message can go through; 0 if it must be suppressed, in
+ *         which case it is accounted in @c rs->missed.
+ */
+static inline int zorolog_ratelimit(struct zorolog_ratelimit *rs)
+{
+	uint64_t now, tat, next, step;
+
+	if (!rs->burst)
+		return 1;
+	step = rs->interval_ns / rs->burst;
+	now = __zorolog_ratelimit_now();
+	tat = __atomic_load_n(&rs->tat, __ATOMIC_RELAXED);
+	do {
+		next = (tat > now ? tat : now) + step;
+		if (next > now + rs->interval_ns) {
+			__atomic_fetch_add(&rs->missed, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&rs->tat, &tat, next, 1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+	return 1;
+}
+
+extern int __zorolog_ratelimit_reporting;
+
+void __zorolog_ratelimit_register(struct zorolog_ratelimit *rs, FILE *stream,
+				  int (*print)(FILE *, const char *, ...),
+				  const char *format, ...);
+
+/*
+ * Make sure the reporter thread sums up the messages suppressed in _rs, with
+ * the prefix of the first _level call site that suppresses one (and again
+ * in a child, which does not inherit the thread).
+ */
+#define __zorolog_ratelimit_track(_level, _rs) do {                    \
+    if (unlikely(!__atomic_load_n(&(_rs)->prefix, __ATOMIC_ACQUIRE) ||  \
+                 !__atomic_load_n(&__zorolog_ratelimit_reporting,       \
+                                  __ATOMIC_RELAXED)))                   \
+        __zorolog_ratelimit_register((_rs), ZOROLOG_STREAM_##_level,    \
+                                     zoro_fprintf,                      \
+                                     "" ZOROLOG_FORMAT_##_level         \
+                                     ZOROLOG_ARGS_##_level);            \
+} while (0)
+
+/*
+ * Run _print if a token of _rs is available, first reporting how many
+ * messages were suppressed since the last one went through. errno is
+ * preserved for the *syserror() calls.
+ */
+#define __zorolog_ratelimited(_level, _rs, _print) ({                  \
+    int __r = 0;                                                        \
+    int __zrl_errno = errno;                                            \
+    unsigned long __zrl_missed;                                         \
+    if (__ZOROLOG_BUILD_##_level &&                                     \
+        __zorolog_enabled(_level, ZOROLOG_CATEGORY_MASK)) {             \
+        if (zorolog_ratelimit(_rs)) {                                   \
+            __zrl_missed = __atomic_exchange_n(&(_rs)->missed, 0,       \
+                                               __ATOMIC_RELAXED);       \
+            if (unlikely(__zrl_missed)) {                               \
+                __zorolog_print(_level, "%lu messages suppressed\n",    \
+                                __zrl_missed);                          \
+                errno = __zrl_errno;                                    \
+            }                                                           \
+            __r = (_print);                                             \
+        } else {                                                        \
+            __zorolog_ratelimit_track(_level, _rs);                     \
+        }                                                               \
+    }                                                                   \
+    __r; })
+
+#define __zorolog_ratelimited_site(_level, _print) ({                  \
+    static struct zorolog_ratelimit __zrs = ZOROLOG_RATELIMIT_INIT(     \
+        ZOROLOG_RATELIMIT_INTERVAL_MS, ZOROLOG_RATELIMIT_BURST);        \
+    __zorolog_ratelimited(_level, &__zrs, _print); })
+
+/* Run _print once every _n calls, counting the others as suppressed */
+#define __zorolog_sampled(_level, _n, _print) ({                       \
+    static unsigned long __zsc;                                         \
+    static struct zorolog_ratelimit __zrs = ZOROLOG_RATELIMIT_INIT(     \
+        ZOROLOG_RATELIMIT_INTERVAL_MS, 0);                              \
+    int __r = 0;                                                        \
+    if (__ZOROLOG_BUILD_##_level &&                                     \
+        __zorolog_enabled(_level, ZOROLOG_CATEGORY_MASK)) {             \
+        if (__atomic_fetch_add(&__zsc, 1, __ATOMIC_RELAXED) % (_n) == 0) \
+            __r = (_print);                                             \
+        else {                                                          \
+            __atomic_fetch_add(&__zrs.missed, 1, __ATOMIC_RELAXED);     \
+            __zorolog_ratelimit_track(_level, &__zrs);                  \
+        }                                                               \
+    }                                                                   \
+    __r; })
+
+/**
+ * @brief Rate limited zorolog_info(): each call site prints at most
+ *        ZOROLOG_RATELIMIT_BURST messages every
+ *        ZOROLOG_RATELIMIT_INTERVAL_MS; suppressed messages are not
+ *        formatted, and are counted in a summary printed along with the
+ *        next message that goes through, or when the interval rolls over.
+ */
+#define zorolog_info_ratelimited(_format, args...) \
+    __zorolog_ratelimited_site(INFO, __zorolog_print(INFO, _format, ##args))
+
+/**
+ * @brief Rate limited zorolog_warning(); see zorolog_info_ratelimited().
+ */
+#define zorolog_warning_ratelimited(_format, args...) \
+    __zorolog_ratelimited_site(WARNING, \
+                               __zorolog_print(WARNING, _format, ##args))
+
+/**
+ * @brief Rate limited zorolog_error(); see zorolog_info_ratelimited().
+ */
+#define zorolog_error_ratelimited(_format, args...) \
+    __zorolog_ratelimited_site(ERROR, __zorolog_print(ERROR, _format, ##args))
+
+/**
+ * @brief Rate limited zorolog_syserror(); see zorolog_info_ratelimited().
+ */
+#define zorolog_syserror_ratelimited(_format, args...) \
+    __zorolog_ratelimited_site(ERROR, \
+                               ({ zorolog_syserror(_format, ##args); 0; }))
+
+/**
+ * @brief zorolog_error() under the rate limit state @a _rs, shared with
+ *        other call sites (see DEFINE_ZOROLOG_RATELIMIT()); the periodic
+ *        summary names the first one that suppressed a message.
+ */
+#define zorolog_error_ratelimit(_rs, _format, args...) \
+    __zorolog_ratelimited(ERROR, _rs, __zorolog_print(ERROR, _format, ##args))
+
+/**
+ * @brief Sampled zorolog_info(): each call site prints the first message,
+ *        and then one every @a _n; the others are not formatted, and are
+ *        counted in a summary printed every ZOROLOG_RATELIMIT_INTERVAL_MS.
+ */
+#define zorolog_info_sampled(_n, _format, args...) \
+    __zorolog_sampled(INFO, _n, __zorolog_print(INFO, _format, ##args))
+
+/**
+ * @brief Sampled zorolog_warning(); see zorolog_info_sampled().
+ */
+#define zorolog_warning_sampled(_n, _format, args...) \
+    __zorolog_sampled(WARNING, _n, __zorolog_print(WARNING, _format, ##args))
+
+/**
+ * @brief Sampled zorolog_error(); see zorolog_info_sampled().
+ */
+#define zorolog_error_sampled(_n, _format, args...) \
+    __zorolog_sampled(ERROR, _n, __zorolog_print(ERROR, _format, ##args))
+
+/**
+ * @brief Sampled zorolog_syserror(); see zorolog_info_sampled().
+ */
+#define zorolog_syserror_sampled(_n, _format, args...) \
+    __zorolog_sampled(ERROR, _n, ({ zorolog_syserror(_format, ##args); 0; }))
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,179 @@
+/**
+ * @file percpu.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Per-CPU storage: one cache line aligned slot per CPU.
+ *
+ * A @a struct @a zoropercpu holds one slot of a given size per configured
+ * CPU, each in cache lines of its own. zoropercpu_this() returns the slot of
+ * the CPU the calling thread runs on, read from the rseq(2) area glibc
+ * registers for every thread (a plain load), or from sched_getcpu() on older
+ * glibc versions. Threads running at the same time thus write to different
+ * cache lines, whatever their number.
+ *
+ * A thread can be migrated right after finding its slot, and share it for a
+ * while with a thread of the new CPU: updates must be atomic, but they stay
+ * uncontended, and the line stays in the cache of its CPU.
+ *
+ * @code
+ *	struct zoropercpu hits;
+ *	uint64_t sum = 0, *v;
+ *	unsigned int cpu;
+ *
+ *	zoropercpu_init(&hits, sizeof(uint64_t), 0);
+ *	...
+ *	__atomic_fetch_add((uint64_t *)zoropercpu_this(&hits), 1,
+ *			   __ATOMIC_RELAXED);
+ *	...
+ *	zoropercpu_for_each(v, cpu, &hits)
+ *		sum += __atomic_load_n(v, __ATOMIC_RELAXED);
+ * @endcode
+ *
+ * With ZOROPERCPU_THREAD, slots are handed out to threads instead, round
+ * robin on their first use: no CPU number to read, and no sharing as long as
+ * there are fewer threads than CPUs.
+ */
+
+#pragma once
+#ifndef __ZORO_PERCPU_H__
+#define __ZORO_PERCPU_H__
+
+#include <sched.h>
+#include <stddef.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/rwonce.h>
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+#include <sys/rseq.h>
+#define ZOROPERCPU_HAVE_RSEQ 1
+#else
+#define ZOROPERCPU_HAVE_RSEQ 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Index the slots by thread, rather than by CPU */
+#define ZOROPERCPU_THREAD	0x1
+
+struct zoropercpu {
+	char *base;
+	/* Distance between two slots, a multiple of SMP_CACHE_BYTES */
+	size_t stride;
+	unsigned int nr;
+	int flags;
+};
+
+/* Slot of the calling thread with ZOROPERCPU_THREAD, plus 1; 0 if none yet */
+extern __thread unsigned int __zoropercpu_thread;
+
+unsigned int __zoropercpu_cpu_slow(void);
+unsigned int __zoropercpu_thread_slow(void);
+
+/**
+ * @brief Number of the CPU the calling thread runs on.
+ */
+static inline unsigned int zoropercpu_cpu(void)
+{
+#if ZOROPERCPU_HAVE_RSEQ
+	if (likely(__rseq_size)) {
+		const struct rseq *rs = (const struct rseq *)
+			((char *)__builtin_thread_pointer() + __rseq_offset);
+
+		return READ_ONCE(rs->cpu_id);
+	}
+#endif
+	return __zoropercpu_cpu_slow();
+}
+
+/**
+ * @fn unsigned int zoropercpu_nr_cpus(void)
+ * @brief Number of configured CPUs, online or not: the number of slots of
+ *        the per-CPU storages.
+ */
+unsigned int zoropercpu_nr_cpus(void);
+
+/**
+ * @fn size_t zoropercpu_cacheline_size(void)
+ * @brief Size of the L1 data cache lines of the running CPU, as the system
+ *        tells it; ZORO_CACHELINE_SIZE if it does not.
+ *
+ * zoropercpu_init() warns once, on the standard error, if it is bigger than
+ * ZORO_CACHELINE_SIZE: the library should then be built for it.
+ */
+size_t zoropercpu_cacheline_size(void);
+
+/**
+ * @fn int zoropercpu_init(struct zoropercpu *pc, size_t size, int flags)
+ * @brief Allocate zeroed slots of @a size bytes, one per CPU.
+ *
+ * @param pc     The per-CPU storage
+ * @param size   Size of a slot
+ * @param flags  ZOROPERCPU_THREAD; 0 otherwise
+ *
+ * @return 0 on success; -EINVAL if @a size is 0; -ENOMEM if out of memory.
+ */
+int zoropercpu_init(struct zoropercpu *pc, size_t size, int flags);
+
+/**
+ * @fn void zoropercpu_destroy(struct zoropercpu *pc)
+ * @brief Release the slots. No thread must use them anymore.
+ */
+void zoropercpu_destroy(struct zoropercpu *pc);
+
+/**
+ * @brief Slot number @a idx, from 0 to @a pc->nr excluded.
+ */
+static inline void *zoropercpu_ptr(const struct zoropercpu *pc,
+				   unsigned int idx)
+{
+	return pc->base + idx * pc->stride;
+}
+
+/**
+ * @brief Index of the slot of the calling thread.
+ */
+static inline unsigned int zoropercpu_idx(const struct zoropercpu *pc)
+{
+	unsigned int idx;
+
+	if (pc->flags & ZOROPERCPU_THREAD) {
+		idx = __zoropercpu_thread;
+		if (unlikely(!idx))
+			idx = __zoropercpu_thread_slow();
+		idx--;
+	} else {
+		idx = zoropercpu_cpu();
+	}
+	/* CPUs hotplugged meanwhile, or more threads than slots */
+	if (unlikely(idx >= pc->nr))
+		idx %= pc->nr;
+	return idx;
+}
+
+/**
+ * @brief Slot of the calling thread: the one of its CPU, or its own with
+ *        ZOROPERCPU_THREAD.
+ */
+static inline void *zoropercpu_this(const struct zoropercpu *pc)
+{
+	return zoropercpu_ptr(pc, zoropercpu_idx(pc));
+}
+
+/**
+ * @brief Iterate over the slots, e.g. to add them up.
+ *
+ * @param _p    Pointer to the type of the slots, set to each of them
+ * @param _i    The unsigned int to use as a loop cursor
+ * @param _pc   Pointer to the @a struct @a zoropercpu
+ */
+#define zoropercpu_for_each(_p, _i, _pc)				\
+	for (_i = 0; _i < (_pc)->nr &&					\
+	     ((_p) = (typeof(_p))zoropercpu_ptr((_pc), _i), 1); _i++)
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_PERCPU_H__ */
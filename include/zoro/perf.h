@@ -0,0 +1,196 @@
+/**
+ * @file perf.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Hardware performance counters, through perf_event_open(2).
+ *
+ * A group opens a set of counters that the kernel schedules on the PMU all
+ * together, so that their values relate to the same instructions: e.g. the
+ * cache misses of a container lookup, per lookup, next to its cycles.
+ *
+ * @code
+ *	struct zoroperf_group g;
+ *	struct zoroperf_counts c;
+ *
+ *	if (!zoroperf_open(&g, ZOROPERF_DEFAULT, 0)) {
+ *		zoroperf_scope(&g, &c)
+ *			lookup_all(table);
+ *		printf("%lu cache misses\n", c.value[ZOROPERF_CACHE_MISSES_IDX]);
+ *		zoroperf_close(&g);
+ *	}
+ * @endcode
+ *
+ * Counters the CPU (or the hypervisor) does not provide are left out of the
+ * group, and out of the @a mask of the counts. zorobench_run() and
+ * zorotest_run_cases() collect them as well, when asked to; see
+ * zorobench_set_perf() and @a struct @a zorotest_opts.
+ *
+ * Only user space is counted, unless ZOROPERF_KERNEL is given, which
+ * /proc/sys/kernel/perf_event_paranoid usually restricts to root.
+ */
+
+#pragma once
+#ifndef __ZORO_PERF_H__
+#define __ZORO_PERF_H__
+
+#include <stdint.h>
+#include <zoro/compiler.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Events, by index in @a struct @a zoroperf_counts */
+#define ZOROPERF_CYCLES_IDX		0
+#define ZOROPERF_INSTRUCTIONS_IDX	1
+/* Last level cache references and misses */
+#define ZOROPERF_CACHE_REFS_IDX		2
+#define ZOROPERF_CACHE_MISSES_IDX	3
+#define ZOROPERF_BRANCH_MISSES_IDX	4
+#define ZOROPERF_L1D_MISSES_IDX		5
+/* A software event: available even without a PMU */
+#define ZOROPERF_PAGE_FAULTS_IDX	6
+#define ZOROPERF_NR_EVENTS		7
+
+/* Events, as masks for zoroperf_open() */
+#define ZOROPERF_CYCLES		(1U << ZOROPERF_CYCLES_IDX)
+#define ZOROPERF_INSTRUCTIONS	(1U << ZOROPERF_INSTRUCTIONS_IDX)
+#define ZOROPERF_CACHE_REFS	(1U << ZOROPERF_CACHE_REFS_IDX)
+#define ZOROPERF_CACHE_MISSES	(1U << ZOROPERF_CACHE_MISSES_IDX)
+#define ZOROPERF_BRANCH_MISSES	(1U << ZOROPERF_BRANCH_MISSES_IDX)
+#define ZOROPERF_L1D_MISSES	(1U << ZOROPERF_L1D_MISSES_IDX)
+#define ZOROPERF_PAGE_FAULTS	(1U << ZOROPERF_PAGE_FAULTS_IDX)
+#define ZOROPERF_DEFAULT	(ZOROPERF_CYCLES | ZOROPERF_INSTRUCTIONS | \
+				 ZOROPERF_CACHE_REFS | ZOROPERF_CACHE_MISSES | \
+				 ZOROPERF_BRANCH_MISSES)
+#define ZOROPERF_ALL		((1U << ZOROPERF_NR_EVENTS) - 1)
+
+/* Also count the threads the calling thread creates after opening */
+#define ZOROPERF_INHERIT	0x1
+/* Also count what the kernel does on behalf of the thread */
+#define ZOROPERF_KERNEL		0x2
+
+struct zoroperf_group {
+	/* File descriptor of each event, -1 if not counted */
+	int fd[ZOROPERF_NR_EVENTS];
+	int leader;
+	/* Events counted */
+	unsigned int mask;
+};
+
+struct zoroperf_counts {
+	/*
+	 * Events counted, i.e. whose value is valid: not those of a group
+	 * the kernel never managed to schedule on the PMU
+	 */
+	unsigned int mask;
+	/*
+	 * Values, scaled up to the whole time the group was enabled if the
+	 * kernel had to multiplex the PMU with other groups
+	 */
+	uint64_t value[ZOROPERF_NR_EVENTS];
+};
+
+/**
+ * @fn int zoroperf_open(struct zoroperf_group *g, unsigned int events,
+ *                       int flags)
+ * @brief Open a disabled group of counters of the calling thread.
+ *
+ * @param g      The group
+ * @param events ZOROPERF_* events to count
+ * @param flags  ZOROPERF_INHERIT and/or ZOROPERF_KERNEL; 0 otherwise
+ *
+ * @return 0 if at least one of @a events is counted; otherwise a negative
+ *         errno value: -ENOENT if the events are not supported (e.g. in a
+ *         virtual machine with no virtual PMU), -EACCES if not allowed.
+ */
+int zoroperf_open(struct zoroperf_group *g, unsigned int events, int flags);
+
+/**
+ * @fn void zoroperf_close(struct zoroperf_group *g)
+ * @brief Close the counters of the group.
+ */
+void zoroperf_close(struct zoroperf_group *g);
+
+/**
+ * @fn void zoroperf_reset(struct zoroperf_group *g)
+ * @brief Zero the counters of the group.
+ */
+void zoroperf_reset(struct zoroperf_group *g);
+
+/**
+ * @fn void zoroperf_enable(struct zoroperf_group *g)
+ * @brief Start counting, keeping the values counted so far. It takes a
+ *        system call.
+ */
+void zoroperf_enable(struct zoroperf_group *g);
+
+/**
+ * @fn void zoroperf_disable(struct zoroperf_group *g)
+ * @brief Stop counting. It takes a system call.
+ */
+void zoroperf_disable(struct zoroperf_group *g);
+
+/**
+ * @fn int zoroperf_read(struct zoroperf_group *g, struct zoroperf_counts *c)
+ * @brief Read the counters of the group.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zoroperf_read(struct zoroperf_group *g, struct zoroperf_counts *c);
+
+/**
+ * @brief Reset and enable the counters of the group.
+ */
+static inline void zoroperf_start(struct zoroperf_group *g)
+{
+	zoroperf_reset(g);
+	zoroperf_enable(g);
+}
+
+/**
+ * @brief Disable the counters of the group and read them.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+static inline int zoroperf_stop(struct zoroperf_group *g,
+				struct zoroperf_counts *c)
+{
+	zoroperf_disable(g);
+	return zoroperf_read(g, c);
+}
+
+/**
+ * @brief Count the statement (or block) that follows, from zoroperf_start()
+ *        to zoroperf_stop() into @a _counts. The statement must not leave
+ *        the scope with break, return or goto.
+ *
+ * @param _g      Pointer to the @a struct @a zoroperf_group
+ * @param _counts Pointer to the @a struct @a zoroperf_counts to fill
+ */
+#define zoroperf_scope(_g, _counts)					\
+	for (int __zp_once = (zoroperf_start(_g), 1); __zp_once;	\
+	     __zp_once = 0, zoroperf_stop((_g), (_counts)))
+
+/**
+ * @fn const char *zoroperf_event_name(unsigned int idx)
+ * @brief Name of the event of index @a idx, as perf(1) calls it, e.g.
+ *        "cache-misses"; NULL if out of range.
+ */
+const char *zoroperf_event_name(unsigned int idx);
+
+/**
+ * @brief Iterate over the indexes of the events of @a _mask.
+ *
+ * @param _i    The unsigned int to use as a loop cursor
+ * @param _mask Mask of ZOROPERF_* events
+ */
+#define zoroperf_for_each_event(_i, _mask)				\
+	for (_i = 0; _i < ZOROPERF_NR_EVENTS; _i++)			\
+		if ((_mask) & (1U << (_i)))
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_PERF_H__ */
@@ -0,0 +1,172 @@
+/**
+ * @file pool.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Fixed size object pools, with per-thread magazines.
+ *
+ * A pool hands out objects of a single size, carved out of cache line
+ * aligned slabs (or aligned to the objects, if more), so that objects
+ * allocated together sit next to each other in memory. Each thread keeps
+ * two magazines (stacks of up to ZOROPOOL_MAGAZINE_SIZE free objects) per
+ * pool: allocations and frees only touch them, and take the pool lock once
+ * every magazine worth of objects, to exchange a full magazine for an empty
+ * one (or vice versa) with the shared depot of the pool.
+ *
+ * Slabs go back to the system only with zoropool_destroy(): a pool keeps
+ * the memory of its peak usage.
+ */
+
+#pragma once
+#ifndef __ZORO_POOL_H__
+#define __ZORO_POOL_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/hlist.h>
+#include <zoro/linux/list.h>
+
+#ifndef ZOROPOOL_MAGAZINE_SIZE
+    /**
+     * @brief Number of objects a magazine holds. It takes effect when
+     * building the library.
+     */
+    #define ZOROPOOL_MAGAZINE_SIZE 64
+#endif
+
+#ifndef ZOROPOOL_SLAB_SIZE
+    /**
+     * @brief Size of the slabs objects are carved from; pools of bigger
+     * objects use slabs of a magazine worth of them. It takes effect when
+     * building the library.
+     */
+    #define ZOROPOOL_SLAB_SIZE (64 * 1024)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct zoropool_magazine;
+
+struct zoropool {
+	pthread_mutex_t lock;
+	/* Per-thread struct zoropool_cache */
+	pthread_key_t key;
+	size_t size;
+	size_t align;
+	size_t slab_size;
+	/* Depot: full and empty magazines, lone free objects */
+	struct zoropool_magazine *full;
+	struct zoropool_magazine *empty;
+	void *free;
+	/* Room left in the last slab */
+	char *carve;
+	size_t carve_left;
+	struct list_head slabs;
+	struct list_head caches;
+};
+
+/**
+ * @fn int zoropool_init(struct zoropool *pool, size_t size, size_t align)
+ * @brief Initialize a pool of objects of @a size bytes.
+ *
+ * @param pool   The pool
+ * @param size   Size of the objects
+ * @param align  Alignment of the objects, a power of two; 0 for the one of
+ *               malloc(). SMP_CACHE_BYTES keeps every object in its own
+ *               cache lines.
+ *
+ * @return 0 on success; -EINVAL if @a align is not a power of two or too
+ *         big; -EAGAIN if no more threads keys are available.
+ */
+int zoropool_init(struct zoropool *pool, size_t size, size_t align);
+
+/**
+ * @fn void zoropool_destroy(struct zoropool *pool)
+ * @brief Release all the memory of the pool, objects still allocated
+ *        included. No thread must use the pool anymore.
+ */
+void zoropool_destroy(struct zoropool *pool);
+
+/**
+ * @fn void *zoropool_alloc(struct zoropool *pool)
+ * @brief Allocate an object; its content is undefined.
+ *
+ * @return The object, or NULL if out of memory.
+ */
+void *zoropool_alloc(struct zoropool *pool);
+
+/**
+ * @fn void zoropool_free(struct zoropool *pool, void *obj)
+ * @brief Give back an object allocated from @a pool, by any thread.
+ */
+void zoropool_free(struct zoropool *pool, void *obj);
+
+/**
+ * @fn void zoropool_free_run(struct zoropool *pool, void *first, void *last)
+ * @brief Give back a run of objects allocated from @a pool, linked through
+ *        their first word, from @a first to @a last, whose first word is
+ *        not read. The magazines of the calling thread are topped up, then
+ *        the rest of the run goes back to the pool at once, with a single
+ *        lock.
+ */
+void zoropool_free_run(struct zoropool *pool, void *first, void *last);
+
+/* Link @a _obj in front of the run @a _first, whose last object is @a _last */
+#define __zoropool_run_add(_first, _last, _obj) do {			\
+	*(void **)(_obj) = (_first);					\
+	if (!(_first))							\
+		(_last) = (_obj);					\
+	(_first) = (_obj);						\
+} while (0)
+
+/**
+ * @brief Free all the entries of a list, allocated from @a _pool, and
+ *        reinitialize it. The entries are not unlinked one by one, but
+ *        chained into a run for zoropool_free_run(): the list must not be in
+ *        use by anybody else.
+ *
+ * @param _pool   The pool
+ * @param _head   The head of the list
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a list_head member of @a _type
+ */
+#define zoropool_free_list(_pool, _head, _type, _member) do {		\
+	_type *__pos, *__tmp;						\
+	void *__first = NULL, *__last = NULL;				\
+									\
+	/* The next entry is read before its first word is overwritten */ \
+	list_for_each_entry_safe(__pos, __tmp, (_head), _member)	\
+		__zoropool_run_add(__first, __last, __pos);		\
+	if (__first)							\
+		zoropool_free_run((_pool), __first, __last);		\
+	INIT_LIST_HEAD(_head);						\
+} while (0)
+
+/**
+ * @brief Free all the entries of an hlist, allocated from @a _pool, and
+ *        reinitialize it. Same as zoropool_free_list().
+ *
+ * @param _pool   The pool
+ * @param _head   The head of the hlist
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a hlist_node member of @a _type
+ */
+#define zoropool_free_hlist(_pool, _head, _type, _member) do {		\
+	_type *__pos;							\
+	struct hlist_node *__tmp;					\
+	void *__first = NULL, *__last = NULL;				\
+									\
+	hlist_for_each_entry_safe(__pos, __tmp, (_head), _member)	\
+		__zoropool_run_add(__first, __last, __pos);		\
+	if (__first)							\
+		zoropool_free_run((_pool), __first, __last);		\
+	INIT_HLIST_HEAD(_head);						\
+} while (0)
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_POOL_H__ */
@@ -0,0 +1,116 @@
+/**
+ * @file sink.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Batched log sink on top of io_uring.
+ *
+ * Data written to a sink is copied into a small set of buffers registered
+ * with an io_uring instance; full buffers are queued and submitted together
+ * as a chain of linked writes, with a single system call. Only one chain is
+ * in flight at a time, so the stream order is preserved, while the caller
+ * fills the next buffers with no system call at all.
+ * If io_uring is not available, a sink is just a writev() loop.
+ *
+ * A sink is not thread safe: it is meant to be owned by a single drain or
+ * logger thread.
+ */
+
+#pragma once
+#ifndef __ZORO_SINK_H__
+#define __ZORO_SINK_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* zorolog_sink_open() flags */
+#define ZOROLOG_SINK_NO_URING	0x1
+
+struct zorolog_sink;
+
+/**
+ * @fn struct zorolog_sink *zorolog_sink_open(int fd, unsigned int depth,
+ *                                            size_t bufsize, int flags)
+ * @brief Create a sink writing to @a fd, at its current file position.
+ *
+ * @param fd      The destination file descriptor; it is not closed by
+ *                zorolog_sink_close()
+ * @param depth   Number of buffers, i.e. max writes per submission; use 0 for
+ *                the default (8)
+ * @param bufsize Size of each buffer; use 0 for the default (64 KiB)
+ * @param flags   ZOROLOG_SINK_NO_URING to force the writev() fallback
+ *
+ * @return The new sink; NULL on error, with errno set.
+ */
+struct zorolog_sink *zorolog_sink_open(int fd, unsigned int depth,
+				       size_t bufsize, int flags);
+
+/**
+ * @fn ssize_t zorolog_sink_writev(struct zorolog_sink *s,
+ *                                 const struct iovec *iov, int iovcnt)
+ * @brief Append data to the sink. The caller can reuse the memory as soon as
+ *        the call returns.
+ *
+ * @return The number of bytes accepted; a negative errno value on error,
+ *         including errors of previous asynchronous writes.
+ */
+ssize_t zorolog_sink_writev(struct zorolog_sink *s, const struct iovec *iov,
+			    int iovcnt);
+
+/**
+ * @fn ssize_t zorolog_sink_write(struct zorolog_sink *s, const void *buf,
+ *                                size_t len)
+ * @brief Same as zorolog_sink_writev(), for a single buffer.
+ */
+ssize_t zorolog_sink_write(struct zorolog_sink *s, const void *buf, size_t len);
+
+/**
+ * @fn int zorolog_sink_submit(struct zorolog_sink *s)
+ * @brief Submit whatever is buffered, without waiting for it to complete.
+ *        It waits for the previous submission, though: once it returns,
+ *        everything buffered before the previous call is written.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zorolog_sink_submit(struct zorolog_sink *s);
+
+/**
+ * @fn int zorolog_sink_flush(struct zorolog_sink *s)
+ * @brief Submit whatever is buffered and wait until it is written.
+ *
+ * @return 0 on success; a negative errno value otherwise.
+ */
+int zorolog_sink_flush(struct zorolog_sink *s);
+
+/**
+ * @fn int zorolog_sink_uring(const struct zorolog_sink *s)
+ * @brief Test whether the sink goes through io_uring.
+ */
+int zorolog_sink_uring(const struct zorolog_sink *s);
+
+/**
+ * @fn int zorolog_sink_set_fd(struct zorolog_sink *s, int fd)
+ * @brief Flush the sink, then have it write to @a fd, at its current file
+ *        position; e.g. to switch to a new file without recreating the
+ *        io_uring instance.
+ *
+ * @return 0 on success; a negative errno value otherwise, in which case the
+ *         sink still writes to the previous file descriptor.
+ */
+int zorolog_sink_set_fd(struct zorolog_sink *s, int fd);
+
+/**
+ * @fn void zorolog_sink_close(struct zorolog_sink *s)
+ * @brief Flush and destroy the sink.
+ */
+void zorolog_sink_close(struct zorolog_sink *s);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_SINK_H__ */
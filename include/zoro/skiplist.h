@@ -0,0 +1,260 @@
+/**
+ * @file skiplist.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Intrusive skip list: an ordered index on top of list_head.
+ *
+ * Entries embed a @a struct @a zorosl_node and are ordered by a key member,
+ * whose location and comparison function the list knows from zorosl_init();
+ * keys are unique.
+ *
+ * Level 0 is a regular circular @a struct @a list_head, in key order, so the
+ * list.h iterators work on it as they are. The upper levels are singly
+ * linked forward pointers, in a small array embedded in every node: a node
+ * is on each of them with probability 1/4 of being on the level below, which
+ * makes lookups, insertions and removals O(log n), and range walks O(log n)
+ * to find their start.
+ *
+ * The list is not thread safe. Lookups and iterations do not change it: they
+ * only need to be serialized with the changes (e.g. by a rwlock).
+ */
+
+#pragma once
+#ifndef __ZORO_SKIPLIST_H__
+#define __ZORO_SKIPLIST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+
+#ifndef ZOROSL_MAX_LEVEL
+    /**
+     * @brief Number of levels, level 0 included: nodes embed one pointer
+     * per level above 0, and lookups stay O(log n) up to about
+     * 4^ZOROSL_MAX_LEVEL entries. It changes the layout of the nodes, so it
+     * must be the same for the library and the code using it.
+     */
+    #define ZOROSL_MAX_LEVEL 12
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Key comparison: < 0, 0 or > 0 if the key @a a sorts before, equal
+ *        to or after the key @a b.
+ */
+typedef int (*zorosl_cmp_t)(const void *a, const void *b);
+
+struct zorosl_node {
+	/* Level 0 */
+	struct list_head list;
+	/* Levels 1 and above; only the first @levels are in use */
+	struct zorosl_node *next[ZOROSL_MAX_LEVEL - 1];
+	unsigned int levels;
+};
+
+struct zorosl {
+	/* Level 0 */
+	struct list_head head;
+	/* Levels 1 and above: first node of each */
+	struct zorosl_node *first[ZOROSL_MAX_LEVEL - 1];
+	/* Levels in use, above 0 */
+	unsigned int levels;
+	size_t count;
+	/* State of the generator of the node levels */
+	uint64_t seed;
+	/* Layout of the entries */
+	size_t node_off;
+	size_t key_off;
+	size_t key_len;
+	zorosl_cmp_t cmp;
+};
+
+/**
+ * @fn int __zorosl_init(struct zorosl *sl, size_t node_off, size_t key_off,
+ *                       size_t key_len, zorosl_cmp_t cmp)
+ * @brief Use zorosl_init() instead.
+ */
+int __zorosl_init(struct zorosl *sl, size_t node_off, size_t key_off,
+		  size_t key_len, zorosl_cmp_t cmp);
+
+/**
+ * @brief Initialize an empty skip list of entries of type @a _type.
+ *
+ * @param _sl    Pointer to the @a struct @a zorosl
+ * @param _type  Type of the entries
+ * @param _node  Name of the @a struct @a zorosl_node member of @a _type
+ * @param _key   Name of the key member of @a _type
+ * @param _cmp   Key comparison function; NULL to compare the keys as
+ *               unsigned integers, which must then be 1, 2, 4 or 8 bytes
+ *
+ * @return 0 on success; -EINVAL if @a _cmp is NULL and the key is not an
+ *         integer size.
+ */
+#define zorosl_init(_sl, _type, _node, _key, _cmp)			\
+	__zorosl_init((_sl), offset_of(_type, _node),			\
+		      offset_of(_type, _key),				\
+		      sizeof(((_type *)0)->_key), (_cmp))
+
+/**
+ * @fn struct zorosl_node *__zorosl_lower_bound(const struct zorosl *sl,
+ *                                              const void *key)
+ * @brief The node of the first entry with a key not before @a key; NULL if
+ *        none. Use zorosl_lower_bound() or zorosl_find().
+ */
+struct zorosl_node *__zorosl_lower_bound(const struct zorosl *sl,
+					 const void *key);
+
+/**
+ * @fn int __zorosl_insert(struct zorosl *sl, struct zorosl_node *node)
+ * @brief Use zorosl_insert() instead.
+ */
+int __zorosl_insert(struct zorosl *sl, struct zorosl_node *node);
+
+/**
+ * @fn void __zorosl_del(struct zorosl *sl, struct zorosl_node *node)
+ * @brief Use zorosl_del() instead.
+ */
+void __zorosl_del(struct zorosl *sl, struct zorosl_node *node);
+
+static inline const void *__zorosl_key(const struct zorosl *sl,
+				       const struct zorosl_node *node)
+{
+	return (const char *)node - sl->node_off + sl->key_off;
+}
+
+/* @a node, unless its key differs from @a key */
+static inline struct zorosl_node *__zorosl_match(const struct zorosl *sl,
+						 struct zorosl_node *node,
+						 const void *key)
+{
+	if (node && !sl->cmp(__zorosl_key(sl, node), key))
+		return node;
+	return NULL;
+}
+
+/* Whether @a pos, a list_head of level 0, is an entry with key before @a key */
+static inline int __zorosl_before(const struct zorosl *sl,
+				  const struct list_head *pos, const void *key)
+{
+	return pos != &sl->head &&
+	       sl->cmp(__zorosl_key(sl, list_entry(pos, struct zorosl_node,
+						   list)), key) < 0;
+}
+
+/**
+ * @brief Add the entry @a _obj at its place, unless an entry with the same
+ *        key is already there.
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a zorosl_node member of the entry
+ *
+ * @return 0 on success; -EEXIST if the key is already in the list.
+ */
+#define zorosl_insert(_sl, _obj, _member) \
+	__zorosl_insert((_sl), &(_obj)->_member)
+
+/**
+ * @brief Remove the entry @a _obj, which must be in the list.
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _obj    Pointer to the entry
+ * @param _member Name of the @a struct @a zorosl_node member of the entry
+ */
+#define zorosl_del(_sl, _obj, _member) \
+	__zorosl_del((_sl), &(_obj)->_member)
+
+/**
+ * @brief Look up an entry by key.
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _key    Pointer to the key
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a zorosl_node member of @a _type
+ *
+ * @return A pointer to the entry; NULL if not found.
+ */
+#define zorosl_find(_sl, _key, _type, _member)				\
+	({								\
+		const void *__k = (_key);				\
+		struct zorosl_node *__n = __zorosl_match((_sl),		\
+			__zorosl_lower_bound((_sl), __k), __k);		\
+		__n ? container_of(__n, _type, _member) : NULL;		\
+	})
+
+/**
+ * @brief The first entry with a key not before @a _key.
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _key    Pointer to the key
+ * @param _type   Type of the entries
+ * @param _member Name of the @a struct @a zorosl_node member of @a _type
+ *
+ * @return A pointer to the entry; NULL if all the keys are before @a _key.
+ */
+#define zorosl_lower_bound(_sl, _key, _type, _member)			\
+	({								\
+		struct zorosl_node *__n = __zorosl_lower_bound((_sl),	\
+							       (_key));	\
+		__n ? container_of(__n, _type, _member) : NULL;		\
+	})
+
+/**
+ * @brief Number of entries in the list.
+ */
+static inline size_t zorosl_count(const struct zorosl *sl)
+{
+	return sl->count;
+}
+
+/**
+ * @brief Iterate over all the entries, in key order. Same as
+ *        list_for_each_entry() on level 0, which can be used as well.
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _pos    The type * to use as a loop cursor
+ * @param _member Name of the @a struct @a zorosl_node member of the entries
+ */
+#define zorosl_for_each_entry(_sl, _pos, _member) \
+	list_for_each_entry(_pos, &(_sl)->head, _member.list)
+
+/**
+ * @brief Iterate over all the entries, in key order, safe against the
+ *        removal of the current entry.
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _pos    The type * to use as a loop cursor
+ * @param _tmp    Another type * to use as temporary storage
+ * @param _member Name of the @a struct @a zorosl_node member of the entries
+ */
+#define zorosl_for_each_entry_safe(_sl, _pos, _tmp, _member) \
+	list_for_each_entry_safe(_pos, _tmp, &(_sl)->head, _member.list)
+
+/**
+ * @brief Iterate, in key order, over the entries with keys from @a _lo
+ *        (included) to @a _hi (excluded).
+ *
+ * @param _sl     Pointer to the @a struct @a zorosl
+ * @param _pos    The type * to use as a loop cursor
+ * @param _lo     Pointer to the lowest key
+ * @param _hi     Pointer to the key to stop at
+ * @param _member Name of the @a struct @a zorosl_node member of the entries
+ */
+#define zorosl_for_each_entry_range(_sl, _pos, _lo, _hi, _member)	\
+	for (_pos = list_entry(({					\
+			struct zorosl_node *__n =			\
+				__zorosl_lower_bound((_sl), (_lo));	\
+			__n ? &__n->list : &(_sl)->head; }),		\
+		typeof(*(_pos)), _member.list);				\
+	     __zorosl_before((_sl), &(_pos)->_member.list, (_hi));	\
+	     _pos = list_next_entry(_pos, _member.list))
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_SKIPLIST_H__ */
@@ -0,0 +1,347 @@
+/**
+ * @file stats.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Counters and latency histograms for hot paths.
+ *
+ * Every thread updates its own cache line aligned shard of a counter or
+ * histogram, found through a thread key: recording a value costs a plain
+ * increment of memory no other thread writes, with no atomic instruction
+ * and no lock. Readers add the shards up into a snapshot whenever they like,
+ * e.g. from a periodic timer, while the threads go on recording.
+ *
+ * Histograms are log-linear, like HdrHistogram: values are grouped by power
+ * of two, and each group is split in 2^(ZOROSTATS_PRECISION_BITS - 1)
+ * buckets of the same width, so the bucket of a value bounds it within
+ * 1 / 2^(ZOROSTATS_PRECISION_BITS - 1) of its magnitude, from 0 to
+ * UINT64_MAX, with no configuration of the range.
+ *
+ * Shards outlive their threads, so nothing recorded is lost; the shard of a
+ * thread that exited is taken over by the next new thread. Each counter or
+ * histogram takes a thread key, out of PTHREAD_KEYS_MAX per process: they
+ * are meant to be a few long lived objects, not one per request.
+ */
+
+#pragma once
+#ifndef __ZORO_STATS_H__
+#define __ZORO_STATS_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zoro/clock.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+
+#ifndef ZOROSTATS_PRECISION_BITS
+    /**
+     * @brief Significant bits of the histogram buckets, from 2 to 10: the
+     * default 5 keeps values within 1/16 (6.25%), with 976 buckets. It
+     * changes the layout of the histograms, so it must be the same for the
+     * library and the code using it.
+     */
+    #define ZOROSTATS_PRECISION_BITS 5
+#endif
+
+#if ZOROSTATS_PRECISION_BITS < 2 || ZOROSTATS_PRECISION_BITS > 10
+#error "ZOROSTATS_PRECISION_BITS must be between 2 and 10"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZOROSTATS_NR_BUCKETS \
+	((66 - ZOROSTATS_PRECISION_BITS) << (ZOROSTATS_PRECISION_BITS - 1))
+
+/* Head of the shards of a counter or histogram */
+struct zorostats_shard {
+	struct list_head list;
+	struct zorostats_shards *owner;
+	/* Whether a live thread records into it */
+	int in_use;
+};
+
+struct zorostats_shards {
+	pthread_mutex_t lock;
+	pthread_key_t key;
+	/* Size of a shard, and its initialization past zeroing */
+	size_t size;
+	void (*init)(void *shard);
+	struct list_head list;
+	/* Updates dropped, since a shard could not be allocated */
+	uint64_t lost;
+};
+
+struct zorostats_counter_shard {
+	struct zorostats_shard shard;
+	uint64_t value;
+} ____cacheline_aligned;
+
+struct zorostats_hist_shard {
+	struct zorostats_shard shard;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[ZOROSTATS_NR_BUCKETS];
+} ____cacheline_aligned;
+
+/**
+ * @brief A monotonic counter.
+ */
+struct zorostats_counter {
+	struct zorostats_shards shards;
+};
+
+/**
+ * @brief A histogram of values, e.g. latencies in nanoseconds.
+ */
+struct zorostats_hist {
+	struct zorostats_shards shards;
+};
+
+/**
+ * @brief Sum of the shards of a histogram, at some point in time.
+ */
+struct zorostats_hist_snapshot {
+	uint64_t count;
+	uint64_t sum;
+	/* UINT64_MAX and 0 while @count is 0 */
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[ZOROSTATS_NR_BUCKETS];
+};
+
+/* Shard of the calling thread, allocated on its first update; NULL if OOM */
+void *__zorostats_shard_slow(struct zorostats_shards *s);
+
+static inline void *__zorostats_shard(struct zorostats_shards *s)
+{
+	void *shard = pthread_getspecific(s->key);
+
+	if (unlikely(!shard))
+		shard = __zorostats_shard_slow(s);
+	return shard;
+}
+
+/*
+ * Only the owner thread writes to a shard: a relaxed load and store are an
+ * increment, that readers never see torn
+ */
+#define __zorostats_set(_p, _v) __atomic_store_n((_p), (_v), __ATOMIC_RELAXED)
+
+/**
+ * @brief Index of the histogram bucket of @a v.
+ */
+static inline unsigned int zorostats_bucket(uint64_t v)
+{
+	unsigned int shift;
+
+	if (v < (1ULL << ZOROSTATS_PRECISION_BITS))
+		return v;
+	shift = 64 - __builtin_clzll(v) - ZOROSTATS_PRECISION_BITS;
+	return (shift << (ZOROSTATS_PRECISION_BITS - 1)) + (v >> shift);
+}
+
+/**
+ * @brief Lowest value of the histogram bucket @a idx.
+ */
+static inline uint64_t zorostats_bucket_low(unsigned int idx)
+{
+	const unsigned int half = 1U << (ZOROSTATS_PRECISION_BITS - 1);
+	unsigned int shift;
+
+	if (idx < 2 * half)
+		return idx;
+	shift = idx / half - 1;
+	return (uint64_t)(idx % half + half) << shift;
+}
+
+/**
+ * @brief Highest value of the histogram bucket @a idx.
+ */
+static inline uint64_t zorostats_bucket_high(unsigned int idx)
+{
+	return idx + 1 < ZOROSTATS_NR_BUCKETS ?
+	       zorostats_bucket_low(idx + 1) - 1 : UINT64_MAX;
+}
+
+/**
+ * @fn int zorostats_counter_init(struct zorostats_counter *c)
+ * @brief Initialize a counter to 0.
+ *
+ * @return 0 on success; -EAGAIN if no more thread keys are available.
+ */
+int zorostats_counter_init(struct zorostats_counter *c);
+
+/**
+ * @fn void zorostats_counter_destroy(struct zorostats_counter *c)
+ * @brief Release the shards of the counter. No thread must use it anymore.
+ */
+void zorostats_counter_destroy(struct zorostats_counter *c);
+
+/**
+ * @brief Add @a n to the counter.
+ */
+static inline void zorostats_add(struct zorostats_counter *c, uint64_t n)
+{
+	struct zorostats_counter_shard *s = __zorostats_shard(&c->shards);
+
+	if (likely(s))
+		__zorostats_set(&s->value, s->value + n);
+}
+
+/**
+ * @brief Add 1 to the counter.
+ */
+static inline void zorostats_inc(struct zorostats_counter *c)
+{
+	zorostats_add(c, 1);
+}
+
+/**
+ * @fn uint64_t zorostats_counter_read(struct zorostats_counter *c)
+ * @brief Value of the counter: the sum of its shards.
+ */
+uint64_t zorostats_counter_read(struct zorostats_counter *c);
+
+/**
+ * @fn int zorostats_hist_init(struct zorostats_hist *h)
+ * @brief Initialize an empty histogram.
+ *
+ * @return 0 on success; -EAGAIN if no more thread keys are available.
+ */
+int zorostats_hist_init(struct zorostats_hist *h);
+
+/**
+ * @fn void zorostats_hist_destroy(struct zorostats_hist *h)
+ * @brief Release the shards of the histogram. No thread must use it anymore.
+ */
+void zorostats_hist_destroy(struct zorostats_hist *h);
+
+/**
+ * @brief Record the value @a v in the histogram.
+ */
+static inline void zorostats_record(struct zorostats_hist *h, uint64_t v)
+{
+	struct zorostats_hist_shard *s = __zorostats_shard(&h->shards);
+	unsigned int idx = zorostats_bucket(v);
+
+	if (unlikely(!s))
+		return;
+	__zorostats_set(&s->buckets[idx], s->buckets[idx] + 1);
+	__zorostats_set(&s->count, s->count + 1);
+	__zorostats_set(&s->sum, s->sum + v);
+	if (unlikely(v < s->min))
+		__zorostats_set(&s->min, v);
+	if (unlikely(v > s->max))
+		__zorostats_set(&s->max, v);
+}
+
+/**
+ * @brief Record the nanoseconds elapsed since @a start, a zorolog_clock_ns()
+ *        time, in the histogram.
+ */
+static inline void zorostats_record_since(struct zorostats_hist *h,
+					  uint64_t start)
+{
+	zorostats_record(h, zorolog_clock_ns() - start);
+}
+
+/**
+ * @fn void zorostats_hist_snapshot(struct zorostats_hist *h,
+ *                                  struct zorostats_hist_snapshot *snap)
+ * @brief Add the shards of the histogram up into @a snap.
+ *
+ * Values recorded meanwhile might be partially accounted, e.g. in @a count
+ * but not yet in its bucket: the snapshot is consistent most of the time,
+ * not always.
+ */
+void zorostats_hist_snapshot(struct zorostats_hist *h,
+			     struct zorostats_hist_snapshot *snap);
+
+/**
+ * @fn void zorostats_hist_merge(struct zorostats_hist_snapshot *dst,
+ *                               const struct zorostats_hist_snapshot *src)
+ * @brief Add the values of @a src to @a dst, e.g. to sum the histograms of
+ *        different objects or processes.
+ */
+void zorostats_hist_merge(struct zorostats_hist_snapshot *dst,
+			  const struct zorostats_hist_snapshot *src);
+
+/**
+ * @fn uint64_t zorostats_hist_percentile(
+ *                      const struct zorostats_hist_snapshot *snap, double p)
+ * @brief The value @a p percent of the recorded values are lower than or
+ *        equal to, within the precision of the buckets.
+ *
+ * That is the recorded value of nearest rank ceil(@a p / 100 * count),
+ * from 1 to count: the lowest one for @a p 0, the highest one for 100.
+ *
+ * @return The highest value of the bucket of that value, capped to the
+ *         highest recorded value; 0 if the snapshot is empty.
+ */
+uint64_t zorostats_hist_percentile(const struct zorostats_hist_snapshot *snap,
+				   double p);
+
+/**
+ * @brief Mean of the recorded values; 0 if the snapshot is empty.
+ */
+static inline double
+zorostats_hist_mean(const struct zorostats_hist_snapshot *snap)
+{
+	return snap->count ? (double)snap->sum / snap->count : 0;
+}
+
+/**
+ * @fn void zorostats_hist_log(const char *name,
+ *                             const struct zorostats_hist_snapshot *snap)
+ * @brief Print a one line summary of @a snap with zorolog_info(): count,
+ *        min, mean, median, 90th, 99th and 99.9th percentiles and max.
+ */
+void zorostats_hist_log(const char *name,
+			const struct zorostats_hist_snapshot *snap);
+
+/**
+ * @fn size_t zorostats_hist_export(const struct zorostats_hist_snapshot *snap,
+ *                                  void *buf, size_t len)
+ * @brief Serialize @a snap, for zorostats_hist_import() to read it back,
+ *        e.g. within another process. Only non-empty buckets are stored.
+ *
+ * The format is in host byte order, and tied to ZOROSTATS_PRECISION_BITS.
+ *
+ * @param snap   The snapshot
+ * @param buf    Where to serialize it; NULL to only get the size
+ * @param len    Size of @a buf
+ *
+ * @return The size of the serialized snapshot; if greater than @a len,
+ *         nothing was written.
+ */
+size_t zorostats_hist_export(const struct zorostats_hist_snapshot *snap,
+			     void *buf, size_t len);
+
+/**
+ * @fn int zorostats_hist_import(struct zorostats_hist_snapshot *snap,
+ *                               const void *buf, size_t len)
+ * @brief Merge a snapshot serialized by zorostats_hist_export() into
+ *        @a snap, which must be initialized (e.g. to an empty one by
+ *        zorostats_hist_snapshot_init()).
+ *
+ * @return 0 on success; -EINVAL if @a buf does not hold a serialized
+ *         snapshot of the same precision.
+ */
+int zorostats_hist_import(struct zorostats_hist_snapshot *snap,
+			  const void *buf, size_t len);
+
+/**
+ * @fn void zorostats_hist_snapshot_init(struct zorostats_hist_snapshot *snap)
+ * @brief Initialize an empty snapshot.
+ */
+void zorostats_hist_snapshot_init(struct zorostats_hist_snapshot *snap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_STATS_H__ */
@@ -3,14 +3,22 @@
  * @author Andrea Pepe
  * @copyright Copyright (c) 2024
  *
- * @brief Unit test and test-suite helpers. 
+ * @brief Unit test and test-suite helpers.
+ *
+ * Test suites run either in order, stopping at the first failure, with
+ * zorotest_run_test_suite(), or all at once on a pool of worker threads,
+ * optionally each test in its own child process, with zorotest_run_suite().
  */
 
 #ifndef __ZORO_TEST_H__
 #define __ZORO_TEST_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <zoro/bench.h>
 #include <zoro/log.h>
 #include <zoro/compiler.h>
+#include <zoro/perf.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,12 +30,16 @@ extern "C" {
 typedef int (*zorotest_test_t)(void);
 typedef void (*zorotest_cleaner_t)(void *);
 
-void *zorotest_to_clear = NULL;
-zorotest_cleaner_t zorotest_fail_clean = NULL;
-uint8_t zorotest_is_verbose = 0;
+/*
+ * Cleaner of the test running on the calling thread; the runners reset it
+ * before every test.
+ */
+extern __thread void *zorotest_to_clear;
+extern __thread zorotest_cleaner_t zorotest_fail_clean;
+extern uint8_t zorotest_is_verbose;
 
 #define __zorotest_fail_msg() \
-        zorolog_error("TEST '%s' FAILED!\n", PRETTY_FUNCTION)
+        zorolog_error("TEST '%s' FAILED!\n", __PRETTY_FUNCTION__)
 /**
  * @brief Print a message if @a zorotest_is_verbose is set.
  *
@@ -142,7 +154,7 @@ uint8_t zorotest_is_verbose = 0;
                         zorolog_error("Expected " __fmt " Actual " __fmt "\n",\
                                       __exp, __act);                    \
                         __zorotest_clear();                             \
-                        return ZOROTEST_SUCCESS;                        \
+                        return ZOROTEST_FAILURE;                        \
                 }                                                       \
                 zorotest_verbose("Number = " __fmt " - Exact\n", __exp);\
         } while(0)
@@ -169,7 +181,7 @@ uint8_t zorotest_is_verbose = 0;
                                 zorolog_error("Expected %s\n Actual %s\n",\
                                               __exp, __act);            \
                                 __zorotest_clear();                     \
-                                return ZOROTEST_SUCCESS;                \
+                                return ZOROTEST_FAILURE;                \
                         }                                               \
                 }                                                       \
                 zorotest_verbose("String = %s - Exact\n", __exp);       \
@@ -194,7 +206,7 @@ uint8_t zorotest_is_verbose = 0;
                         zorolog_error("Expected %s\n Actual %s\n",      \
                                       __exp, __act);                    \
                         __zorotest_clear();                             \
-                        return ZOROTEST_SUCCESS;                        \
+                        return ZOROTEST_FAILURE;                        \
                 }                                                       \
                 zorotest_verbose("Memory (as string) = %s - Exact\n",   \
                                  __exp);                                \
@@ -304,6 +316,7 @@ static inline int __zorotest_run_test_suite(zorotest_test_t tests[],
         zorolog_info("RUNNING test suite %s\n", test_suite_name);
         for (i = 0; i < num_tests; i++) {
                 zorotest_verbose("Running test n# %lu ...", i);
+                zorotest_unset_clear_on_fail();
                 if (tests[i]() != ZOROTEST_SUCCESS) {
                         zorolog_error("\nTEST SUITE '%s' FAILED!\n", 
                                       test_suite_name);
@@ -315,10 +328,91 @@ static inline int __zorotest_run_test_suite(zorotest_test_t tests[],
         return ZOROTEST_SUCCESS;
 }
 
+/**
+ * @brief Run the tests of the array @a __tests in order, stopping at the
+ *        first failure.
+ *
+ * @param __tests               array of @a zorotest_test_t
+ * @param __test_suite_name     name of the test suite
+ *
+ * @return ZOROTEST_SUCCESS if all the tests passed; ZOROTEST_FAILURE
+ *         otherwise.
+ */
 #define zorotest_run_test_suite(__tests, __test_suite_name)             \
         __zorotest_run_test_suite(__tests, ARRAY_SIZE(__tests),         \
                                   __test_suite_name)
 
+/**
+ * @brief A named test, for zorotest_run_cases().
+ */
+struct zorotest_case {
+        const char *name;
+        zorotest_test_t test;
+};
+
+/**
+ * @brief Initializer of a @a struct @a zorotest_case named after the test
+ *        function @a __test.
+ */
+#define ZOROTEST_CASE(__test) { __stringify(__test), __test }
+
+/* Run every test in a child process: crashes and leaks stay there */
+#define ZOROTEST_FORK           0x1
+
+struct zorotest_opts {
+        /* Worker threads; 0 for $ZOROTEST_JOBS, or one per online CPU */
+        unsigned int jobs;
+        /* Number of slowest tests to report; 0 for ZOROTEST_SLOWEST */
+        unsigned int slowest;
+        /* ZOROTEST_FORK, also set by $ZOROTEST_FORK=1 */
+        int flags;
+        /*
+         * ZOROPERF_* events to count for each test, reported along with the
+         * slowest tests; 0 for ZOROPERF_DEFAULT if $ZOROTEST_PERF=1, or none
+         */
+        unsigned int perf;
+};
+
+#ifndef ZOROTEST_SLOWEST
+    /**
+     * @brief Default number of slowest tests reported by
+     * zorotest_run_cases(). It takes effect when building the library.
+     */
+    #define ZOROTEST_SLOWEST 10
+#endif
+
+/**
+ * @fn int zorotest_run_cases(const char *suite,
+ *                            const struct zorotest_case cases[], size_t num,
+ *                            const struct zorotest_opts *opts)
+ * @brief Run all the tests of a suite on a pool of worker threads, whatever
+ *        their outcome, then report the failures and the slowest tests.
+ *
+ * Tests are picked in order by the first idle worker, so they must not
+ * depend on each other, nor share state without synchronization. Every test
+ * is timed: wall clock, and CPU time of the worker thread or, with
+ * ZOROTEST_FORK, of the whole child process, threads included. A forked test
+ * that crashes is a failure, reported with its signal.
+ *
+ * @param suite  Name of the test suite
+ * @param cases  The tests
+ * @param num    Number of tests
+ * @param opts   Options; NULL for the defaults
+ *
+ * @return ZOROTEST_SUCCESS if all the tests passed; ZOROTEST_FAILURE
+ *         otherwise, or if the runner could not allocate its state.
+ */
+int zorotest_run_cases(const char *suite, const struct zorotest_case cases[],
+                       size_t num, const struct zorotest_opts *opts);
+
+/**
+ * @brief zorotest_run_cases() on the array of @a struct @a zorotest_case
+ *        @a __cases.
+ */
+#define zorotest_run_suite(__cases, __suite_name, __opts)               \
+        zorotest_run_cases(__suite_name, __cases, ARRAY_SIZE(__cases),  \
+                           __opts)
+
 #ifdef __cplusplus
 }
 #endif
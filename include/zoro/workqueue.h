@@ -0,0 +1,174 @@
+/**
+ * @file workqueue.h
+ * @copyright Copyright (c) 2024
+ * @author Andrea Pepe <pepe.andmj@gmail.com>
+ *
+ * @brief Work queues: a pool of worker threads running work items, after
+ *        the work_struct of the kernel.
+ *
+ * A work item is a @a struct @a zorowork embedded in the caller's object,
+ * with the function to run on it, which finds the object back with
+ * container_of(). Queuing allocates nothing: items are linked through their
+ * own @a struct @a list_head.
+ *
+ * Each worker has its own deque of items, under its own lock, in its own
+ * cache line: there is no queue shared by all the workers. Items queued by a
+ * worker go to its own deque; the others go to the deque of the worker of
+ * the CPU of the caller. A worker runs the items of its deque in order, and
+ * when it runs out of them, steals a batch of the newest items of another
+ * deque, if any, or sleeps. A whole list of items is queued at once, with a
+ * single lock, by zorowq_queue_list(): idle workers take their share by
+ * stealing it.
+ *
+ * @code
+ *	struct req {
+ *		struct zorowork work;
+ *		...
+ *	};
+ *
+ *	static void req_handle(struct zorowork *work)
+ *	{
+ *		struct req *r = container_of(work, struct req, work);
+ *		...
+ *	}
+ *
+ *	zorowork_init(&r->work, req_handle);
+ *	zorowq_queue(wq, &r->work);
+ * @endcode
+ *
+ * Work items must not block waiting for other items of the same queue: they
+ * could be queued behind it, with no worker left to run them.
+ */
+
+#pragma once
+#ifndef __ZORO_WORKQUEUE_H__
+#define __ZORO_WORKQUEUE_H__
+
+#include <stddef.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+
+#ifndef ZOROWQ_STEAL_BATCH
+    /**
+     * @brief Max number of items a worker steals at once from another one.
+     * It takes effect when building the library.
+     */
+    #define ZOROWQ_STEAL_BATCH 32
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pin each worker to a CPU the process is allowed to run on, round robin */
+#define ZOROWQ_AFFINE		0x1
+
+/* Queued, and not started yet */
+#define ZOROWORK_PENDING	0x1
+/* Flush color the item was queued with; internal to the work queues */
+#define __ZOROWORK_COLOR	0x2
+
+struct zorowork;
+
+/**
+ * @brief Function of a work item, run by a worker. The item is not pending
+ *        anymore by then: it can be queued again, or freed.
+ */
+typedef void (*zorowork_fn_t)(struct zorowork *work);
+
+struct zorowork {
+	struct list_head entry;
+	zorowork_fn_t func;
+	unsigned long flags;
+};
+
+struct zorowq;
+
+#define ZOROWORK_INIT(_name, _func)					\
+	{ .entry = LIST_HEAD_INIT((_name).entry), .func = (_func) }
+
+#define DECLARE_ZOROWORK(_name, _func)					\
+	struct zorowork _name = ZOROWORK_INIT(_name, _func)
+
+/**
+ * @brief Initialize a work item, to run @a func.
+ */
+static inline void zorowork_init(struct zorowork *work, zorowork_fn_t func)
+{
+	INIT_LIST_HEAD(&work->entry);
+	work->func = func;
+	work->flags = 0;
+}
+
+/**
+ * @brief Test whether the work item is queued, and not started yet.
+ */
+static inline bool zorowork_pending(const struct zorowork *work)
+{
+	return __atomic_load_n(&work->flags, __ATOMIC_ACQUIRE) &
+	       ZOROWORK_PENDING;
+}
+
+/**
+ * @fn struct zorowq *zorowq_create(unsigned int nworkers, int flags)
+ * @brief Create a work queue and start its workers.
+ *
+ * @param nworkers Number of workers; 0 for one per online CPU
+ * @param flags    ZOROWQ_AFFINE; 0 otherwise
+ *
+ * @return The new work queue; NULL on error, with errno set.
+ */
+struct zorowq *zorowq_create(unsigned int nworkers, int flags);
+
+/**
+ * @fn void zorowq_destroy(struct zorowq *wq)
+ * @brief Run all the items queued, then stop the workers and free the
+ *        queue. No item must be queued meanwhile, but by the items running.
+ */
+void zorowq_destroy(struct zorowq *wq);
+
+/**
+ * @fn struct zorowq *zorowq_system(void)
+ * @brief The work queue shared by the library and its users, with one
+ *        worker per online CPU, created on the first call; it is never
+ *        destroyed. Its items should not run for long.
+ *
+ * @return The work queue; NULL if it cannot be created, with errno set.
+ */
+struct zorowq *zorowq_system(void);
+
+/**
+ * @fn unsigned int zorowq_nr_workers(const struct zorowq *wq)
+ * @brief Number of workers of the queue.
+ */
+unsigned int zorowq_nr_workers(const struct zorowq *wq);
+
+/**
+ * @fn bool zorowq_queue(struct zorowq *wq, struct zorowork *work)
+ * @brief Queue a work item, unless it is already pending.
+ *
+ * @return true if queued; false if it was pending already.
+ */
+bool zorowq_queue(struct zorowq *wq, struct zorowork *work);
+
+/**
+ * @fn size_t zorowq_queue_list(struct zorowq *wq, struct list_head *list)
+ * @brief Queue all the work items of @a list, linked through their @a entry
+ *        members, taking a single lock; @a list is left empty. None of them
+ *        must be pending.
+ *
+ * @return The number of items queued.
+ */
+size_t zorowq_queue_list(struct zorowq *wq, struct list_head *list);
+
+/**
+ * @fn void zorowq_flush(struct zorowq *wq)
+ * @brief Wait until the items queued before the call have run. It must not
+ *        be called by a work item of @a wq.
+ */
+void zorowq_flush(struct zorowq *wq);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ZORO_WORKQUEUE_H__ */
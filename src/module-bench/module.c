@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zoro/bench.h>
+
+#if ZOROBENCH_RUNS < 1
+#error "ZOROBENCH_RUNS must be at least 1"
+#endif
+
+/* Beyond this many iterations, @fn is assumed not to honour them */
+#define ZOROBENCH_MAX_ITERS	(1ULL << 40)
+
+#if ZOROBENCH_USE_TSC && (defined(__x86_64__) || defined(__i386__))
+#define ZOROBENCH_TSC 1
+#else
+#define ZOROBENCH_TSC 0
+#endif
+
+static struct {
+	unsigned int runs;
+	FILE *out;
+	int format;
+	int configured;
+	unsigned int perf;
+	int perf_configured;
+} zlbench = {
+	.runs = ZOROBENCH_RUNS,
+};
+
+/* Time excluded from the run in progress, in clock units */
+static __thread struct {
+	uint64_t paused_at;
+	uint64_t excluded;
+	/* Counters of the run in progress, if any */
+	struct zoroperf_group *perf;
+} zlbench_self;
+
+#if ZOROBENCH_TSC
+/* Nanoseconds per TSC tick, measured on first use */
+static double zlbench_ns_per_tick;
+
+static void __zorobench_calibrate_tsc(void)
+{
+	uint64_t t0, c0, t1, c1;
+
+	t0 = zorobench_now_ns();
+	c0 = __zorolog_clock_tsc();
+	do {
+		t1 = zorobench_now_ns();
+	} while (t1 - t0 < 20000000ULL);
+	c1 = __zorolog_clock_tsc();
+	zlbench_ns_per_tick = (double)(t1 - t0) / (double)(c1 - c0);
+}
+#endif
+
+static inline uint64_t __zorobench_clock(void)
+{
+#if ZOROBENCH_TSC
+	return __zorolog_clock_tsc();
+#else
+	return zorobench_now_ns();
+#endif
+}
+
+/*
+ * Duration of a run of @iters iterations, in nanoseconds; the counters of
+ * @perf, if any, add up the events of the run
+ */
+static double __zorobench_time(zorobench_fn_t fn, void *arg, uint64_t iters,
+			       struct zoroperf_group *perf)
+{
+	uint64_t t;
+
+	zlbench_self.excluded = 0;
+	zlbench_self.perf = perf;
+	if (perf)
+		zoroperf_enable(perf);
+	t = __zorobench_clock();
+	fn(iters, arg);
+	t = __zorobench_clock() - t - zlbench_self.excluded;
+	if (perf)
+		zoroperf_disable(perf);
+	zlbench_self.perf = NULL;
+#if ZOROBENCH_TSC
+	return (double)t * zlbench_ns_per_tick;
+#else
+	return (double)t;
+#endif
+}
+
+void zorobench_pause_timing(void)
+{
+	if (zlbench_self.perf)
+		zoroperf_disable(zlbench_self.perf);
+	zlbench_self.paused_at = __zorobench_clock();
+}
+
+void zorobench_resume_timing(void)
+{
+	zlbench_self.excluded += __zorobench_clock() - zlbench_self.paused_at;
+	if (zlbench_self.perf)
+		zoroperf_enable(zlbench_self.perf);
+}
+
+void zorobench_set_runs(unsigned int runs)
+{
+	zlbench.runs = runs ? runs : ZOROBENCH_RUNS;
+}
+
+void zorobench_set_perf(unsigned int events)
+{
+	zlbench.perf = events;
+	zlbench.perf_configured = 1;
+}
+
+void zorobench_set_output(FILE *out, int format)
+{
+	zlbench.out = out;
+	zlbench.format = format;
+	zlbench.configured = 1;
+}
+
+static int __zorobench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int zorobench_run(const char *name, zorobench_fn_t fn, void *arg,
+		  struct zorobench_result *res)
+{
+	unsigned int i, runs = zlbench.runs;
+	struct zoroperf_group group, *perf = NULL;
+	struct zoroperf_counts counts = { 0 };
+	uint64_t iters = 1, start;
+	double *samples, t, sum = 0;
+	const char *env;
+
+#if ZOROBENCH_TSC
+	if (!zlbench_ns_per_tick)
+		__zorobench_calibrate_tsc();
+#endif
+
+	/* Grow the run up to ZOROBENCH_MIN_RUN_NS, aiming a bit beyond it */
+	start = zorobench_now_ns();
+	for (;;) {
+		t = __zorobench_time(fn, arg, iters, NULL);
+		if (t >= ZOROBENCH_MIN_RUN_NS)
+			break;
+		if (iters >= ZOROBENCH_MAX_ITERS)
+			return -ERANGE;
+		if (t < ZOROBENCH_MIN_RUN_NS / 10)
+			iters *= 10;
+		else
+			iters = iters * 1.2 * ZOROBENCH_MIN_RUN_NS / t + 1;
+	}
+
+	while (zorobench_now_ns() - start < ZOROBENCH_WARMUP_NS)
+		__zorobench_time(fn, arg, iters, NULL);
+
+	samples = malloc(runs * sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+
+	if (!zlbench.perf_configured) {
+		env = getenv("ZOROBENCH_PERF");
+		zlbench.perf = env && *env && strcmp(env, "0") ?
+			       ZOROPERF_DEFAULT : 0;
+		zlbench.perf_configured = 1;
+	}
+	if (zlbench.perf &&
+	    !zoroperf_open(&group, zlbench.perf, ZOROPERF_INHERIT)) {
+		perf = &group;
+		zoroperf_reset(perf);
+	}
+
+	for (i = 0; i < runs; i++) {
+		samples[i] = __zorobench_time(fn, arg, iters, perf) / iters;
+		sum += samples[i];
+	}
+
+	if (perf) {
+		zoroperf_read(perf, &counts);
+		zoroperf_close(perf);
+	}
+	res->perf_mask = counts.mask;
+	zoroperf_for_each_event(i, ZOROPERF_ALL)
+		res->perf[i] = (double)counts.value[i] / iters / runs;
+
+	qsort(samples, runs, sizeof(*samples), __zorobench_cmp);
+
+	res->name = name;
+	res->iters = iters;
+	res->runs = runs;
+	res->min_ns = samples[0];
+	res->median_ns = runs % 2 ? samples[runs / 2] :
+			 (samples[runs / 2 - 1] + samples[runs / 2]) / 2;
+	res->p99_ns = samples[(99 * runs + 99) / 100 - 1];
+	res->mean_ns = sum / runs;
+	res->ops_per_sec = res->median_ns > 0 ? 1e9 / res->median_ns : 0;
+	free(samples);
+	return 0;
+}
+
+/* Print @str as a JSON string */
+static void __zorobench_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", *str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+void zorobench_report(const struct zorobench_result *res)
+{
+	const char *env;
+	unsigned int i;
+	FILE *out;
+
+	if (!zlbench.configured) {
+		env = getenv("ZOROBENCH_FORMAT");
+		zlbench.format = env && !strcmp(env, "json") ?
+				 ZOROBENCH_FORMAT_JSON : ZOROBENCH_FORMAT_TEXT;
+		zlbench.configured = 1;
+	}
+	out = zlbench.out ? zlbench.out : stdout;
+
+	if (zlbench.format == ZOROBENCH_FORMAT_JSON) {
+		fputs("{\"name\":", out);
+		__zorobench_json_string(out, res->name);
+		fprintf(out, ",\"iters\":%lu,\"runs\":%u,\"min_ns\":%.3f,"
+			"\"median_ns\":%.3f,\"p99_ns\":%.3f,\"mean_ns\":%.3f,"
+			"\"ops_per_sec\":%.1f", (unsigned long)res->iters,
+			res->runs, res->min_ns, res->median_ns, res->p99_ns,
+			res->mean_ns, res->ops_per_sec);
+		if (res->perf_mask) {
+			fputs(",\"perf\":{", out);
+			zoroperf_for_each_event(i, res->perf_mask)
+				fprintf(out, "%s\"%s\":%.4f",
+					res->perf_mask & ((1U << i) - 1) ?
+					"," : "", zoroperf_event_name(i),
+					res->perf[i]);
+			fputc('}', out);
+		}
+		fputs("}\n", out);
+	} else {
+		fprintf(out, "%-40s %12lu x %-3u min %12.2f median %12.2f "
+			"p99 %12.2f ns/op %14.0f ops/s\n", res->name,
+			(unsigned long)res->iters, res->runs, res->min_ns,
+			res->median_ns, res->p99_ns, res->ops_per_sec);
+		if (res->perf_mask) {
+			fprintf(out, "%-40s", "");
+			zoroperf_for_each_event(i, res->perf_mask)
+				fprintf(out, " %s %.2f", zoroperf_event_name(i),
+					res->perf[i]);
+			fputs(" /op\n", out);
+		}
+	}
+	fflush(out);
+}
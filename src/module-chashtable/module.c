@@ -0,0 +1,168 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zoro/atomic.h>
+#include <zoro/chashtable.h>
+#include <zoro/compiler.h>
+
+int __zorocht_init(struct zorocht *ht, unsigned int bits, size_t node_off,
+		   size_t key_off, size_t key_len, zoroht_hash_t hash)
+{
+	size_t i, nlocks;
+
+	if (bits >= sizeof(size_t) * 8 - 4)
+		return -EINVAL;
+
+	memset(ht, 0, sizeof(*ht));
+	ht->bits = bits;
+	ht->lock_bits = bits < ZOROCHT_LOCK_BITS ? bits : ZOROCHT_LOCK_BITS;
+	ht->node_off = node_off;
+	ht->key_off = key_off;
+	ht->key_len = key_len;
+	ht->hash = hash ? hash : zoroht_hash_default;
+
+	if (zoropercpu_init(&ht->count, sizeof(int64_t), 0))
+		return -ENOMEM;
+	ht->buckets = calloc(1UL << bits, sizeof(*ht->buckets));
+	if (!ht->buckets)
+		goto err;
+
+	nlocks = 1UL << ht->lock_bits;
+	if (posix_memalign((void **)&ht->locks, sizeof(*ht->locks),
+			   nlocks * sizeof(*ht->locks)))
+		goto err;
+	for (i = 0; i < nlocks; i++)
+		pthread_spin_init(&ht->locks[i].lock, PTHREAD_PROCESS_PRIVATE);
+	return 0;
+
+err:
+	free(ht->buckets);
+	ht->buckets = NULL;
+	zoropercpu_destroy(&ht->count);
+	return -ENOMEM;
+}
+
+void zorocht_destroy(struct zorocht *ht)
+{
+	size_t i;
+
+	if (ht->locks)
+		for (i = 0; i < (1UL << ht->lock_bits); i++)
+			pthread_spin_destroy(&ht->locks[i].lock);
+	free(ht->locks);
+	free(ht->buckets);
+	zoropercpu_destroy(&ht->count);
+	ht->locks = NULL;
+	ht->buckets = NULL;
+}
+
+/* Uncontended: the line of the CPU is only shared across migrations */
+static inline void __zorocht_count(struct zorocht *ht, int64_t n)
+{
+	__atomic_fetch_add((int64_t *)zoropercpu_this(&ht->count), n,
+			   __ATOMIC_RELAXED);
+}
+
+static inline pthread_spinlock_t *__zorocht_lock(struct zorocht *ht,
+						 struct hlist_head *head)
+{
+	size_t i = head - ht->buckets;
+
+	return &ht->locks[i & ((1UL << ht->lock_bits) - 1)].lock;
+}
+
+static inline const void *__zorocht_key(const struct zorocht *ht,
+					const struct hlist_node *node)
+{
+	return (const char *)node - ht->node_off + ht->key_off;
+}
+
+/* Writers only, with the bucket lock held */
+static struct hlist_node *__zorocht_lookup(struct zorocht *ht,
+					   struct hlist_head *head,
+					   const void *key)
+{
+	struct hlist_node *node;
+
+	hlist_for_each(node, head)
+		if (!memcmp(__zorocht_key(ht, node), key, ht->key_len))
+			return node;
+	return NULL;
+}
+
+/* The entry is written out before any reader can reach it */
+static inline void __zorocht_publish(struct hlist_node *n,
+				     struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	n->pprev = &h->first;
+	if (first)
+		first->pprev = &n->next;
+	smp_store_release(&h->first, n);
+}
+
+/* Readers at the node can still move on past it: its next is kept */
+static inline void __zorocht_unlink(struct hlist_node *n)
+{
+	__hlist_del(n);
+	WRITE_ONCE(n->pprev, NULL);
+}
+
+int __zorocht_insert(struct zorocht *ht, struct hlist_node *node)
+{
+	const void *key = __zorocht_key(ht, node);
+	struct hlist_head *head = __zorocht_bucket(ht, key);
+	pthread_spinlock_t *lock = __zorocht_lock(ht, head);
+	int ret = 0;
+
+	pthread_spin_lock(lock);
+	if (__zorocht_lookup(ht, head, key)) {
+		ret = -EEXIST;
+		goto unlock;
+	}
+	__zorocht_publish(node, head);
+	__zorocht_count(ht, 1);
+
+unlock:
+	pthread_spin_unlock(lock);
+	return ret;
+}
+
+int __zorocht_del(struct zorocht *ht, struct hlist_node *node)
+{
+	struct hlist_head *head = __zorocht_bucket(ht, __zorocht_key(ht, node));
+	pthread_spinlock_t *lock = __zorocht_lock(ht, head);
+	int ret = 0;
+
+	pthread_spin_lock(lock);
+	if (hlist_unhashed(node)) {
+		ret = -ENOENT;
+		goto unlock;
+	}
+	__zorocht_unlink(node);
+	__zorocht_count(ht, -1);
+
+unlock:
+	pthread_spin_unlock(lock);
+	return ret;
+}
+
+struct hlist_node *__zorocht_remove(struct zorocht *ht, const void *key)
+{
+	struct hlist_head *head = __zorocht_bucket(ht, key);
+	pthread_spinlock_t *lock = __zorocht_lock(ht, head);
+	struct hlist_node *node;
+
+	pthread_spin_lock(lock);
+	node = __zorocht_lookup(ht, head, key);
+	if (node) {
+		__zorocht_unlink(node);
+		__zorocht_count(ht, -1);
+	}
+	pthread_spin_unlock(lock);
+	return node;
+}
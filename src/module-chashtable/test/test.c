@@ -0,0 +1,286 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/chashtable.h>
+#include <zoro/epoch.h>
+#include <zoro/test.h>
+
+#define NR_KEYS		1024
+#define NR_ENTRIES	(4 * NR_KEYS)
+#define NR_READERS	2
+#define NR_WRITERS	3
+#define NR_OPS		60000
+
+#define LIVE		0x11u
+#define DEAD		0xddu
+
+/*
+ * Entries are recycled rather than freed, once a grace period elapsed after
+ * their removal: a reader finding one DEAD, or with another key, found it
+ * before its removal and still holds it after its reclamation
+ */
+struct entry {
+	struct hlist_node node;
+	uint64_t key;
+	unsigned int state;
+	struct zoroepoch_head head;
+	struct entry *next_free;
+	struct run *run;
+};
+
+struct run {
+	struct zorocht ht;
+	struct entry entries[NR_ENTRIES];
+	pthread_mutex_t lock;
+	struct entry *free;
+	unsigned int stop;
+	unsigned int writers;
+	unsigned long inserted;
+	unsigned long removed;
+	unsigned long found;
+	unsigned int errors;
+};
+
+static void error(struct run *r)
+{
+	__atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+}
+
+static struct entry *entry_get(struct run *r)
+{
+	struct entry *e;
+
+	pthread_mutex_lock(&r->lock);
+	e = r->free;
+	if (e)
+		r->free = e->next_free;
+	pthread_mutex_unlock(&r->lock);
+	return e;
+}
+
+static void entry_put(struct entry *e)
+{
+	struct run *r = e->run;
+
+	__atomic_store_n(&e->state, DEAD, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&r->lock);
+	e->next_free = r->free;
+	r->free = e;
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void entry_reclaim(struct zoroepoch_head *head)
+{
+	struct entry *e = container_of(head, struct entry, head);
+
+	if (e->state != LIVE || !hlist_unhashed(&e->node))
+		error(e->run);
+	entry_put(e);
+}
+
+static unsigned int next_rand(unsigned int *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+/*
+ * An entry found within a read section is the one of its key, and stays
+ * live until the section exits, even if removed meanwhile
+ */
+static void check_found(struct run *r, struct entry *e, uint64_t key)
+{
+	if (__atomic_load_n(&e->state, __ATOMIC_RELAXED) != LIVE ||
+	    __atomic_load_n(&e->key, __ATOMIC_RELAXED) != key)
+		error(r);
+}
+
+static void *reader(void *arg)
+{
+	struct run *r = arg;
+	unsigned int seed = 2463534242u, i, n;
+	struct entry *e[8];
+	uint64_t keys[8];
+	size_t bkt;
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+		zoroepoch_enter();
+		for (i = 0; i < ARRAY_SIZE(e); i++) {
+			keys[i] = next_rand(&seed) % NR_KEYS;
+			e[i] = zorocht_find(&r->ht, &keys[i], struct entry,
+					    node);
+			if (e[i])
+				check_found(r, e[i], keys[i]);
+		}
+		/* Let the writers run meanwhile, even on one CPU */
+		if (!(seed % 8))
+			sched_yield();
+		for (i = 0; i < ARRAY_SIZE(e); i++)
+			if (e[i])
+				check_found(r, e[i], keys[i]);
+
+		/* Iterations see every key once at most */
+		if (!(seed % 64)) {
+			n = 0;
+			zorocht_for_each_entry(&r->ht, bkt, e[0], node) {
+				check_found(r, e[0], e[0]->key);
+				n++;
+			}
+			if (n > NR_KEYS)
+				error(r);
+		}
+		zoroepoch_exit();
+		__atomic_add_fetch(&r->found, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct run *r = arg;
+	unsigned int seed, i;
+	unsigned long inserted = 0, removed = 0;
+	struct entry *e;
+	uint64_t key;
+	int ret;
+
+	seed = 88172645u * __atomic_add_fetch(&r->writers, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < NR_OPS / NR_WRITERS; i++) {
+		key = next_rand(&seed) % NR_KEYS;
+		switch (next_rand(&seed) % 3) {
+		case 0:
+			while (!(e = entry_get(r)))
+				/* All the spare entries wait for a grace period */
+				zoroepoch_barrier();
+			e->key = key;
+			__atomic_store_n(&e->state, LIVE, __ATOMIC_RELAXED);
+			ret = zorocht_insert(&r->ht, e, node);
+			if (ret == -EEXIST) {
+				/* Never published: no reader can hold it */
+				entry_put(e);
+			} else if (ret) {
+				error(r);
+			} else {
+				inserted++;
+			}
+			break;
+		case 1:
+			e = zorocht_remove(&r->ht, &key, struct entry, node);
+			if (e) {
+				if (e->key != key)
+					error(r);
+				removed++;
+				zoroepoch_call(&e->head, entry_reclaim);
+			}
+			break;
+		default:
+			/* Races with the removals of the other writers */
+			ret = -ENOENT;
+			zoroepoch_enter();
+			e = zorocht_find(&r->ht, &key, struct entry, node);
+			if (e)
+				ret = zorocht_del(&r->ht, e, node);
+			zoroepoch_exit();
+			if (!ret) {
+				removed++;
+				zoroepoch_call(&e->head, entry_reclaim);
+			} else if (ret != -ENOENT) {
+				error(r);
+			}
+			break;
+		}
+		if (!(i % 32))
+			sched_yield();
+	}
+	__atomic_add_fetch(&r->inserted, inserted, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&r->removed, removed, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void destroy_run(void *arg)
+{
+	struct run *r = arg;
+
+	zorocht_destroy(&r->ht);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+/*
+ * Writers insert and delete random keys while readers look them up: the
+ * table ends up with the entries inserted and not removed, each once
+ */
+static int test_stress(void)
+{
+	pthread_t threads[NR_READERS + NR_WRITERS];
+	unsigned int i, started = 0;
+	unsigned char seen[NR_KEYS];
+	struct entry *e;
+	struct run *r;
+	size_t bkt, n;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		zorotest_fail("Cannot allocate the entries\n");
+	zorotest_set_clear_on_fail(free, r);
+	zorotest_assert_eq_nums(0, zorocht_init(&r->ht, 8, struct entry, node,
+						key, NULL), "%d");
+	pthread_mutex_init(&r->lock, NULL);
+	zorotest_set_clear_on_fail(destroy_run, r);
+	for (i = 0; i < NR_ENTRIES; i++) {
+		r->entries[i].run = r;
+		entry_put(&r->entries[i]);
+	}
+
+	for (i = 0; i < NR_READERS + NR_WRITERS; i++) {
+		if (pthread_create(&threads[i], NULL,
+				   i < NR_READERS ? reader : writer, r))
+			break;
+		started++;
+	}
+	for (i = NR_READERS; i < started; i++)
+		pthread_join(threads[i], NULL);
+	__atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < started && i < NR_READERS; i++)
+		pthread_join(threads[i], NULL);
+	zoroepoch_barrier();
+
+	zorotest_verbose("%lu inserted, %lu removed, %lu read sections\n",
+			 r->inserted, r->removed, r->found);
+	zorotest_assert_eq_nums(NR_READERS + NR_WRITERS, started, "%u");
+	zorotest_assert_eq_nums(0u, r->errors, "%u");
+	zorotest_assert_true(r->inserted > NR_KEYS && r->removed > NR_KEYS);
+	zorotest_assert_eq_nums(r->inserted - r->removed,
+				zorocht_count(&r->ht), "%lu");
+
+	memset(seen, 0, sizeof(seen));
+	n = 0;
+	zoroepoch_enter();
+	zorocht_for_each_entry(&r->ht, bkt, e, node) {
+		if (e->state != LIVE || e->key >= NR_KEYS || seen[e->key]++)
+			break;
+		if (zorocht_find(&r->ht, &e->key, struct entry, node) != e)
+			break;
+		n++;
+	}
+	zoroepoch_exit();
+	zorotest_assert_eq_nums(zorocht_count(&r->ht), n, "%zu");
+
+	destroy_run(r);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_stress),
+	};
+
+	return zorotest_run_suite(tests, "chashtable", NULL);
+}
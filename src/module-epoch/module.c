@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <zoro/atomic.h>
+#include <zoro/epoch.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+
+/* Polls of a reader before yielding the CPU to it */
+#define ZOROEPOCH_SPINS 128
+
+/* Never 0, that marks the threads outside of read sections */
+uint64_t __zoroepoch_global = 1;
+__thread struct zoroepoch_thread *__zoroepoch_self;
+
+static struct {
+	/* Registered threads; also serializes the grace periods */
+	pthread_mutex_t lock;
+	struct list_head threads;
+	pthread_key_t key;
+	pthread_once_t once;
+	/* Deferred callbacks */
+	pthread_mutex_t cb_lock;
+	struct zoroepoch_head *cbs;
+	unsigned int ncbs;
+} zlepoch = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.threads = LIST_HEAD_INIT(zlepoch.threads),
+	.once = PTHREAD_ONCE_INIT,
+	.cb_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Thread exit: its read sections are over */
+static void __zoroepoch_destructor(void *arg)
+{
+	struct zoroepoch_thread *t = arg;
+
+	pthread_mutex_lock(&zlepoch.lock);
+	list_del(&t->list);
+	pthread_mutex_unlock(&zlepoch.lock);
+	free(t);
+	__zoroepoch_self = NULL;
+}
+
+static void __zoroepoch_atfork_prepare(void)
+{
+	pthread_mutex_lock(&zlepoch.cb_lock);
+	pthread_mutex_lock(&zlepoch.lock);
+}
+
+static void __zoroepoch_atfork_parent(void)
+{
+	pthread_mutex_unlock(&zlepoch.lock);
+	pthread_mutex_unlock(&zlepoch.cb_lock);
+}
+
+static void __zoroepoch_atfork_child(void)
+{
+	struct zoroepoch_thread *t, *n;
+
+	/* Only the forking thread survives: the others must not be waited */
+	list_for_each_entry_safe(t, n, &zlepoch.threads, list) {
+		if (t == __zoroepoch_self)
+			continue;
+		list_del(&t->list);
+		free(t);
+	}
+	pthread_mutex_init(&zlepoch.lock, NULL);
+	pthread_mutex_init(&zlepoch.cb_lock, NULL);
+}
+
+static void __zoroepoch_init_once(void)
+{
+	pthread_key_create(&zlepoch.key, __zoroepoch_destructor);
+	pthread_atfork(__zoroepoch_atfork_prepare, __zoroepoch_atfork_parent,
+		       __zoroepoch_atfork_child);
+}
+
+struct zoroepoch_thread *__zoroepoch_register(void)
+{
+	struct zoroepoch_thread *t;
+
+	pthread_once(&zlepoch.once, __zoroepoch_init_once);
+
+	if (posix_memalign((void **)&t, SMP_CACHE_BYTES, sizeof(*t))) {
+		fprintf(stderr, "zoroepoch: cannot register thread\n");
+		abort();
+	}
+	t->epoch = 0;
+	t->nest = 0;
+	t->qsbr = 0;
+
+	pthread_mutex_lock(&zlepoch.lock);
+	list_add_tail(&t->list, &zlepoch.threads);
+	pthread_mutex_unlock(&zlepoch.lock);
+
+	pthread_setspecific(zlepoch.key, t);
+	__zoroepoch_self = t;
+	return t;
+}
+
+void zoroepoch_qsbr_online(void)
+{
+	struct zoroepoch_thread *t = __zoroepoch_self;
+
+	if (unlikely(!t))
+		t = __zoroepoch_register();
+	t->qsbr = 1;
+	zoroepoch_quiescent();
+}
+
+void zoroepoch_qsbr_offline(void)
+{
+	struct zoroepoch_thread *t = __zoroepoch_self;
+
+	if (!t || !t->qsbr)
+		return;
+	t->qsbr = 0;
+	/* Pairs with the one of zoroepoch_synchronize(), as on exit */
+	smp_mb();
+	smp_store_release(&t->epoch, 0);
+}
+
+void zoroepoch_synchronize(void)
+{
+	struct zoroepoch_thread *t, *self = __zoroepoch_self;
+	int online = self && self->qsbr;
+	uint64_t target, e;
+	unsigned int spins;
+
+	/*
+	 * Offline meanwhile, as quiescent: another grace period may wait for
+	 * this thread while it waits for the lock
+	 */
+	if (online) {
+		smp_mb();
+		smp_store_release(&self->epoch, 0);
+	}
+
+	pthread_mutex_lock(&zlepoch.lock);
+	target = __atomic_add_fetch(&__zoroepoch_global, 1, __ATOMIC_SEQ_CST);
+	/*
+	 * Pairs with the one of zoroepoch_enter(): either a reader sees what
+	 * was unlinked before, or its epoch is seen here.
+	 */
+	smp_mb();
+
+	list_for_each_entry(t, &zlepoch.threads, list) {
+		for (spins = 0;; spins++) {
+			e = smp_load_acquire(&t->epoch);
+			/* Readers entered from now on cannot see the old data */
+			if (!e || e >= target)
+				break;
+			/* Short read sections end while spinning */
+			if (spins < ZOROEPOCH_SPINS)
+				cpu_relax();
+			else
+				sched_yield();
+		}
+	}
+	pthread_mutex_unlock(&zlepoch.lock);
+
+	/* Back online, the next reads done after */
+	if (online) {
+		__atomic_store_n(&self->epoch,
+				 __atomic_load_n(&__zoroepoch_global,
+						 __ATOMIC_RELAXED),
+				 __ATOMIC_RELAXED);
+		smp_mb();
+	}
+}
+
+static void __zoroepoch_run(struct zoroepoch_head *head)
+{
+	struct zoroepoch_head *next;
+
+	zoroepoch_synchronize();
+	for (; head; head = next) {
+		next = head->next;
+		head->func(head);
+	}
+}
+
+void zoroepoch_call(struct zoroepoch_head *head,
+		    void (*func)(struct zoroepoch_head *head))
+{
+	struct zoroepoch_head *batch = NULL;
+
+	head->func = func;
+
+	pthread_mutex_lock(&zlepoch.cb_lock);
+	head->next = zlepoch.cbs;
+	zlepoch.cbs = head;
+	if (++zlepoch.ncbs >= ZOROEPOCH_BATCH) {
+		batch = zlepoch.cbs;
+		zlepoch.cbs = NULL;
+		zlepoch.ncbs = 0;
+	}
+	pthread_mutex_unlock(&zlepoch.cb_lock);
+
+	if (batch)
+		__zoroepoch_run(batch);
+}
+
+void zoroepoch_barrier(void)
+{
+	struct zoroepoch_head *batch;
+
+	pthread_mutex_lock(&zlepoch.cb_lock);
+	batch = zlepoch.cbs;
+	zlepoch.cbs = NULL;
+	zlepoch.ncbs = 0;
+	pthread_mutex_unlock(&zlepoch.cb_lock);
+
+	__zoroepoch_run(batch);
+}
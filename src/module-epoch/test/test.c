@@ -0,0 +1,330 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zoro/atomic.h>
+#include <zoro/epoch.h>
+#include <zoro/test.h>
+
+#define NR_OBJS		256
+#define NR_SLOTS	16
+#define NR_READERS	2
+#define NR_WRITERS	2
+#define NR_REPLACED	20000
+#define NR_SYNCS	500
+
+#define LIVE		0x11u
+#define DEAD		0xddu
+
+/*
+ * Objects are recycled rather than freed: a reader seeing one DEAD found it
+ * before it was replaced, and still holds it after its reclamation
+ */
+struct obj {
+	struct zoroepoch_head head;
+	unsigned int state;
+	struct obj *next_free;
+	struct run *run;
+};
+
+struct run {
+	struct obj objs[NR_OBJS];
+	struct obj *slots[NR_SLOTS];
+	pthread_mutex_t lock;
+	struct obj *free;
+	/* Retire with zoroepoch_call(), rather than zoroepoch_synchronize() */
+	int deferred;
+	unsigned int stop;
+	unsigned long reads;
+	unsigned long retired;
+	unsigned long reclaimed;
+	unsigned int errors;
+};
+
+static struct obj *obj_get(struct run *r)
+{
+	struct obj *o;
+
+	pthread_mutex_lock(&r->lock);
+	o = r->free;
+	if (o)
+		r->free = o->next_free;
+	pthread_mutex_unlock(&r->lock);
+	return o;
+}
+
+static void obj_reclaim(struct obj *o)
+{
+	struct run *r = o->run;
+
+	if (o->state != LIVE)
+		__atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&o->state, DEAD, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&r->lock);
+	o->next_free = r->free;
+	r->free = o;
+	pthread_mutex_unlock(&r->lock);
+	__atomic_add_fetch(&r->reclaimed, 1, __ATOMIC_RELAXED);
+}
+
+static void obj_reclaim_cb(struct zoroepoch_head *head)
+{
+	obj_reclaim(container_of(head, struct obj, head));
+}
+
+/* Read the objects of a few slots, holding them for a while */
+static void read_slots(struct run *r, unsigned int seed)
+{
+	struct obj *o[4];
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(o); i++) {
+		o[i] = smp_load_acquire(&r->slots[(seed + i * 5) % NR_SLOTS]);
+		if (__atomic_load_n(&o[i]->state, __ATOMIC_RELAXED) != LIVE)
+			__atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+	}
+	/* Let the writers run meanwhile, even on one CPU */
+	if (!(seed % 16))
+		sched_yield();
+	else
+		for (j = 0; j < 64; j++)
+			cpu_relax();
+	for (i = 0; i < ARRAY_SIZE(o); i++)
+		if (__atomic_load_n(&o[i]->state, __ATOMIC_RELAXED) != LIVE)
+			__atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+}
+
+static void *reader(void *arg)
+{
+	struct run *r = arg;
+	unsigned int seed = 0;
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+		zoroepoch_enter();
+		read_slots(r, seed++);
+		/* Nested sections do not end the outer one */
+		zoroepoch_enter();
+		read_slots(r, seed++);
+		zoroepoch_exit();
+		read_slots(r, seed++);
+		zoroepoch_exit();
+		__atomic_add_fetch(&r->reads, 3, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* Same without read sections, reporting a quiescent state every loop */
+static void *qsbr_reader(void *arg)
+{
+	struct run *r = arg;
+	unsigned int seed = 0;
+
+	zoroepoch_qsbr_online();
+	while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+		read_slots(r, seed++);
+		read_slots(r, seed++);
+		__atomic_add_fetch(&r->reads, 2, __ATOMIC_RELAXED);
+		zoroepoch_quiescent();
+	}
+	zoroepoch_qsbr_offline();
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct run *r = arg;
+	struct obj *o, *old;
+	unsigned int i, slot;
+
+	for (i = 0; i < NR_REPLACED / NR_WRITERS; i++) {
+		while (!(o = obj_get(r))) {
+			/* All the spare objects wait for a grace period */
+			zoroepoch_barrier();
+		}
+		if (o->state != DEAD)
+			__atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&o->state, LIVE, __ATOMIC_RELAXED);
+
+		slot = i * 7 % NR_SLOTS;
+		old = __atomic_exchange_n(&r->slots[slot], o, __ATOMIC_ACQ_REL);
+		__atomic_add_fetch(&r->retired, 1, __ATOMIC_RELAXED);
+		if (r->deferred) {
+			zoroepoch_call(&old->head, obj_reclaim_cb);
+		} else {
+			zoroepoch_synchronize();
+			obj_reclaim(old);
+		}
+		/* Not to be done before the readers even start, on one CPU */
+		if (!(i % 16))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static int run_readers_writers(int deferred)
+{
+	pthread_t threads[NR_READERS + 1 + NR_WRITERS];
+	unsigned int i, nr_readers = 0, nr_writers = 0;
+	struct run *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		zorotest_fail("Cannot allocate the objects\n");
+	zorotest_set_clear_on_fail(free, r);
+	pthread_mutex_init(&r->lock, NULL);
+	r->deferred = deferred;
+	for (i = 0; i < NR_OBJS; i++) {
+		r->objs[i].run = r;
+		r->objs[i].state = DEAD;
+		if (i < NR_SLOTS) {
+			r->objs[i].state = LIVE;
+			r->slots[i] = &r->objs[i];
+		} else {
+			r->objs[i].next_free = r->free;
+			r->free = &r->objs[i];
+		}
+	}
+
+	for (i = 0; i < NR_READERS + 1; i++) {
+		if (pthread_create(&threads[i], NULL,
+				   i < NR_READERS ? reader : qsbr_reader, r))
+			break;
+		nr_readers++;
+	}
+	for (i = 0; nr_readers == NR_READERS + 1 && i < NR_WRITERS; i++) {
+		if (pthread_create(&threads[nr_readers + i], NULL, writer, r))
+			break;
+		nr_writers++;
+	}
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(threads[nr_readers + i], NULL);
+	__atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < nr_readers; i++)
+		pthread_join(threads[i], NULL);
+	zoroepoch_barrier();
+
+	zorotest_verbose("%lu reads, %lu objects retired\n", r->reads,
+			 r->retired);
+	zorotest_assert_eq_nums(NR_READERS + 1, nr_readers, "%u");
+	zorotest_assert_eq_nums(NR_WRITERS, nr_writers, "%u");
+	zorotest_assert_eq_nums(0u, r->errors, "%u");
+	zorotest_assert_eq_nums((unsigned long)NR_REPLACED, r->retired, "%lu");
+	zorotest_assert_eq_nums(r->retired, r->reclaimed, "%lu");
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+	zorotest_success();
+}
+
+/* No reader sees an object reclaimed after zoroepoch_synchronize() */
+static int test_synchronize(void)
+{
+	return run_readers_writers(0);
+}
+
+/* Same, with the callbacks deferred by zoroepoch_call() */
+static int test_call(void)
+{
+	return run_readers_writers(1);
+}
+
+static void *synchronizer(void *arg)
+{
+	zoroepoch_synchronize();
+	__atomic_store_n((unsigned int *)arg, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* A grace period waits for the outermost read section to exit */
+static int test_nested(void)
+{
+	unsigned int done = 0;
+	pthread_t thread;
+
+	zoroepoch_enter();
+	zoroepoch_enter();
+	if (pthread_create(&thread, NULL, synchronizer, &done)) {
+		zoroepoch_exit();
+		zoroepoch_exit();
+		zorotest_fail("Cannot start the synchronizer\n");
+	}
+	zoroepoch_exit();
+	usleep(20000);
+	if (__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+		zoroepoch_exit();
+		pthread_join(thread, NULL);
+		zorotest_fail("Grace period ended within a read section\n");
+	}
+	zoroepoch_exit();
+	pthread_join(thread, NULL);
+	zorotest_assert_true(__atomic_load_n(&done, __ATOMIC_ACQUIRE));
+	zorotest_success();
+}
+
+struct syncer {
+	int online;
+	unsigned int *done;
+};
+
+static void *syncer(void *arg)
+{
+	struct syncer *s = arg;
+	unsigned int i;
+
+	if (s->online)
+		zoroepoch_qsbr_online();
+	for (i = 0; i < NR_SYNCS; i++) {
+		zoroepoch_quiescent();
+		usleep(100);
+		zoroepoch_synchronize();
+	}
+	if (s->online)
+		zoroepoch_qsbr_offline();
+	__atomic_add_fetch(s->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Grace periods started at the same time by online threads, and by one
+ * that is not, all end: none waits for another one waiting for the lock
+ */
+static int test_concurrent_online(void)
+{
+	struct syncer s[] = {
+		{ .online = 1 }, { .online = 1 }, { .online = 0 },
+	};
+	pthread_t threads[ARRAY_SIZE(s)];
+	unsigned int i, done = 0, started = 0, waited;
+
+	for (i = 0; i < ARRAY_SIZE(s); i++) {
+		s[i].done = &done;
+		if (pthread_create(&threads[i], NULL, syncer, &s[i]))
+			break;
+		started++;
+	}
+	/* Deadlocked threads cannot be joined: give up on them */
+	for (waited = 0; waited < 1000; waited++) {
+		if (__atomic_load_n(&done, __ATOMIC_ACQUIRE) == started)
+			break;
+		usleep(10000);
+	}
+	if (__atomic_load_n(&done, __ATOMIC_ACQUIRE) != started)
+		zorotest_fail("Grace periods still running after 10 s\n");
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	zorotest_assert_eq_nums((unsigned int)ARRAY_SIZE(s), started, "%u");
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_synchronize),
+		ZOROTEST_CASE(test_call),
+		ZOROTEST_CASE(test_nested),
+		ZOROTEST_CASE(test_concurrent_online),
+	};
+
+	return zorotest_run_suite(tests, "epoch", NULL);
+}
@@ -0,0 +1,23 @@
+/*
+ * The hashes built without 128 bit integers, as on 32 bit CPUs: the
+ * multiplications take the portable path of __zorohash_mum()
+ */
+#undef __SIZEOF_INT128__
+#include <zoro/hash.h>
+
+#include "fallback.h"
+
+uint64_t fallback_hash_bytes(const void *key, size_t len, uint64_t seed)
+{
+	return zorohash_bytes(key, len, seed);
+}
+
+uint64_t fallback_combine(uint64_t h, uint64_t v)
+{
+	return zorohash_combine(h, v);
+}
+
+uint64_t fallback_reduce(uint64_t h, uint64_t n)
+{
+	return zorohash_reduce(h, n);
+}
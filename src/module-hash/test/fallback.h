@@ -0,0 +1,12 @@
+#pragma once
+#ifndef __FALLBACK_H__
+#define __FALLBACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t fallback_hash_bytes(const void *key, size_t len, uint64_t seed);
+uint64_t fallback_combine(uint64_t h, uint64_t v);
+uint64_t fallback_reduce(uint64_t h, uint64_t n);
+
+#endif /* __FALLBACK_H__ */
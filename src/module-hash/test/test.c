@@ -0,0 +1,307 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/hash.h>
+#include <zoro/test.h>
+
+#include "fallback.h"
+
+#define NR_INVERTED	(1U << 20)
+#define NR_AVALANCHE	4096
+#define NR_RANDOM_KEYS	10000
+#define MAX_RANDOM_KEY	200
+
+/* Lengths on both sides of each read pattern and round of zorohash_bytes() */
+static const struct {
+	size_t len;
+	uint64_t hash;
+	uint64_t seeded;
+} bytes_vectors[] = {
+	{  0, 0x93228a4de0eec5a2ULL, 0x16d3b0a07d2cea83ULL },
+	{  1, 0x9676022bfd177d90ULL, 0x1c604858fa60c8e7ULL },
+	{  3, 0xe9609c2e635eb614ULL, 0xc87b70049cd83382ULL },
+	{  4, 0x856e7a5c5ce6b65eULL, 0xbdae3cb54cc85488ULL },
+	{  8, 0xca9f70fc67bbea6dULL, 0x65b24eb83f47811dULL },
+	{ 16, 0xbdc55046c6d1ec4fULL, 0x8eaeb231fd7a666eULL },
+	{ 17, 0xb3889b861f2af496ULL, 0xa723525c7b010669ULL },
+	{ 48, 0x0a7f07945487ff48ULL, 0xe5516884f44e6e87ULL },
+	{ 49, 0x0c4d8b68d0152146ULL, 0x828184def42ff99fULL },
+};
+
+#define BYTES_SEED	0x0123456789abcdefULL
+
+/* The test vectors of wyhash, each hashed with its index as the seed */
+static const struct {
+	const char *key;
+	uint64_t hash;
+} wyhash_vectors[] = {
+	{ "", 0x93228a4de0eec5a2ULL },
+	{ "a", 0xc5bac3db178713c4ULL },
+	{ "abc", 0xa97f2f7b1d9b3314ULL },
+	{ "message digest", 0x786d1f1df3801df4ULL },
+	{ "abcdefghijklmnopqrstuvwxyz", 0xdca5a8138ad37c87ULL },
+	{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+	  0xb9e734f117cfaf70ULL },
+	{ "1234567890123456789012345678901234567890"
+	  "1234567890123456789012345678901234567890", 0x6cc5eab49a92d617ULL },
+};
+
+static uint64_t next_random(uint64_t *state)
+{
+	/* xorshift64*: independent of the functions under test */
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/* The key is copied at the end of a buffer of its own size, for ASAN */
+static int check_bytes(const uint8_t *msg, size_t len, uint64_t seed,
+		       uint64_t hash)
+{
+	uint8_t *key = malloc(len ? len : 1);
+	int ret;
+
+	if (!key)
+		return 0;
+	memcpy(key, msg, len);
+	ret = zorohash_bytes(key, len, seed) == hash &&
+	      fallback_hash_bytes(key, len, seed) == hash;
+	if (!ret)
+		zorotest_verbose("%zu bytes, seed %#lx: %#lx (%#lx without "
+				 "128 bit integers), expected %#lx\n", len,
+				 seed, zorohash_bytes(key, len, seed),
+				 fallback_hash_bytes(key, len, seed), hash);
+	free(key);
+	return ret;
+}
+
+/* Known answers at every length where zorohash_bytes() changes its reads */
+static int test_bytes(void)
+{
+	uint8_t msg[64];
+	size_t i;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i * 31 + 7;
+	for (i = 0; i < ARRAY_SIZE(bytes_vectors); i++) {
+		zorotest_assert_true(check_bytes(msg, bytes_vectors[i].len, 0,
+						 bytes_vectors[i].hash));
+		zorotest_assert_true(check_bytes(msg, bytes_vectors[i].len,
+						 BYTES_SEED,
+						 bytes_vectors[i].seeded));
+	}
+	zorotest_success();
+}
+
+/* Same hashes as wyhash, whose secret and rounds zorohash_bytes() keeps */
+static int test_wyhash(void)
+{
+	const char *key;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(wyhash_vectors); i++) {
+		key = wyhash_vectors[i].key;
+		zorotest_assert_true(check_bytes((const uint8_t *)key,
+						 strlen(key), i,
+						 wyhash_vectors[i].hash));
+	}
+	zorotest_assert_eq_nums(wyhash_vectors[2].hash,
+				zorohash_str(wyhash_vectors[2].key, 2), "%#lx");
+	zorotest_success();
+}
+
+/* Without 128 bit integers, products and thus hashes are the same */
+static int test_fallback(void)
+{
+	uint8_t key[MAX_RANDOM_KEY];
+	uint64_t state = 1, a, b, seed;
+	unsigned int i;
+	size_t len, j;
+
+	for (i = 0; i < NR_RANDOM_KEYS; i++) {
+		len = next_random(&state) % (MAX_RANDOM_KEY + 1);
+		for (j = 0; j < len; j++)
+			key[j] = next_random(&state);
+		seed = i & 1 ? next_random(&state) : 0;
+		zorotest_assert_eq_nums(zorohash_bytes(key, len, seed),
+					fallback_hash_bytes(key, len, seed),
+					"%#lx");
+
+		a = next_random(&state);
+		b = i & 2 ? next_random(&state) : ~0ULL;
+		zorotest_assert_eq_nums(zorohash_combine(a, b),
+					fallback_combine(a, b), "%#lx");
+		zorotest_assert_eq_nums(zorohash_reduce(a, b),
+					fallback_reduce(a, b), "%#lx");
+	}
+	zorotest_success();
+}
+
+/* Reductions stay in range, and are the high half of the product */
+static int test_reduce(void)
+{
+	const uint64_t h = 0xfedcba9876543210ULL;
+	uint64_t state = 2, n;
+	unsigned int i;
+
+	zorotest_assert_eq_nums(0ul, zorohash_reduce(h, 1), "%lu");
+	zorotest_assert_eq_nums(2ul, zorohash_reduce(h, 3), "%lu");
+	zorotest_assert_eq_nums(995ul, zorohash_reduce(h, 1000), "%lu");
+	zorotest_assert_eq_nums(h - 1, zorohash_reduce(h, ~0ULL), "%#lx");
+	zorotest_assert_eq_nums(0ul, zorohash_reduce(0, ~0ULL), "%lu");
+	for (i = 0; i < NR_RANDOM_KEYS; i++) {
+		n = next_random(&state) >> (i % 64);
+		if (n)
+			zorotest_assert_true(zorohash_reduce(
+				next_random(&state), n) < n);
+	}
+	zorotest_success();
+}
+
+static uint64_t inverse_mul64(uint64_t c)
+{
+	uint64_t inv = c;
+	int i;
+
+	/* Newton's iteration doubles the correct low bits for odd c */
+	for (i = 0; i < 6; i++)
+		inv *= 2 - c * inv;
+	return inv;
+}
+
+static uint64_t inverse_xorshift64(uint64_t v, unsigned int shift)
+{
+	uint64_t x = v;
+	unsigned int i;
+
+	for (i = shift; i < 64; i += shift)
+		x = v ^ (x >> shift);
+	return x;
+}
+
+/* zorohash_u64() undone step by step */
+static uint64_t inverse_u64(uint64_t v)
+{
+	v = inverse_xorshift64(v, 31);
+	v *= inverse_mul64(0x94d049bb133111ebULL);
+	v = inverse_xorshift64(v, 27);
+	v *= inverse_mul64(0xbf58476d1ce4e5b9ULL);
+	return inverse_xorshift64(v, 30);
+}
+
+static uint32_t inverse_u32(uint32_t v)
+{
+	v = inverse_xorshift64(v, 16);
+	v *= (uint32_t)inverse_mul64(0x846ca68bU);
+	v = inverse_xorshift64(v, 15);
+	v *= (uint32_t)inverse_mul64(0x7feb352dU);
+	return inverse_xorshift64(v, 16);
+}
+
+/*
+ * Fraction of the inputs for which flipping input bit i flips output bit o,
+ * for every pair: the worst one, in per mille away from a half
+ */
+static unsigned int avalanche(uint64_t (*hash)(uint64_t), unsigned int bits)
+{
+	unsigned int flips[64][64] = { { 0 } };
+	uint64_t state = 3, mask, v, h, d;
+	unsigned int i, o, n, worst = 0, dev;
+
+	mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+	for (n = 0; n < NR_AVALANCHE; n++) {
+		v = next_random(&state) & mask;
+		h = hash(v);
+		for (i = 0; i < bits; i++) {
+			d = h ^ hash(v ^ (1ULL << i));
+			for (o = 0; o < bits; o++)
+				flips[i][o] += (d >> o) & 1;
+		}
+	}
+	for (i = 0; i < bits; i++) {
+		for (o = 0; o < bits; o++) {
+			dev = abs((int)(flips[i][o] * 2000 / NR_AVALANCHE) -
+				  1000) / 2;
+			if (dev > worst)
+				worst = dev;
+		}
+	}
+	return worst;
+}
+
+static uint64_t hash_u64(uint64_t v)
+{
+	return zorohash_u64(v);
+}
+
+static uint64_t hash_u32(uint64_t v)
+{
+	return zorohash_u32(v);
+}
+
+/*
+ * zorohash_u64() is SplitMix64's finalizer: a bijection, every input bit
+ * flipping every output bit half of the time
+ */
+static int test_u64(void)
+{
+	uint64_t state = 4, v;
+	unsigned int i, worst;
+
+	zorotest_assert_eq_nums(0ul, zorohash_u64(0), "%#lx");
+	/* First output of SplitMix64, seeded with 0 */
+	zorotest_assert_eq_nums(0xe220a8397b1dcdafUL,
+				zorohash_u64(0x9e3779b97f4a7c15ULL), "%#lx");
+	zorotest_assert_eq_nums(0xb4d055fcf2cbbd7bUL, zorohash_u64(~0ULL),
+				"%#lx");
+
+	for (i = 0; i < NR_INVERTED; i++) {
+		v = i & 1 ? next_random(&state) : i;
+		if (inverse_u64(zorohash_u64(v)) != v)
+			zorotest_fail("zorohash_u64() is not injective\n");
+	}
+
+	worst = avalanche(hash_u64, 64);
+	zorotest_verbose("zorohash_u64() worst bias: %u per mille\n", worst);
+	zorotest_assert_true(worst < 50);
+	zorotest_success();
+}
+
+/* zorohash_u32() is lowbias32: the same, on 32 bits */
+static int test_u32(void)
+{
+	uint64_t state = 5;
+	unsigned int i, worst;
+	uint32_t v;
+
+	zorotest_assert_eq_nums(0u, zorohash_u32(0), "%#x");
+	zorotest_assert_eq_nums(0x688990c0u, zorohash_u32(1), "%#x");
+	zorotest_assert_eq_nums(0xe628c683u, zorohash_u32(0xdeadbeefu), "%#x");
+
+	for (i = 0; i < NR_INVERTED; i++) {
+		v = i & 1 ? (uint32_t)next_random(&state) : i;
+		if (inverse_u32(zorohash_u32(v)) != v)
+			zorotest_fail("zorohash_u32() is not injective\n");
+	}
+
+	worst = avalanche(hash_u32, 32);
+	zorotest_verbose("zorohash_u32() worst bias: %u per mille\n", worst);
+	zorotest_assert_true(worst < 50);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_bytes),
+		ZOROTEST_CASE(test_wyhash),
+		ZOROTEST_CASE(test_fallback),
+		ZOROTEST_CASE(test_reduce),
+		ZOROTEST_CASE(test_u64),
+		ZOROTEST_CASE(test_u32),
+	};
+
+	return zorotest_run_suite(tests, "hash", NULL);
+}
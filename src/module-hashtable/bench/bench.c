@@ -0,0 +1,226 @@
+/*
+ * hlist hash table insertion and lookup, hits and misses, at load factors
+ * from 1/2 to 8 entries per bucket, on a plain bucket array, and the same on
+ * the resizable zoroht tables, that keep their load factor under 1.
+ *
+ * Usage: bench [entries (default 1M)]
+ * Output as set by ZOROBENCH_FORMAT (text, or json).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/bench.h>
+#include <zoro/hashtable.h>
+#include <zoro/linux/hash.h>
+#include <zoro/linux/hlist.h>
+
+struct item {
+	uint64_t key;
+	struct hlist_node node;
+};
+
+struct ctx {
+	struct item *items;
+	size_t n;
+	/* Plain table */
+	struct hlist_head *buckets;
+	unsigned int bits;
+	/* Resizable table */
+	struct zoroht ht;
+	/* Keys to look up, in random order */
+	uint64_t *keys;
+	size_t next;
+};
+
+/* Load factors, in eighths of entry per bucket */
+static const unsigned int loads[] = { 4, 8, 16, 32, 64 };
+
+static uint64_t rand64(void)
+{
+	return (uint64_t)rand() << 33 ^ (uint64_t)rand() << 11 ^ rand();
+}
+
+static inline struct hlist_head *bucket(struct ctx *c, uint64_t key)
+{
+	return &c->buckets[hash_64(key, c->bits)];
+}
+
+static struct item *lookup(struct ctx *c, uint64_t key)
+{
+	struct item *pos;
+
+	hlist_for_each_entry(pos, bucket(c, key), node)
+		if (pos->key == key)
+			return pos;
+	return NULL;
+}
+
+/* One operation is an insertion; the table is emptied every n of them */
+static void bench_insert(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+	struct item *it;
+
+	while (iters--) {
+		if (c->next == c->n) {
+			zorobench_pause_timing();
+			memset(c->buckets, 0, sizeof(*c->buckets) << c->bits);
+			c->next = 0;
+			zorobench_resume_timing();
+		}
+		it = &c->items[c->next++];
+		hlist_add_head(&it->node, bucket(c, it->key));
+	}
+}
+
+static void fill(struct ctx *c)
+{
+	size_t i;
+
+	memset(c->buckets, 0, sizeof(*c->buckets) << c->bits);
+	for (i = 0; i < c->n; i++)
+		hlist_add_head(&c->items[i].node, bucket(c, c->items[i].key));
+}
+
+/* One operation is a lookup, of the keys of c->keys in turn */
+static void bench_lookup(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+	size_t i = c->next;
+
+	while (iters--) {
+		zorobench_do_not_optimize(lookup(c, c->keys[i]));
+		if (++i == c->n)
+			i = 0;
+	}
+	c->next = i;
+}
+
+static void bench_zoroht_insert(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+
+	while (iters--) {
+		if (c->next == c->n) {
+			zorobench_pause_timing();
+			zoroht_destroy(&c->ht);
+			if (zoroht_init(&c->ht, 0, struct item, node, key,
+					NULL))
+				abort();
+			c->next = 0;
+			zorobench_resume_timing();
+		}
+		zoroht_add(&c->ht, &c->items[c->next++], node);
+	}
+}
+
+static void bench_zoroht_lookup(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+	size_t i = c->next;
+
+	while (iters--) {
+		zorobench_do_not_optimize(zoroht_find(&c->ht, &c->keys[i],
+						      struct item, node));
+		if (++i == c->n)
+			i = 0;
+	}
+	c->next = i;
+}
+
+static void run(const char *name, zorobench_fn_t fn, struct ctx *c)
+{
+	struct zorobench_result res;
+	int ret;
+
+	c->next = 0;
+	ret = zorobench_run(name, fn, c, &res);
+	if (ret) {
+		fprintf(stderr, "%s: error %d\n", name, ret);
+		return;
+	}
+	zorobench_report(&res);
+}
+
+/* Keys to look up: those of the items (hits) or others (misses), shuffled */
+static void set_keys(struct ctx *c, int hits)
+{
+	size_t i, j;
+	uint64_t tmp;
+
+	for (i = 0; i < c->n; i++)
+		c->keys[i] = hits ? c->items[i].key : c->items[i].key ^ 1;
+	for (i = c->n - 1; i > 0; i--) {
+		j = rand64() % (i + 1);
+		tmp = c->keys[i];
+		c->keys[i] = c->keys[j];
+		c->keys[j] = tmp;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct ctx c = { 0 };
+	unsigned int l, bits;
+	char name[128];
+	size_t i;
+
+	c.n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	c.items = calloc(c.n, sizeof(*c.items));
+	c.keys = calloc(c.n, sizeof(*c.keys));
+	for (bits = 0; (1UL << bits) * loads[0] / 8 < c.n; bits++)
+		;
+	c.buckets = calloc(1UL << bits, sizeof(*c.buckets));
+	if (!c.items || !c.keys || !c.buckets) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	srand(1);
+	/* Even keys: key ^ 1 is a miss */
+	for (i = 0; i < c.n; i++)
+		c.items[i].key = rand64() & ~1ULL;
+
+	for (l = 0; l < ARRAY_SIZE(loads); l++) {
+		/* The first power of two giving at most the load factor */
+		for (c.bits = 0; (1UL << c.bits) * loads[l] / 8 < c.n; c.bits++)
+			;
+		snprintf(name, sizeof(name), "hlist_insert/%zu/load=%.2f",
+			 c.n, (double)c.n / (1UL << c.bits));
+		run(name, bench_insert, &c);
+
+		fill(&c);
+		set_keys(&c, 1);
+		snprintf(name, sizeof(name), "hlist_lookup_hit/%zu/load=%.2f",
+			 c.n, (double)c.n / (1UL << c.bits));
+		run(name, bench_lookup, &c);
+		set_keys(&c, 0);
+		snprintf(name, sizeof(name), "hlist_lookup_miss/%zu/load=%.2f",
+			 c.n, (double)c.n / (1UL << c.bits));
+		run(name, bench_lookup, &c);
+	}
+
+	if (zoroht_init(&c.ht, 0, struct item, node, key, NULL))
+		return EXIT_FAILURE;
+	snprintf(name, sizeof(name), "zoroht_insert/%zu", c.n);
+	c.next = c.n;
+	run(name, bench_zoroht_insert, &c);
+	/* Complete the table, as the insertions stopped anywhere */
+	zoroht_destroy(&c.ht);
+	if (zoroht_init(&c.ht, 0, struct item, node, key, NULL))
+		return EXIT_FAILURE;
+	for (i = 0; i < c.n; i++)
+		zoroht_add(&c.ht, &c.items[i], node);
+	set_keys(&c, 1);
+	snprintf(name, sizeof(name), "zoroht_lookup_hit/%zu", c.n);
+	run(name, bench_zoroht_lookup, &c);
+	set_keys(&c, 0);
+	snprintf(name, sizeof(name), "zoroht_lookup_miss/%zu", c.n);
+	run(name, bench_zoroht_lookup, &c);
+	zoroht_destroy(&c.ht);
+
+	free(c.buckets);
+	free(c.keys);
+	free(c.items);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+TARGETNAME=bench
+TARGETTYPE=exec
+INCFLAGS=-I../../../include -I../../../build/include
+LDFLAGS=-Wl,-rpath=$(shell pwd -P)/../../.. -L../../.. -L../../../build -lzoro
+
+# Benchmarks are built optimized (-O3 -DNDEBUG), unless DEBUG is given
+DEBUG=n
@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zoro/hash.h>
+#include <zoro/hashtable.h>
+#include <zoro/compiler.h>
+
+#if ZOROHT_MIGRATE_STEP < 2
+#error "ZOROHT_MIGRATE_STEP must be at least 2"
+#endif
+
+uint64_t zoroht_hash_default(const void *key, size_t len)
+{
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+
+	switch (len) {
+	case 1:
+		memcpy(&u8, key, 1);
+		return zorohash_u64(u8);
+	case 2:
+		memcpy(&u16, key, 2);
+		return zorohash_u64(u16);
+	case 4:
+		memcpy(&u32, key, 4);
+		return zorohash_u64(u32);
+	case 8:
+		memcpy(&u64, key, 8);
+		return zorohash_u64(u64);
+	}
+	return zorohash_bytes(key, len, 0);
+}
+
+int __zoroht_init(struct zoroht *ht, unsigned int bits, size_t node_off,
+		  size_t key_off, size_t key_len, zoroht_hash_t hash)
+{
+	if (bits < ZOROHT_MIN_BITS)
+		bits = ZOROHT_MIN_BITS;
+	if (bits >= sizeof(size_t) * 8 - 4)
+		return -EINVAL;
+
+	memset(ht, 0, sizeof(*ht));
+	ht->buckets = calloc(1UL << bits, sizeof(*ht->buckets));
+	if (!ht->buckets)
+		return -ENOMEM;
+	ht->bits = bits;
+	ht->min_bits = bits;
+	ht->node_off = node_off;
+	ht->key_off = key_off;
+	ht->key_len = key_len;
+	ht->hash = hash ? hash : zoroht_hash_default;
+	return 0;
+}
+
+void zoroht_destroy(struct zoroht *ht)
+{
+	free(ht->buckets);
+	free(ht->old);
+	ht->buckets = NULL;
+	ht->old = NULL;
+	ht->count = 0;
+}
+
+/* Last node of @a head, NULL if empty */
+static struct hlist_node *__zoroht_tail(struct hlist_head *head)
+{
+	struct hlist_node *node = head->first;
+
+	if (node)
+		while (node->next)
+			node = node->next;
+	return node;
+}
+
+/*
+ * Entries move to the tail of their new bucket, in the order of the old
+ * one: what was added since the resize started stays in front, and the
+ * entries with the same key keep the order they were added in.
+ */
+size_t zoroht_migrate(struct zoroht *ht, size_t nbuckets)
+{
+	/* A chain splits into two buckets at most, the sizes being a bit apart */
+	struct {
+		struct hlist_head *head;
+		struct hlist_node *tail;
+	} to[2];
+	struct hlist_node *node, *tmp;
+	struct hlist_head *head;
+	size_t size;
+	int i;
+
+	if (!ht->old)
+		return 0;
+
+	size = 1UL << ht->old_bits;
+	for (; nbuckets && ht->migrated < size; nbuckets--) {
+		memset(to, 0, sizeof(to));
+		hlist_for_each_safe(node, tmp, &ht->old[ht->migrated]) {
+			head = &ht->buckets[
+				__zoroht_hash(ht, __zoroht_key(ht, node)) &
+				((1UL << ht->bits) - 1)];
+			i = to[0].head && to[0].head != head;
+			if (to[i].head != head) {
+				to[i].head = head;
+				to[i].tail = __zoroht_tail(head);
+			}
+
+			hlist_del(node);
+			if (to[i].tail)
+				hlist_add_behind(node, to[i].tail);
+			else
+				hlist_add_head(node, head);
+			to[i].tail = node;
+		}
+		ht->migrated++;
+	}
+
+	if (ht->migrated < size)
+		return size - ht->migrated;
+	free(ht->old);
+	ht->old = NULL;
+	return 0;
+}
+
+/* Allocate the new bucket array; the entries follow incrementally */
+static void __zoroht_resize(struct zoroht *ht, unsigned int bits)
+{
+	struct hlist_head *buckets;
+
+	/* Calloc'ed memory is usually mapped on demand: no spike here either */
+	buckets = calloc(1UL << bits, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	ht->old = ht->buckets;
+	ht->old_bits = ht->bits;
+	ht->migrated = 0;
+	ht->buckets = buckets;
+	ht->bits = bits;
+}
+
+void __zoroht_rehash(struct zoroht *ht)
+{
+	size_t size;
+
+	if (ht->old) {
+		zoroht_migrate(ht, ZOROHT_MIGRATE_STEP);
+		return;
+	}
+
+	size = 1UL << ht->bits;
+	if (ht->count > size && ht->bits < sizeof(size_t) * 8 - 4)
+		__zoroht_resize(ht, ht->bits + 1);
+	else if (ht->bits > ht->min_bits && ht->count < size / 8)
+		__zoroht_resize(ht, ht->bits - 1);
+}
@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zoro/hashtable.h>
+#include <zoro/test.h>
+
+#define NR_DUPS		16
+#define NR_COPIES	8
+#define NR_FILLERS	20000
+
+struct entry {
+	struct hlist_node node;
+	uint64_t key;
+	unsigned int copy;
+};
+
+struct run {
+	struct zoroht ht;
+	struct entry dups[NR_COPIES][NR_DUPS];
+	struct entry fillers[NR_FILLERS];
+};
+
+static void destroy_run(void *arg)
+{
+	struct run *r = arg;
+
+	zoroht_destroy(&r->ht);
+	free(r);
+}
+
+/* Duplicated keys are found as their copy @a copy, the last one added */
+static int check_dups(struct run *r, unsigned int copy)
+{
+	struct entry *e;
+	uint64_t key;
+
+	for (key = 0; key < NR_DUPS; key++) {
+		e = zoroht_find(&r->ht, &key, struct entry, node);
+		if (!e || e->key != key || e->copy != copy) {
+			zorolog_error("Key %lu: copy %d instead of %u\n",
+				      (unsigned long)key, e ? (int)e->copy : -1,
+				      copy);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Copies of the same keys added and removed while the table grows and
+ * shrinks: lookups always find the last one added, migrations included.
+ */
+static int test_dups_order(void)
+{
+	unsigned int c, i, done = 0, step = NR_FILLERS / NR_COPIES;
+	unsigned int grown = ZOROHT_MIN_BITS;
+	size_t moved = 0;
+	struct run *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		zorotest_fail("Cannot allocate the entries\n");
+	zorotest_set_clear_on_fail(free, r);
+	zorotest_assert_eq_nums(0, zoroht_init(&r->ht, 0, struct entry, node,
+					       key, NULL), "%d");
+	zorotest_set_clear_on_fail(destroy_run, r);
+
+	for (c = 0; c < NR_COPIES; c++) {
+		for (i = 0; i < NR_DUPS; i++) {
+			r->dups[c][i].key = i;
+			r->dups[c][i].copy = c;
+			zoroht_add(&r->ht, &r->dups[c][i], node);
+		}
+		/* Fillers trigger resizes, with copies in flight */
+		for (i = 0; i < step; i++, done++) {
+			r->fillers[done].key = NR_DUPS + done;
+			zoroht_add(&r->ht, &r->fillers[done], node);
+			moved += !!r->ht.old;
+			if (check_dups(r, c))
+				zorotest_fail("Wrong copy found while growing\n");
+		}
+		if (r->ht.bits > grown)
+			grown = r->ht.bits;
+	}
+	zorotest_assert_true(grown > ZOROHT_MIN_BITS + NR_COPIES / 2);
+	zorotest_assert_true(moved > 0);
+
+	for (c = NR_COPIES; c--;) {
+		for (i = 0; i < step; i++) {
+			done--;
+			zoroht_del(&r->ht, &r->fillers[done], node);
+			if (check_dups(r, c))
+				zorotest_fail("Wrong copy found while shrinking\n");
+		}
+		for (i = 0; i < NR_DUPS; i++)
+			zoroht_del(&r->ht, &r->dups[c][i], node);
+		if (c && check_dups(r, c - 1))
+			zorotest_fail("Previous copy not found\n");
+	}
+	zorotest_assert_eq_nums((size_t)0, zoroht_count(&r->ht), "%zu");
+
+	destroy_run(r);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_dups_order),
+	};
+
+	return zorotest_run_suite(tests, "hashtable", NULL);
+}
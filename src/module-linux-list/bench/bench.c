@@ -0,0 +1,297 @@
+/*
+ * list_sort() and friends on random, sorted and reverse sorted inputs, and
+ * list_for_each_entry() against list_for_each_entry_prefetch() (and their
+ * hlist counterparts) on cold lists, for growing sizes and amounts of work
+ * per entry: the prefetching walks win once the list does not fit in cache
+ * and the body does enough work to hide the misses behind.
+ *
+ * Usage: bench [max sort nodes (default 1M, up to 100M)]
+ * Output as set by ZOROBENCH_FORMAT (text, or json).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zoro/bench.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/hlist.h>
+#include <zoro/linux/list.h>
+
+#define WALK_MAX_NODES	(4UL << 20)
+/* Sizes from which a single sort lasts long enough to cut the runs */
+#define SORT_BIG_NODES	(1UL << 20)
+
+/*
+ * One entry per cache line: the size is a multiple of the alignment too,
+ * which aligned_alloc() of an array of them relies on
+ */
+struct item {
+	struct list_head list;
+	struct hlist_node hnode;
+	uint64_t value;
+} ____cacheline_aligned;
+
+enum { INPUT_RANDOM, INPUT_SORTED, INPUT_REVERSE };
+
+static const char *const input_names[] = { "random", "sorted", "reverse" };
+
+static int cmp(void *priv, const struct list_head *a,
+	       const struct list_head *b)
+{
+	return list_entry(a, struct item, list)->value >
+	       list_entry(b, struct item, list)->value;
+}
+
+static uint64_t key(void *priv, const struct list_head *a)
+{
+	return list_entry(a, struct item, list)->value;
+}
+
+static void sort_merge(struct list_head *head)
+{
+	list_sort(NULL, head, cmp);
+}
+
+static void sort_natural(struct list_head *head)
+{
+	list_sort_natural(NULL, head, cmp);
+}
+
+static void sort_key(struct list_head *head)
+{
+	list_sort_key(NULL, head, key);
+}
+
+static void sort_parallel(struct list_head *head)
+{
+	list_sort_parallel(NULL, head, cmp, 0);
+}
+
+static const struct {
+	const char *name;
+	void (*sort)(struct list_head *head);
+} sorts[] = {
+	{ "list_sort", sort_merge },
+	{ "list_sort_natural", sort_natural },
+	{ "list_sort_key", sort_key },
+	{ "list_sort_parallel", sort_parallel },
+};
+
+struct ctx {
+	struct item *items;
+	size_t n;
+	struct list_head head;
+	struct hlist_head hhead;
+	void (*sort)(struct list_head *head);
+	unsigned int work;
+	int prefetching;
+};
+
+static uint64_t rand64(void)
+{
+	return (uint64_t)rand() << 33 ^ (uint64_t)rand() << 11 ^ rand();
+}
+
+/* Link the items in memory order: sorting reorders them, not this */
+static void link_in_order(struct ctx *c)
+{
+	size_t i;
+
+	INIT_LIST_HEAD(&c->head);
+	for (i = 0; i < c->n; i++)
+		list_add_tail(&c->items[i].list, &c->head);
+}
+
+/* One operation is a sort of the whole list */
+static void bench_sort(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+
+	while (iters--) {
+		zorobench_pause_timing();
+		link_in_order(c);
+		zorobench_resume_timing();
+		c->sort(&c->head);
+	}
+	zorobench_clobber_memory();
+}
+
+/* Some dependent arithmetic on the entry, @work rounds of it */
+static inline uint64_t body(const struct item *it, unsigned int work,
+			    uint64_t acc)
+{
+	uint64_t v = it->value;
+	unsigned int i;
+
+	for (i = 0; i < work; i++)
+		v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+	return acc + v;
+}
+
+/* One operation is a visit of an entry */
+static void bench_walk_list(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+	struct list_head *ahead;
+	struct item *pos;
+	uint64_t acc = 0;
+
+	while (iters) {
+		if (c->prefetching) {
+			list_for_each_entry_prefetch(pos, ahead, &c->head, list) {
+				acc = body(pos, c->work, acc);
+				if (!--iters)
+					break;
+			}
+		} else {
+			list_for_each_entry(pos, &c->head, list) {
+				acc = body(pos, c->work, acc);
+				if (!--iters)
+					break;
+			}
+		}
+	}
+	zorobench_do_not_optimize(acc);
+}
+
+static void bench_walk_hlist(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+	struct hlist_node *ahead;
+	struct item *pos;
+	uint64_t acc = 0;
+
+	while (iters) {
+		if (c->prefetching) {
+			hlist_for_each_entry_prefetch(pos, ahead, &c->hhead,
+						      hnode) {
+				acc = body(pos, c->work, acc);
+				if (!--iters)
+					break;
+			}
+		} else {
+			hlist_for_each_entry(pos, &c->hhead, hnode) {
+				acc = body(pos, c->work, acc);
+				if (!--iters)
+					break;
+			}
+		}
+	}
+	zorobench_do_not_optimize(acc);
+}
+
+static void run(const char *name, zorobench_fn_t fn, struct ctx *c)
+{
+	struct zorobench_result res;
+	int ret;
+
+	ret = zorobench_run(name, fn, c, &res);
+	if (ret) {
+		fprintf(stderr, "%s: error %d\n", name, ret);
+		return;
+	}
+	zorobench_report(&res);
+}
+
+static void bench_sorts(struct ctx *c, size_t max)
+{
+	unsigned int input, s;
+	char name[128];
+	size_t i;
+
+	for (c->n = 1000; c->n <= max; c->n *= 10) {
+		zorobench_set_runs(c->n >= SORT_BIG_NODES ? 5 : 0);
+		for (input = 0; input < ARRAY_SIZE(input_names); input++) {
+			for (i = 0; i < c->n; i++)
+				c->items[i].value = input == INPUT_RANDOM ?
+						    rand64() :
+						    input == INPUT_SORTED ?
+						    i : c->n - i;
+			for (s = 0; s < ARRAY_SIZE(sorts); s++) {
+				snprintf(name, sizeof(name), "%s/%s/%zu",
+					 sorts[s].name, input_names[input],
+					 c->n);
+				c->sort = sorts[s].sort;
+				run(name, bench_sort, c);
+			}
+		}
+	}
+	zorobench_set_runs(0);
+}
+
+/* Link the items in a random order, so that walks defeat the prefetcher */
+static void link_shuffled(struct ctx *c)
+{
+	size_t *perm, i, j, tmp;
+
+	perm = malloc(c->n * sizeof(*perm));
+	if (!perm) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < c->n; i++)
+		perm[i] = i;
+	for (i = c->n - 1; i > 0; i--) {
+		j = rand64() % (i + 1);
+		tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+
+	INIT_LIST_HEAD(&c->head);
+	INIT_HLIST_HEAD(&c->hhead);
+	for (i = 0; i < c->n; i++) {
+		c->items[perm[i]].value = i;
+		list_add_tail(&c->items[perm[i]].list, &c->head);
+		hlist_add_head(&c->items[perm[i]].hnode, &c->hhead);
+	}
+	free(perm);
+}
+
+static void bench_walks(struct ctx *c)
+{
+	static const unsigned int works[] = { 0, 32, 128 };
+	unsigned int w;
+	char name[128];
+
+	zorobench_set_runs(10);
+	for (c->n = 1024; c->n <= WALK_MAX_NODES; c->n *= 16) {
+		link_shuffled(c);
+		for (w = 0; w < ARRAY_SIZE(works); w++) {
+			c->work = works[w];
+			for (c->prefetching = 0; c->prefetching < 2;
+			     c->prefetching++) {
+				snprintf(name, sizeof(name),
+					 "list_walk%s/%zu/work=%u",
+					 c->prefetching ? "_prefetch" : "",
+					 c->n, c->work);
+				run(name, bench_walk_list, c);
+				snprintf(name, sizeof(name),
+					 "hlist_walk%s/%zu/work=%u",
+					 c->prefetching ? "_prefetch" : "",
+					 c->n, c->work);
+				run(name, bench_walk_hlist, c);
+			}
+		}
+	}
+	zorobench_set_runs(0);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	size_t nitems = max > WALK_MAX_NODES ? max : WALK_MAX_NODES;
+	struct ctx c = { 0 };
+
+	c.items = aligned_alloc(SMP_CACHE_BYTES, nitems * sizeof(*c.items));
+	if (!c.items) {
+		perror("aligned_alloc");
+		return EXIT_FAILURE;
+	}
+	srand(1);
+
+	bench_sorts(&c, max);
+	bench_walks(&c);
+
+	free(c.items);
+	return EXIT_SUCCESS;
+}
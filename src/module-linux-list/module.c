@@ -1,4 +1,10 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <zoro/linux/list.h>
+#include <zoro/workqueue.h>
 
 /*
  * Returns a list organized in an intermediate format suited
@@ -91,6 +97,45 @@ static void merge_final(void *priv, list_cmp_func_t cmp, struct list_head *head,
 	head->prev = tail;
 }
 
+/*
+ * Cut the longest sorted run at the start of the null-terminated list *@run
+ * and return what follows it. A strictly descending run is reversed in
+ * place, and *@run updated to its new first element: reversing equal
+ * elements would break stability.
+ */
+__attribute__((nonnull(2,3)))
+static struct list_head *take_run(void *priv, list_cmp_func_t cmp,
+				  struct list_head **run)
+{
+	struct list_head *first = *run, *tail = first, *next = first->next;
+
+	if (!next)
+		return NULL;
+
+	if (cmp(priv, tail, next) > 0) {
+		/* Descending: push each element in front of the run */
+		struct list_head *prev = first->prev;
+
+		do {
+			tail = next;
+			next = next->next;
+			tail->next = *run;
+			*run = tail;
+		} while (next && cmp(priv, tail, next) > 0);
+		first->next = NULL;
+		/* The new first element takes the place of the old one */
+		(*run)->prev = prev;
+		return next;
+	}
+
+	do {
+		tail = next;
+		next = next->next;
+	} while (next && cmp(priv, tail, next) <= 0);
+	tail->next = NULL;
+	return next;
+}
+
 /*
  * This mergesort is as eager as possible while always performing at least
  * 2:1 balanced merges.  Given two pending sublists of size 2^k, they are
@@ -146,19 +191,24 @@ static void merge_final(void *priv, list_cmp_func_t cmp, struct list_head *head,
  * 5 above, you can see that the number of elements we merge with a list
  * of size 2^k varies from 2^(k-1) (cases 3 and 5 when x == 0) to
  * 2^(k+1) - 1 (second merge of case 5 when x == 2^(k-1) - 1).
+ *
+ * presort() sorts the null-terminated list @list, of at least two elements,
+ * up to the last merge: of the two sorted sublists left, the one made of the
+ * earlier elements is returned, the other one is stored in @second.
+ *
+ * With @runs set, the input is consumed by already sorted runs instead of
+ * one element at a time, and the sizes above count runs, not elements: a
+ * list made of k runs is sorted with O(n log k) comparisons. If the whole
+ * list is a single run, @second is set to NULL.
  */
-__attribute__((nonnull(2,3)))
-void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp)
+__attribute__((nonnull(2,3,4)))
+static struct list_head *presort(void *priv, list_cmp_func_t cmp,
+				 struct list_head *list,
+				 struct list_head **second, bool runs)
 {
-	struct list_head *list = head->next, *pending = NULL;
+	struct list_head *pending = NULL;
 	size_t count = 0;	/* Count of pending */
 
-	if (list == head->prev)	/* Zero or one elements */
-		return;
-
-	/* Convert to a null-terminated singly-linked list. */
-	head->prev->next = NULL;
-
 	/*
 	 * Data structure invariants:
 	 * - All lists are singly linked and null-terminated; prev
@@ -194,17 +244,25 @@ void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp)
 			*tail = a;
 		}
 
-		/* Move one element from input list to pending */
+		/* Move one element (or run) from input list to pending */
 		list->prev = pending;
 		pending = list;
-		list = list->next;
-		pending->next = NULL;
+		if (runs) {
+			list = take_run(priv, cmp, &pending);
+		} else {
+			list = list->next;
+			pending->next = NULL;
+		}
 		count++;
 	} while (list);
 
 	/* End of input; merge together all the pending lists. */
 	list = pending;
 	pending = pending->prev;
+	if (unlikely(!pending)) {	/* A single run */
+		*second = NULL;
+		return list;
+	}
 	for (;;) {
 		struct list_head *next = pending->prev;
 
@@ -213,7 +271,372 @@ void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp)
 		list = merge(priv, cmp, pending, list);
 		pending = next;
 	}
+	*second = list;
+	return pending;
+}
+
+__attribute__((nonnull(2,3)))
+void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp)
+{
+	struct list_head *list = head->next, *second;
+
+	if (list == head->prev)	/* Zero or one elements */
+		return;
+
+	/* Convert to a null-terminated singly-linked list. */
+	head->prev->next = NULL;
+
+	list = presort(priv, cmp, list, &second, false);
 	/* The final merge, rebuilding prev links */
-	merge_final(priv, cmp, head, pending, list);
+	merge_final(priv, cmp, head, list, second);
+}
+
+/* Rebuild the prev links of the null-terminated list @list into @head */
+static void relink(struct list_head *head, struct list_head *list)
+{
+	struct list_head *tail = head;
+
+	for (; list; list = list->next) {
+		tail->next = list;
+		list->prev = tail;
+		tail = list;
+	}
+	tail->next = head;
+	head->prev = tail;
+}
+
+__attribute__((nonnull(2,3)))
+void list_sort_natural(void *priv, struct list_head *head, list_cmp_func_t cmp)
+{
+	struct list_head *list = head->next, *second;
+
+	if (list == head->prev)	/* Zero or one elements */
+		return;
+
+	head->prev->next = NULL;
+
+	list = presort(priv, cmp, list, &second, true);
+	if (!second)
+		relink(head, list);
+	else
+		merge_final(priv, cmp, head, list, second);
+}
+
+__attribute__((nonnull(2,3,4)))
+void list_merge_sorted(void *priv, struct list_head *head,
+		       struct list_head *list, list_cmp_func_t cmp)
+{
+	struct list_head *a = head->next, *b = list->next;
+
+	if (list_empty(list))
+		return;
+	if (list_empty(head)) {
+		list_splice_init(list, head);
+		return;
+	}
+
+	head->prev->next = NULL;
+	list->prev->next = NULL;
+	INIT_LIST_HEAD(list);
+	merge_final(priv, cmp, head, a, b);
+}
+
+/* A chunk of the list, sorted by a work item of list_sort_parallel() */
+struct list_sort_chunk {
+	struct zorowork work;
+	struct list_sort_par *par;
+	/* Sorted chunk, null-terminated, then the merges of its subtree */
+	struct list_head *list;
+	size_t index;
+	/* Set by whoever sorts the chunk: a work item, or the caller */
+	int claimed;
+	/* Arrivals at the pair this chunk is the right half of */
+	int arrive;
+};
+
+/*
+ * State shared by the chunks of a list_sort_parallel(), freed by the last
+ * of the caller and the work items to drop it: the caller does not wait for
+ * the work items, which may be queued behind it when it is one of them
+ */
+struct list_sort_par {
+	size_t nchunks;
+	void *priv;
+	list_cmp_func_t cmp;
+	/* Set when the halves of the root pair are done */
+	int done;
+	int refs;
+	struct list_sort_chunk chunks[];
+};
+
+static inline void chunk_futex_wake(int *uaddr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void chunk_futex_wait(int *uaddr, int val)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void chunk_put(struct list_sort_par *par)
+{
+	if (__atomic_sub_fetch(&par->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(par);
+}
+
+/*
+ * Sort a chunk, then walk up the merge tree: the pair of level k joins
+ * the subtrees [i, i + 2^k) and [i + 2^k, i + 2^(k+1)), for i multiple of
+ * 2^(k+1). The first half done leaves; the second one merges them, later
+ * partner last to keep the sort stable, then goes on with the next level.
+ * Nobody waits for anybody, so that the chunks can run as work items of a
+ * queue with any number of workers. The root pair, merged by the caller,
+ * restores the prev links.
+ */
+static void chunk_sort(struct list_sort_chunk *c)
+{
+	struct list_sort_par *par = c->par;
+	struct list_sort_chunk *chunks = par->chunks;
+	size_t i = c->index, l, r, step;
+	struct list_head *second;
+
+	c->list = presort(par->priv, par->cmp, c->list, &second, false);
+	c->list = merge(par->priv, par->cmp, c->list, second);
+
+	for (step = 1;; step <<= 1) {
+		if (i & step) {
+			l = i - step;
+			r = i;
+		} else {
+			l = i;
+			r = i + step;
+			if (r >= par->nchunks)
+				continue;
+		}
+		/* The results of both halves are visible to the last one */
+		if (!__atomic_fetch_add(&chunks[r].arrive, 1, __ATOMIC_ACQ_REL))
+			return;
+		if (!l && step * 2 >= par->nchunks) {
+			__atomic_store_n(&par->done, 1, __ATOMIC_RELEASE);
+			chunk_futex_wake(&par->done);
+			return;
+		}
+		chunks[l].list = merge(par->priv, par->cmp, chunks[l].list,
+				       chunks[r].list);
+		i = l;
+	}
+}
+
+static inline bool chunk_claim(struct list_sort_chunk *c)
+{
+	return !__atomic_exchange_n(&c->claimed, 1, __ATOMIC_ACQUIRE);
+}
+
+static void chunk_work(struct zorowork *work)
+{
+	struct list_sort_chunk *c = container_of(work, struct list_sort_chunk,
+						 work);
+	struct list_sort_par *par = c->par;
+
+	if (chunk_claim(c))
+		chunk_sort(c);
+	chunk_put(par);
 }
 
+__attribute__((nonnull(2,3)))
+void list_sort_parallel(void *priv, struct list_head *head,
+			list_cmp_func_t cmp, int nthreads)
+{
+	struct list_sort_chunk *chunks;
+	struct list_head *list, *second;
+	size_t count = 0, nchunks, size, i, j;
+	struct list_sort_par *par;
+	struct zorowq *wq;
+	LIST_HEAD(works);
+	long ncpus;
+
+	list_for_each(list, head)
+		count++;
+
+	if (nthreads <= 0) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpus > 0 ? ncpus : 1;
+	}
+	nchunks = count / LIST_SORT_PARALLEL_MIN;
+	if (nchunks > (size_t)nthreads)
+		nchunks = nthreads;
+	if (nchunks < 2)
+		goto serial;
+
+	par = calloc(1, sizeof(*par) + nchunks * sizeof(*chunks));
+	if (!par)
+		goto serial;
+
+	chunks = par->chunks;
+	par->nchunks = nchunks;
+	par->priv = priv;
+	par->cmp = cmp;
+	par->refs = 1;
+
+	/* Split into null-terminated chunks, the last one takes the rest */
+	head->prev->next = NULL;
+	list = head->next;
+	size = count / nchunks;
+	for (i = 0; i < nchunks; i++) {
+		zorowork_init(&chunks[i].work, chunk_work);
+		chunks[i].par = par;
+		chunks[i].list = list;
+		chunks[i].index = i;
+		if (i == nchunks - 1)
+			break;
+		for (j = 1; j < size; j++)
+			list = list->next;
+		second = list->next;
+		list->next = NULL;
+		list = second;
+	}
+
+	/* Without a queue, the caller sorts all the chunks itself */
+	wq = zorowq_system();
+	if (wq) {
+		for (i = 1; i < nchunks; i++)
+			list_add_tail(&chunks[i].work.entry, &works);
+		par->refs += nchunks - 1;
+		zorowq_queue_list(wq, &works);
+	}
+
+	/*
+	 * The first chunk is sorted by the caller, then any chunk no worker
+	 * took yet, e.g. because the caller is itself a work item of the
+	 * queue, keeping the workers busy with other items
+	 */
+	for (i = 0; i < nchunks; i++) {
+		if (chunk_claim(&chunks[i]))
+			chunk_sort(&chunks[i]);
+	}
+
+	/* All the chunks are claimed: the root pair completes without us */
+	while (!__atomic_load_n(&par->done, __ATOMIC_ACQUIRE))
+		chunk_futex_wait(&par->done, 0);
+
+	for (i = 1; i < nchunks; i <<= 1)
+		;
+	merge_final(priv, cmp, head, chunks[0].list, chunks[i >> 1].list);
+	chunk_put(par);
+	return;
+
+serial:
+	list_sort(priv, head, cmp);
+}
+
+/* Key of a node, gathered by list_sort_key() */
+struct list_sort_item {
+	uint64_t key;
+	struct list_head *node;
+};
+
+/* The key function of list_sort_key(), for list_sort() */
+struct list_sort_key_ctx {
+	void *priv;
+	list_key_func_t key;
+};
+
+static int key_cmp(void *priv, const struct list_head *a,
+		   const struct list_head *b)
+{
+	struct list_sort_key_ctx *ctx = priv;
+
+	return ctx->key(ctx->priv, a) > ctx->key(ctx->priv, b);
+}
+
+/*
+ * LSD radix sort, one byte per pass, of the keys of @a into @b: stable, and
+ * passes on a byte equal for all the keys are skipped. Returns the array the
+ * sorted items ended up in.
+ */
+static struct list_sort_item *radix_sort(struct list_sort_item *a,
+					 struct list_sort_item *b, size_t n)
+{
+	static const unsigned int passes = sizeof(uint64_t);
+	size_t (*count)[256], *c, i, sum, tmp;
+	struct list_sort_item *swap;
+	unsigned int p, shift;
+	uint64_t k;
+
+	count = calloc(passes, sizeof(*count));
+	if (!count)
+		return NULL;
+
+	/* All the histograms in one pass */
+	for (i = 0; i < n; i++) {
+		k = a[i].key;
+		for (p = 0; p < passes; p++, k >>= 8)
+			count[p][k & 0xff]++;
+	}
+
+	for (p = 0, shift = 0; p < passes; p++, shift += 8) {
+		c = count[p];
+		if (c[(a[0].key >> shift) & 0xff] == n)
+			continue;
+		/* Counts to starting offsets */
+		for (i = 0, sum = 0; i < 256; i++) {
+			tmp = c[i];
+			c[i] = sum;
+			sum += tmp;
+		}
+		for (i = 0; i < n; i++)
+			b[c[(a[i].key >> shift) & 0xff]++] = a[i];
+		swap = a;
+		a = b;
+		b = swap;
+	}
+	free(count);
+	return a;
+}
+
+__attribute__((nonnull(2,3)))
+void list_sort_key(void *priv, struct list_head *head, list_key_func_t key)
+{
+	struct list_sort_key_ctx ctx = { .priv = priv, .key = key };
+	struct list_sort_item *items, *sorted;
+	struct list_head *pos, *prev;
+	size_t n = 0, i;
+
+	list_for_each(pos, head)
+		n++;
+	if (n < 2)
+		return;
+
+	items = malloc(2 * n * sizeof(*items));
+	if (!items)
+		goto fallback;
+
+	i = 0;
+	list_for_each(pos, head) {
+		items[i].key = key(priv, pos);
+		items[i].node = pos;
+		i++;
+	}
+
+	sorted = radix_sort(items, items + n, n);
+	if (!sorted) {
+		free(items);
+		goto fallback;
+	}
+
+	/* Relink in one pass, prev links included */
+	prev = head;
+	for (i = 0; i < n; i++) {
+		prev->next = sorted[i].node;
+		sorted[i].node->prev = prev;
+		prev = sorted[i].node;
+	}
+	prev->next = head;
+	head->prev = prev;
+	free(items);
+	return;
+
+fallback:
+	list_sort(&ctx, head, key_cmp);
+}
@@ -0,0 +1,372 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/linux/list.h>
+#include <zoro/test.h>
+
+/* Above 2 * LIST_SORT_PARALLEL_MIN, for the parallel sort to split */
+#define NR_MAX		(5 * LIST_SORT_PARALLEL_MIN + 4321)
+
+struct item {
+	struct list_head list;
+	uint64_t key;
+	/* Position in the input, to check the stability */
+	uint32_t seq;
+};
+
+/* Inputs: few distinct keys make the stability matter */
+enum pattern {
+	PAT_RANDOM,
+	PAT_FEW_KEYS,
+	PAT_SORTED,
+	PAT_REVERSED,
+	PAT_EQUAL,
+	PAT_SAWTOOTH,
+	NR_PATTERNS,
+};
+
+struct sort_run {
+	struct item *items;
+	uint32_t *order;
+	uint32_t *expected;
+	unsigned int seed;
+};
+
+static unsigned int next_rand(unsigned int *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+static uint64_t pattern_key(struct sort_run *run, enum pattern pat, size_t i,
+			    size_t n)
+{
+	switch (pat) {
+	case PAT_FEW_KEYS:
+		return next_rand(&run->seed) % 7;
+	case PAT_SORTED:
+		return i / 3;
+	case PAT_REVERSED:
+		return (n - i) / 3;
+	case PAT_EQUAL:
+		return 42;
+	case PAT_SAWTOOTH:
+		return i % 1000;
+	default:
+		return ((uint64_t)next_rand(&run->seed) << 32) |
+		       next_rand(&run->seed);
+	}
+}
+
+/* Fill @a head with @a n items of pattern @a pat, the same for each seed */
+static void build(struct sort_run *run, struct list_head *head,
+		  enum pattern pat, size_t n, unsigned int seed)
+{
+	size_t i;
+
+	INIT_LIST_HEAD(head);
+	run->seed = seed;
+	for (i = 0; i < n; i++) {
+		run->items[i].key = pattern_key(run, pat, i, n);
+		run->items[i].seq = i;
+		list_add_tail(&run->items[i].list, head);
+	}
+}
+
+static int cmp_items(void *priv, const struct list_head *a,
+		     const struct list_head *b)
+{
+	const struct item *x = list_entry(a, struct item, list);
+	const struct item *y = list_entry(b, struct item, list);
+
+	(void)priv;
+	return x->key > y->key;
+}
+
+/*
+ * Store the order of the items of @a head in @a order, checking the links
+ * both ways; return the number of items, or -1 if the list is broken
+ */
+static long snapshot(struct list_head *head, uint32_t *order, size_t max)
+{
+	struct list_head *pos, *prev = head;
+	size_t n = 0;
+
+	list_for_each(pos, head) {
+		if (pos->prev != prev || n == max)
+			return -1;
+		order[n++] = list_entry(pos, struct item, list)->seq;
+		prev = pos;
+	}
+	return head->prev == prev ? (long)n : -1;
+}
+
+/* The order list_sort() gives to the input */
+static void reference(struct sort_run *run, enum pattern pat, size_t n,
+		      unsigned int seed)
+{
+	LIST_HEAD(head);
+
+	build(run, &head, pat, n, seed);
+	list_sort(NULL, &head, cmp_items);
+	snapshot(&head, run->expected, n);
+}
+
+/* Same order as list_sort(), hence sorted and stable too */
+static int check_order(struct sort_run *run, struct list_head *head,
+		       size_t n, const char *what, enum pattern pat)
+{
+	long got = snapshot(head, run->order, n);
+
+	if (got != (long)n ||
+	    memcmp(run->order, run->expected, n * sizeof(*run->order))) {
+		zorolog_error("%s, pattern %d, %zu items: not the order of "
+			      "list_sort()\n", what, pat, n);
+		return -1;
+	}
+	return 0;
+}
+
+static void free_run(void *arg)
+{
+	struct sort_run *run = arg;
+
+	free(run->items);
+	free(run->order);
+	free(run->expected);
+	free(run);
+}
+
+static struct sort_run *alloc_run(void)
+{
+	struct sort_run *run = calloc(1, sizeof(*run));
+
+	if (!run)
+		return NULL;
+	run->items = malloc(NR_MAX * sizeof(*run->items));
+	run->order = malloc(NR_MAX * sizeof(*run->order));
+	run->expected = malloc(NR_MAX * sizeof(*run->expected));
+	if (!run->items || !run->order || !run->expected) {
+		free_run(run);
+		return NULL;
+	}
+	return run;
+}
+
+/*
+ * list_sort_parallel() gives the order of list_sort(), for any number of
+ * chunks, the last one taking the rest, and below the parallel threshold
+ */
+static int test_sort_parallel(void)
+{
+	static const size_t counts[] = {
+		0, 1, 1000, 2 * LIST_SORT_PARALLEL_MIN - 1,
+		2 * LIST_SORT_PARALLEL_MIN, 2 * LIST_SORT_PARALLEL_MIN + 1,
+		3 * LIST_SORT_PARALLEL_MIN + 777, NR_MAX,
+	};
+	static const int threads[] = { 0, 1, 2, 3, 4, 7 };
+	struct sort_run *run = alloc_run();
+	unsigned int c, t, seed = 1;
+	enum pattern pat;
+	LIST_HEAD(head);
+
+	if (!run)
+		zorotest_fail("Cannot allocate the items\n");
+	zorotest_set_clear_on_fail(free_run, run);
+
+	for (c = 0; c < ARRAY_SIZE(counts); c++) {
+		for (pat = 0; pat < NR_PATTERNS; pat++, seed++) {
+			reference(run, pat, counts[c], seed);
+			for (t = 0; t < ARRAY_SIZE(threads); t++) {
+				/* One thread count per pattern is enough */
+				if (counts[c] < 2 * LIST_SORT_PARALLEL_MIN &&
+				    t != pat % ARRAY_SIZE(threads))
+					continue;
+				build(run, &head, pat, counts[c], seed);
+				list_sort_parallel(NULL, &head, cmp_items,
+						   threads[t]);
+				if (check_order(run, &head, counts[c],
+						"list_sort_parallel", pat))
+					zorotest_fail("Wrong parallel sort\n");
+			}
+		}
+	}
+
+	free_run(run);
+	zorotest_success();
+}
+
+static uint64_t key_item(void *priv, const struct list_head *a)
+{
+	(void)priv;
+	return list_entry(a, struct item, list)->key;
+}
+
+/* Keys sharing their high bytes, for the radix sort to skip passes */
+static uint64_t key_low_bytes(void *priv, const struct list_head *a)
+{
+	(void)priv;
+	return 0xabcd000000000000ULL |
+	       (list_entry(a, struct item, list)->key & 0xffffff);
+}
+
+static int cmp_low_bytes(void *priv, const struct list_head *a,
+			 const struct list_head *b)
+{
+	return key_low_bytes(priv, a) > key_low_bytes(priv, b);
+}
+
+/* list_sort_key() gives the order of list_sort() on the same keys */
+static int test_sort_key(void)
+{
+	static const size_t counts[] = {
+		0, 1, 2, 255, 1000, 2 * LIST_SORT_PARALLEL_MIN + 1, NR_MAX,
+	};
+	struct sort_run *run = alloc_run();
+	unsigned int c, seed = 1;
+	enum pattern pat;
+	LIST_HEAD(head);
+
+	if (!run)
+		zorotest_fail("Cannot allocate the items\n");
+	zorotest_set_clear_on_fail(free_run, run);
+
+	for (c = 0; c < ARRAY_SIZE(counts); c++) {
+		for (pat = 0; pat < NR_PATTERNS; pat++, seed++) {
+			reference(run, pat, counts[c], seed);
+			build(run, &head, pat, counts[c], seed);
+			list_sort_key(NULL, &head, key_item);
+			if (check_order(run, &head, counts[c], "list_sort_key",
+					pat))
+				zorotest_fail("Wrong key sort\n");
+
+			/* Same with the bytes common to all the keys */
+			build(run, &head, pat, counts[c], seed);
+			list_sort(NULL, &head, cmp_low_bytes);
+			snapshot(&head, run->expected, counts[c]);
+			build(run, &head, pat, counts[c], seed);
+			list_sort_key(NULL, &head, key_low_bytes);
+			if (check_order(run, &head, counts[c], "list_sort_key",
+					pat))
+				zorotest_fail("Wrong key sort, common bytes\n");
+		}
+	}
+
+	free_run(run);
+	zorotest_success();
+}
+
+/* list_sort_natural() gives the order of list_sort() */
+static int test_sort_natural(void)
+{
+	static const size_t counts[] = {
+		0, 1, 2, 3, 1000, 2 * LIST_SORT_PARALLEL_MIN + 1, NR_MAX,
+	};
+	struct sort_run *run = alloc_run();
+	unsigned int c, seed = 1;
+	enum pattern pat;
+	LIST_HEAD(head);
+
+	if (!run)
+		zorotest_fail("Cannot allocate the items\n");
+	zorotest_set_clear_on_fail(free_run, run);
+
+	for (c = 0; c < ARRAY_SIZE(counts); c++) {
+		for (pat = 0; pat < NR_PATTERNS; pat++, seed++) {
+			reference(run, pat, counts[c], seed);
+			build(run, &head, pat, counts[c], seed);
+			list_sort_natural(NULL, &head, cmp_items);
+			if (check_order(run, &head, counts[c],
+					"list_sort_natural", pat))
+				zorotest_fail("Wrong natural sort\n");
+		}
+	}
+
+	free_run(run);
+	zorotest_success();
+}
+
+/*
+ * Split the items of @a head between @a head and @a list, at random, each
+ * keeping its order
+ */
+static void split(struct sort_run *run, struct list_head *head,
+		  struct list_head *list, size_t n)
+{
+	size_t i;
+
+	INIT_LIST_HEAD(head);
+	INIT_LIST_HEAD(list);
+	for (i = 0; i < n; i++)
+		list_add_tail(&run->items[i].list,
+			      next_rand(&run->seed) & 1 ? list : head);
+}
+
+/*
+ * list_merge_sorted() of two sorted lists gives the order list_sort() gives
+ * to the first one followed by the second one
+ */
+static int test_merge_sorted(void)
+{
+	static const size_t counts[] = {
+		0, 1, 2, 1000, 2 * LIST_SORT_PARALLEL_MIN + 1, NR_MAX,
+	};
+	struct sort_run *run = alloc_run();
+	unsigned int c, seed = 1;
+	enum pattern pat;
+	LIST_HEAD(head);
+	LIST_HEAD(list);
+	size_t n;
+
+	if (!run)
+		zorotest_fail("Cannot allocate the items\n");
+	zorotest_set_clear_on_fail(free_run, run);
+
+	for (c = 0; c < ARRAY_SIZE(counts); c++) {
+		for (pat = 0; pat < NR_PATTERNS; pat++, seed++) {
+			n = counts[c];
+			build(run, &head, pat, n, seed);
+			split(run, &head, &list, n);
+			list_splice_tail_init(&list, &head);
+			list_sort(NULL, &head, cmp_items);
+			snapshot(&head, run->expected, n);
+
+			/* Same split again, from the same seed */
+			build(run, &head, pat, n, seed);
+			split(run, &head, &list, n);
+			list_sort(NULL, &head, cmp_items);
+			list_sort(NULL, &list, cmp_items);
+			list_merge_sorted(NULL, &head, &list, cmp_items);
+			zorotest_assert_true(list_empty(&list));
+			if (check_order(run, &head, n, "list_merge_sorted",
+					pat))
+				zorotest_fail("Wrong merge\n");
+
+			/* Into an empty list, and of an empty list */
+			list_merge_sorted(NULL, &list, &head, cmp_items);
+			zorotest_assert_true(list_empty(&head));
+			list_merge_sorted(NULL, &list, &head, cmp_items);
+			if (check_order(run, &list, n, "list_merge_sorted",
+					pat))
+				zorotest_fail("Wrong merge with empty list\n");
+		}
+	}
+
+	free_run(run);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_sort_parallel),
+		ZOROTEST_CASE(test_sort_key),
+		ZOROTEST_CASE(test_sort_natural),
+		ZOROTEST_CASE(test_merge_sorted),
+	};
+
+	return zorotest_run_suite(tests, "list", NULL);
+}
@@ -0,0 +1,253 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/linux/llist.h>
+#include <zoro/test.h>
+
+#define NR_PRODUCERS	4
+#define NR_NODES	200000
+#define BATCH		16
+
+struct item {
+	struct llist_node node;
+	unsigned int producer;
+	unsigned int seq;
+};
+
+/* State of a test, for it to run along with the others */
+struct run {
+	struct llist_head queue;
+	struct item *items;
+	unsigned int producers_done;
+	pthread_t threads[NR_PRODUCERS];
+	struct producer {
+		struct run *run;
+		unsigned int id;
+	} producers[NR_PRODUCERS];
+};
+
+static void *producer(void *arg)
+{
+	struct producer *p = arg;
+	unsigned int id = p->id;
+	struct item *it = &p->run->items[id * NR_NODES];
+	unsigned int i;
+
+	for (i = 0; i < NR_NODES; i++) {
+		it[i].producer = id;
+		it[i].seq = i;
+		llist_add(&it[i].node, &p->run->queue);
+	}
+	__atomic_add_fetch(&p->run->producers_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* Same, but pushing chains of BATCH nodes at once */
+static void *batch_producer(void *arg)
+{
+	struct producer *p = arg;
+	unsigned int id = p->id;
+	struct item *it = &p->run->items[id * NR_NODES];
+	unsigned int i, j;
+
+	for (i = 0; i < NR_NODES; i += BATCH) {
+		for (j = i; j < i + BATCH; j++) {
+			it[j].producer = id;
+			it[j].seq = j;
+		}
+		/* Newest first, like the nodes pushed one at a time */
+		for (j = i + 1; j < i + BATCH; j++)
+			it[j].node.next = &it[j - 1].node;
+		llist_add_batch(&it[i + BATCH - 1].node, &it[i].node,
+				&p->run->queue);
+	}
+	__atomic_add_fetch(&p->run->producers_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void free_run(void *arg)
+{
+	struct run *run = arg;
+
+	free(run->items);
+	free(run);
+}
+
+static struct run *alloc_run(void)
+{
+	struct run *run = calloc(1, sizeof(*run));
+
+	if (!run)
+		return NULL;
+	init_llist_head(&run->queue);
+	run->items = calloc(NR_PRODUCERS * NR_NODES, sizeof(*run->items));
+	if (!run->items) {
+		free(run);
+		return NULL;
+	}
+	return run;
+}
+
+static int start_producers(struct run *run, void *(*fn)(void *))
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_PRODUCERS; i++) {
+		run->producers[i].run = run;
+		run->producers[i].id = i;
+		if (pthread_create(&run->threads[i], NULL, fn,
+				   &run->producers[i]))
+			return -1;
+	}
+	return 0;
+}
+
+static void join_producers(struct run *run)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_PRODUCERS; i++)
+		pthread_join(run->threads[i], NULL);
+}
+
+/*
+ * Drain the queue with llist_del_all() while the producers run: once
+ * reversed, every batch must continue the sequence of each producer.
+ */
+static int run_del_all(void *(*fn)(void *))
+{
+	struct run *run;
+	unsigned int next[NR_PRODUCERS] = { 0 };
+	struct llist_node *batch;
+	struct item *it, *tmp;
+	unsigned long total = 0, batches = 0;
+	unsigned int done;
+
+	run = alloc_run();
+	if (!run)
+		zorotest_fail("Cannot allocate the nodes\n");
+	if (start_producers(run, fn))
+		zorotest_fail("Cannot create the producers\n");
+
+	do {
+		done = __atomic_load_n(&run->producers_done, __ATOMIC_ACQUIRE);
+		batch = llist_del_all(&run->queue);
+		if (!batch)
+			continue;
+		batches++;
+		batch = llist_reverse_order(batch);
+		llist_for_each_entry_safe(it, tmp, batch, node) {
+			zorotest_assert_true(it->producer < NR_PRODUCERS);
+			zorotest_assert_eq_nums(next[it->producer], it->seq,
+						"%u");
+			next[it->producer]++;
+			it->node.next = NULL;
+			total++;
+		}
+	} while (done < NR_PRODUCERS || !llist_empty(&run->queue));
+
+	join_producers(run);
+	free_run(run);
+	zorotest_assert_eq_nums((unsigned long)NR_PRODUCERS * NR_NODES, total,
+				"%lu");
+	zorotest_verbose("%lu nodes in %lu batches\n", total, batches);
+	zorotest_success();
+}
+
+static int test_del_all(void)
+{
+	return run_del_all(producer);
+}
+
+static int test_add_batch(void)
+{
+	return run_del_all(batch_producer);
+}
+
+/*
+ * A single consumer popping with llist_del_first(): nodes of a producer
+ * come out newest first within what was pushed meanwhile, so only check
+ * that each one is seen exactly once.
+ */
+static int test_del_first(void)
+{
+	struct run *run;
+	struct llist_node *node;
+	struct item *it;
+	unsigned char *seen;
+	unsigned long total = 0;
+	unsigned int done;
+
+	seen = calloc(NR_PRODUCERS * NR_NODES, 1);
+	if (!seen)
+		zorotest_fail("Cannot allocate the nodes bitmap\n");
+	zorotest_set_clear_on_fail(free, seen);
+	run = alloc_run();
+	if (!run)
+		zorotest_fail("Cannot allocate the nodes\n");
+
+	if (start_producers(run, producer))
+		zorotest_fail("Cannot create the producers\n");
+
+	do {
+		done = __atomic_load_n(&run->producers_done, __ATOMIC_ACQUIRE);
+		while ((node = llist_del_first(&run->queue))) {
+			it = llist_entry(node, struct item, node);
+			zorotest_assert_true(it->producer < NR_PRODUCERS);
+			zorotest_assert_false(
+				seen[it->producer * NR_NODES + it->seq]);
+			seen[it->producer * NR_NODES + it->seq] = 1;
+			total++;
+		}
+	} while (done < NR_PRODUCERS || !llist_empty(&run->queue));
+
+	join_producers(run);
+	free_run(run);
+	zorotest_assert_eq_nums((unsigned long)NR_PRODUCERS * NR_NODES, total,
+				"%lu");
+	free(seen);
+	zorotest_success();
+}
+
+static int test_reverse(void)
+{
+	struct item it[8];
+	struct llist_node *first;
+	struct item *pos;
+	LLIST_HEAD(head);
+	unsigned int i;
+
+	zorotest_assert_true(llist_empty(&head));
+	zorotest_assert_true(llist_reverse_order(NULL) == NULL);
+
+	for (i = 0; i < ARRAY_SIZE(it); i++) {
+		it[i].seq = i;
+		zorotest_assert_eq_nums(i == 0, __llist_add(&it[i].node, &head),
+					"%d");
+	}
+
+	i = ARRAY_SIZE(it);
+	llist_for_each_entry(pos, head.first, node)
+		zorotest_assert_eq_nums(--i, pos->seq, "%u");
+
+	first = llist_reverse_order(__llist_del_all(&head));
+	zorotest_assert_true(llist_empty(&head));
+	i = 0;
+	llist_for_each_entry(pos, first, node)
+		zorotest_assert_eq_nums(i++, pos->seq, "%u");
+	zorotest_assert_eq_nums((unsigned int)ARRAY_SIZE(it), i, "%u");
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_reverse),
+		ZOROTEST_CASE(test_del_all),
+		ZOROTEST_CASE(test_add_batch),
+		ZOROTEST_CASE(test_del_first),
+	};
+
+	return zorotest_run_suite(tests, "llist", NULL);
+}
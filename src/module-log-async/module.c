@@ -0,0 +1,662 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <zoro/log.h>
+#include <zoro/sink.h>
+#include <zoro/compiler.h>
+#include <zoro/workqueue.h>
+
+#ifndef ZOROLOG_ASYNC_SLOT_SIZE
+/* Size of a ring slot; records longer than the payload are moved to heap */
+#define ZOROLOG_ASYNC_SLOT_SIZE 256
+#endif
+
+#ifndef ZOROLOG_ASYNC_RING_SLOTS
+/* Default number of slots, used when zorolog_async_start() gets 0 */
+#define ZOROLOG_ASYNC_RING_SLOTS 4096
+#endif
+
+/* Max records gathered in a single writev() by the drain thread */
+#define ZOROLOG_ASYNC_BATCH 64
+/* Upper bound to the drain thread sleep, in milliseconds */
+#define ZOROLOG_ASYNC_IDLE_MSEC 100
+/* Max file descriptors with an io_uring sink; the others use writev() */
+#define ZOROLOG_ASYNC_MAX_SINKS 4
+
+#define SLOT_EXTERNAL 0x1
+
+struct zorolog_async_slot {
+	uint64_t seq;
+	int fd;
+	uint16_t flags;
+	uint16_t len;
+	union {
+		char data[ZOROLOG_ASYNC_SLOT_SIZE - 16];
+		struct {
+			char *buf;
+			size_t len;
+		} ext;
+	};
+} ____cacheline_aligned;
+
+/*
+ * MPSC bounded queue (D. Vyukov's sequence-numbered ring, with a single
+ * consumer): producers reserve a slot with a CAS on @a tail, format into it
+ * and publish it by storing its sequence number; the drain thread is the only
+ * one advancing @a head (with ZOROLOG_ASYNC_WORKQUEUE, whoever holds
+ * @a draining).
+ */
+struct zorolog_async {
+	uint64_t tail ____cacheline_aligned;
+	uint64_t head ____cacheline_aligned;
+	/* Records up to here reached the kernel */
+	uint64_t done;
+	/* Records up to here were submitted to the sinks */
+	uint64_t submitted;
+	/*
+	 * Set while the drain thread sleeps; with ZOROLOG_ASYNC_WORKQUEUE,
+	 * while no drain work is queued or running
+	 */
+	int sleeping ____cacheline_aligned;
+	/* With ZOROLOG_ASYNC_WORKQUEUE, set by whoever is draining the ring */
+	int draining;
+	int running;
+	int active;
+	int flags;
+	uint64_t dropped;
+	uint64_t mask;
+	struct zorolog_async_slot *ring;
+	pthread_t drainer;
+	struct zorowq *wq;
+	struct zorowork work;
+	int nsinks;
+	struct {
+		int fd;
+		struct zorolog_sink *sink;
+	} sinks[ZOROLOG_ASYNC_MAX_SINKS];
+	/* Sink written to last, whose writes may not be complete yet */
+	struct zorolog_sink *pending;
+};
+
+static struct zorolog_async zlasync;
+static pthread_mutex_t zlasync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void __zorolog_futex_wake(int *uaddr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void __zorolog_futex_wait(int *uaddr, int val, long msec)
+{
+	struct timespec ts = {
+		.tv_sec = msec / 1000,
+		.tv_nsec = (msec % 1000) * 1000000L,
+	};
+
+	syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static inline void __zorolog_async_kick(struct zorolog_async *a)
+{
+	if (__atomic_load_n(&a->sleeping, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&a->sleeping, 0, __ATOMIC_SEQ_CST)) {
+		if (a->flags & ZOROLOG_ASYNC_WORKQUEUE)
+			zorowq_queue(a->wq, &a->work);
+		else
+			__zorolog_futex_wake(&a->sleeping);
+	}
+}
+
+static ssize_t __zorolog_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret, total = 0;
+
+	while (iovcnt > 0) {
+		ret = writev(fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		total += ret;
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return total;
+}
+
+static struct zorolog_sink *__zorolog_async_sink(struct zorolog_async *a,
+						 int fd)
+{
+	struct zorolog_sink *s;
+	int i;
+
+	for (i = 0; i < a->nsinks; i++)
+		if (a->sinks[i].fd == fd)
+			return a->sinks[i].sink;
+	if (a->nsinks == ZOROLOG_ASYNC_MAX_SINKS)
+		return NULL;
+
+	/* Remember failures as well, not to try again for every batch */
+	s = zorolog_sink_open(fd, 0, 0, 0);
+	if (s && !zorolog_sink_uring(s)) {
+		zorolog_sink_close(s);
+		s = NULL;
+	}
+	a->sinks[a->nsinks].fd = fd;
+	a->sinks[a->nsinks].sink = s;
+	a->nsinks++;
+	return s;
+}
+
+/*
+ * Two fds can be the same file (e.g. with 2>&1): before switching fd, what
+ * the sink of the previous one holds is written out, to keep the records in
+ * ring order. Records alternating between fds thus wait for each other.
+ */
+static void __zorolog_async_write(struct zorolog_async *a, int fd,
+				  struct iovec *iov, int iovcnt)
+{
+	struct zorolog_sink *s = NULL;
+
+	if (a->flags & ZOROLOG_ASYNC_URING)
+		s = __zorolog_async_sink(a, fd);
+	if (a->pending && a->pending != s) {
+		zorolog_sink_flush(a->pending);
+		a->pending = NULL;
+	}
+	if (s && zorolog_sink_writev(s, iov, iovcnt) >= 0) {
+		a->pending = s;
+		return;
+	}
+	/* Same for what the sink of this fd holds */
+	if (s)
+		zorolog_sink_flush(s);
+	a->pending = NULL;
+	(void)__zorolog_writev_all(fd, iov, iovcnt);
+}
+
+/*
+ * Advance @a done. Without @a wait, the sinks only wait for their previous
+ * submission, so @a done lags by one round.
+ */
+static void __zorolog_async_sync(struct zorolog_async *a, int wait)
+{
+	uint64_t head = a->head;
+	int i;
+
+	if (!a->nsinks) {
+		__atomic_store_n(&a->done, head, __ATOMIC_RELEASE);
+		return;
+	}
+
+	for (i = 0; i < a->nsinks; i++) {
+		if (!a->sinks[i].sink)
+			continue;
+		if (wait)
+			zorolog_sink_flush(a->sinks[i].sink);
+		else
+			zorolog_sink_submit(a->sinks[i].sink);
+	}
+	if (wait)
+		a->pending = NULL;
+	__atomic_store_n(&a->done, wait ? head : a->submitted,
+			 __ATOMIC_RELEASE);
+	a->submitted = head;
+}
+
+static void __zorolog_async_close_sinks(struct zorolog_async *a)
+{
+	int i;
+
+	__zorolog_async_sync(a, 1);
+	for (i = 0; i < a->nsinks; i++)
+		zorolog_sink_close(a->sinks[i].sink);
+	a->nsinks = 0;
+}
+
+static inline struct zorolog_async_slot *
+__zorolog_async_ready(struct zorolog_async *a, uint64_t pos)
+{
+	struct zorolog_async_slot *s = &a->ring[pos & a->mask];
+
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return NULL;
+	return s;
+}
+
+/*
+ * Write out all the consecutive published records starting at @a head,
+ * grouping records directed to the same fd in a single writev().
+ * Return the number of records consumed.
+ */
+static size_t __zorolog_async_drain(struct zorolog_async *a)
+{
+	struct iovec iov[ZOROLOG_ASYNC_BATCH];
+	struct zorolog_async_slot *s;
+	uint64_t head, first;
+	size_t total = 0;
+	int cnt, fd;
+
+	head = a->head;
+	while ((s = __zorolog_async_ready(a, head)) != NULL) {
+		first = head;
+		fd = s->fd;
+		cnt = 0;
+		do {
+			if (s->flags & SLOT_EXTERNAL) {
+				iov[cnt].iov_base = s->ext.buf;
+				iov[cnt].iov_len = s->ext.len;
+			} else {
+				iov[cnt].iov_base = s->data;
+				iov[cnt].iov_len = s->len;
+			}
+			cnt++;
+			head++;
+		} while (cnt < ZOROLOG_ASYNC_BATCH &&
+			 (s = __zorolog_async_ready(a, head)) != NULL &&
+			 s->fd == fd);
+
+		__zorolog_async_write(a, fd, iov, cnt);
+
+		/* Give the slots back to the producers */
+		for (; first != head; first++) {
+			s = &a->ring[first & a->mask];
+			if (s->flags & SLOT_EXTERNAL)
+				free(s->ext.buf);
+			__atomic_store_n(&s->seq, first + a->mask + 1,
+					 __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&a->head, head, __ATOMIC_RELEASE);
+		total += cnt;
+	}
+	return total;
+}
+
+static void __zorolog_async_report_dropped(struct zorolog_async *a)
+{
+	uint64_t dropped;
+	char msg[64];
+	int len;
+
+	dropped = __atomic_exchange_n(&a->dropped, 0, __ATOMIC_RELAXED);
+	if (likely(!dropped))
+		return;
+	len = snprintf(msg, sizeof(msg), "zorolog: %lu messages dropped\n",
+		       (unsigned long)dropped);
+	(void)!write(STDERR_FILENO, msg, len);
+}
+
+static void *__zorolog_async_drainer(void *arg)
+{
+	struct zorolog_async *a = arg;
+
+	for (;;) {
+		if (__zorolog_async_drain(a)) {
+			__zorolog_async_sync(a, 0);
+			__zorolog_async_report_dropped(a);
+			continue;
+		}
+		__zorolog_async_sync(a, 1);
+
+		if (!__atomic_load_n(&a->running, __ATOMIC_ACQUIRE))
+			break;
+
+		/*
+		 * Announce we are going to sleep, then check again: any
+		 * producer publishing after this point sees the flag set.
+		 */
+		__atomic_store_n(&a->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__zorolog_async_ready(a, a->head) ||
+		    !__atomic_load_n(&a->running, __ATOMIC_SEQ_CST)) {
+			__atomic_store_n(&a->sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		__zorolog_futex_wait(&a->sleeping, 1, ZOROLOG_ASYNC_IDLE_MSEC);
+		__atomic_store_n(&a->sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	/* Let late producers find the queue closed, then flush leftovers */
+	__zorolog_async_drain(a);
+	__zorolog_async_report_dropped(a);
+	return NULL;
+}
+
+/*
+ * With ZOROLOG_ASYNC_WORKQUEUE, drain the ring from the calling thread,
+ * unless somebody else is draining it: producers waiting for room, and
+ * flushers, may be work items the drain work is queued behind. Return
+ * whether the ring was drained.
+ *
+ * Whoever drains re-arms the drain work when it is done, then looks for
+ * records published meanwhile: the drain work itself, when it finds
+ * somebody else draining, can just return.
+ */
+static int __zorolog_async_help(struct zorolog_async *a)
+{
+	if (__atomic_exchange_n(&a->draining, 1, __ATOMIC_ACQUIRE))
+		return 0;
+
+	for (;;) {
+		/*
+		 * Once stopped, the ring and the sinks belong to
+		 * zorolog_async_stop(), then to zorolog_async_start(), which
+		 * may bring the drain thread back instead of the drain work
+		 */
+		if (!__atomic_load_n(&a->running, __ATOMIC_ACQUIRE) ||
+		    !(a->flags & ZOROLOG_ASYNC_WORKQUEUE)) {
+			__atomic_store_n(&a->draining, 0, __ATOMIC_RELEASE);
+			return 0;
+		}
+
+		/* No need to queue the drain work while we are at it */
+		__atomic_store_n(&a->sleeping, 0, __ATOMIC_RELAXED);
+		while (__zorolog_async_drain(a)) {
+			__zorolog_async_sync(a, 0);
+			__zorolog_async_report_dropped(a);
+		}
+		__zorolog_async_sync(a, 1);
+
+		/*
+		 * Same as the drain thread going to sleep: any producer
+		 * publishing after this point queues the drain work, and
+		 * anybody draining after this point re-arms it in turn
+		 */
+		__atomic_store_n(&a->draining, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&a->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&a->draining, 1, __ATOMIC_SEQ_CST))
+			return 1;
+		if (!__zorolog_async_ready(a, a->head)) {
+			__atomic_store_n(&a->draining, 0, __ATOMIC_RELEASE);
+			return 1;
+		}
+	}
+}
+
+/* The drain thread of ZOROLOG_ASYNC_WORKQUEUE, as a work item */
+static void __zorolog_async_drain_work(struct zorowork *work)
+{
+	struct zorolog_async *a = container_of(work, struct zorolog_async,
+					       work);
+
+	__zorolog_async_help(a);
+}
+
+/*
+ * Reserve a slot for a new record. Return NULL if the ring is full and the
+ * caller must not wait for room.
+ */
+static struct zorolog_async_slot *
+__zorolog_async_reserve(struct zorolog_async *a, uint64_t *ppos)
+{
+	struct zorolog_async_slot *s;
+	uint64_t pos, seq;
+	int64_t diff;
+
+	pos = __atomic_load_n(&a->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		s = &a->ring[pos & a->mask];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		diff = (int64_t)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&a->tail, &pos, pos + 1,
+							1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Ring full */
+			if (a->flags & ZOROLOG_ASYNC_DROP)
+				return NULL;
+			__zorolog_async_kick(a);
+			if (!(a->flags & ZOROLOG_ASYNC_WORKQUEUE) ||
+			    !__zorolog_async_help(a))
+				sched_yield();
+			pos = __atomic_load_n(&a->tail, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&a->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	*ppos = pos;
+	return s;
+}
+
+int zorolog_async_fprintf(FILE *stream, const char *format, ...)
+{
+	struct zorolog_async *a = &zlasync;
+	struct zorolog_async_slot *s;
+	va_list args, args2;
+	uint64_t pos;
+	int ret;
+
+	va_start(args, format);
+	if (unlikely(!__atomic_load_n(&a->active, __ATOMIC_ACQUIRE))) {
+		ret = vfprintf(stream, format, args);
+		va_end(args);
+		return ret;
+	}
+
+	s = __zorolog_async_reserve(a, &pos);
+	if (unlikely(!s)) {
+		__atomic_fetch_add(&a->dropped, 1, __ATOMIC_RELAXED);
+		va_end(args);
+		return 0;
+	}
+
+	s->fd = fileno(stream);
+	s->flags = 0;
+	va_copy(args2, args);
+	ret = vsnprintf(s->data, sizeof(s->data), format, args);
+	if (unlikely(ret < 0)) {
+		s->len = 0;
+	} else if (likely((size_t)ret < sizeof(s->data))) {
+		s->len = ret;
+	} else {
+		/* Record too long for a slot: keep it on the heap */
+		s->ext.buf = malloc(ret + 1);
+		if (s->ext.buf) {
+			vsnprintf(s->ext.buf, ret + 1, format, args2);
+			s->ext.len = ret;
+			s->flags = SLOT_EXTERNAL;
+		} else {
+			s->len = sizeof(s->data) - 1;
+		}
+	}
+	va_end(args2);
+	va_end(args);
+
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_SEQ_CST);
+	__zorolog_async_kick(a);
+
+	return ret;
+}
+
+static void __zorolog_async_atfork_child(void)
+{
+	/* The drain thread does not exist in the child: go synchronous */
+	zlasync.active = 0;
+	zlasync.running = 0;
+	/* Nor does the queue the drain work may be pending on */
+	zlasync.draining = 0;
+	zorowork_init(&zlasync.work, __zorolog_async_drain_work);
+	pthread_mutex_init(&zlasync_lock, NULL);
+}
+
+static void __zorolog_async_atexit(void)
+{
+	zorolog_async_stop();
+}
+
+int zorolog_async_start(size_t slots, int flags)
+{
+	static int registered;
+	struct zorolog_async *a = &zlasync;
+	size_t i;
+	int ret;
+
+	if (flags & ~(ZOROLOG_ASYNC_DROP | ZOROLOG_ASYNC_URING |
+		      ZOROLOG_ASYNC_WORKQUEUE))
+		return -EINVAL;
+
+	if (!slots)
+		slots = ZOROLOG_ASYNC_RING_SLOTS;
+	if (slots & (slots - 1))
+		return -EINVAL;
+
+	pthread_mutex_lock(&zlasync_lock);
+	if (a->active) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	/*
+	 * The drain work may still be queued from the previous run: keep it
+	 * off the ring, and the sinks, while they are set up again
+	 */
+	while (__atomic_exchange_n(&a->draining, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	/*
+	 * The ring survives zorolog_async_stop(), since late producers may
+	 * still be touching it: reuse it whenever possible.
+	 */
+	if (a->ring && a->mask != slots - 1) {
+		free(a->ring);
+		a->ring = NULL;
+	}
+	if (!a->ring) {
+		a->ring = aligned_alloc(SMP_CACHE_BYTES, slots * sizeof(*a->ring));
+		if (!a->ring) {
+			ret = -ENOMEM;
+			goto release;
+		}
+	}
+	for (i = 0; i < slots; i++)
+		a->ring[i].seq = i;
+
+	a->mask = slots - 1;
+	a->head = 0;
+	a->done = 0;
+	a->submitted = 0;
+	a->nsinks = 0;
+	a->pending = NULL;
+	a->tail = 0;
+	a->dropped = 0;
+	a->sleeping = 0;
+	a->flags = flags;
+	a->running = 1;
+
+	/* Whatever stdio still holds must come before the async records */
+	fflush(stdout);
+	fflush(stderr);
+
+	if (flags & ZOROLOG_ASYNC_WORKQUEUE) {
+		a->wq = zorowq_system();
+		if (!a->wq) {
+			ret = -errno;
+			a->running = 0;
+			goto release;
+		}
+		/* Once and for all: it may still be pending */
+		if (!a->work.func)
+			zorowork_init(&a->work, __zorolog_async_drain_work);
+		/* The first record queues the drain work */
+		a->sleeping = 1;
+		ret = 0;
+	} else {
+		ret = -pthread_create(&a->drainer, NULL,
+				      __zorolog_async_drainer, a);
+		if (ret) {
+			a->running = 0;
+			goto release;
+		}
+	}
+
+	if (!registered) {
+		pthread_atfork(NULL, NULL, __zorolog_async_atfork_child);
+		atexit(__zorolog_async_atexit);
+		registered = 1;
+	}
+	__atomic_store_n(&a->active, 1, __ATOMIC_RELEASE);
+
+release:
+	__atomic_store_n(&a->draining, 0, __ATOMIC_RELEASE);
+unlock:
+	pthread_mutex_unlock(&zlasync_lock);
+	return ret;
+}
+
+int zorolog_async_flush(void)
+{
+	struct zorolog_async *a = &zlasync;
+	uint64_t target;
+
+	if (!__atomic_load_n(&a->active, __ATOMIC_ACQUIRE))
+		return -EINVAL;
+
+	target = __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&a->done, __ATOMIC_ACQUIRE) < target) {
+		__zorolog_async_kick(a);
+		if (!(a->flags & ZOROLOG_ASYNC_WORKQUEUE) ||
+		    !__zorolog_async_help(a))
+			sched_yield();
+	}
+	return 0;
+}
+
+void zorolog_async_stop(void)
+{
+	struct zorolog_async *a = &zlasync;
+
+	pthread_mutex_lock(&zlasync_lock);
+	if (!a->active)
+		goto unlock;
+
+	/* New records go synchronous from now on */
+	__atomic_store_n(&a->active, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&a->running, 0, __ATOMIC_SEQ_CST);
+	if (a->flags & ZOROLOG_ASYNC_WORKQUEUE) {
+		/*
+		 * Wait for whoever is draining the ring to be done. The drain
+		 * work is not waited for: it may be queued behind the caller,
+		 * and once it runs it finds the backend stopped.
+		 */
+		while (__atomic_exchange_n(&a->draining, 1, __ATOMIC_ACQUIRE))
+			sched_yield();
+		__zorolog_async_drain(a);
+		__zorolog_async_report_dropped(a);
+	} else {
+		__atomic_store_n(&a->sleeping, 0, __ATOMIC_SEQ_CST);
+		__zorolog_futex_wake(&a->sleeping);
+		pthread_join(a->drainer, NULL);
+	}
+
+	/* Producers that raced with the stop may still be publishing */
+	while (__atomic_load_n(&a->head, __ATOMIC_ACQUIRE) !=
+	       __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE)) {
+		if (!__zorolog_async_drain(a))
+			sched_yield();
+	}
+	__zorolog_async_close_sinks(a);
+	__atomic_store_n(&a->draining, 0, __ATOMIC_RELEASE);
+
+unlock:
+	pthread_mutex_unlock(&zlasync_lock);
+}
@@ -0,0 +1,236 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zoro/log.h>
+#include <zoro/test.h>
+
+#define NR_PRODUCERS	4
+#define NR_RECORDS	20000
+/* Small enough for the producers to keep filling it */
+#define NR_SLOTS	64
+
+/* Records of the child process, after the fork */
+#define CHILD_ID	NR_PRODUCERS
+#define NR_CHILD	1000
+
+struct producer {
+	FILE *out;
+	unsigned int id;
+	/* Fork once half of the records are queued */
+	int fork;
+	pid_t child;
+};
+
+struct check {
+	/* Next record expected from each producer, and the child */
+	unsigned long next[NR_PRODUCERS + 1];
+	unsigned long lines;
+	unsigned int errors;
+};
+
+/* Synchronous in the child, which only writes its own records */
+static void __attribute__((noreturn)) child(FILE *out)
+{
+	unsigned long i;
+
+	for (i = 0; i < NR_CHILD; i++)
+		zorolog_async_fprintf(out, "%u %lu\n", CHILD_ID, i);
+	/* As at exit, sparing the stdio buffers of the parent */
+	zorolog_async_stop();
+	fflush(out);
+	_exit(0);
+}
+
+static void *producer(void *arg)
+{
+	struct producer *p = arg;
+	unsigned long i;
+
+	for (i = 0; i < NR_RECORDS; i++) {
+		if (p->fork && i == NR_RECORDS / 2) {
+			p->child = fork();
+			if (!p->child)
+				child(p->out);
+		}
+		zorolog_async_fprintf(p->out, "%u %lu\n", p->id, i);
+	}
+	return NULL;
+}
+
+static void stop_async(void *arg)
+{
+	zorolog_async_stop();
+	fclose(arg);
+}
+
+/*
+ * Read back the records: with @dropping, some may be missing, but none is
+ * duplicated or out of order within its producer
+ */
+static void check_records(FILE *out, int dropping, struct check *c)
+{
+	unsigned long seq;
+	unsigned int id;
+	char line[64];
+
+	memset(c, 0, sizeof(*c));
+	fseek(out, 0, SEEK_SET);
+	while (fgets(line, sizeof(line), out)) {
+		c->lines++;
+		if (sscanf(line, "%u %lu", &id, &seq) != 2 || id > CHILD_ID ||
+		    seq < c->next[id] || (!dropping && seq != c->next[id])) {
+			if (!c->errors++)
+				zorotest_verbose("Unexpected record: %s", line);
+			continue;
+		}
+		c->next[id] = seq + 1;
+	}
+}
+
+static int run_producers(int flags, int fork)
+{
+	struct producer p[NR_PRODUCERS];
+	pthread_t threads[NR_PRODUCERS];
+	unsigned int i, started = 0, waited;
+	struct check c;
+	int status, dropping = flags & ZOROLOG_ASYNC_DROP;
+	FILE *out;
+
+	out = tmpfile();
+	if (!out)
+		zorotest_fail("Cannot create the log file\n");
+	if (zorolog_async_start(NR_SLOTS, flags)) {
+		fclose(out);
+		zorotest_fail("Cannot start the asynchronous backend\n");
+	}
+	zorotest_set_clear_on_fail(stop_async, out);
+
+	for (i = 0; i < NR_PRODUCERS; i++) {
+		p[i] = (struct producer){
+			.out = out, .id = i, .fork = fork && !i, .child = -1,
+		};
+		if (pthread_create(&threads[i], NULL, producer, &p[i]))
+			break;
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	zorotest_assert_eq_nums(NR_PRODUCERS, started, "%u");
+
+	if (fork) {
+		zorotest_assert_true(p[0].child > 0);
+		/* Waiting for a drain thread it does not have, it is stuck */
+		for (waited = 0; waited < 1000; waited++) {
+			if (waitpid(p[0].child, &status, WNOHANG))
+				break;
+			usleep(10000);
+		}
+		if (waited == 1000) {
+			kill(p[0].child, SIGKILL);
+			waitpid(p[0].child, &status, 0);
+			zorotest_fail("Child still logging after 10 s\n");
+		}
+		zorotest_assert_true(WIFEXITED(status) &&
+				     !WEXITSTATUS(status));
+	}
+
+	/* Stopping drains what is left */
+	zorolog_async_stop();
+	check_records(out, dropping, &c);
+	zorotest_verbose("%lu records\n", c.lines);
+	zorotest_assert_eq_nums(0u, c.errors, "%u");
+	for (i = 0; i < NR_PRODUCERS && !dropping; i++)
+		zorotest_assert_eq_nums((unsigned long)NR_RECORDS, c.next[i],
+					"%lu");
+	zorotest_assert_eq_nums(fork ? (unsigned long)NR_CHILD : 0ul,
+				c.next[CHILD_ID], "%lu");
+	if (dropping)
+		zorotest_assert_true(c.lines > 0);
+
+	zorotest_unset_clear_on_fail();
+	fclose(out);
+	zorotest_success();
+}
+
+/* Producers waiting for room: every record written once, in order */
+static int test_block(void)
+{
+	return run_producers(0, 0);
+}
+
+/* Records dropped when the ring is full: never duplicated nor reordered */
+static int test_drop(void)
+{
+	return run_producers(ZOROLOG_ASYNC_DROP, 0);
+}
+
+/* Drained by work items rather than by the drain thread */
+static int test_workqueue(void)
+{
+	return run_producers(ZOROLOG_ASYNC_WORKQUEUE, 0);
+}
+
+/* Written through io_uring sinks, when available */
+static int test_uring(void)
+{
+	return run_producers(ZOROLOG_ASYNC_URING, 0);
+}
+
+/*
+ * A child forked amid the producers logs synchronously, and its exit does
+ * not write the records the parent left in the ring a second time
+ */
+static int test_fork(void)
+{
+	return run_producers(0, 1);
+}
+
+/* Records queued before being started, or after stopping, are not lost */
+static int test_restart(void)
+{
+	struct check c;
+	FILE *out;
+
+	out = tmpfile();
+	if (!out)
+		zorotest_fail("Cannot create the log file\n");
+	zorotest_set_clear_on_fail(stop_async, out);
+
+	zorolog_async_fprintf(out, "0 0\n");
+	fflush(out);
+	zorotest_assert_eq_nums(0, zorolog_async_start(NR_SLOTS, 0), "%d");
+	zorolog_async_fprintf(out, "0 1\n");
+	zorotest_assert_eq_nums(0, zorolog_async_flush(), "%d");
+	zorolog_async_stop();
+	zorotest_assert_eq_nums(-EINVAL, zorolog_async_flush(), "%d");
+	zorolog_async_fprintf(out, "0 2\n");
+	fflush(out);
+
+	check_records(out, 0, &c);
+	zorotest_assert_eq_nums(0u, c.errors, "%u");
+	zorotest_assert_eq_nums(3ul, c.next[0], "%lu");
+
+	zorotest_unset_clear_on_fail();
+	fclose(out);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_block),
+		ZOROTEST_CASE(test_drop),
+		ZOROTEST_CASE(test_workqueue),
+		ZOROTEST_CASE(test_uring),
+		ZOROTEST_CASE(test_fork),
+		ZOROTEST_CASE(test_restart),
+	};
+	/* The backend is process wide: one test at a time */
+	struct zorotest_opts opts = { .jobs = 1 };
+
+	return zorotest_run_suite(tests, "log-async", &opts);
+}
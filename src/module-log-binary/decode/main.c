@@ -0,0 +1,32 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zoro/binlog.h>
+
+int main(int argc, char *argv[])
+{
+	int fd = STDIN_FILENO, ret;
+
+	if (argc > 2 || (argc == 2 && !strcmp(argv[1], "-h"))) {
+		fprintf(stderr, "Usage: %s [binary log file]\n", argv[0]);
+		fprintf(stderr, "\tReads from standard input if no file is given\n");
+		return 1;
+	}
+
+	if (argc == 2 && strcmp(argv[1], "-")) {
+		fd = open(argv[1], O_RDONLY);
+		if (fd == -1) {
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+			return 1;
+		}
+	}
+
+	ret = zorolog_bin_decode(fd, stdout);
+	if (ret < 0) {
+		fprintf(stderr, "Malformed binary log: %s\n", strerror(-ret));
+		return 1;
+	}
+	return 0;
+}
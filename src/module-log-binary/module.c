@@ -0,0 +1,814 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <zoro/binlog.h>
+#include <zoro/compiler.h>
+
+#define ZOROLOG_BIN_MAGIC		"ZOROBIN"
+#define ZOROLOG_BIN_VERSION		1
+#define ZOROLOG_BIN_DEFAULT_RING	(64 * 1024)
+/* How often the writer looks for new records, in milliseconds */
+#define ZOROLOG_BIN_FLUSH_MSEC		10
+
+/* Reserved record ids */
+#define ZOROLOG_BIN_ID_DEFINE		0
+#define ZOROLOG_BIN_ID_WRAP		0xffffffffU
+
+struct zorolog_bin_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t clock;
+	uint64_t realtime_ns;
+	uint64_t clock_ns;
+};
+
+/* Payload of a ZOROLOG_BIN_ID_DEFINE record */
+struct zorolog_bin_define {
+	uint32_t id;
+	uint16_t format_len;
+	uint8_t nargs;
+	uint8_t types[ZOROLOG_BIN_MAX_ARGS];
+	/* followed by the format string */
+} __attribute__((packed));
+
+__thread struct zorolog_bin_ring *__zorolog_bin_ring;
+int __zorolog_bin_enabled;
+
+static struct {
+	int fd;
+	int flags;
+	int running;
+	int kick;
+	size_t ring_size;
+	uint32_t next_id;
+	struct zorolog_bin_site **sites;
+	size_t nsites;
+	pthread_t writer;
+	/* Protects the ring list and the log file */
+	pthread_mutex_t lock;
+	struct list_head rings;
+	pthread_key_t key;
+} zlbin = {
+	.fd = -1,
+	.next_id = 1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.rings = LIST_HEAD_INIT(zlbin.rings),
+};
+
+static pthread_once_t zlbin_once = PTHREAD_ONCE_INIT;
+
+static int __zorolog_bin_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Append the definition of @a site to the log file; called with the lock */
+static int __zorolog_bin_write_define(struct zorolog_bin_site *site)
+{
+	struct zorolog_bin_define def;
+	struct zorolog_bin_hdr hdr;
+	static const char pad[8];
+	struct iovec iov[4];
+	size_t len;
+
+	len = strlen(site->format);
+	if (len > UINT16_MAX)
+		len = UINT16_MAX;
+
+	memset(&def, 0, sizeof(def));
+	def.id = site->id;
+	def.format_len = len;
+	def.nargs = site->nargs;
+	memcpy(def.types, site->types, sizeof(def.types));
+
+	hdr.id = ZOROLOG_BIN_ID_DEFINE;
+	hdr.size = (sizeof(hdr) + sizeof(def) + len + 7) & ~7U;
+	hdr.ts = 0;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = &def;
+	iov[1].iov_len = sizeof(def);
+	iov[2].iov_base = (void *)site->format;
+	iov[2].iov_len = len;
+	iov[3].iov_base = (void *)pad;
+	iov[3].iov_len = hdr.size - sizeof(hdr) - sizeof(def) - len;
+
+	if (writev(zlbin.fd, iov, 4) != hdr.size)
+		return -EIO;
+	return 0;
+}
+
+static int __zorolog_bin_register(struct zorolog_bin_site *site)
+{
+	struct zorolog_bin_site **sites;
+	int ret = 0;
+
+	pthread_mutex_lock(&zlbin.lock);
+	if (site->id)
+		goto unlock;
+	if (zlbin.fd == -1) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	sites = reallocarray(zlbin.sites, zlbin.nsites + 1, sizeof(*sites));
+	if (!sites) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+	zlbin.sites = sites;
+	zlbin.sites[zlbin.nsites++] = site;
+
+	/*
+	 * The definition reaches the file before any record of the site,
+	 * since they are written by the background writer with the lock held.
+	 */
+	site->id = zlbin.next_id++;
+	ret = __zorolog_bin_write_define(site);
+	__atomic_store_n(&site->id, site->id, __ATOMIC_RELEASE);
+
+unlock:
+	pthread_mutex_unlock(&zlbin.lock);
+	return ret;
+}
+
+static inline void __zorolog_bin_futex_wake(int *uaddr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void __zorolog_bin_futex_wait(int *uaddr, int val, long msec)
+{
+	struct timespec ts = {
+		.tv_sec = msec / 1000,
+		.tv_nsec = (msec % 1000) * 1000000L,
+	};
+
+	syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static void __zorolog_bin_kick(void)
+{
+	__atomic_store_n(&zlbin.kick, 1, __ATOMIC_RELEASE);
+	__zorolog_bin_futex_wake(&zlbin.kick);
+}
+
+static void __zorolog_bin_ring_free(struct zorolog_bin_ring *r)
+{
+	free(r->data);
+	free(r);
+}
+
+/* Thread exit: let the writer drain the ring, then free it */
+static void __zorolog_bin_destructor(void *arg)
+{
+	struct zorolog_bin_ring *r = arg;
+
+	pthread_mutex_lock(&zlbin.lock);
+	if (zlbin.running) {
+		r->dead = 1;
+	} else {
+		list_del(&r->list);
+		__zorolog_bin_ring_free(r);
+	}
+	pthread_mutex_unlock(&zlbin.lock);
+	__zorolog_bin_ring = NULL;
+}
+
+static void __zorolog_bin_atfork_child(void)
+{
+	/* The writer does not exist in the child: fall back to text logging */
+	__zorolog_bin_enabled = 0;
+	zlbin.running = 0;
+	if (zlbin.fd != -1)
+		close(zlbin.fd);
+	zlbin.fd = -1;
+	pthread_mutex_init(&zlbin.lock, NULL);
+}
+
+static void __zorolog_bin_atexit(void)
+{
+	zorolog_bin_close();
+}
+
+static void __zorolog_bin_init_once(void)
+{
+	pthread_key_create(&zlbin.key, __zorolog_bin_destructor);
+	pthread_atfork(NULL, NULL, __zorolog_bin_atfork_child);
+	atexit(__zorolog_bin_atexit);
+}
+
+static struct zorolog_bin_ring *__zorolog_bin_ring_new(void)
+{
+	struct zorolog_bin_ring *r;
+
+	r = aligned_alloc(SMP_CACHE_BYTES, sizeof(*r));
+	if (!r)
+		return NULL;
+	memset(r, 0, sizeof(*r));
+
+	pthread_mutex_lock(&zlbin.lock);
+	r->mask = zlbin.ring_size - 1;
+	r->data = malloc(zlbin.ring_size);
+	if (!r->data || pthread_setspecific(zlbin.key, r)) {
+		pthread_mutex_unlock(&zlbin.lock);
+		__zorolog_bin_ring_free(r);
+		return NULL;
+	}
+	list_add_tail(&r->list, &zlbin.rings);
+	pthread_mutex_unlock(&zlbin.lock);
+
+	__zorolog_bin_ring = r;
+	return r;
+}
+
+struct zorolog_bin_hdr *__zorolog_bin_reserve_slow(struct zorolog_bin_site *site,
+						   uint32_t size)
+{
+	struct zorolog_bin_ring *r = __zorolog_bin_ring;
+	struct zorolog_bin_hdr *wrap;
+	uint64_t off, need, ring_size;
+
+	if (!zorolog_bin_active())
+		return NULL;
+
+	if (unlikely(!r)) {
+		r = __zorolog_bin_ring_new();
+		if (!r)
+			return NULL;
+	}
+
+	if (unlikely(!__atomic_load_n(&site->id, __ATOMIC_ACQUIRE)) &&
+	    __zorolog_bin_register(site))
+		return NULL;
+
+	ring_size = r->mask + 1;
+	if (size > ring_size / 2)
+		return NULL;
+
+	for (;;) {
+		off = r->head & r->mask;
+		/* Records never wrap around: skip the ring tail if needed */
+		need = off + size > ring_size ? ring_size - off + size : size;
+		if (r->head + need - r->tail_cache <= ring_size)
+			break;
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head + need - r->tail_cache <= ring_size)
+			break;
+
+		if (!zorolog_bin_active())
+			return NULL;
+		if (zlbin.flags & ZOROLOG_BIN_DROP)
+			return NULL;
+		__zorolog_bin_kick();
+		sched_yield();
+	}
+
+	if (need != size) {
+		wrap = (struct zorolog_bin_hdr *)(r->data + off);
+		wrap->id = ZOROLOG_BIN_ID_WRAP;
+		wrap->size = ring_size - off;
+		__atomic_store_n(&r->head, r->head + wrap->size,
+				 __ATOMIC_RELEASE);
+		off = 0;
+	}
+	return (struct zorolog_bin_hdr *)(r->data + off);
+}
+
+/*
+ * Move the published records of @a r to the log file; called with the lock.
+ * Return the number of bytes consumed.
+ */
+static uint64_t __zorolog_bin_drain_ring(struct zorolog_bin_ring *r)
+{
+	struct zorolog_bin_hdr *h;
+	uint64_t head, tail, start, pos;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	tail = r->tail;
+	start = pos = tail;
+
+	while (pos != head) {
+		h = (struct zorolog_bin_hdr *)(r->data + (pos & r->mask));
+		if (h->id == ZOROLOG_BIN_ID_WRAP) {
+			if (pos != start)
+				__zorolog_bin_write(zlbin.fd,
+						    r->data + (start & r->mask),
+						    pos - start);
+			pos += h->size;
+			start = pos;
+			continue;
+		}
+		pos += h->size;
+	}
+	if (pos != start)
+		__zorolog_bin_write(zlbin.fd, r->data + (start & r->mask),
+				    pos - start);
+
+	__atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+	return head - tail;
+}
+
+static uint64_t __zorolog_bin_drain(void)
+{
+	struct zorolog_bin_ring *r, *n;
+	uint64_t total = 0;
+
+	pthread_mutex_lock(&zlbin.lock);
+	list_for_each_entry_safe(r, n, &zlbin.rings, list) {
+		total += __zorolog_bin_drain_ring(r);
+		if (r->dead) {
+			list_del(&r->list);
+			__zorolog_bin_ring_free(r);
+		}
+	}
+	pthread_mutex_unlock(&zlbin.lock);
+	return total;
+}
+
+static void *__zorolog_bin_writer(void *arg)
+{
+	while (__atomic_load_n(&zlbin.running, __ATOMIC_ACQUIRE)) {
+		if (__zorolog_bin_drain())
+			continue;
+		__zorolog_bin_futex_wait(&zlbin.kick, 0, ZOROLOG_BIN_FLUSH_MSEC);
+		__atomic_store_n(&zlbin.kick, 0, __ATOMIC_RELAXED);
+	}
+	__zorolog_bin_drain();
+	return NULL;
+}
+
+int zorolog_bin_open(const char *path, size_t ring_size, int flags)
+{
+	struct zorolog_bin_file_hdr fhdr;
+	int open_flags, ret, fd;
+	size_t i;
+	off_t end;
+
+	if (!path || flags & ~(ZOROLOG_APPEND | ZOROLOG_BIN_DROP))
+		return -EINVAL;
+	if (!ring_size)
+		ring_size = ZOROLOG_BIN_DEFAULT_RING;
+	if (ring_size & (ring_size - 1) || ring_size < ZOROLOG_BIN_DEFAULT_RING)
+		return -EINVAL;
+
+	pthread_once(&zlbin_once, __zorolog_bin_init_once);
+
+	open_flags = O_CREAT | O_WRONLY | O_APPEND;
+	if (!(flags & ZOROLOG_APPEND))
+		open_flags |= O_TRUNC;
+
+	pthread_mutex_lock(&zlbin.lock);
+	if (zlbin.fd != -1) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	fd = open(path, open_flags, S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd == -1) {
+		ret = -errno;
+		goto unlock;
+	}
+
+	/* Appended logs carry a file header for each session */
+	end = lseek(fd, 0, SEEK_END);
+	memset(&fhdr, 0, sizeof(fhdr));
+	memcpy(fhdr.magic, ZOROLOG_BIN_MAGIC, sizeof(ZOROLOG_BIN_MAGIC));
+	fhdr.version = ZOROLOG_BIN_VERSION;
+	fhdr.clock = CLOCK_MONOTONIC;
+	fhdr.realtime_ns = zorolog_clock_real_ns();
+	fhdr.clock_ns = zorolog_clock_ns();
+	ret = __zorolog_bin_write(fd, &fhdr, sizeof(fhdr));
+	if (ret) {
+		if (end >= 0)
+			(void)!ftruncate(fd, end);
+		close(fd);
+		goto unlock;
+	}
+
+	zlbin.fd = fd;
+	zlbin.flags = flags;
+	zlbin.ring_size = ring_size;
+
+	/* Call sites registered in a previous session are defined again */
+	for (i = 0; i < zlbin.nsites; i++)
+		__zorolog_bin_write_define(zlbin.sites[i]);
+
+	zlbin.running = 1;
+	ret = -pthread_create(&zlbin.writer, NULL, __zorolog_bin_writer, NULL);
+	if (ret) {
+		zlbin.running = 0;
+		zlbin.fd = -1;
+		close(fd);
+		goto unlock;
+	}
+	__atomic_store_n(&__zorolog_bin_enabled, 1, __ATOMIC_RELEASE);
+
+unlock:
+	pthread_mutex_unlock(&zlbin.lock);
+	return ret;
+}
+
+int zorolog_bin_flush(void)
+{
+	struct zorolog_bin_ring *r;
+	int pending;
+
+	if (!zorolog_bin_active())
+		return -EINVAL;
+
+	do {
+		__zorolog_bin_kick();
+		sched_yield();
+		pending = 0;
+		pthread_mutex_lock(&zlbin.lock);
+		list_for_each_entry(r, &zlbin.rings, list) {
+			if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) !=
+			    r->tail) {
+				pending = 1;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&zlbin.lock);
+	} while (pending);
+
+	return 0;
+}
+
+void zorolog_bin_close(void)
+{
+	int fd;
+
+	pthread_mutex_lock(&zlbin.lock);
+	if (!zlbin.running) {
+		pthread_mutex_unlock(&zlbin.lock);
+		return;
+	}
+	__atomic_store_n(&__zorolog_bin_enabled, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&zlbin.running, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&zlbin.lock);
+
+	__zorolog_bin_kick();
+	pthread_join(zlbin.writer, NULL);
+
+	pthread_mutex_lock(&zlbin.lock);
+	fd = zlbin.fd;
+	zlbin.fd = -1;
+	pthread_mutex_unlock(&zlbin.lock);
+	close(fd);
+}
+
+/* ======================== Binary log decoding ========================= */
+
+struct zorolog_bin_def {
+	uint8_t nargs;
+	uint8_t types[ZOROLOG_BIN_MAX_ARGS];
+	char *format;
+};
+
+struct zorolog_bin_arg {
+	int type;
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+		char *s;
+	};
+};
+
+struct zorolog_bin_reader {
+	int fd;
+	char *buf;
+	size_t cap;
+	size_t pos;
+	size_t len;
+	int eof;
+};
+
+/* Make sure at least @a n bytes are buffered; return 0 if not possible */
+static int __zorolog_bin_fill(struct zorolog_bin_reader *rd, size_t n)
+{
+	ssize_t ret;
+	char *buf;
+
+	while (rd->len - rd->pos < n) {
+		if (rd->eof)
+			return 0;
+		if (rd->pos) {
+			memmove(rd->buf, rd->buf + rd->pos, rd->len - rd->pos);
+			rd->len -= rd->pos;
+			rd->pos = 0;
+		}
+		if (rd->cap < n) {
+			buf = realloc(rd->buf, n);
+			if (!buf)
+				return 0;
+			rd->buf = buf;
+			rd->cap = n;
+		}
+		ret = read(rd->fd, rd->buf + rd->len, rd->cap - rd->len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			rd->eof = 1;
+		else
+			rd->len += ret;
+	}
+	return 1;
+}
+
+static int __zorolog_bin_parse_args(const struct zorolog_bin_def *d,
+				    const char *p, const char *end,
+				    struct zorolog_bin_arg *args, char *strbuf)
+{
+	uint16_t len;
+	int32_t i32;
+	uint32_t u32;
+	int i;
+
+	for (i = 0; i < d->nargs; i++) {
+		args[i].type = d->types[i];
+		switch (d->types[i]) {
+		case ZOROLOG_BIN_T_I32:
+			if (end - p < 4)
+				return -1;
+			memcpy(&i32, p, 4);
+			args[i].i = i32;
+			p += 4;
+			break;
+		case ZOROLOG_BIN_T_U32:
+			if (end - p < 4)
+				return -1;
+			memcpy(&u32, p, 4);
+			args[i].u = u32;
+			p += 4;
+			break;
+		case ZOROLOG_BIN_T_I64:
+		case ZOROLOG_BIN_T_U64:
+		case ZOROLOG_BIN_T_DBL:
+		case ZOROLOG_BIN_T_PTR:
+			if (end - p < 8)
+				return -1;
+			memcpy(&args[i].u, p, 8);
+			p += 8;
+			break;
+		case ZOROLOG_BIN_T_STR:
+			if (end - p < 2)
+				return -1;
+			memcpy(&len, p, 2);
+			p += 2;
+			if (end - p < len)
+				return -1;
+			memcpy(strbuf, p, len);
+			strbuf[len] = '\0';
+			args[i].s = strbuf;
+			strbuf += len + 1;
+			p += len;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Render @a format with the decoded arguments, one conversion specification
+ * at a time: the length modifiers are rewritten to match the stored types.
+ */
+static void __zorolog_bin_render(FILE *out, const char *format,
+				 struct zorolog_bin_arg *args, int nargs)
+{
+	char spec[64], *sp;
+	const char *f = format;
+	int next = 0, width, prec, has_width, has_prec;
+	struct zorolog_bin_arg *a;
+	char conv;
+
+	while (*f) {
+		if (*f != '%') {
+			fputc(*f++, out);
+			continue;
+		}
+		f++;
+		if (*f == '%') {
+			fputc(*f++, out);
+			continue;
+		}
+
+		sp = spec;
+		*sp++ = '%';
+		while (*f && strchr("-+ #0'", *f) && sp < spec + 8)
+			*sp++ = *f++;
+
+		has_width = has_prec = 0;
+		width = prec = 0;
+		if (*f == '*') {
+			f++;
+			if (next < nargs)
+				width = args[next++].i;
+			has_width = 1;
+		} else {
+			while (*f >= '0' && *f <= '9') {
+				width = width * 10 + (*f++ - '0');
+				has_width = 1;
+			}
+		}
+		if (*f == '.') {
+			f++;
+			has_prec = 1;
+			if (*f == '*') {
+				f++;
+				if (next < nargs)
+					prec = args[next++].i;
+			} else {
+				while (*f >= '0' && *f <= '9')
+					prec = prec * 10 + (*f++ - '0');
+			}
+		}
+		while (*f && strchr("hlLqjzt", *f))
+			f++;
+		conv = *f;
+		if (!conv)
+			break;
+		f++;
+
+		if (has_width)
+			sp += sprintf(sp, "%d", width);
+		if (has_prec)
+			sp += sprintf(sp, ".%d", prec);
+
+		if (next >= nargs) {
+			fputs("<missing>", out);
+			continue;
+		}
+		a = &args[next++];
+
+		if (strchr("diouxXc", conv)) {
+			switch (a->type) {
+			case ZOROLOG_BIN_T_I32:
+				sp[0] = conv;
+				sp[1] = '\0';
+				fprintf(out, spec, (int)a->i);
+				continue;
+			case ZOROLOG_BIN_T_U32:
+				sp[0] = conv;
+				sp[1] = '\0';
+				fprintf(out, spec, (unsigned int)a->u);
+				continue;
+			case ZOROLOG_BIN_T_I64:
+			case ZOROLOG_BIN_T_U64:
+				sp[0] = 'l';
+				sp[1] = 'l';
+				sp[2] = conv;
+				sp[3] = '\0';
+				fprintf(out, spec, (long long)a->i);
+				continue;
+			}
+		} else if (strchr("eEfFgGaA", conv)) {
+			if (a->type == ZOROLOG_BIN_T_DBL) {
+				sp[0] = conv;
+				sp[1] = '\0';
+				fprintf(out, spec, a->d);
+				continue;
+			}
+		} else if (conv == 's') {
+			if (a->type == ZOROLOG_BIN_T_STR) {
+				sp[0] = 's';
+				sp[1] = '\0';
+				fprintf(out, spec, a->s);
+				continue;
+			}
+		} else if (conv == 'p') {
+			if (a->type == ZOROLOG_BIN_T_PTR) {
+				sp[0] = 'p';
+				sp[1] = '\0';
+				fprintf(out, spec, (void *)(uintptr_t)a->u);
+				continue;
+			}
+		}
+		fprintf(out, "<bad %%%c>", conv);
+	}
+}
+
+int zorolog_bin_decode(int fd, FILE *out)
+{
+	struct zorolog_bin_reader rd = { .fd = fd };
+	struct zorolog_bin_arg args[ZOROLOG_BIN_MAX_ARGS];
+	struct zorolog_bin_def *defs = NULL, *d;
+	struct zorolog_bin_file_hdr *fhdr;
+	struct zorolog_bin_define *def;
+	struct zorolog_bin_hdr hdr;
+	size_t ndefs = 0, n;
+	char *p, *strbuf;
+	int ret = 0, count = 0;
+
+	strbuf = malloc(ZOROLOG_BIN_MAX_ARGS * (ZOROLOG_BIN_MAX_STRING + 1));
+	if (!strbuf)
+		return -ENOMEM;
+
+	while (__zorolog_bin_fill(&rd, sizeof(hdr))) {
+		p = rd.buf + rd.pos;
+
+		/* A new session starts with a file header */
+		if (!memcmp(p, ZOROLOG_BIN_MAGIC, sizeof(ZOROLOG_BIN_MAGIC))) {
+			if (!__zorolog_bin_fill(&rd, sizeof(*fhdr))) {
+				ret = -EINVAL;
+				break;
+			}
+			fhdr = (struct zorolog_bin_file_hdr *)(rd.buf + rd.pos);
+			if (fhdr->version != ZOROLOG_BIN_VERSION) {
+				ret = -EPROTO;
+				break;
+			}
+			rd.pos += sizeof(*fhdr);
+			for (n = 0; n < ndefs; n++)
+				free(defs[n].format);
+			memset(defs, 0, ndefs * sizeof(*defs));
+			continue;
+		}
+
+		memcpy(&hdr, p, sizeof(hdr));
+		if (hdr.size < sizeof(hdr) || (hdr.size & 7) ||
+		    !__zorolog_bin_fill(&rd, hdr.size)) {
+			ret = -EINVAL;
+			break;
+		}
+		p = rd.buf + rd.pos + sizeof(hdr);
+		rd.pos += hdr.size;
+
+		if (hdr.id == ZOROLOG_BIN_ID_DEFINE) {
+			def = (struct zorolog_bin_define *)p;
+			if (sizeof(hdr) + sizeof(*def) + def->format_len >
+			    hdr.size || def->nargs > ZOROLOG_BIN_MAX_ARGS) {
+				ret = -EINVAL;
+				break;
+			}
+			if (def->id >= ndefs) {
+				n = def->id + 64;
+				d = reallocarray(defs, n, sizeof(*defs));
+				if (!d) {
+					ret = -ENOMEM;
+					break;
+				}
+				memset(d + ndefs, 0, (n - ndefs) * sizeof(*d));
+				defs = d;
+				ndefs = n;
+			}
+			d = &defs[def->id];
+			free(d->format);
+			d->format = strndup((char *)(def + 1), def->format_len);
+			d->nargs = def->nargs;
+			memcpy(d->types, def->types, sizeof(d->types));
+			continue;
+		}
+
+		if (hdr.id >= ndefs || !defs[hdr.id].format) {
+			fprintf(out, "[%lu.%09lu] <unknown record %u>\n",
+				(unsigned long)(hdr.ts / 1000000000ULL),
+				(unsigned long)(hdr.ts % 1000000000ULL), hdr.id);
+			continue;
+		}
+		d = &defs[hdr.id];
+		if (__zorolog_bin_parse_args(d, p, p + hdr.size - sizeof(hdr),
+					     args, strbuf)) {
+			ret = -EINVAL;
+			break;
+		}
+		fprintf(out, "[%lu.%09lu] ",
+			(unsigned long)(hdr.ts / 1000000000ULL),
+			(unsigned long)(hdr.ts % 1000000000ULL));
+		__zorolog_bin_render(out, d->format, args, d->nargs);
+		count++;
+	}
+
+	for (n = 0; n < ndefs; n++)
+		free(defs[n].format);
+	free(defs);
+	free(rd.buf);
+	free(strbuf);
+	return ret ? ret : count;
+}
@@ -0,0 +1,219 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zoro/binlog.h>
+#include <zoro/test.h>
+
+#define NR_WRITERS	4
+#define NR_RECORDS	10000
+
+struct binlog {
+	char path[32];
+	char *text;
+	size_t size;
+};
+
+static void remove_binlog(void *arg)
+{
+	struct binlog *b = arg;
+
+	zorolog_bin_close();
+	unlink(b->path);
+	free(b->text);
+}
+
+static int open_binlog(struct binlog *b, int flags)
+{
+	int fd;
+
+	if (!b->path[0]) {
+		strcpy(b->path, "/tmp/binlog.XXXXXX");
+		fd = mkstemp(b->path);
+		if (fd < 0)
+			return -1;
+		close(fd);
+	}
+	return zorolog_bin_open(b->path, 0, flags);
+}
+
+/* Close the log, and render it without the timestamps */
+static int decode_binlog(struct binlog *b)
+{
+	char *line = NULL, *p;
+	size_t len = 0;
+	FILE *raw, *out;
+	int fd, ret;
+
+	zorolog_bin_close();
+	fd = open(b->path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	raw = tmpfile();
+	ret = raw ? zorolog_bin_decode(fd, raw) : -1;
+	close(fd);
+	if (ret < 0)
+		goto out;
+
+	free(b->text);
+	out = open_memstream(&b->text, &b->size);
+	if (!out) {
+		ret = -1;
+		goto out;
+	}
+	rewind(raw);
+	while (getline(&line, &len, raw) > 0) {
+		p = strstr(line, "] ");
+		fputs(p ? p + 2 : line, out);
+	}
+	fclose(out);
+	free(line);
+out:
+	if (raw)
+		fclose(raw);
+	return ret;
+}
+
+/* Every argument type is rendered as the text zorolog_info() would print */
+static int test_types(void)
+{
+	struct binlog b = { 0 };
+	char expected[ZOROLOG_BIN_MAX_STRING + 256];
+	char unterminated[8], *long_str;
+	/* Out of sight of -Wformat-overflow, for the text fallback */
+	const char *volatile null = NULL;
+	int x = 0;
+
+	zorotest_set_clear_on_fail(remove_binlog, &b);
+	zorotest_assert_eq_nums(0, open_binlog(&b, 0), "%d");
+
+	memcpy(unterminated, "abcdefgh", sizeof(unterminated));
+	long_str = malloc(ZOROLOG_BIN_MAX_STRING + 100);
+	zorotest_assert_true(long_str);
+	memset(long_str, 'x', ZOROLOG_BIN_MAX_STRING + 99);
+	long_str[ZOROLOG_BIN_MAX_STRING + 99] = '\0';
+
+	zorolog_bin_info("int %d %u %ld %lu\n", -1, 4000000000u, -5000000000L,
+			 18000000000000000000UL);
+	zorolog_bin_info("char %c short %hd\n", 'z', (short)-7);
+	zorolog_bin_info("double %.3f %g\n", 3.25, -1e-3);
+	zorolog_bin_info("str <%s> <%s> <%s>\n", "hello", "", null);
+	zorolog_bin_info("array <%.8s>\n", unterminated);
+	zorolog_bin_info("pointer %p %p\n", (void *)&x, (void *)NULL);
+	zorolog_bin_info("long <%s>\n", long_str);
+	zorolog_bin_info("no arguments\n");
+	zorolog_bin_info("sixteen %d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d\n",
+			 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5);
+
+	zorotest_assert_eq_nums(9, decode_binlog(&b), "%d");
+	long_str[ZOROLOG_BIN_MAX_STRING] = '\0';
+	snprintf(expected, sizeof(expected),
+		 "int -1 4000000000 -5000000000 18000000000000000000\n"
+		 "char z short -7\n"
+		 "double 3.250 -0.001\n"
+		 "str <hello> <> <(null)>\n"
+		 "array <abcdefgh>\n"
+		 "pointer %p %p\n"
+		 "long <%s>\n"
+		 "no arguments\n"
+		 "sixteen 0123456789012345\n",
+		 (void *)&x, (void *)NULL, long_str);
+	free(long_str);
+	zorotest_assert_eq_strings(expected, b.text);
+
+	zorotest_unset_clear_on_fail();
+	remove_binlog(&b);
+	zorotest_success();
+}
+
+static void *writer(void *arg)
+{
+	unsigned long id = (unsigned long)arg, i;
+
+	for (i = 0; i < NR_RECORDS; i++)
+		zorolog_bin_info("%lu %lu %s\n", id, i, "record");
+	return NULL;
+}
+
+/* Records of every thread are all there, each in the order it logged them */
+static int test_threads(void)
+{
+	unsigned long next[NR_WRITERS] = { 0 }, id, seq;
+	pthread_t threads[NR_WRITERS];
+	struct binlog b = { 0 };
+	unsigned int i, started = 0, errors = 0;
+	char *line, *save;
+
+	zorotest_set_clear_on_fail(remove_binlog, &b);
+	zorotest_assert_eq_nums(0, open_binlog(&b, 0), "%d");
+	for (i = 0; i < NR_WRITERS; i++) {
+		if (pthread_create(&threads[i], NULL, writer,
+				   (void *)(unsigned long)i))
+			break;
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	zorotest_assert_eq_nums(NR_WRITERS, started, "%u");
+
+	zorotest_assert_eq_nums(NR_WRITERS * NR_RECORDS, decode_binlog(&b),
+				"%d");
+	for (line = strtok_r(b.text, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "%lu %lu record", &id, &seq) != 2 ||
+		    id >= NR_WRITERS || seq != next[id]) {
+			if (!errors++)
+				zorotest_verbose("Unexpected record: %s\n",
+						 line);
+			continue;
+		}
+		next[id]++;
+	}
+	zorotest_assert_eq_nums(0u, errors, "%u");
+	for (i = 0; i < NR_WRITERS; i++)
+		zorotest_assert_eq_nums((unsigned long)NR_RECORDS, next[i],
+					"%lu");
+
+	zorotest_unset_clear_on_fail();
+	remove_binlog(&b);
+	zorotest_success();
+}
+
+/* An appended session reuses the call sites registered by the first one */
+static int test_append(void)
+{
+	struct binlog b = { 0 };
+	unsigned int i;
+
+	zorotest_set_clear_on_fail(remove_binlog, &b);
+	for (i = 0; i < 2; i++) {
+		zorotest_assert_eq_nums(0, open_binlog(&b, i ? ZOROLOG_APPEND :
+						       0), "%d");
+		zorolog_bin_info("session %u\n", i);
+		zorotest_assert_eq_nums(0, zorolog_bin_flush(), "%d");
+		zorolog_bin_close();
+	}
+	zorotest_assert_eq_nums(-EINVAL, zorolog_bin_flush(), "%d");
+
+	zorotest_assert_eq_nums(2, decode_binlog(&b), "%d");
+	zorotest_assert_eq_strings("session 0\nsession 1\n", b.text);
+
+	zorotest_unset_clear_on_fail();
+	remove_binlog(&b);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_types),
+		ZOROTEST_CASE(test_threads),
+		ZOROTEST_CASE(test_append),
+	};
+	/* There is one binary log per process: one test at a time */
+	struct zorotest_opts opts = { .jobs = 1 };
+
+	return zorotest_run_suite(tests, "log-binary", &opts);
+}
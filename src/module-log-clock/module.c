@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <zoro/clock.h>
+#include <zoro/compiler.h>
+
+/* Fixed point shift of the TSC to nanoseconds factor */
+#define ZOROLOG_CLOCK_SHIFT		24
+/* The TSC is used only after a first calibration over this window */
+#define ZOROLOG_CLOCK_CALIB_NSEC	100000000ULL
+/* The factor is refined over a growing window, this often */
+#define ZOROLOG_CLOCK_RECALIB_NSEC	1000000000ULL
+
+struct zorolog_clock __zorolog_clock;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_t ticker;
+	int stop;
+	int registered;
+	/* Calibration origin and last refinement */
+	uint64_t calib_tsc;
+	uint64_t calib_ns;
+	uint64_t last_calib_ns;
+	time_t date_sec;
+} zlclock = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Only an invariant TSC ticks at a constant rate across P/C-states */
+static int __zorolog_clock_tsc_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+	    eax < 0x80000007)
+		return 0;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return !!(edx & (1U << 8));
+#else
+	return 0;
+#endif
+}
+
+static inline void __zorolog_clock_write_begin(struct zorolog_clock *c)
+{
+	__atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void __zorolog_clock_write_end(struct zorolog_clock *c)
+{
+	__atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Take a sample of the system clocks and publish it */
+static void __zorolog_clock_tick(struct zorolog_clock *c, int use_tsc)
+{
+	uint64_t tsc, mono, real, prev, mult = c->mult;
+	int tsc_on = c->tsc;
+	char date[26]; /* size got from ctime man page */
+	int new_date = 0;
+	time_t sec;
+
+	tsc = __zorolog_clock_tsc();
+	mono = __zorolog_clock_sys_ns(CLOCK_MONOTONIC);
+	real = __zorolog_clock_sys_ns(CLOCK_REALTIME);
+
+	if (use_tsc) {
+		if (!zlclock.calib_tsc) {
+			zlclock.calib_tsc = tsc;
+			zlclock.calib_ns = mono;
+		} else if (tsc > zlclock.calib_tsc &&
+			   (tsc_on ? mono - zlclock.last_calib_ns >=
+				     ZOROLOG_CLOCK_RECALIB_NSEC :
+				     mono - zlclock.calib_ns >=
+				     ZOROLOG_CLOCK_CALIB_NSEC)) {
+			mult = (uint64_t)(((unsigned __int128)(mono - zlclock.calib_ns)
+					   << ZOROLOG_CLOCK_SHIFT) /
+					  (tsc - zlclock.calib_tsc));
+			if (mult && mult <= UINT32_MAX) {
+				zlclock.last_calib_ns = mono;
+				tsc_on = 1;
+			}
+		}
+	}
+
+	/* Readers extrapolating past this tick must not see time going back */
+	if (c->tsc) {
+		prev = c->mono_ns + (uint64_t)(((unsigned __int128)
+				(tsc - c->tsc_base) * c->mult) >> c->shift);
+		if (prev > mono) {
+			real += prev - mono;
+			mono = prev;
+		}
+	}
+
+	sec = real / 1000000000ULL;
+	if (sec != zlclock.date_sec) {
+		ctime_r(&sec, date);
+		zlclock.date_sec = sec;
+		new_date = 1;
+	}
+
+	__zorolog_clock_write_begin(c);
+	__atomic_store_n(&c->tsc_base, tsc, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->mono_ns, mono, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->real_ns, real, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->mult, (uint32_t)mult, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->shift, ZOROLOG_CLOCK_SHIFT, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->tsc, tsc_on, __ATOMIC_RELAXED);
+	if (new_date) {
+		memcpy(c->date, date, ZOROLOG_CLOCK_DATE_LEN);
+		c->date[ZOROLOG_CLOCK_DATE_LEN] = '\0';
+	}
+	__zorolog_clock_write_end(c);
+}
+
+static void *__zorolog_clock_ticker(void *arg)
+{
+	struct timespec next, period = {
+		.tv_sec = ZOROLOG_CLOCK_TICK_USEC / 1000000,
+		.tv_nsec = (ZOROLOG_CLOCK_TICK_USEC % 1000000) * 1000L,
+	};
+	int use_tsc = __zorolog_clock_tsc_invariant();
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!__atomic_load_n(&zlclock.stop, __ATOMIC_RELAXED)) {
+		next.tv_sec += period.tv_sec;
+		next.tv_nsec += period.tv_nsec;
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		__zorolog_clock_tick(&__zorolog_clock, use_tsc);
+	}
+	return NULL;
+}
+
+static void __zorolog_clock_atfork_child(void)
+{
+	/* No ticker in the child: the first reader starts a new one */
+	__zorolog_clock.seq &= ~1ULL;
+	__zorolog_clock.tsc = 0;
+	__zorolog_clock.state = ZOROLOG_CLOCK_OFF;
+	pthread_mutex_init(&zlclock.lock, NULL);
+}
+
+int zorolog_clock_start(void)
+{
+	struct zorolog_clock *c = &__zorolog_clock;
+	int ret = 0;
+
+	pthread_mutex_lock(&zlclock.lock);
+	if (c->state == ZOROLOG_CLOCK_RUNNING)
+		goto unlock;
+
+	/* The first sample is there before any reader can see the clock */
+	c->tsc = 0;
+	zlclock.calib_tsc = 0;
+	zlclock.last_calib_ns = 0;
+	zlclock.date_sec = -1;
+	zlclock.stop = 0;
+	__zorolog_clock_tick(c, 0);
+
+	ret = -pthread_create(&zlclock.ticker, NULL, __zorolog_clock_ticker,
+			      NULL);
+	if (ret) {
+		__atomic_store_n(&c->state, ZOROLOG_CLOCK_DISABLED,
+				 __ATOMIC_RELEASE);
+		goto unlock;
+	}
+	pthread_setname_np(zlclock.ticker, "zorolog-clock");
+
+	if (!zlclock.registered) {
+		pthread_atfork(NULL, NULL, __zorolog_clock_atfork_child);
+		zlclock.registered = 1;
+	}
+	__atomic_store_n(&c->state, ZOROLOG_CLOCK_RUNNING, __ATOMIC_RELEASE);
+
+unlock:
+	pthread_mutex_unlock(&zlclock.lock);
+	return ret;
+}
+
+void zorolog_clock_stop(void)
+{
+	struct zorolog_clock *c = &__zorolog_clock;
+
+	pthread_mutex_lock(&zlclock.lock);
+	if (c->state != ZOROLOG_CLOCK_RUNNING) {
+		c->state = ZOROLOG_CLOCK_DISABLED;
+		goto unlock;
+	}
+
+	__atomic_store_n(&c->state, ZOROLOG_CLOCK_DISABLED, __ATOMIC_RELEASE);
+	__atomic_store_n(&zlclock.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(zlclock.ticker, NULL);
+
+unlock:
+	pthread_mutex_unlock(&zlclock.lock);
+}
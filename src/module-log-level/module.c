@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zoro/log.h>
+#include <zoro/compiler.h>
+
+/* Verbose calls are the only ones disabled by default */
+uint64_t __zorolog_masks[ZOROLOG_LEVELS] = {
+	[ZOROLOG_LEVEL_DEBUG]	= ZOROLOG_ALL_CATEGORIES,
+	[ZOROLOG_LEVEL_VERBOSE]	= 0,
+	[ZOROLOG_LEVEL_INFO]	= ZOROLOG_ALL_CATEGORIES,
+	[ZOROLOG_LEVEL_WARNING]	= ZOROLOG_ALL_CATEGORIES,
+	[ZOROLOG_LEVEL_ERROR]	= ZOROLOG_ALL_CATEGORIES,
+};
+
+/* Masks saved by the signal handler while everything is enabled */
+static struct {
+	int all;
+	uint64_t saved[ZOROLOG_LEVELS];
+} zllevel;
+
+static inline int __zorolog_level_valid(int level)
+{
+	return level >= 0 && level < ZOROLOG_LEVELS;
+}
+
+void zorolog_set_mask(int level, uint64_t mask)
+{
+	if (!__zorolog_level_valid(level))
+		return;
+	__atomic_store_n(&__zorolog_masks[level], mask, __ATOMIC_RELAXED);
+}
+
+uint64_t zorolog_get_mask(int level)
+{
+	if (!__zorolog_level_valid(level))
+		return 0;
+	return __atomic_load_n(&__zorolog_masks[level], __ATOMIC_RELAXED);
+}
+
+void zorolog_set_level(int category, int level)
+{
+	uint64_t cats;
+	int i;
+
+	if (category >= 64)
+		return;
+	cats = category < 0 ? ZOROLOG_ALL_CATEGORIES : 1ULL << category;
+
+	for (i = 0; i < ZOROLOG_LEVELS; i++) {
+		if (i >= level)
+			__atomic_fetch_or(&__zorolog_masks[i], cats,
+					  __ATOMIC_RELAXED);
+		else
+			__atomic_fetch_and(&__zorolog_masks[i], ~cats,
+					   __ATOMIC_RELAXED);
+	}
+}
+
+/* Only lock-free atomics in here: it is async-signal-safe */
+static void __zorolog_level_handler(int signo)
+{
+	int i;
+
+	if (!zllevel.all) {
+		for (i = 0; i < ZOROLOG_LEVELS; i++)
+			zllevel.saved[i] = __atomic_exchange_n(&__zorolog_masks[i],
+							       ZOROLOG_ALL_CATEGORIES,
+							       __ATOMIC_RELAXED);
+		zllevel.all = 1;
+	} else {
+		for (i = 0; i < ZOROLOG_LEVELS; i++)
+			__atomic_store_n(&__zorolog_masks[i], zllevel.saved[i],
+					 __ATOMIC_RELAXED);
+		zllevel.all = 0;
+	}
+}
+
+int zorolog_level_signal(int signo)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = __zorolog_level_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(signo, &sa, NULL))
+		return -errno;
+	return 0;
+}
+
+/* Rate limit states with suppressed messages, and their reporter thread */
+static struct {
+	pthread_mutex_t lock;
+	struct zorolog_ratelimit *states;
+	int registered;
+} zlratelimit = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+int __zorolog_ratelimit_reporting;
+
+/* Bounds of the reporter period, which follows the shortest interval */
+#define ZOROLOG_RATELIMIT_PERIOD_MIN_NS	  10000000ULL
+#define ZOROLOG_RATELIMIT_PERIOD_MAX_NS	1000000000ULL
+
+/* Called with the lock held; @a all ignores the intervals (at exit) */
+static uint64_t __zorolog_ratelimit_report(int all)
+{
+	uint64_t now, missed, period = ZOROLOG_RATELIMIT_PERIOD_MAX_NS;
+	struct zorolog_ratelimit *rs;
+
+	now = __zorolog_ratelimit_now();
+	for (rs = zlratelimit.states; rs; rs = rs->next) {
+		if (rs->interval_ns < period)
+			period = rs->interval_ns;
+		if (!all && now - rs->reported < rs->interval_ns)
+			continue;
+		missed = __atomic_exchange_n(&rs->missed, 0, __ATOMIC_RELAXED);
+		if (!missed)
+			continue;
+		rs->reported = now;
+		rs->print(rs->stream, "%s%lu messages suppressed\n",
+			  rs->prefix, (unsigned long)missed);
+	}
+	if (period < ZOROLOG_RATELIMIT_PERIOD_MIN_NS)
+		period = ZOROLOG_RATELIMIT_PERIOD_MIN_NS;
+	return period;
+}
+
+static void *__zorolog_ratelimit_reporter(void *arg)
+{
+	struct timespec ts;
+	uint64_t period;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&zlratelimit.lock);
+		period = __zorolog_ratelimit_report(0);
+		pthread_mutex_unlock(&zlratelimit.lock);
+
+		ts.tv_sec = period / 1000000000ULL;
+		ts.tv_nsec = period % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+/* Messages suppressed since the last summary would be lost otherwise */
+static void __zorolog_ratelimit_atexit(void)
+{
+	pthread_mutex_lock(&zlratelimit.lock);
+	__zorolog_ratelimit_report(1);
+	pthread_mutex_unlock(&zlratelimit.lock);
+}
+
+static void __zorolog_ratelimit_atfork_child(void)
+{
+	pthread_mutex_init(&zlratelimit.lock, NULL);
+	__atomic_store_n(&__zorolog_ratelimit_reporting, 0, __ATOMIC_RELAXED);
+}
+
+void __zorolog_ratelimit_register(struct zorolog_ratelimit *rs, FILE *stream,
+				  int (*print)(FILE *, const char *, ...),
+				  const char *format, ...)
+{
+	pthread_attr_t attr;
+	pthread_t reporter;
+	va_list args;
+	char *prefix;
+	int saved_errno = errno;
+
+	pthread_mutex_lock(&zlratelimit.lock);
+	if (!rs->prefix) {
+		va_start(args, format);
+		if (vasprintf(&prefix, format, args) < 0)
+			prefix = NULL;
+		va_end(args);
+		if (!prefix)
+			goto unlock;
+
+		rs->stream = stream;
+		rs->print = print;
+		rs->reported = __zorolog_ratelimit_now();
+		rs->next = zlratelimit.states;
+		zlratelimit.states = rs;
+		__atomic_store_n(&rs->prefix, prefix, __ATOMIC_RELEASE);
+	}
+
+	if (__zorolog_ratelimit_reporting)
+		goto unlock;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (!pthread_create(&reporter, &attr, __zorolog_ratelimit_reporter,
+			    NULL)) {
+		pthread_setname_np(reporter, "zorolog-rlimit");
+		__atomic_store_n(&__zorolog_ratelimit_reporting, 1,
+				 __ATOMIC_RELAXED);
+	}
+	pthread_attr_destroy(&attr);
+
+	if (!zlratelimit.registered) {
+		atexit(__zorolog_ratelimit_atexit);
+		pthread_atfork(NULL, NULL, __zorolog_ratelimit_atfork_child);
+		zlratelimit.registered = 1;
+	}
+
+unlock:
+	pthread_mutex_unlock(&zlratelimit.lock);
+	errno = saved_errno;
+}
@@ -0,0 +1,580 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <zoro/log.h>
+#include <zoro/compiler.h>
+
+#ifndef ZOROLOG_MMAP_SEGMENT_SIZE
+/* Default size of a segment, used when zorolog_mmap_start() gets 0 */
+#define ZOROLOG_MMAP_SEGMENT_SIZE (16UL << 20)
+#endif
+
+#ifndef ZOROLOG_MMAP_RECORD_SIZE
+/* Records up to this size are formatted on the stack, longer ones on heap */
+#define ZOROLOG_MMAP_RECORD_SIZE 512
+#endif
+
+/* Segments mapped at once: the one being written, and the next ones ready */
+#define ZOROLOG_MMAP_SEGMENTS 3
+/* Period of the writer thread, in milliseconds */
+#define ZOROLOG_MMAP_TICK_MSEC 100
+
+/* Set in the tail when the log is closed: later reservations fail */
+#define ZOROLOG_MMAP_CLOSED (1ULL << 63)
+#define ZOROLOG_MMAP_NONE UINT64_MAX
+
+struct zorolog_mmap_seg {
+	/* Number of the segment mapped, from 0; ZOROLOG_MMAP_NONE if none */
+	uint64_t id;
+	/*
+	 * Bytes of the segment accounted for: records copied, plus the end
+	 * left unused once the log is closed. The segment is finished when
+	 * they are all accounted for.
+	 */
+	uint64_t written;
+	char *map;
+	int fd;
+	/* Bytes holding records, known once the log is closed */
+	size_t used;
+	/* Bytes handed to writeback, and dropped from memory, so far */
+	size_t flushed;
+	size_t reclaimed;
+} ____cacheline_aligned;
+
+/*
+ * Producers reserve bytes with a fetch-add on @a tail, an offset in the
+ * concatenation of the segments, and copy their record there once the
+ * segment under it is mapped: records can straddle two segments. The writer
+ * thread maps the segments ahead of the producers, and finishes them behind.
+ */
+struct zorolog_mmap {
+	uint64_t tail ____cacheline_aligned;
+	int sleeping ____cacheline_aligned;
+	int running;
+	int active;
+	int flags;
+	/* Mapping a segment failed: producers must not wait for segments */
+	int failed;
+	/* Writing back a segment failed, see zorolog_mmap_flush() */
+	int error;
+	int closed;
+	size_t size;
+	size_t page;
+	/* End of the log, once closed */
+	uint64_t end;
+	/* Oldest segment not finished yet, and next one to map */
+	uint64_t oldest;
+	uint64_t next;
+	/* Number in the file name of segment 0 */
+	uint64_t first;
+	char *path;
+	pthread_t writer;
+	/* Held by the writer thread while it maps or unmaps segments */
+	pthread_mutex_t lock;
+	struct zorolog_mmap_seg segs[ZOROLOG_MMAP_SEGMENTS];
+};
+
+static struct zorolog_mmap zlmmap = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_mutex_t zlmmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void __zorolog_mmap_kick(struct zorolog_mmap *m)
+{
+	if (__atomic_load_n(&m->sleeping, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&m->sleeping, 0, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &m->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL,
+			NULL, 0);
+}
+
+static void __zorolog_mmap_sleep(struct zorolog_mmap *m)
+{
+	struct timespec ts = {
+		.tv_sec = ZOROLOG_MMAP_TICK_MSEC / 1000,
+		.tv_nsec = (ZOROLOG_MMAP_TICK_MSEC % 1000) * 1000000L,
+	};
+
+	__atomic_store_n(&m->sleeping, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&m->running, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &m->sleeping, FUTEX_WAIT_PRIVATE, 1, &ts,
+			NULL, 0);
+	__atomic_store_n(&m->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static inline struct zorolog_mmap_seg *__zorolog_mmap_slot(
+		struct zorolog_mmap *m, uint64_t id)
+{
+	return &m->segs[id % ZOROLOG_MMAP_SEGMENTS];
+}
+
+static void __zorolog_mmap_name(struct zorolog_mmap *m, uint64_t id,
+				char *name, size_t len)
+{
+	snprintf(name, len, "%s.%06" PRIu64, m->path, m->first + id);
+}
+
+/* Number following the last segment of @path left by previous runs */
+static uint64_t __zorolog_mmap_first(const char *path)
+{
+	const char *base = strrchr(path, '/');
+	char dir[PATH_MAX];
+	uint64_t first = 0, n;
+	struct dirent *d;
+	size_t len;
+	char *end;
+	DIR *dp;
+
+	if (base) {
+		snprintf(dir, sizeof(dir), "%.*s", (int)(base - path + 1), path);
+		base++;
+	} else {
+		strcpy(dir, ".");
+		base = path;
+	}
+	len = strlen(base);
+
+	dp = opendir(dir);
+	if (!dp)
+		return 0;
+	while ((d = readdir(dp))) {
+		if (strncmp(d->d_name, base, len) || d->d_name[len] != '.')
+			continue;
+		n = strtoull(d->d_name + len + 1, &end, 10);
+		if (*end || end == d->d_name + len + 1)
+			continue;
+		if (n >= first)
+			first = n + 1;
+	}
+	closedir(dp);
+	return first;
+}
+
+/* How much of segment @id holds records, according to the end of the log */
+static size_t __zorolog_mmap_used(struct zorolog_mmap *m, uint64_t id)
+{
+	uint64_t start = id * m->size;
+
+	if (m->end <= start)
+		return 0;
+	return m->end - start < m->size ? m->end - start : m->size;
+}
+
+/* Account @len bytes of segment @s: whoever finishes it kicks the writer */
+static inline void __zorolog_mmap_done(struct zorolog_mmap *m,
+				       struct zorolog_mmap_seg *s, size_t len)
+{
+	if (__atomic_add_fetch(&s->written, len, __ATOMIC_RELEASE) == m->size)
+		__zorolog_mmap_kick(m);
+}
+
+static int __zorolog_mmap_map(struct zorolog_mmap *m, uint64_t id)
+{
+	struct zorolog_mmap_seg *s = __zorolog_mmap_slot(m, id);
+	char name[PATH_MAX];
+	int fd, ret;
+	void *map;
+
+	__zorolog_mmap_name(m, id, name, sizeof(name));
+	fd = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	/* Allocate the blocks now, not on page faults in the producers */
+	ret = posix_fallocate(fd, 0, m->size);
+	if (ret == EOPNOTSUPP || ret == EINVAL)
+		ret = ftruncate(fd, m->size) ? errno : 0;
+	if (ret)
+		goto error;
+
+	map = mmap(NULL, m->size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (map == MAP_FAILED) {
+		ret = errno;
+		goto error;
+	}
+
+	s->map = map;
+	s->fd = fd;
+	s->written = 0;
+	s->used = m->size;
+	s->flushed = 0;
+	s->reclaimed = 0;
+	if (m->closed) {
+		s->used = __zorolog_mmap_used(m, id);
+		s->written = m->size - s->used;
+	}
+	__atomic_store_n(&s->id, id, __ATOMIC_RELEASE);
+	return 0;
+
+error:
+	close(fd);
+	unlink(name);
+	return -ret;
+}
+
+/* Sync, trim and unmap segment @id, which all producers are done with */
+static void __zorolog_mmap_finish(struct zorolog_mmap *m, uint64_t id)
+{
+	struct zorolog_mmap_seg *s = __zorolog_mmap_slot(m, id);
+	char name[PATH_MAX];
+
+	munmap(s->map, m->size);
+	s->map = NULL;
+	if (s->used < m->size && ftruncate(s->fd, s->used))
+		m->error = errno;
+	if (fdatasync(s->fd))
+		m->error = errno;
+	posix_fadvise(s->fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(s->fd);
+	s->fd = -1;
+
+	if (!s->used) {
+		__zorolog_mmap_name(m, id, name, sizeof(name));
+		unlink(name);
+	}
+}
+
+/*
+ * Close the log: the end of the log is the tail, and the rest of the
+ * mapped segments is accounted for as written
+ */
+static void __zorolog_mmap_close(struct zorolog_mmap *m)
+{
+	struct zorolog_mmap_seg *s;
+	uint64_t id;
+
+	m->end = __atomic_fetch_or(&m->tail, ZOROLOG_MMAP_CLOSED,
+				   __ATOMIC_SEQ_CST);
+	m->closed = 1;
+	for (id = m->oldest; id < m->next; id++) {
+		s = __zorolog_mmap_slot(m, id);
+		s->used = __zorolog_mmap_used(m, id);
+		__zorolog_mmap_done(m, s, m->size - s->used);
+	}
+}
+
+static void __zorolog_mmap_map_ahead(struct zorolog_mmap *m)
+{
+	char name[PATH_MAX];
+	int ret;
+
+	while (!m->failed && m->next < m->oldest + ZOROLOG_MMAP_SEGMENTS &&
+	       (!m->closed || m->next * m->size < m->end)) {
+		ret = __zorolog_mmap_map(m, m->next);
+		if (ret) {
+			__zorolog_mmap_name(m, m->next, name, sizeof(name));
+			fprintf(stderr, "zorolog_mmap: cannot map %s: %s, logging "
+				"to the streams from now on\n", name,
+				strerror(-ret));
+			/* Producers waiting for the segment give up */
+			__atomic_store_n(&m->failed, 1, __ATOMIC_SEQ_CST);
+			if (!m->closed)
+				__zorolog_mmap_close(m);
+			break;
+		}
+		m->next++;
+	}
+}
+
+/*
+ * Write back the records of the oldest segment as it fills, and drop the
+ * pages written back on the previous tick from memory, to keep the page
+ * cache footprint of the log to a few segments, whatever its size
+ */
+static void __zorolog_mmap_writeback(struct zorolog_mmap *m)
+{
+	struct zorolog_mmap_seg *s;
+	uint64_t tail, start;
+	size_t lim;
+
+	if (m->oldest == m->next)
+		return;
+	s = __zorolog_mmap_slot(m, m->oldest);
+	start = m->oldest * m->size;
+
+	if (s->flushed > s->reclaimed) {
+		madvise(s->map + s->reclaimed, s->flushed - s->reclaimed,
+			MADV_DONTNEED);
+		posix_fadvise(s->fd, s->reclaimed, s->flushed - s->reclaimed,
+			      POSIX_FADV_DONTNEED);
+		s->reclaimed = s->flushed;
+	}
+
+	tail = __atomic_load_n(&m->tail, __ATOMIC_ACQUIRE);
+	tail &= ~ZOROLOG_MMAP_CLOSED;
+	if (tail <= start)
+		return;
+	lim = tail - start < m->size ? tail - start : m->size;
+	lim &= ~(m->page - 1);
+	if (lim <= s->flushed)
+		return;
+
+	/*
+	 * Producers might still be copying into the last pages: those get
+	 * dirty again, and are written back when the segment is finished
+	 */
+	if (m->flags & ZOROLOG_MMAP_SYNC) {
+		if (msync(s->map + s->flushed, lim - s->flushed, MS_SYNC))
+			m->error = errno;
+	} else {
+		sync_file_range(s->fd, s->flushed, lim - s->flushed,
+				SYNC_FILE_RANGE_WRITE);
+	}
+	s->flushed = lim;
+}
+
+static void *__zorolog_mmap_writer(void *arg)
+{
+	struct zorolog_mmap *m = arg;
+	struct zorolog_mmap_seg *s;
+
+	for (;;) {
+		pthread_mutex_lock(&m->lock);
+		if (!m->closed && !__atomic_load_n(&m->running, __ATOMIC_ACQUIRE))
+			__zorolog_mmap_close(m);
+		while (m->oldest < m->next) {
+			s = __zorolog_mmap_slot(m, m->oldest);
+			if (__atomic_load_n(&s->written, __ATOMIC_ACQUIRE) !=
+			    m->size)
+				break;
+			__zorolog_mmap_finish(m, m->oldest++);
+		}
+		__zorolog_mmap_map_ahead(m);
+		__zorolog_mmap_writeback(m);
+		pthread_mutex_unlock(&m->lock);
+
+		if (m->closed && m->oldest == m->next)
+			break;
+		/* Producers are still copying into the last segment */
+		if (m->closed)
+			sched_yield();
+		else
+			__zorolog_mmap_sleep(m);
+	}
+	return NULL;
+}
+
+/*
+ * Copy @len bytes into the log. Return -EPIPE if the log is closed: nothing
+ * was copied then, unless the log failed while copying.
+ */
+static int __zorolog_mmap_append(struct zorolog_mmap *m, const char *buf,
+				 size_t len)
+{
+	struct zorolog_mmap_seg *s;
+	uint64_t pos, id;
+	size_t off, n;
+
+	pos = __atomic_fetch_add(&m->tail, len, __ATOMIC_RELAXED);
+	if (unlikely(pos & ZOROLOG_MMAP_CLOSED))
+		return -EPIPE;
+
+	while (len) {
+		id = pos / m->size;
+		off = pos % m->size;
+		n = len < m->size - off ? len : m->size - off;
+
+		s = __zorolog_mmap_slot(m, id);
+		while (unlikely(__atomic_load_n(&s->id, __ATOMIC_ACQUIRE) !=
+				id)) {
+			/* The writer thread lags behind, or failed */
+			if (__atomic_load_n(&m->failed, __ATOMIC_ACQUIRE))
+				return -EPIPE;
+			__zorolog_mmap_kick(m);
+			sched_yield();
+		}
+
+		memcpy(s->map + off, buf, n);
+		__zorolog_mmap_done(m, s, n);
+		buf += n;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int zorolog_mmap_fprintf(FILE *stream, const char *format, ...)
+{
+	struct zorolog_mmap *m = &zlmmap;
+	char buf[ZOROLOG_MMAP_RECORD_SIZE], *rec = buf;
+	va_list args, args2;
+	int ret;
+
+	va_start(args, format);
+	if (unlikely(!__atomic_load_n(&m->active, __ATOMIC_ACQUIRE))) {
+		ret = vfprintf(stream, format, args);
+		va_end(args);
+		return ret;
+	}
+
+	va_copy(args2, args);
+	ret = vsnprintf(buf, sizeof(buf), format, args);
+	if (unlikely(ret >= (int)sizeof(buf))) {
+		rec = malloc(ret + 1);
+		if (rec) {
+			vsnprintf(rec, ret + 1, format, args2);
+		} else {
+			rec = buf;
+			ret = sizeof(buf) - 1;
+		}
+	}
+	va_end(args2);
+	va_end(args);
+
+	/* Closed meanwhile: go synchronous */
+	if (ret > 0 && unlikely(__zorolog_mmap_append(m, rec, ret)))
+		fwrite(rec, 1, ret, stream);
+
+	if (rec != buf)
+		free(rec);
+	return ret;
+}
+
+static void __zorolog_mmap_atfork_child(void)
+{
+	/* The writer thread does not exist in the child: go synchronous */
+	zlmmap.active = 0;
+	zlmmap.running = 0;
+	pthread_mutex_init(&zlmmap_lock, NULL);
+	pthread_mutex_init(&zlmmap.lock, NULL);
+}
+
+static void __zorolog_mmap_atexit(void)
+{
+	zorolog_mmap_stop();
+}
+
+int zorolog_mmap_start(const char *path, size_t size, int flags)
+{
+	static int registered;
+	struct zorolog_mmap *m = &zlmmap;
+	int i, ret;
+
+	if (!path || (flags & ~ZOROLOG_MMAP_SYNC))
+		return -EINVAL;
+
+	pthread_mutex_lock(&zlmmap_lock);
+	if (m->active) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	m->page = sysconf(_SC_PAGESIZE);
+	if (!size)
+		size = ZOROLOG_MMAP_SEGMENT_SIZE;
+	m->size = (size + m->page - 1) & ~(m->page - 1);
+	m->path = strdup(path);
+	if (!m->path) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+	m->first = __zorolog_mmap_first(path);
+	m->flags = flags;
+	m->tail = 0;
+	m->end = 0;
+	m->oldest = 0;
+	m->next = 0;
+	m->failed = 0;
+	m->error = 0;
+	m->closed = 0;
+	m->sleeping = 0;
+	for (i = 0; i < ZOROLOG_MMAP_SEGMENTS; i++) {
+		m->segs[i].id = ZOROLOG_MMAP_NONE;
+		m->segs[i].fd = -1;
+	}
+
+	/* The first segment is mapped here, to report errors to the caller */
+	ret = __zorolog_mmap_map(m, 0);
+	if (ret)
+		goto free_path;
+	m->next = 1;
+
+	/* Whatever stdio still holds is not going to the log */
+	fflush(stdout);
+	fflush(stderr);
+
+	m->running = 1;
+	ret = -pthread_create(&m->writer, NULL, __zorolog_mmap_writer, m);
+	if (ret) {
+		m->running = 0;
+		__zorolog_mmap_close(m);
+		__zorolog_mmap_finish(m, 0);
+		goto free_path;
+	}
+
+	if (!registered) {
+		pthread_atfork(NULL, NULL, __zorolog_mmap_atfork_child);
+		atexit(__zorolog_mmap_atexit);
+		registered = 1;
+	}
+	__atomic_store_n(&m->active, 1, __ATOMIC_RELEASE);
+	goto unlock;
+
+free_path:
+	free(m->path);
+	m->path = NULL;
+unlock:
+	pthread_mutex_unlock(&zlmmap_lock);
+	return ret;
+}
+
+int zorolog_mmap_flush(void)
+{
+	struct zorolog_mmap *m = &zlmmap;
+	struct zorolog_mmap_seg *s;
+	int ret = 0;
+	uint64_t id;
+
+	if (!__atomic_load_n(&m->active, __ATOMIC_ACQUIRE))
+		return -EINVAL;
+
+	/* Finished segments are synced already */
+	pthread_mutex_lock(&m->lock);
+	for (id = m->oldest; id < m->next; id++) {
+		s = __zorolog_mmap_slot(m, id);
+		if (msync(s->map, m->size, MS_SYNC))
+			ret = -errno;
+	}
+	if (!ret && m->error)
+		ret = -m->error;
+	else if (!ret && m->failed)
+		ret = -EIO;
+	pthread_mutex_unlock(&m->lock);
+	return ret;
+}
+
+void zorolog_mmap_stop(void)
+{
+	struct zorolog_mmap *m = &zlmmap;
+
+	pthread_mutex_lock(&zlmmap_lock);
+	if (!m->active)
+		goto unlock;
+
+	/* New records go synchronous from now on */
+	__atomic_store_n(&m->active, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&m->running, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&m->sleeping, 0, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &m->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	pthread_join(m->writer, NULL);
+	free(m->path);
+	m->path = NULL;
+
+unlock:
+	pthread_mutex_unlock(&zlmmap_lock);
+}
@@ -0,0 +1,470 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <zoro/sink.h>
+#include <zoro/compiler.h>
+
+#define ZOROLOG_SINK_DEFAULT_DEPTH	8
+#define ZOROLOG_SINK_MAX_DEPTH		64
+#define ZOROLOG_SINK_DEFAULT_BUFSIZE	(64 * 1024)
+
+struct zorolog_sink_buf {
+	char *data;
+	size_t len;
+	int res;
+};
+
+struct zorolog_sink {
+	int fd;
+	int ring_fd;
+	int fixed;
+	int error;
+	unsigned int depth;
+	size_t bufsize;
+	char *mem;
+	struct zorolog_sink_buf *bufs;
+
+	/* Buffer being filled, or -1 */
+	int cur;
+	/* Free buffers stack */
+	unsigned int nfree;
+	unsigned int *free;
+	/* Full buffers, in stream order, not yet submitted */
+	unsigned int nqueued;
+	unsigned int *queued;
+	/* Buffers of the chain in flight, in stream order */
+	unsigned int ninflight;
+	unsigned int *inflight;
+
+	/* Rings */
+	void *ring;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static inline int __io_uring_setup(unsigned int entries,
+				   struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int __io_uring_enter(int fd, unsigned int to_submit,
+				   unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static inline int __io_uring_register(int fd, unsigned int opcode, void *arg,
+				      unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int __zorolog_sink_write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static ssize_t __zorolog_sink_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret, total = 0;
+
+	while (iovcnt > 0) {
+		ret = writev(fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		total += ret;
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return total;
+}
+
+static int __zorolog_sink_uring_init(struct zorolog_sink *s)
+{
+	struct io_uring_params p;
+	struct iovec *iov;
+	unsigned int i;
+	char *ring;
+
+	memset(&p, 0, sizeof(p));
+	s->ring_fd = __io_uring_setup(s->depth, &p);
+	if (s->ring_fd < 0)
+		return -errno;
+
+	/* Writes at the current file position keep sharing the fd possible */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_RW_CUR_POS))
+		goto fail;
+
+	s->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	if (s->ring_size < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+		s->ring_size = p.cq_off.cqes +
+			       p.cq_entries * sizeof(struct io_uring_cqe);
+	ring = mmap(NULL, s->ring_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, s->ring_fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED)
+		goto fail;
+	s->ring = ring;
+
+	s->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	s->sqes = mmap(NULL, s->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, s->ring_fd, IORING_OFF_SQES);
+	if (s->sqes == MAP_FAILED) {
+		munmap(s->ring, s->ring_size);
+		goto fail;
+	}
+
+	s->sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+	s->sq_mask = (unsigned int *)(ring + p.sq_off.ring_mask);
+	s->sq_array = (unsigned int *)(ring + p.sq_off.array);
+	s->cq_head = (unsigned int *)(ring + p.cq_off.head);
+	s->cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+	s->cq_mask = (unsigned int *)(ring + p.cq_off.ring_mask);
+	s->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	/* Registered buffers spare the per-write page pinning; optional */
+	iov = calloc(s->depth, sizeof(*iov));
+	if (iov) {
+		for (i = 0; i < s->depth; i++) {
+			iov[i].iov_base = s->bufs[i].data;
+			iov[i].iov_len = s->bufsize;
+		}
+		s->fixed = !__io_uring_register(s->ring_fd,
+						IORING_REGISTER_BUFFERS,
+						iov, s->depth);
+		free(iov);
+	}
+	return 0;
+
+fail:
+	close(s->ring_fd);
+	s->ring_fd = -1;
+	return -ENOSYS;
+}
+
+struct zorolog_sink *zorolog_sink_open(int fd, unsigned int depth,
+				       size_t bufsize, int flags)
+{
+	struct zorolog_sink *s;
+	unsigned int i;
+
+	if (fd < 0 || depth > ZOROLOG_SINK_MAX_DEPTH ||
+	    flags & ~ZOROLOG_SINK_NO_URING) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->fd = fd;
+	s->ring_fd = -1;
+	s->cur = -1;
+	s->depth = depth ? depth : ZOROLOG_SINK_DEFAULT_DEPTH;
+	s->bufsize = bufsize ? bufsize : ZOROLOG_SINK_DEFAULT_BUFSIZE;
+
+	if (flags & ZOROLOG_SINK_NO_URING)
+		return s;
+
+	s->mem = mmap(NULL, s->depth * s->bufsize, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (s->mem == MAP_FAILED) {
+		s->mem = NULL;
+		return s;
+	}
+	s->bufs = calloc(s->depth, sizeof(*s->bufs));
+	s->free = calloc(3 * s->depth, sizeof(unsigned int));
+	if (!s->bufs || !s->free)
+		goto writev_only;
+	s->queued = s->free + s->depth;
+	s->inflight = s->queued + s->depth;
+
+	for (i = 0; i < s->depth; i++) {
+		s->bufs[i].data = s->mem + i * s->bufsize;
+		s->free[s->nfree++] = s->depth - 1 - i;
+	}
+
+	if (__zorolog_sink_uring_init(s))
+		goto writev_only;
+	return s;
+
+writev_only:
+	free(s->bufs);
+	free(s->free);
+	munmap(s->mem, s->depth * s->bufsize);
+	s->bufs = NULL;
+	s->free = NULL;
+	s->mem = NULL;
+	return s;
+}
+
+int zorolog_sink_uring(const struct zorolog_sink *s)
+{
+	return s->ring_fd != -1;
+}
+
+/*
+ * Wait for the chain in flight. Writes that came up short, or that were
+ * cancelled because an earlier link failed, are completed synchronously, in
+ * stream order, before anything else is submitted.
+ */
+static int __zorolog_sink_wait(struct zorolog_sink *s)
+{
+	struct zorolog_sink_buf *b;
+	struct io_uring_cqe *cqe;
+	unsigned int head, i, done = 0;
+	int ret;
+
+	while (done < s->ninflight) {
+		head = *s->cq_head;
+		while (head != __atomic_load_n(s->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &s->cqes[head & *s->cq_mask];
+			s->bufs[cqe->user_data].res = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(s->cq_head, head, __ATOMIC_RELEASE);
+		if (done >= s->ninflight)
+			break;
+
+		ret = __io_uring_enter(s->ring_fd, 0, s->ninflight - done,
+				       IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	for (i = 0; i < s->ninflight; i++) {
+		b = &s->bufs[s->inflight[i]];
+		if (b->res < 0 && b->res != -ECANCELED && b->res != -EAGAIN &&
+		    b->res != -EINTR) {
+			if (!s->error)
+				s->error = b->res;
+		} else if ((size_t)MAX(b->res, 0) < b->len && !s->error) {
+			ret = __zorolog_sink_write_all(s->fd,
+						       b->data + MAX(b->res, 0),
+						       b->len - MAX(b->res, 0));
+			if (ret)
+				s->error = ret;
+		}
+		b->len = 0;
+		s->free[s->nfree++] = s->inflight[i];
+	}
+	s->ninflight = 0;
+	return s->error;
+}
+
+/* Move the buffer being filled, if any, to the queue */
+static void __zorolog_sink_close_cur(struct zorolog_sink *s)
+{
+	if (s->cur == -1)
+		return;
+	if (s->bufs[s->cur].len)
+		s->queued[s->nqueued++] = s->cur;
+	else
+		s->free[s->nfree++] = s->cur;
+	s->cur = -1;
+}
+
+int zorolog_sink_submit(struct zorolog_sink *s)
+{
+	struct zorolog_sink_buf *b;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, i;
+	int ret;
+
+	if (s->ring_fd == -1)
+		return s->error;
+
+	__zorolog_sink_close_cur(s);
+
+	/* One chain at a time keeps the stream ordered */
+	ret = __zorolog_sink_wait(s);
+	if (ret || !s->nqueued)
+		return ret;
+
+	tail = *s->sq_tail;
+	for (i = 0; i < s->nqueued; i++) {
+		b = &s->bufs[s->queued[i]];
+		sqe = &s->sqes[tail & *s->sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = s->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+		sqe->fd = s->fd;
+		sqe->off = (uint64_t)-1;
+		sqe->addr = (uintptr_t)b->data;
+		sqe->len = b->len;
+		sqe->buf_index = s->queued[i];
+		sqe->user_data = s->queued[i];
+		if (i + 1 < s->nqueued)
+			sqe->flags = IOSQE_IO_LINK;
+		s->sq_array[tail & *s->sq_mask] = tail & *s->sq_mask;
+		s->inflight[i] = s->queued[i];
+		tail++;
+	}
+	__atomic_store_n(s->sq_tail, tail, __ATOMIC_RELEASE);
+	s->ninflight = s->nqueued;
+	s->nqueued = 0;
+
+	do {
+		ret = __io_uring_enter(s->ring_fd, s->ninflight, 0, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		s->error = -errno;
+		return s->error;
+	}
+	return 0;
+}
+
+int zorolog_sink_flush(struct zorolog_sink *s)
+{
+	int ret;
+
+	if (s->ring_fd == -1)
+		return s->error;
+
+	ret = zorolog_sink_submit(s);
+	if (ret)
+		return ret;
+	return __zorolog_sink_wait(s);
+}
+
+int zorolog_sink_set_fd(struct zorolog_sink *s, int fd)
+{
+	int ret;
+
+	if (fd < 0)
+		return -EINVAL;
+
+	/* Nothing buffered for the old destination can go to the new one */
+	ret = zorolog_sink_flush(s);
+	if (ret)
+		return ret;
+	s->fd = fd;
+	return 0;
+}
+
+/* Get a buffer with room, submitting and waiting if all are busy */
+static struct zorolog_sink_buf *__zorolog_sink_get(struct zorolog_sink *s)
+{
+	if (s->cur != -1 && s->bufs[s->cur].len < s->bufsize)
+		return &s->bufs[s->cur];
+
+	__zorolog_sink_close_cur(s);
+	if (!s->nfree) {
+		if (zorolog_sink_submit(s) || __zorolog_sink_wait(s))
+			return NULL;
+	}
+	s->cur = s->free[--s->nfree];
+	return &s->bufs[s->cur];
+}
+
+ssize_t zorolog_sink_writev(struct zorolog_sink *s, const struct iovec *iov,
+			    int iovcnt)
+{
+	struct zorolog_sink_buf *b;
+	struct iovec *copy;
+	const char *p;
+	size_t len, n;
+	ssize_t total = 0;
+	int i;
+
+	if (s->error)
+		return s->error;
+
+	if (s->ring_fd == -1) {
+		/* writev() may update the iovec array: use a copy */
+		copy = alloca(iovcnt * sizeof(*copy));
+		memcpy(copy, iov, iovcnt * sizeof(*copy));
+		total = __zorolog_sink_writev_all(s->fd, copy, iovcnt);
+		if (total < 0)
+			s->error = total;
+		return total;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+		while (len) {
+			b = __zorolog_sink_get(s);
+			if (!b)
+				return s->error;
+			n = MIN(len, s->bufsize - b->len);
+			memcpy(b->data + b->len, p, n);
+			b->len += n;
+			p += n;
+			len -= n;
+			total += n;
+		}
+	}
+	return total;
+}
+
+ssize_t zorolog_sink_write(struct zorolog_sink *s, const void *buf, size_t len)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = len,
+	};
+
+	return zorolog_sink_writev(s, &iov, 1);
+}
+
+void zorolog_sink_close(struct zorolog_sink *s)
+{
+	if (!s)
+		return;
+
+	if (s->ring_fd != -1) {
+		zorolog_sink_flush(s);
+		/* the chain in flight references the buffers */
+		if (s->ninflight)
+			__zorolog_sink_wait(s);
+		munmap(s->sqes, s->sqes_size);
+		munmap(s->ring, s->ring_size);
+		close(s->ring_fd);
+	}
+	if (s->mem)
+		munmap(s->mem, s->depth * s->bufsize);
+	free(s->bufs);
+	free(s->free);
+	free(s);
+}
@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include <zoro/log.h>
+#include <zoro/compiler.h>
+#include <zoro/linux/list.h>
+
+/* Max number of file descriptors a thread can buffer for at the same time */
+#define ZOROLOG_TLS_MAX_FDS 4
+
+#define ZOROLOG_TLS_DEFAULT_SIZE	4096
+#define ZOROLOG_TLS_DEFAULT_LINES	64
+#define ZOROLOG_TLS_DEFAULT_MSEC	100
+
+struct zorolog_tls_buf {
+	int fd;
+	size_t len;
+	unsigned int lines;
+	uint64_t first_ms;
+	char *data;
+};
+
+/*
+ * Per-thread state. The lock is only ever contended by zorolog_tls_flush_all()
+ * and by the exit path, so appending a record never bounces a shared cache
+ * line between cores.
+ */
+struct zorolog_tls {
+	pthread_mutex_t lock;
+	struct list_head list;
+	size_t size;
+	struct zorolog_tls_buf bufs[ZOROLOG_TLS_MAX_FDS];
+};
+
+static struct {
+	size_t size;
+	unsigned int lines;
+	unsigned int msec;
+} zltls_conf = {
+	.size = ZOROLOG_TLS_DEFAULT_SIZE,
+	.lines = ZOROLOG_TLS_DEFAULT_LINES,
+	.msec = ZOROLOG_TLS_DEFAULT_MSEC,
+};
+
+static __thread struct zorolog_tls *zltls;
+static pthread_key_t zltls_key;
+static pthread_once_t zltls_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t zltls_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(zltls_list);
+
+static inline uint64_t __zorolog_tls_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+static int __zorolog_tls_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret;
+
+	while (iovcnt > 0) {
+		ret = writev(fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write out the buffer content, followed by the optional @a tail record, with
+ * a single system call. Must be called with the thread state lock held.
+ */
+static int __zorolog_tls_flush_buf(struct zorolog_tls_buf *b,
+				   const char *tail, size_t tail_len)
+{
+	struct iovec iov[2];
+	int cnt = 0, ret = 0;
+
+	if (b->len) {
+		iov[cnt].iov_base = b->data;
+		iov[cnt].iov_len = b->len;
+		cnt++;
+	}
+	if (tail_len) {
+		iov[cnt].iov_base = (void *)tail;
+		iov[cnt].iov_len = tail_len;
+		cnt++;
+	}
+	if (cnt)
+		ret = __zorolog_tls_writev(b->fd, iov, cnt);
+
+	b->len = 0;
+	b->lines = 0;
+	return ret;
+}
+
+static void __zorolog_tls_flush_all_bufs(struct zorolog_tls *t)
+{
+	int i;
+
+	for (i = 0; i < ZOROLOG_TLS_MAX_FDS; i++)
+		if (t->bufs[i].data)
+			__zorolog_tls_flush_buf(&t->bufs[i], NULL, 0);
+}
+
+static void __zorolog_tls_release(struct zorolog_tls *t)
+{
+	int i;
+
+	for (i = 0; i < ZOROLOG_TLS_MAX_FDS; i++)
+		free(t->bufs[i].data);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+/* Thread exit: flush whatever is still buffered */
+static void __zorolog_tls_destructor(void *arg)
+{
+	struct zorolog_tls *t = arg;
+
+	pthread_mutex_lock(&zltls_list_lock);
+	list_del(&t->list);
+	pthread_mutex_unlock(&zltls_list_lock);
+
+	pthread_mutex_lock(&t->lock);
+	__zorolog_tls_flush_all_bufs(t);
+	pthread_mutex_unlock(&t->lock);
+
+	__zorolog_tls_release(t);
+	zltls = NULL;
+}
+
+static void __zorolog_tls_atfork_prepare(void)
+{
+	/* Avoid the child writing again what this thread still buffers */
+	if (zltls) {
+		pthread_mutex_lock(&zltls->lock);
+		__zorolog_tls_flush_all_bufs(zltls);
+		pthread_mutex_unlock(&zltls->lock);
+	}
+	pthread_mutex_lock(&zltls_list_lock);
+}
+
+static void __zorolog_tls_atfork_parent(void)
+{
+	pthread_mutex_unlock(&zltls_list_lock);
+}
+
+static void __zorolog_tls_atfork_child(void)
+{
+	struct zorolog_tls *t, *n;
+
+	/* Only the forking thread survives: drop the others' buffers */
+	list_for_each_entry_safe(t, n, &zltls_list, list) {
+		if (t == zltls)
+			continue;
+		list_del(&t->list);
+		pthread_mutex_init(&t->lock, NULL);
+		__zorolog_tls_release(t);
+	}
+	pthread_mutex_init(&zltls_list_lock, NULL);
+}
+
+static void __zorolog_tls_atexit(void)
+{
+	zorolog_tls_flush_all();
+}
+
+static void __zorolog_tls_init_once(void)
+{
+	pthread_key_create(&zltls_key, __zorolog_tls_destructor);
+	pthread_atfork(__zorolog_tls_atfork_prepare,
+		       __zorolog_tls_atfork_parent,
+		       __zorolog_tls_atfork_child);
+	atexit(__zorolog_tls_atexit);
+}
+
+static struct zorolog_tls *__zorolog_tls_get(void)
+{
+	struct zorolog_tls *t = zltls;
+	int i;
+
+	if (likely(t))
+		return t;
+
+	pthread_once(&zltls_once, __zorolog_tls_init_once);
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	pthread_mutex_init(&t->lock, NULL);
+	t->size = __atomic_load_n(&zltls_conf.size, __ATOMIC_RELAXED);
+	for (i = 0; i < ZOROLOG_TLS_MAX_FDS; i++)
+		t->bufs[i].fd = -1;
+
+	if (pthread_setspecific(zltls_key, t)) {
+		__zorolog_tls_release(t);
+		return NULL;
+	}
+	pthread_mutex_lock(&zltls_list_lock);
+	list_add_tail(&t->list, &zltls_list);
+	pthread_mutex_unlock(&zltls_list_lock);
+
+	zltls = t;
+	return t;
+}
+
+/*
+ * Look for the buffer associated to @a fd, or pick a new one. When all of them
+ * are busy, the first one is flushed and recycled.
+ */
+static struct zorolog_tls_buf *__zorolog_tls_buf(struct zorolog_tls *t, int fd)
+{
+	struct zorolog_tls_buf *b, *free_buf = NULL;
+	int i;
+
+	for (i = 0; i < ZOROLOG_TLS_MAX_FDS; i++) {
+		b = &t->bufs[i];
+		if (likely(b->fd == fd))
+			return b;
+		if (!free_buf && b->fd == -1)
+			free_buf = b;
+	}
+
+	if (!free_buf) {
+		free_buf = &t->bufs[0];
+		__zorolog_tls_flush_buf(free_buf, NULL, 0);
+	}
+	if (!free_buf->data) {
+		free_buf->data = malloc(t->size);
+		if (!free_buf->data)
+			return NULL;
+	}
+	free_buf->fd = fd;
+	free_buf->len = 0;
+	free_buf->lines = 0;
+	return free_buf;
+}
+
+static inline unsigned int __zorolog_tls_count_lines(const char *s, size_t len)
+{
+	const char *end = s + len;
+	unsigned int lines = 0;
+
+	while ((s = memchr(s, '\n', end - s)) != NULL) {
+		lines++;
+		s++;
+	}
+	return lines;
+}
+
+int zorolog_tls_fprintf(FILE *stream, const char *format, ...)
+{
+	struct zorolog_tls_buf *b;
+	struct zorolog_tls *t;
+	unsigned int max_lines, msec;
+	va_list args, args2;
+	uint64_t now;
+	size_t room;
+	char *big;
+	int ret;
+
+	va_start(args, format);
+	t = __zorolog_tls_get();
+	if (unlikely(!t))
+		goto sync;
+
+	pthread_mutex_lock(&t->lock);
+	b = __zorolog_tls_buf(t, fileno(stream));
+	if (unlikely(!b)) {
+		pthread_mutex_unlock(&t->lock);
+		goto sync;
+	}
+
+	va_copy(args2, args);
+	room = t->size - b->len;
+	ret = vsnprintf(b->data + b->len, room, format, args);
+	if (unlikely(ret < 0)) {
+		va_end(args2);
+		goto unlock;
+	}
+
+	if (unlikely((size_t)ret >= room)) {
+		if ((size_t)ret < t->size && b->len) {
+			/* Make room and format it again */
+			__zorolog_tls_flush_buf(b, NULL, 0);
+			vsnprintf(b->data, t->size, format, args2);
+		} else {
+			/* It will never fit: write it along with the buffer */
+			big = malloc(ret + 1);
+			if (big) {
+				vsnprintf(big, ret + 1, format, args2);
+				__zorolog_tls_flush_buf(b, big, ret);
+				free(big);
+			} else {
+				__zorolog_tls_flush_buf(b, NULL, 0);
+			}
+			va_end(args2);
+			goto unlock;
+		}
+	}
+	va_end(args2);
+
+	now = __zorolog_tls_now_ms();
+	if (!b->len)
+		b->first_ms = now;
+	b->lines += __zorolog_tls_count_lines(b->data + b->len, ret);
+	b->len += ret;
+
+	max_lines = __atomic_load_n(&zltls_conf.lines, __ATOMIC_RELAXED);
+	msec = __atomic_load_n(&zltls_conf.msec, __ATOMIC_RELAXED);
+	if (b->len >= t->size - 1 || (max_lines && b->lines >= max_lines) ||
+	    (msec && now - b->first_ms >= msec))
+		__zorolog_tls_flush_buf(b, NULL, 0);
+
+unlock:
+	pthread_mutex_unlock(&t->lock);
+	va_end(args);
+	return ret;
+
+sync:
+	ret = vfprintf(stream, format, args);
+	va_end(args);
+	return ret;
+}
+
+int zorolog_tls_setup(size_t size, unsigned int lines, unsigned int msec)
+{
+	if (size && size < 128)
+		return -EINVAL;
+
+	__atomic_store_n(&zltls_conf.size, size ? size : ZOROLOG_TLS_DEFAULT_SIZE,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&zltls_conf.lines, lines, __ATOMIC_RELAXED);
+	__atomic_store_n(&zltls_conf.msec, msec, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void zorolog_tls_flush(void)
+{
+	struct zorolog_tls *t = zltls;
+
+	if (!t)
+		return;
+	pthread_mutex_lock(&t->lock);
+	__zorolog_tls_flush_all_bufs(t);
+	pthread_mutex_unlock(&t->lock);
+}
+
+void zorolog_tls_flush_all(void)
+{
+	struct zorolog_tls *t;
+
+	pthread_mutex_lock(&zltls_list_lock);
+	list_for_each_entry(t, &zltls_list, list) {
+		pthread_mutex_lock(&t->lock);
+		__zorolog_tls_flush_all_bufs(t);
+		pthread_mutex_unlock(&t->lock);
+	}
+	pthread_mutex_unlock(&zltls_list_lock);
+}
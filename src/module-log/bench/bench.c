@@ -0,0 +1,173 @@
+/*
+ * zorolog_info() throughput with the stdio, per-thread buffer and
+ * asynchronous backends, from one thread and from several at once, then
+ * with the standard output duplicated to a log file, which is done last
+ * since it cannot be undone.
+ *
+ * The records go to /dev/null, with the results printed to the original
+ * standard output.
+ *
+ * Usage: bench [threads (default 4)] [thread|process (duplication, default
+ *        thread)]
+ * Output as set by ZOROBENCH_FORMAT (text, or json).
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zoro/bench.h>
+
+/* Have the zorolog_* macros go through the backend under benchmark */
+static int (*backend)(FILE *stream, const char *format, ...) = fprintf;
+#define zoro_fprintf (*backend)
+#include <zoro/log.h>
+
+#define PATH_LOGFILE "./bench.log"
+
+struct ctx {
+	uint64_t iters;
+	int async;
+};
+
+static unsigned int nthreads = 4;
+
+static void records(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		zorolog_info("bench record %lu of %lu, %s\n", i, iters,
+			     "some payload");
+}
+
+/* One operation is a record; asynchronous ones are only done once flushed */
+static void bench_log(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+
+	records(iters);
+	if (c->async)
+		zorolog_async_flush();
+}
+
+static void *thread_fn(void *arg)
+{
+	struct ctx *c = arg;
+
+	records(c->iters);
+	if (backend == zorolog_tls_fprintf)
+		zorolog_tls_flush();
+	return NULL;
+}
+
+/* Same as bench_log(), with the records split among the threads */
+static void bench_log_threads(uint64_t iters, void *arg)
+{
+	struct ctx *c = arg;
+	pthread_t tids[nthreads];
+	unsigned int i;
+
+	c->iters = iters / nthreads;
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&tids[i], NULL, thread_fn, c))
+			abort();
+	/* The remainder, by the calling thread */
+	records(iters % nthreads);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	if (c->async)
+		zorolog_async_flush();
+}
+
+static void run(const char *name, zorobench_fn_t fn, struct ctx *c)
+{
+	struct zorobench_result res;
+	int ret;
+
+	ret = zorobench_run(name, fn, c, &res);
+	if (ret) {
+		fprintf(stderr, "%s: error %d\n", name, ret);
+		return;
+	}
+	zorobench_report(&res);
+}
+
+static void run_all(const char *suffix)
+{
+	struct ctx c = { 0 };
+	char name[128];
+
+	backend = fprintf;
+	snprintf(name, sizeof(name), "log_info/stdio/threads=1%s", suffix);
+	run(name, bench_log, &c);
+	snprintf(name, sizeof(name), "log_info/stdio/threads=%u%s", nthreads,
+		 suffix);
+	run(name, bench_log_threads, &c);
+
+	backend = zorolog_tls_fprintf;
+	snprintf(name, sizeof(name), "log_info/tls/threads=1%s", suffix);
+	run(name, bench_log, &c);
+	snprintf(name, sizeof(name), "log_info/tls/threads=%u%s", nthreads,
+		 suffix);
+	run(name, bench_log_threads, &c);
+	zorolog_tls_flush();
+
+	if (zorolog_async_start(0, 0)) {
+		fprintf(stderr, "zorolog_async_start() failed\n");
+		return;
+	}
+	backend = zorolog_async_fprintf;
+	c.async = 1;
+	snprintf(name, sizeof(name), "log_info/async/threads=1%s", suffix);
+	run(name, bench_log, &c);
+	snprintf(name, sizeof(name), "log_info/async/threads=%u%s", nthreads,
+		 suffix);
+	run(name, bench_log_threads, &c);
+	zorolog_async_stop();
+	backend = fprintf;
+}
+
+int main(int argc, char *argv[])
+{
+	int flags = ZOROLOG_DUP_THREAD;
+	FILE *out;
+	int fd;
+
+	if (argc > 1)
+		nthreads = strtoul(argv[1], NULL, 0);
+	if (!nthreads)
+		nthreads = 1;
+	if (argc > 2 && !strcmp(argv[2], "process"))
+		flags = 0;
+
+	/* Results to the original standard output, records to /dev/null */
+	fd = dup(STDOUT_FILENO);
+	out = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!out) {
+		perror("dup");
+		return EXIT_FAILURE;
+	}
+	zorobench_set_output(out, getenv("ZOROBENCH_FORMAT") &&
+			     !strcmp(getenv("ZOROBENCH_FORMAT"), "json") ?
+			     ZOROBENCH_FORMAT_JSON : ZOROBENCH_FORMAT_TEXT);
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		perror("/dev/null");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	run_all("");
+
+	/* The copy to the log file goes on until exit */
+	if (zorolog_duplicate(PATH_LOGFILE, ZOROLOG_DUP_STDOUT, flags)) {
+		fprintf(stderr, "zorolog_duplicate() failed\n");
+		return EXIT_FAILURE;
+	}
+	run_all(flags ? "/dup=thread" : "/dup=process");
+	unlink(PATH_LOGFILE);
+
+	return EXIT_SUCCESS;
+}
@@ -1,94 +1,801 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <glob.h>
+#include <spawn.h>
+#include <time.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
 
 #include <string.h>
 #include <zoro/log.h>
+#include <zoro/sink.h>
 #include <zoro/compiler.h>
+#include <zoro/linux/list.h>
 
 #define MAX_STANDARDS 2
-#define MAX_BUFFER_SIZE 512
+/*
+ * Default size of the copy buffer, that is also the max number of bytes moved
+ * per tee(2)/splice(2) call
+ */
+#define DEFAULT_BUFFER_SIZE (64 * 1024)
+#define MIN_BUFFER_SIZE 4096
+
+/* Program compressing the rotated segments, looked up in PATH */
+#define ROTATE_COMPRESSOR "gzip"
+/* Suffix of the file prepared for the next rotation */
+#define ROTATE_NEXT_SUFFIX ".next"
+
+struct zorolog_rotator;
 
 typedef struct log_config {
     uint8_t stdsdup[MAX_STANDARDS];
 	int pipes[MAX_STANDARDS][2];
+	/* The log file copy of each standard goes through these pipes */
+	int tees[MAX_STANDARDS][2];
+	uint8_t zerocopy[MAX_STANDARDS];
 	int custom_stds[MAX_STANDARDS];
 	int fd_logfile;
+	size_t bufsize;
+	/* Batches the copy path writes to the log file, NULL if unavailable */
+	struct zorolog_sink *sink;
+	/* Running on a thread of the duplicated process rather than in a child */
+	uint8_t thread;
+	/* Thread mode: readable once the process exits, -1 otherwise */
+	int stop;
+	/* Rotation settings, and state: NULL if the log file is not rotated */
+	char *path;
+	size_t rot_size;
+	unsigned int rot_sec;
+	unsigned int rot_keep;
+	int rot_flags;
+	struct zorolog_rotator *rot;
 } log_config;
 
+static struct {
+	size_t pipe_size;
+	size_t bufsize;
+	size_t rot_size;
+	unsigned int rot_sec;
+	unsigned int rot_keep;
+	int rot_flags;
+} zldup_conf = {
+	.bufsize = DEFAULT_BUFFER_SIZE,
+};
+
+/* A rotated segment, waiting for the rotator thread */
+struct zorolog_segment {
+	struct list_head list;
+	int fd;
+	char name[];
+};
+
+/*
+ * Rotation state of a logger. The switch to a new file is done by the
+ * logger itself, and only takes two renames: the new file is created and
+ * preallocated ahead of time by the rotator thread, which also truncates,
+ * closes and possibly compresses the old segments. Meanwhile, what is
+ * written to the standards waits in the pipes.
+ */
+struct zorolog_rotator {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int stop;
+	/* The prepared next file, -1 while not ready */
+	int next_fd;
+	/* Preparing the next file failed: the logger creates it on its own */
+	int next_err;
+	/* The next file is being prepared, out of the lock */
+	int opening;
+	struct list_head segments;
+	char *next_path;
+	size_t max_size;
+	uint64_t max_ns;
+	unsigned int keep;
+	int flags;
+	/* Current file */
+	size_t written;
+	uint64_t opened_ns;
+};
+
+/* State of the ZOROLOG_DUP_THREAD logger */
+static struct {
+	pthread_mutex_t lock;
+	pthread_t thread;
+	int active;
+	int stds[MAX_STANDARDS];
+	/* Written by the exit handler, read by the logger */
+	int stop[2];
+} zldup = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.stop = { -1, -1 },
+};
+
 #define __zorolog_close(_fd) do {   \
     if (_fd != -1)                  \
         close(_fd);                 \
     } while (0)
 
+static int __zorolog_write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Move @a len bytes out of the pipe @a in; @a len is left to what is not moved */
+static int __zorolog_splice_all(int in, int out, size_t *len)
+{
+	ssize_t ret;
+
+	while (*len) {
+		ret = splice(in, NULL, out, NULL, *len, SPLICE_F_MOVE);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0) {
+			errno = EPIPE;
+			return -1;
+		}
+		*len -= ret;
+	}
+	return 0;
+}
+
+/* Same as __zorolog_splice_all(), going through @a buf of @a size bytes */
+static int __zorolog_copy_all(int in, int out, size_t len, char *buf,
+			      size_t size)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = read(in, buf, len < size ? len : size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0 || __zorolog_write_all(out, buf, ret))
+			return -1;
+		len -= ret;
+	}
+	return 0;
+}
+
+static int __zorolog_log_write(log_config *lc, const char *buf, size_t len)
+{
+	if (lc->sink)
+		return zorolog_sink_write(lc->sink, buf, len) < 0 ? -1 : 0;
+	return __zorolog_write_all(lc->fd_logfile, buf, len);
+}
+
+/*
+ * Copy path: one read(2) of up to lc->bufsize bytes, written to both
+ * destinations. Return the number of bytes moved, 0 at end of file, -1 on
+ * error.
+ */
+static ssize_t __zorolog_dup_copy(log_config *lc, int i, char *buf)
+{
+	ssize_t len;
+
+	do {
+		len = read(lc->pipes[i][0], buf, lc->bufsize);
+	} while (len < 0 && errno == EINTR);
+	if (len <= 0)
+		return len;
+
+	if (__zorolog_write_all(lc->custom_stds[i], buf, len) ||
+	    __zorolog_log_write(lc, buf, len))
+		return -1;
+	return len;
+}
+
+/*
+ * Zero-copy duplication: the pipe content is cloned into the tee pipe, then
+ * each copy is spliced to its destination. Should a destination not support
+ * splice(2) (e.g. a terminal, or an O_APPEND log file), the standard is
+ * switched to the copy path.
+ * Return the number of bytes moved, 0 at end of file, -1 on error; -1 with
+ * errno set to EAGAIN when nothing could be moved this time.
+ */
+static ssize_t __zorolog_dup_zerocopy(log_config *lc, int i, char *buf)
+{
+	ssize_t len;
+	size_t left;
+
+	do {
+		len = tee(lc->pipes[i][0], lc->tees[i][1], lc->bufsize,
+			  SPLICE_F_NONBLOCK);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) {
+		if (errno != EINVAL)
+			return -1;
+		/* Nothing was cloned: the copy path takes the same chunk */
+		lc->zerocopy[i] = 0;
+		return __zorolog_dup_copy(lc, i, buf);
+	}
+	if (len == 0)
+		return 0;
+
+	left = len;
+	if (__zorolog_splice_all(lc->pipes[i][0], lc->custom_stds[i], &left)) {
+		if (errno != EINVAL)
+			return -1;
+		lc->zerocopy[i] = 0;
+		if (__zorolog_copy_all(lc->pipes[i][0], lc->custom_stds[i],
+				       left, buf, lc->bufsize))
+			return -1;
+	}
+
+	/* What the other standard left in the sink comes first */
+	if (lc->sink && zorolog_sink_flush(lc->sink))
+		return -1;
+
+	left = len;
+	if (__zorolog_splice_all(lc->tees[i][0], lc->fd_logfile, &left)) {
+		if (errno != EINVAL)
+			return -1;
+		lc->zerocopy[i] = 0;
+		if (__zorolog_copy_all(lc->tees[i][0], lc->fd_logfile, left,
+				       buf, lc->bufsize))
+			return -1;
+	}
+	return len;
+}
+
+static uint64_t __zorolog_rotate_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Best effort: reserve the extents, without changing the file size */
+static void __zorolog_rotate_prealloc(struct zorolog_rotator *rot, int fd)
+{
+	if (rot->max_size)
+		fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, rot->max_size);
+}
+
+static int __zorolog_rotate_open_next(struct zorolog_rotator *rot)
+{
+	return open(rot->next_path, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC,
+		    S_IRWXU);
+}
+
+/* Release the preallocated space past the end of a segment, and close it */
+static void __zorolog_rotate_release(int fd)
+{
+	off_t end = lseek(fd, 0, SEEK_END);
+
+	if (end != -1)
+		(void)!ftruncate(fd, end);
+	close(fd);
+}
+
+static void __zorolog_rotate_compress(const char *name)
+{
+	char *argv[] = { ROTATE_COMPRESSOR, "-f", "--", (char *)name, NULL };
+	posix_spawn_file_actions_t fa;
+	extern char **environ;
+	pid_t pid;
+	int status;
+
+	/* Holding the standards would keep the logger pipes open */
+	if (posix_spawn_file_actions_init(&fa))
+		return;
+	posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null",
+					 O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null",
+					 O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null",
+					 O_WRONLY, 0);
+	if (!posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ))
+		while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+			;
+	posix_spawn_file_actions_destroy(&fa);
+}
+
+/* Order segment names by rotation time, compressed or not */
+static int __zorolog_segment_cmp(const void *a, const void *b)
+{
+	const char *x = *(const char **)a, *y = *(const char **)b;
+	size_t lx = strlen(x), ly = strlen(y);
+
+	if (lx > 3 && !strcmp(x + lx - 3, ".gz"))
+		lx -= 3;
+	if (ly > 3 && !strcmp(y + ly - 3, ".gz"))
+		ly -= 3;
+	return strncmp(x, y, lx < ly ? lx : ly) ?: (lx > ly) - (lx < ly);
+}
+
+/* Remove the oldest segments, so that only rot->keep of them are left */
+static void __zorolog_rotate_prune(struct zorolog_rotator *rot,
+				   const char *path)
+{
+	char pattern[PATH_MAX];
+	glob_t g;
+	size_t i;
+
+	if (!rot->keep)
+		return;
+	if (snprintf(pattern, sizeof(pattern), "%s.[0-9]*", path) >=
+	    (int)sizeof(pattern))
+		return;
+	if (glob(pattern, GLOB_NOSORT, NULL, &g))
+		return;
+
+	qsort(g.gl_pathv, g.gl_pathc, sizeof(*g.gl_pathv),
+	      __zorolog_segment_cmp);
+	for (i = 0; i + rot->keep < g.gl_pathc; i++)
+		unlink(g.gl_pathv[i]);
+	globfree(&g);
+}
+
+static void *__zorolog_rotator_thread(void *arg)
+{
+	log_config *lc = arg;
+	struct zorolog_rotator *rot = lc->rot;
+	struct zorolog_segment *seg;
+	int fd;
+
+	pthread_mutex_lock(&rot->lock);
+	for (;;) {
+		if (rot->next_fd == -1 && !rot->next_err && !rot->stop) {
+			rot->opening = 1;
+			pthread_mutex_unlock(&rot->lock);
+			fd = __zorolog_rotate_open_next(rot);
+			if (fd != -1)
+				__zorolog_rotate_prealloc(rot, fd);
+			pthread_mutex_lock(&rot->lock);
+			rot->next_fd = fd;
+			rot->next_err = fd == -1;
+			rot->opening = 0;
+			/* The logger might be waiting for it */
+			pthread_cond_signal(&rot->cond);
+			continue;
+		}
+
+		if (!list_empty(&rot->segments)) {
+			seg = list_first_entry(&rot->segments,
+					       struct zorolog_segment, list);
+			list_del(&seg->list);
+			pthread_mutex_unlock(&rot->lock);
+
+			__zorolog_rotate_release(seg->fd);
+			if (rot->flags & ZOROLOG_ROTATE_COMPRESS)
+				__zorolog_rotate_compress(seg->name);
+			__zorolog_rotate_prune(rot, lc->path);
+			free(seg);
+
+			pthread_mutex_lock(&rot->lock);
+			continue;
+		}
+
+		if (rot->stop)
+			break;
+		pthread_cond_wait(&rot->cond, &rot->lock);
+	}
+	pthread_mutex_unlock(&rot->lock);
+	return NULL;
+}
+
+static struct zorolog_rotator *__zorolog_rotator_start(log_config *lc)
+{
+	struct zorolog_rotator *rot;
+	size_t len = strlen(lc->path);
+
+	rot = calloc(1, sizeof(*rot));
+	if (!rot)
+		return NULL;
+	rot->next_path = malloc(len + sizeof(ROTATE_NEXT_SUFFIX));
+	if (!rot->next_path)
+		goto err_free;
+	memcpy(rot->next_path, lc->path, len);
+	memcpy(rot->next_path + len, ROTATE_NEXT_SUFFIX,
+	       sizeof(ROTATE_NEXT_SUFFIX));
+
+	pthread_mutex_init(&rot->lock, NULL);
+	pthread_cond_init(&rot->cond, NULL);
+	INIT_LIST_HEAD(&rot->segments);
+	rot->next_fd = -1;
+	rot->max_size = lc->rot_size;
+	rot->max_ns = lc->rot_sec * 1000000000ULL;
+	rot->keep = lc->rot_keep;
+	rot->flags = lc->rot_flags;
+	rot->opened_ns = __zorolog_rotate_now();
+	rot->written = lseek(lc->fd_logfile, 0, SEEK_END);
+	__zorolog_rotate_prealloc(rot, lc->fd_logfile);
+
+	lc->rot = rot;
+	if (pthread_create(&rot->thread, NULL, __zorolog_rotator_thread, lc))
+		goto err_destroy;
+	pthread_setname_np(rot->thread, "zorolog-rotate");
+	return rot;
+
+err_destroy:
+	lc->rot = NULL;
+	pthread_cond_destroy(&rot->cond);
+	pthread_mutex_destroy(&rot->lock);
+	free(rot->next_path);
+err_free:
+	free(rot);
+	return NULL;
+}
+
+/* Finish the pending segments, then drop the prepared next file */
+static void __zorolog_rotator_stop(log_config *lc)
+{
+	struct zorolog_rotator *rot = lc->rot;
+
+	if (!rot)
+		return;
+
+	pthread_mutex_lock(&rot->lock);
+	rot->stop = 1;
+	pthread_cond_signal(&rot->cond);
+	pthread_mutex_unlock(&rot->lock);
+	pthread_join(rot->thread, NULL);
+
+	if (rot->next_fd != -1) {
+		close(rot->next_fd);
+		unlink(rot->next_path);
+	}
+	pthread_cond_destroy(&rot->cond);
+	pthread_mutex_destroy(&rot->lock);
+	free(rot->next_path);
+	free(rot);
+	lc->rot = NULL;
+}
+
+/* Milliseconds to the next time based rotation, for poll(2) */
+static int __zorolog_rotate_timeout(log_config *lc)
+{
+	struct zorolog_rotator *rot = lc->rot;
+	uint64_t now, deadline, ms;
+
+	if (!rot || !rot->max_ns)
+		return -1;
+	now = __zorolog_rotate_now();
+	deadline = rot->opened_ns + rot->max_ns;
+	if (now >= deadline)
+		return 0;
+	ms = (deadline - now + 999999) / 1000000;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+static int __zorolog_rotate_due(log_config *lc)
+{
+	struct zorolog_rotator *rot = lc->rot;
+
+	if (!rot || !rot->written)
+		return 0;
+	if (rot->max_size && rot->written >= rot->max_size)
+		return 1;
+	return rot->max_ns &&
+	       __zorolog_rotate_now() - rot->opened_ns >= rot->max_ns;
+}
+
+/*
+ * Switch to a new log file: the current one is renamed after the rotation
+ * time, and the prepared one takes its name. On failure the logger keeps
+ * writing to the current file.
+ */
+static int __zorolog_rotate(log_config *lc)
+{
+	struct zorolog_rotator *rot = lc->rot;
+	struct zorolog_segment *seg;
+	size_t len = strlen(lc->path);
+	struct tm tm;
+	time_t now;
+	int fd, n;
+
+	/* What the sink holds belongs to the current file */
+	if (lc->sink && zorolog_sink_flush(lc->sink))
+		return -1;
+
+	/* Room for the date, and an index for rotations within a second */
+	seg = malloc(sizeof(*seg) + len + 32);
+	if (!seg)
+		return -1;
+	now = time(NULL);
+	localtime_r(&now, &tm);
+	n = sprintf(seg->name, "%s.", lc->path);
+	n += strftime(seg->name + n, 20, "%Y%m%d-%H%M%S", &tm);
+	for (int i = 1; renameat2(AT_FDCWD, lc->path, AT_FDCWD, seg->name,
+				  RENAME_NOREPLACE); i++) {
+		if (errno != EEXIST || i > 9999) {
+			free(seg);
+			return -1;
+		}
+		sprintf(seg->name + n, "-%04d", i);
+	}
+
+	/*
+	 * The next file is the rotator's until it is renamed: opening it
+	 * meanwhile, here or there, would truncate the other one
+	 */
+	pthread_mutex_lock(&rot->lock);
+	while (rot->opening)
+		pthread_cond_wait(&rot->cond, &rot->lock);
+	fd = rot->next_fd;
+	rot->next_fd = -1;
+	rot->next_err = 0;
+	if (fd == -1)
+		fd = __zorolog_rotate_open_next(rot);
+	if (fd != -1 && rename(rot->next_path, lc->path)) {
+		close(fd);
+		fd = -1;
+	}
+	pthread_mutex_unlock(&rot->lock);
+
+	if (fd == -1) {
+		/* Put the current file back in place */
+		rename(seg->name, lc->path);
+		free(seg);
+		return -1;
+	}
+
+	if (lc->sink)
+		zorolog_sink_set_fd(lc->sink, fd);
+	seg->fd = lc->fd_logfile;
+	lc->fd_logfile = fd;
+	rot->written = 0;
+	rot->opened_ns = __zorolog_rotate_now();
+
+	pthread_mutex_lock(&rot->lock);
+	list_add_tail(&seg->list, &rot->segments);
+	pthread_cond_signal(&rot->cond);
+	pthread_mutex_unlock(&rot->lock);
+	return 0;
+}
+
 int process_logger(log_config lc){
-	char buffer[MAX_BUFFER_SIZE];
-	struct pollfd fds[MAX_STANDARDS];
-	int ret = 0;
+	struct pollfd fds[MAX_STANDARDS + 1];
+	int ret = -1, nopen = 0, stopping = 0, n;
+	ssize_t len;
+	char *buffer;
+
+	buffer = malloc(lc.bufsize);
+	if (!buffer)
+		goto child_exit;
+	lc.sink = zorolog_sink_open(lc.fd_logfile, 0, lc.bufsize, 0);
+	/* Without the rotator, the log file just grows */
+	if (lc.path)
+		__zorolog_rotator_start(&lc);
 
 	for (int i = 0; i < MAX_STANDARDS; i++) {
 		fds[i].fd = lc.pipes[i][0];
 		fds[i].events = POLLIN;
-		if (lc.stdsdup[i])
-			close(i + 1);
+		if (lc.stdsdup[i]) {
+			/* A child must not keep its own pipe ends open */
+			if (!lc.thread)
+				close(i + 1);
+			nopen++;
+		}
 	}
+	fds[MAX_STANDARDS].fd = lc.stop;
+	fds[MAX_STANDARDS].events = POLLIN;
 
-	while (1) {
-		ret = poll(fds, MAX_STANDARDS, -1);
-		if (ret == -1)
+	/*
+	 * Keep going until all the duplicated standards are closed or, in
+	 * thread mode, the process exits: children forked meanwhile may hold
+	 * the pipes open for ever
+	 */
+	while (nopen) {
+		n = poll(fds, MAX_STANDARDS + 1,
+			 stopping ? 0 : __zorolog_rotate_timeout(&lc));
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			goto child_exit;
+		}
+		/* Exiting, and what was written before is drained */
+		if (stopping && !n)
 			break;
+		if (fds[MAX_STANDARDS].revents) {
+			fds[MAX_STANDARDS].fd = -1;
+			stopping = 1;
+		}
 
 		for (int i = 0; i < MAX_STANDARDS; i++) {
-			if (!(fds[i].revents & POLLIN))
+			if (!(fds[i].revents & (POLLIN | POLLHUP)))
 				continue;
 
-			memset(buffer, 0, MAX_BUFFER_SIZE);
-
-			ret = read(lc.pipes[i][0], buffer, MAX_BUFFER_SIZE);
-			if (ret <= 0)
-				goto child_exit;
-
-			ret = write(lc.custom_stds[i], buffer, strlen(buffer));
-			if (ret <= 0)
-				goto child_exit;
-
-			ret = write(lc.fd_logfile, buffer, strlen(buffer));
-			if (ret <= 0)
+			if (lc.zerocopy[i]) {
+				len = __zorolog_dup_zerocopy(&lc, i, buffer);
+				/* Nothing moved, and nothing to account */
+				if (len < 0 && errno == EAGAIN)
+					continue;
+			} else {
+				len = __zorolog_dup_copy(&lc, i, buffer);
+			}
+			if (len < 0)
 				goto child_exit;
+			if (len == 0) {
+				fds[i].fd = -1;
+				nopen--;
+			} else if (lc.rot) {
+				lc.rot->written += len;
+			}
 		}
 
-		for (int i = 0; i < MAX_STANDARDS; i++) {
-			if (fds[i].revents & POLLHUP) {
-				ret = 0;
-				goto child_exit;
-			}
+		/* One submission for whatever the copy path gathered */
+		if (lc.sink && zorolog_sink_submit(lc.sink))
+			goto child_exit;
+
+		/* A failed rotation is retried one period later */
+		if (__zorolog_rotate_due(&lc) && __zorolog_rotate(&lc)) {
+			lc.rot->written = 0;
+			lc.rot->opened_ns = __zorolog_rotate_now();
 		}
 	}
+	ret = 0;
 
 child_exit:
-	close(lc.fd_logfile);
+	if (lc.sink && zorolog_sink_flush(lc.sink))
+		ret = -1;
+	zorolog_sink_close(lc.sink);
+	free(buffer);
+	__zorolog_rotator_stop(&lc);
+	if (lc.path)
+		__zorolog_rotate_release(lc.fd_logfile);
+	else
+		close(lc.fd_logfile);
+	free(lc.path);
 	for (int i = 0; i < MAX_STANDARDS; i++) {
 		__zorolog_close(lc.pipes[i][0]);
-		__zorolog_close(lc.custom_stds[i]);
+		__zorolog_close(lc.tees[i][0]);
+		__zorolog_close(lc.tees[i][1]);
+		/* The thread mode exit handler restores the standards from these */
+		if (!lc.thread)
+			__zorolog_close(lc.custom_stds[i]);
 	}
 
 	return ret;
-    return 0;
+}
+
+static void *__zorolog_logger_thread(void *arg)
+{
+	log_config *lc = arg;
+
+	process_logger(*lc);
+	free(lc);
+	return NULL;
+}
+
+static void __zorolog_dup_close_stop(void)
+{
+	for (int i = 0; i < 2; i++) {
+		__zorolog_close(zldup.stop[i]);
+		zldup.stop[i] = -1;
+	}
+}
+
+/*
+ * Put the original standards back and have the logger thread stop once it
+ * has drained the pipes, and wait for it: the end of the pipes might never
+ * come, with children holding them.
+ */
+static void __zorolog_dup_atexit(void)
+{
+	pthread_mutex_lock(&zldup.lock);
+	if (!zldup.active)
+		goto unlock;
+
+	/* stdio buffers would otherwise be flushed past the logger */
+	fflush(NULL);
+	for (int i = 0; i < MAX_STANDARDS; i++)
+		if (zldup.stds[i] != -1)
+			dup2(zldup.stds[i], i + 1);
+
+	while (write(zldup.stop[1], "", 1) == -1 && errno == EINTR)
+		;
+	pthread_join(zldup.thread, NULL);
+	for (int i = 0; i < MAX_STANDARDS; i++) {
+		__zorolog_close(zldup.stds[i]);
+		zldup.stds[i] = -1;
+	}
+	__zorolog_dup_close_stop();
+	zldup.active = 0;
+
+unlock:
+	pthread_mutex_unlock(&zldup.lock);
+}
+
+/* The logger thread is not in the child: its exit handler must not wait */
+static void __zorolog_dup_atfork_child(void)
+{
+	pthread_mutex_init(&zldup.lock, NULL);
+	if (!zldup.active)
+		return;
+	for (int i = 0; i < MAX_STANDARDS; i++) {
+		__zorolog_close(zldup.stds[i]);
+		zldup.stds[i] = -1;
+	}
+	__zorolog_dup_close_stop();
+	zldup.active = 0;
+}
+
+static int __zorolog_dup_start_thread(log_config *lc)
+{
+	static int registered;
+	log_config *tlc;
+	int ret;
+
+	tlc = malloc(sizeof(*tlc));
+	if (!tlc)
+		return -1;
+	*tlc = *lc;
+	tlc->thread = 1;
+	if (pipe2(zldup.stop, O_CLOEXEC)) {
+		free(tlc);
+		return -1;
+	}
+	tlc->stop = zldup.stop[0];
+
+	ret = pthread_create(&zldup.thread, NULL, __zorolog_logger_thread, tlc);
+	if (ret) {
+		__zorolog_dup_close_stop();
+		free(tlc);
+		return -1;
+	}
+	pthread_setname_np(zldup.thread, "zorolog-dup");
+
+	for (int i = 0; i < MAX_STANDARDS; i++)
+		zldup.stds[i] = lc->custom_stds[i];
+	zldup.active = 1;
+	if (!registered) {
+		atexit(__zorolog_dup_atexit);
+		pthread_atfork(NULL, NULL, __zorolog_dup_atfork_child);
+		registered = 1;
+	}
+	return 0;
 }
 
 int __zorolog_duplicate(const char *logfile, uint8_t stds, int flags){
     log_config lc;
-    int log_flags;
+    int log_flags, ret;
+    size_t pipe_size;
 
 	/* Init to -1 all file descriptors */
 	memset(lc.pipes, -1, (MAX_STANDARDS * MAX_STANDARDS) * sizeof(int));
+	memset(lc.tees, -1, (MAX_STANDARDS * MAX_STANDARDS) * sizeof(int));
 	memset(lc.custom_stds, -1, MAX_STANDARDS * sizeof(int));
+	memset(lc.zerocopy, 0, sizeof(lc.zerocopy));
+	lc.bufsize = __atomic_load_n(&zldup_conf.bufsize, __ATOMIC_RELAXED);
+	lc.sink = NULL;
+	lc.thread = 0;
+	lc.stop = -1;
+	lc.path = NULL;
+	lc.rot = NULL;
+	lc.rot_size = __atomic_load_n(&zldup_conf.rot_size, __ATOMIC_RELAXED);
+	lc.rot_sec = __atomic_load_n(&zldup_conf.rot_sec, __ATOMIC_RELAXED);
+	lc.rot_keep = __atomic_load_n(&zldup_conf.rot_keep, __ATOMIC_RELAXED);
+	lc.rot_flags = __atomic_load_n(&zldup_conf.rot_flags, __ATOMIC_RELAXED);
+	pipe_size = __atomic_load_n(&zldup_conf.pipe_size, __ATOMIC_RELAXED);
 
 	/* Set flags */
 	lc.stdsdup[0] = stds & ZOROLOG_DUP_STDOUT;
@@ -104,15 +811,35 @@ int __zorolog_duplicate(const char *logfile, uint8_t stds, int flags){
 	if (lc.fd_logfile == -1)
 		return -1;
 
+	/* Rotation renames the file: the path must not depend on the cwd */
+	if (lc.rot_size || lc.rot_sec) {
+		lc.path = realpath(logfile, NULL);
+		if (!lc.path)
+			return -1;
+	}
+
 	/* Standard duplication management */
 	for (int i = 0; i < MAX_STANDARDS; i++) {
 		if (lc.stdsdup[i]) {
-			/* create a pipe */
-			if (pipe(lc.pipes[i]))
+			/*
+			 * create a pipe; none of the logger fds must survive an
+			 * exec(), that would leave the standards without reader
+			 */
+			if (pipe2(lc.pipes[i], O_CLOEXEC))
 				return -1;
 
+			/* without the tee pipe, fall back to plain copies */
+			lc.zerocopy[i] = !pipe2(lc.tees[i], O_CLOEXEC);
+
+			/* best effort: capped by /proc/sys/fs/pipe-max-size */
+			if (pipe_size) {
+				fcntl(lc.pipes[i][1], F_SETPIPE_SZ, pipe_size);
+				if (lc.zerocopy[i])
+					fcntl(lc.tees[i][1], F_SETPIPE_SZ, pipe_size);
+			}
+
 			/* duplicate standard file descriptor */
-			lc.custom_stds[i] = dup(i + 1);
+			lc.custom_stds[i] = fcntl(i + 1, F_DUPFD_CLOEXEC, 0);
 			if (lc.custom_stds[i] == -1)
 				return -1;
 
@@ -126,6 +853,24 @@ int __zorolog_duplicate(const char *logfile, uint8_t stds, int flags){
 	for (int i = 0; i < MAX_STANDARDS; i++)
 		__zorolog_close(lc.pipes[i][1]);
 
+	if (flags & ZOROLOG_DUP_THREAD) {
+		ret = __zorolog_dup_start_thread(&lc);
+		if (ret) {
+			/* Nobody would read the pipes: undo the redirection */
+			close(lc.fd_logfile);
+			free(lc.path);
+			for (int i = 0; i < MAX_STANDARDS; i++) {
+				if (lc.custom_stds[i] != -1)
+					dup2(lc.custom_stds[i], i + 1);
+				__zorolog_close(lc.pipes[i][0]);
+				__zorolog_close(lc.tees[i][0]);
+				__zorolog_close(lc.tees[i][1]);
+				__zorolog_close(lc.custom_stds[i]);
+			}
+		}
+		return ret;
+	}
+
 	int pid = fork();
 	if (pid == -1)
 		return -1;
@@ -134,8 +879,11 @@ int __zorolog_duplicate(const char *logfile, uint8_t stds, int flags){
 		exit(process_logger(lc));
 	} else {
 		close(lc.fd_logfile);
+		free(lc.path);
 		for (int i = 0; i < MAX_STANDARDS; i++) {
 		    __zorolog_close(lc.pipes[i][0]);
+			__zorolog_close(lc.tees[i][0]);
+			__zorolog_close(lc.tees[i][1]);
 			__zorolog_close(lc.custom_stds[i]);
 		}
 	}
@@ -143,14 +891,50 @@ int __zorolog_duplicate(const char *logfile, uint8_t stds, int flags){
     return 0;
 }
 int zorolog_duplicate(const char *logfile, uint8_t stds, int flags){
+	int ret;
+
 	if (logfile == NULL)
 		return -EINVAL;
 
 	if (stds == 0 || stds > (ZOROLOG_DUP_STDOUT | ZOROLOG_DUP_STDERR))
 		return -EINVAL;
 
-	if (flags > ZOROLOG_APPEND)
+	if (flags & ~(ZOROLOG_APPEND | ZOROLOG_DUP_THREAD))
+		return -EINVAL;
+
+	if (!(flags & ZOROLOG_DUP_THREAD))
+		return __zorolog_duplicate(logfile, stds, flags);
+
+	/* Only one logger thread at a time */
+	pthread_mutex_lock(&zldup.lock);
+	ret = zldup.active ? -EBUSY : __zorolog_duplicate(logfile, stds, flags);
+	pthread_mutex_unlock(&zldup.lock);
+	return ret;
+}
+
+int zorolog_duplicate_rotation(size_t max_size, unsigned int max_sec,
+			       unsigned int keep, int flags)
+{
+	if (flags & ~ZOROLOG_ROTATE_COMPRESS)
+		return -EINVAL;
+
+	__atomic_store_n(&zldup_conf.rot_size, max_size, __ATOMIC_RELAXED);
+	__atomic_store_n(&zldup_conf.rot_sec, max_sec, __ATOMIC_RELAXED);
+	__atomic_store_n(&zldup_conf.rot_keep, keep, __ATOMIC_RELAXED);
+	__atomic_store_n(&zldup_conf.rot_flags, flags, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int zorolog_duplicate_setup(size_t pipe_size, size_t buffer_size)
+{
+	if (buffer_size && buffer_size < MIN_BUFFER_SIZE)
+		return -EINVAL;
+	if (pipe_size > INT_MAX)
 		return -EINVAL;
 
-	return __zorolog_duplicate(logfile, stds, flags);
+	__atomic_store_n(&zldup_conf.pipe_size, pipe_size, __ATOMIC_RELAXED);
+	__atomic_store_n(&zldup_conf.bufsize,
+			 buffer_size ? buffer_size : DEFAULT_BUFFER_SIZE,
+			 __ATOMIC_RELAXED);
+	return 0;
 }
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zoro/percpu.h>
+
+#define ZLPERCPU_SYSFS_LINE \
+	"/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size"
+
+__thread unsigned int __zoropercpu_thread;
+
+static struct {
+	pthread_once_t once;
+	unsigned int nr_cpus;
+	size_t line;
+	/* Next slot handed out to a thread */
+	unsigned int next;
+} zlpercpu = {
+	.once = PTHREAD_ONCE_INIT,
+};
+
+static size_t zlpercpu_read_line(void)
+{
+	unsigned long line = 0;
+	long ret = -1;
+	FILE *f;
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+	ret = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+	if (ret > 0)
+		return ret;
+
+	f = fopen(ZLPERCPU_SYSFS_LINE, "r");
+	if (f) {
+		if (fscanf(f, "%lu", &line) != 1)
+			line = 0;
+		fclose(f);
+	}
+	return line ? line : ZORO_CACHELINE_SIZE;
+}
+
+static void zlpercpu_init_once(void)
+{
+	long nr = sysconf(_SC_NPROCESSORS_CONF);
+
+	zlpercpu.nr_cpus = nr > 0 ? nr : 1;
+	zlpercpu.line = zlpercpu_read_line();
+	if (zlpercpu.line > ZORO_CACHELINE_SIZE)
+		fprintf(stderr, "zoropercpu: cache lines are %zu bytes, but the "
+			"library is built for %d: rebuild it with "
+			"-DZORO_CACHELINE_SIZE=%zu\n", zlpercpu.line,
+			ZORO_CACHELINE_SIZE, zlpercpu.line);
+}
+
+unsigned int zoropercpu_nr_cpus(void)
+{
+	pthread_once(&zlpercpu.once, zlpercpu_init_once);
+	return zlpercpu.nr_cpus;
+}
+
+size_t zoropercpu_cacheline_size(void)
+{
+	pthread_once(&zlpercpu.once, zlpercpu_init_once);
+	return zlpercpu.line;
+}
+
+unsigned int __zoropercpu_cpu_slow(void)
+{
+	int cpu = sched_getcpu();
+
+	return cpu < 0 ? 0 : cpu;
+}
+
+unsigned int __zoropercpu_thread_slow(void)
+{
+	__zoropercpu_thread = __atomic_fetch_add(&zlpercpu.next, 1,
+						 __ATOMIC_RELAXED) + 1;
+	return __zoropercpu_thread;
+}
+
+int zoropercpu_init(struct zoropercpu *pc, size_t size, int flags)
+{
+	if (!size)
+		return -EINVAL;
+
+	pc->nr = zoropercpu_nr_cpus();
+	pc->stride = L1_CACHE_ALIGN(size);
+	pc->flags = flags;
+	pc->base = aligned_alloc(SMP_CACHE_BYTES, pc->nr * pc->stride);
+	if (!pc->base)
+		return -ENOMEM;
+	memset(pc->base, 0, pc->nr * pc->stride);
+	return 0;
+}
+
+void zoropercpu_destroy(struct zoropercpu *pc)
+{
+	free(pc->base);
+	pc->base = NULL;
+	pc->nr = 0;
+}
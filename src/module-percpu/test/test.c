@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <zoro/percpu.h>
+#include <zoro/test.h>
+
+#define NR_ADDERS	4
+#define NR_ADDS		100000
+
+static void destroy_percpu(void *arg)
+{
+	zoropercpu_destroy(arg);
+}
+
+/* Slots of any size are zeroed, and no two of them share a cache line */
+static int test_slots(void)
+{
+	const size_t sizes[] = {
+		1, sizeof(uint64_t), SMP_CACHE_BYTES - 1, SMP_CACHE_BYTES,
+		SMP_CACHE_BYTES + 1, 3 * SMP_CACHE_BYTES + 8,
+	};
+	struct zoropercpu pc;
+	unsigned int i, j;
+	unsigned char *p;
+	size_t k;
+
+	zorotest_assert_eq_nums(-EINVAL, zoropercpu_init(&pc, 0, 0), "%d");
+
+	for (k = 0; k < ARRAY_SIZE(sizes); k++) {
+		zorotest_assert_eq_nums(0, zoropercpu_init(&pc, sizes[k], 0),
+					"%d");
+		zorotest_set_clear_on_fail(destroy_percpu, &pc);
+		zorotest_assert_eq_nums(zoropercpu_nr_cpus(), pc.nr, "%u");
+		zorotest_assert_true(pc.stride >= sizes[k]);
+		zorotest_assert_eq_nums((size_t)0, pc.stride % SMP_CACHE_BYTES,
+					"%zu");
+		zorotest_assert_eq_nums((uintptr_t)0,
+					(uintptr_t)pc.base % SMP_CACHE_BYTES,
+					"%lu");
+
+		/* Fill each slot in turn: the others are left alone */
+		zoropercpu_for_each(p, i, &pc) {
+			for (j = 0; j < sizes[k]; j++)
+				zorotest_assert_eq_nums(0, p[j], "%d");
+			memset(p, i + 1, sizes[k]);
+		}
+		zoropercpu_for_each(p, i, &pc) {
+			for (j = 0; j < sizes[k]; j++)
+				zorotest_assert_eq_nums((int)(i + 1) & 0xff,
+							p[j], "%d");
+			if (i + 1 < pc.nr)
+				zorotest_assert_true(
+					(uintptr_t)(p + sizes[k] - 1) /
+					SMP_CACHE_BYTES <
+					(uintptr_t)zoropercpu_ptr(&pc, i + 1) /
+					SMP_CACHE_BYTES);
+		}
+
+		zorotest_unset_clear_on_fail();
+		zoropercpu_destroy(&pc);
+		zorotest_assert_true(!pc.base);
+	}
+	zorotest_success();
+}
+
+struct pinned {
+	struct zoropercpu *pc;
+	int cpu;
+	int ok;
+};
+
+static void *pinned(void *arg)
+{
+	struct pinned *p = arg;
+
+	p->ok = zoropercpu_cpu() == (unsigned int)p->cpu &&
+		zoropercpu_idx(p->pc) == (unsigned int)p->cpu &&
+		zoropercpu_this(p->pc) == zoropercpu_ptr(p->pc, p->cpu);
+	return NULL;
+}
+
+/* A thread bound to a CPU gets the slot of that CPU */
+static int test_cpu(void)
+{
+	struct zoropercpu pc;
+	pthread_attr_t attr;
+	struct pinned p;
+	pthread_t thread;
+	cpu_set_t set, one;
+	int cpu, tested = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		zorotest_fail("Cannot read the CPU affinity\n");
+	zorotest_assert_eq_nums(0, zoropercpu_init(&pc, sizeof(long), 0),
+				"%d");
+	zorotest_set_clear_on_fail(destroy_percpu, &pc);
+
+	for (cpu = 0; cpu < CPU_SETSIZE && cpu < (int)pc.nr; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		p = (struct pinned){ .pc = &pc, .cpu = cpu };
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+		if (pthread_create(&thread, &attr, pinned, &p)) {
+			pthread_attr_destroy(&attr);
+			continue;
+		}
+		pthread_attr_destroy(&attr);
+		pthread_join(thread, NULL);
+		zorotest_verbose("CPU %d: %s\n", cpu,
+				 p.ok ? "ok" : "wrong slot");
+		zorotest_assert_true(p.ok);
+		tested++;
+	}
+	zorotest_assert_true(tested > 0);
+
+	zorotest_unset_clear_on_fail();
+	zoropercpu_destroy(&pc);
+	zorotest_success();
+}
+
+struct slot_of {
+	struct zoropercpu *pc;
+	unsigned int idx;
+	int stable;
+};
+
+static void *slot_of(void *arg)
+{
+	struct slot_of *s = arg;
+
+	s->idx = zoropercpu_idx(s->pc);
+	s->stable = zoropercpu_idx(s->pc) == s->idx &&
+		    zoropercpu_this(s->pc) == zoropercpu_ptr(s->pc, s->idx);
+	return NULL;
+}
+
+/*
+ * With ZOROPERCPU_THREAD, threads get the next slot on their first use, and
+ * keep it: wrapping around after the last one. No other test hands out
+ * slots to its threads meanwhile.
+ */
+static int test_thread_round_robin(void)
+{
+	struct zoropercpu pc;
+	struct slot_of s;
+	pthread_t thread;
+	unsigned int i, first = 0;
+
+	zorotest_assert_eq_nums(0, zoropercpu_init(&pc, sizeof(long),
+						   ZOROPERCPU_THREAD), "%d");
+	zorotest_set_clear_on_fail(destroy_percpu, &pc);
+
+	for (i = 0; i < 2 * pc.nr + 1; i++) {
+		s = (struct slot_of){ .pc = &pc };
+		if (pthread_create(&thread, NULL, slot_of, &s))
+			zorotest_fail("Cannot start a thread\n");
+		pthread_join(thread, NULL);
+		zorotest_assert_true(s.stable);
+		if (!i)
+			first = s.idx;
+		zorotest_assert_eq_nums((first + i) % pc.nr, s.idx, "%u");
+	}
+
+	zorotest_unset_clear_on_fail();
+	zoropercpu_destroy(&pc);
+	zorotest_success();
+}
+
+static void *adder(void *arg)
+{
+	struct zoropercpu *pc = arg;
+	unsigned int i;
+
+	for (i = 0; i < NR_ADDS; i++)
+		__atomic_fetch_add((uint64_t *)zoropercpu_this(pc), 1,
+				   __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/* Concurrent updates of the slots of their CPU add up, migrations or not */
+static int test_sum(void)
+{
+	pthread_t threads[NR_ADDERS];
+	unsigned int i, started = 0;
+	struct zoropercpu pc;
+	uint64_t sum = 0, *v;
+
+	zorotest_assert_eq_nums(0, zoropercpu_init(&pc, sizeof(uint64_t), 0),
+				"%d");
+	for (i = 0; i < NR_ADDERS; i++) {
+		if (pthread_create(&threads[i], NULL, adder, &pc))
+			break;
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	zoropercpu_for_each(v, i, &pc)
+		sum += __atomic_load_n(v, __ATOMIC_RELAXED);
+	zoropercpu_destroy(&pc);
+
+	zorotest_assert_eq_nums(NR_ADDERS, started, "%u");
+	zorotest_assert_eq_nums((uint64_t)NR_ADDERS * NR_ADDS, sum, "%lu");
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_slots),
+		ZOROTEST_CASE(test_cpu),
+		ZOROTEST_CASE(test_thread_round_robin),
+		ZOROTEST_CASE(test_sum),
+	};
+
+	return zorotest_run_suite(tests, "percpu", NULL);
+}
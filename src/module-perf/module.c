@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <zoro/perf.h>
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} zlperf_events[ZOROPERF_NR_EVENTS] = {
+	[ZOROPERF_CYCLES_IDX] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES
+	},
+	[ZOROPERF_INSTRUCTIONS_IDX] = {
+		"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS
+	},
+	[ZOROPERF_CACHE_REFS_IDX] = {
+		"cache-references", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CACHE_REFERENCES
+	},
+	[ZOROPERF_CACHE_MISSES_IDX] = {
+		"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES
+	},
+	[ZOROPERF_BRANCH_MISSES_IDX] = {
+		"branch-misses", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_BRANCH_MISSES
+	},
+	[ZOROPERF_L1D_MISSES_IDX] = {
+		"L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D |
+		PERF_COUNT_HW_CACHE_OP_READ << 8 |
+		PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+	},
+	[ZOROPERF_PAGE_FAULTS_IDX] = {
+		"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS
+	},
+};
+
+/* Values as read from each counter */
+struct zlperf_value {
+	uint64_t value;
+	uint64_t time_enabled;
+	uint64_t time_running;
+};
+
+const char *zoroperf_event_name(unsigned int idx)
+{
+	return idx < ZOROPERF_NR_EVENTS ? zlperf_events[idx].name : NULL;
+}
+
+int zoroperf_open(struct zoroperf_group *g, unsigned int events, int flags)
+{
+	struct perf_event_attr attr;
+	int ret = -ENOENT;
+	unsigned int i;
+	int fd;
+
+	g->leader = -1;
+	g->mask = 0;
+	for (i = 0; i < ZOROPERF_NR_EVENTS; i++)
+		g->fd[i] = -1;
+
+	zoroperf_for_each_event(i, events) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = zlperf_events[i].type;
+		attr.config = zlperf_events[i].config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+		/* The leader enables and disables the whole group */
+		attr.disabled = g->leader < 0;
+		attr.inherit = !!(flags & ZOROPERF_INHERIT);
+		attr.exclude_kernel = !(flags & ZOROPERF_KERNEL);
+		attr.exclude_hv = 1;
+
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, g->leader,
+			     PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			/* The first error is the most telling one */
+			if (ret == -ENOENT)
+				ret = -errno;
+			continue;
+		}
+		g->fd[i] = fd;
+		g->mask |= 1U << i;
+		if (g->leader < 0)
+			g->leader = fd;
+	}
+
+	return g->mask ? 0 : ret;
+}
+
+void zoroperf_close(struct zoroperf_group *g)
+{
+	unsigned int i;
+
+	/* Siblings first: closing the leader would ungroup them */
+	zoroperf_for_each_event(i, g->mask) {
+		if (g->fd[i] != g->leader)
+			close(g->fd[i]);
+		g->fd[i] = -1;
+	}
+	if (g->leader >= 0)
+		close(g->leader);
+	g->leader = -1;
+	g->mask = 0;
+}
+
+void zoroperf_reset(struct zoroperf_group *g)
+{
+	if (g->leader >= 0)
+		ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+void zoroperf_enable(struct zoroperf_group *g)
+{
+	if (g->leader >= 0)
+		ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void zoroperf_disable(struct zoroperf_group *g)
+{
+	if (g->leader >= 0)
+		ioctl(g->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+int zoroperf_read(struct zoroperf_group *g, struct zoroperf_counts *c)
+{
+	struct zlperf_value v;
+	unsigned int i;
+	ssize_t n;
+
+	c->mask = 0;
+	memset(c->value, 0, sizeof(c->value));
+	/*
+	 * One read per counter: the kernel does not read the groups of
+	 * inherited counters at once
+	 */
+	zoroperf_for_each_event(i, g->mask) {
+		n = read(g->fd[i], &v, sizeof(v));
+		if (n != sizeof(v))
+			return n < 0 ? -errno : -EIO;
+		/* Never scheduled on the PMU: there is nothing to scale */
+		if (!v.time_running)
+			continue;
+		if (v.time_running < v.time_enabled)
+			v.value = (double)v.value * v.time_enabled /
+				  v.time_running;
+		c->value[i] = v.value;
+		c->mask |= 1U << i;
+	}
+	return 0;
+}
@@ -0,0 +1,343 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zoro/pool.h>
+#include <zoro/compiler.h>
+
+#define ZOROPOOL_CACHE_LINE	SMP_CACHE_BYTES
+
+struct zoropool_magazine {
+	struct zoropool_magazine *next;
+	unsigned int count;
+	void *objs[ZOROPOOL_MAGAZINE_SIZE];
+};
+
+/* Magazines of a thread for a pool */
+struct zoropool_cache {
+	struct zoropool *pool;
+	struct zoropool_magazine *loaded;
+	struct zoropool_magazine *prev;
+	struct list_head list;
+};
+
+/* Header of a slab, objects follow from the next cache line */
+struct zoropool_slab {
+	struct list_head list;
+};
+
+#define ZOROPOOL_SLAB_HEADER	ZOROPOOL_CACHE_LINE
+
+static inline size_t __zoropool_round(size_t n, size_t align)
+{
+	return (n + align - 1) & ~(align - 1);
+}
+
+/* Slabs are aligned to cache lines, or to the objects if more */
+static inline size_t __zoropool_slab_align(const struct zoropool *pool)
+{
+	return pool->align > ZOROPOOL_CACHE_LINE ? pool->align :
+						   ZOROPOOL_CACHE_LINE;
+}
+
+/* Lone free objects are linked through their first word */
+static inline void __zoropool_push_free(struct zoropool *pool, void *obj)
+{
+	*(void **)obj = pool->free;
+	pool->free = obj;
+}
+
+/* Pop a free object, carving a new slab if needed; pool locked */
+static void *__zoropool_get(struct zoropool *pool)
+{
+	struct zoropool_slab *slab;
+	void *obj;
+
+	if (pool->free) {
+		obj = pool->free;
+		pool->free = *(void **)obj;
+		return obj;
+	}
+
+	if (!pool->carve_left) {
+		slab = aligned_alloc(__zoropool_slab_align(pool),
+				     pool->slab_size);
+		if (!slab)
+			return NULL;
+		list_add(&slab->list, &pool->slabs);
+		pool->carve = (char *)slab + __zoropool_round(
+				ZOROPOOL_SLAB_HEADER, pool->align);
+		pool->carve_left = (pool->slab_size -
+				    (pool->carve - (char *)slab)) / pool->size;
+	}
+	obj = pool->carve;
+	pool->carve += pool->size;
+	pool->carve_left--;
+	return obj;
+}
+
+/* Empty the magazine into the lone free objects; pool locked */
+static void __zoropool_drain(struct zoropool *pool,
+			     struct zoropool_magazine *mag)
+{
+	while (mag->count)
+		__zoropool_push_free(pool, mag->objs[--mag->count]);
+	mag->next = pool->empty;
+	pool->empty = mag;
+}
+
+static void __zoropool_cache_release(struct zoropool_cache *cache)
+{
+	struct zoropool *pool = cache->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	__zoropool_drain(pool, cache->loaded);
+	__zoropool_drain(pool, cache->prev);
+	list_del(&cache->list);
+	pthread_mutex_unlock(&pool->lock);
+	free(cache);
+}
+
+/* Thread exit: the magazines go back to the depot */
+static void __zoropool_cache_destructor(void *arg)
+{
+	__zoropool_cache_release(arg);
+}
+
+int zoropool_init(struct zoropool *pool, size_t size, size_t align)
+{
+	int ret;
+
+	if (!align)
+		align = sizeof(max_align_t);
+	if (align & (align - 1) || align > ZOROPOOL_SLAB_SIZE / 4)
+		return -EINVAL;
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+
+	memset(pool, 0, sizeof(*pool));
+	ret = pthread_key_create(&pool->key, __zoropool_cache_destructor);
+	if (ret)
+		return -ret;
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->align = align;
+	pool->size = __zoropool_round(size, align);
+	pool->slab_size = __zoropool_round(ZOROPOOL_SLAB_HEADER, align) +
+			  pool->size * ZOROPOOL_MAGAZINE_SIZE;
+	if (pool->slab_size < ZOROPOOL_SLAB_SIZE)
+		pool->slab_size = ZOROPOOL_SLAB_SIZE;
+	pool->slab_size = __zoropool_round(pool->slab_size,
+					   __zoropool_slab_align(pool));
+	INIT_LIST_HEAD(&pool->slabs);
+	INIT_LIST_HEAD(&pool->caches);
+	return 0;
+}
+
+void zoropool_destroy(struct zoropool *pool)
+{
+	struct zoropool_cache *cache, *ctmp;
+	struct zoropool_slab *slab, *stmp;
+	struct zoropool_magazine *mag;
+
+	/* Threads still alive lose their cache, and no destructor runs */
+	pthread_key_delete(pool->key);
+	list_for_each_entry_safe(cache, ctmp, &pool->caches, list) {
+		free(cache->loaded);
+		free(cache->prev);
+		free(cache);
+	}
+	while ((mag = pool->full)) {
+		pool->full = mag->next;
+		free(mag);
+	}
+	while ((mag = pool->empty)) {
+		pool->empty = mag->next;
+		free(mag);
+	}
+	list_for_each_entry_safe(slab, stmp, &pool->slabs, list)
+		free(slab);
+	pthread_mutex_destroy(&pool->lock);
+	memset(pool, 0, sizeof(*pool));
+}
+
+static struct zoropool_magazine *__zoropool_empty_magazine(
+						struct zoropool *pool)
+{
+	struct zoropool_magazine *mag = pool->empty;
+
+	if (mag) {
+		pool->empty = mag->next;
+		return mag;
+	}
+	mag = malloc(sizeof(*mag));
+	if (mag)
+		mag->count = 0;
+	return mag;
+}
+
+/* The cache of the calling thread, created on first use; NULL if OOM */
+static struct zoropool_cache *__zoropool_cache(struct zoropool *pool)
+{
+	struct zoropool_cache *cache = pthread_getspecific(pool->key);
+
+	if (likely(cache))
+		return cache;
+
+	cache = malloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+	cache->pool = pool;
+	pthread_mutex_lock(&pool->lock);
+	cache->loaded = __zoropool_empty_magazine(pool);
+	cache->prev = __zoropool_empty_magazine(pool);
+	if (!cache->loaded || !cache->prev)
+		goto fail;
+	list_add(&cache->list, &pool->caches);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (pthread_setspecific(pool->key, cache)) {
+		__zoropool_cache_release(cache);
+		return NULL;
+	}
+	return cache;
+
+fail:
+	if (cache->loaded)
+		__zoropool_drain(pool, cache->loaded);
+	if (cache->prev)
+		__zoropool_drain(pool, cache->prev);
+	pthread_mutex_unlock(&pool->lock);
+	free(cache);
+	return NULL;
+}
+
+static inline void __zoropool_swap(struct zoropool_cache *cache)
+{
+	struct zoropool_magazine *tmp = cache->loaded;
+
+	cache->loaded = cache->prev;
+	cache->prev = tmp;
+}
+
+void *zoropool_alloc(struct zoropool *pool)
+{
+	struct zoropool_cache *cache = __zoropool_cache(pool);
+	struct zoropool_magazine *mag;
+	void *obj;
+
+	if (unlikely(!cache)) {
+		pthread_mutex_lock(&pool->lock);
+		obj = __zoropool_get(pool);
+		pthread_mutex_unlock(&pool->lock);
+		return obj;
+	}
+
+	if (likely(cache->loaded->count))
+		return cache->loaded->objs[--cache->loaded->count];
+	if (cache->prev->count) {
+		__zoropool_swap(cache);
+		return cache->loaded->objs[--cache->loaded->count];
+	}
+
+	/* Both empty: trade one for a full magazine of the depot, or fill it */
+	pthread_mutex_lock(&pool->lock);
+	mag = pool->full;
+	if (mag) {
+		pool->full = mag->next;
+		cache->prev->next = pool->empty;
+		pool->empty = cache->prev;
+		cache->prev = cache->loaded;
+		cache->loaded = mag;
+	} else {
+		mag = cache->loaded;
+		while (mag->count < ZOROPOOL_MAGAZINE_SIZE) {
+			obj = __zoropool_get(pool);
+			if (!obj)
+				break;
+			mag->objs[mag->count++] = obj;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (unlikely(!cache->loaded->count))
+		return NULL;
+	return cache->loaded->objs[--cache->loaded->count];
+}
+
+void zoropool_free(struct zoropool *pool, void *obj)
+{
+	struct zoropool_cache *cache = __zoropool_cache(pool);
+	struct zoropool_magazine *mag;
+
+	if (unlikely(!cache))
+		goto lone;
+
+	if (likely(cache->loaded->count < ZOROPOOL_MAGAZINE_SIZE)) {
+		cache->loaded->objs[cache->loaded->count++] = obj;
+		return;
+	}
+	if (cache->prev->count < ZOROPOOL_MAGAZINE_SIZE) {
+		__zoropool_swap(cache);
+		cache->loaded->objs[cache->loaded->count++] = obj;
+		return;
+	}
+
+	/* Both full: move one to the depot, in exchange for an empty one */
+	pthread_mutex_lock(&pool->lock);
+	mag = __zoropool_empty_magazine(pool);
+	if (!mag) {
+		pthread_mutex_unlock(&pool->lock);
+		goto lone;
+	}
+	cache->prev->next = pool->full;
+	pool->full = cache->prev;
+	cache->prev = cache->loaded;
+	cache->loaded = mag;
+	pthread_mutex_unlock(&pool->lock);
+
+	cache->loaded->objs[cache->loaded->count++] = obj;
+	return;
+
+lone:
+	pthread_mutex_lock(&pool->lock);
+	__zoropool_push_free(pool, obj);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Move objects of the run from @a first to @a last into @a mag, up to its
+ * capacity; return the first one left, NULL if none
+ */
+static void *__zoropool_fill_run(struct zoropool_magazine *mag, void *first,
+				 void *last)
+{
+	void *obj;
+
+	while (first && mag->count < ZOROPOOL_MAGAZINE_SIZE) {
+		obj = first;
+		/* The first word of @a last is not read */
+		first = obj == last ? NULL : *(void **)obj;
+		mag->objs[mag->count++] = obj;
+	}
+	return first;
+}
+
+void zoropool_free_run(struct zoropool *pool, void *first, void *last)
+{
+	struct zoropool_cache *cache = __zoropool_cache(pool);
+
+	/* Top the magazines of the thread up first, without the lock */
+	if (likely(cache)) {
+		first = __zoropool_fill_run(cache->loaded, first, last);
+		first = __zoropool_fill_run(cache->prev, first, last);
+	}
+	if (!first)
+		return;
+
+	/* The rest of the run joins the lone free objects as a whole */
+	pthread_mutex_lock(&pool->lock);
+	*(void **)last = pool->free;
+	pool->free = first;
+	pthread_mutex_unlock(&pool->lock);
+}
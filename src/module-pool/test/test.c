@@ -0,0 +1,378 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/pool.h>
+#include <zoro/linux/llist.h>
+#include <zoro/test.h>
+
+#define NR_OBJS		5000
+#define NR_PAIRS	2
+#define NR_PASSED	200000
+#define MAX_IN_FLIGHT	4096
+#define NR_RUN_MAX	(5 * ZOROPOOL_MAGAZINE_SIZE)
+
+#define LIVE		0x11u
+#define DEAD		0xddu
+
+static int cmp_ptrs(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)*(void * const *)a;
+	uintptr_t y = (uintptr_t)*(void * const *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void destroy_pool(void *arg)
+{
+	zoropool_destroy(arg);
+}
+
+/*
+ * Objects get the alignment asked, more than the one of the slabs
+ * included, and do not overlap.
+ */
+static int run_align(size_t size, size_t align)
+{
+	struct zoropool pool;
+	void **objs;
+	size_t i;
+
+	zorotest_assert_eq_nums(0, zoropool_init(&pool, size, align), "%d");
+	objs = calloc(NR_OBJS, sizeof(*objs));
+	if (!objs) {
+		zoropool_destroy(&pool);
+		zorotest_fail("Cannot allocate the objects array\n");
+	}
+
+	for (i = 0; i < NR_OBJS; i++) {
+		objs[i] = zoropool_alloc(&pool);
+		if (!objs[i])
+			break;
+		memset(objs[i], (int)(i & 0xff), size);
+	}
+	for (i = 0; i < NR_OBJS && objs[i]; i++) {
+		if ((uintptr_t)objs[i] & (align - 1)) {
+			zorolog_error("size %zu align %zu: %p misaligned\n",
+				      size, align, objs[i]);
+			break;
+		}
+		if (((unsigned char *)objs[i])[0] != (i & 0xff) ||
+		    ((unsigned char *)objs[i])[size - 1] != (i & 0xff)) {
+			zorolog_error("size %zu align %zu: %p overwritten\n",
+				      size, align, objs[i]);
+			break;
+		}
+	}
+	for (size = i, i = 0; i < size; i++)
+		zoropool_free(&pool, objs[i]);
+
+	zoropool_destroy(&pool);
+	free(objs);
+	zorotest_assert_eq_nums((size_t)NR_OBJS, size, "%zu");
+	zorotest_success();
+}
+
+static int test_align(void)
+{
+	static const size_t sizes[] = { 1, 24, 100, 300 };
+	static const size_t aligns[] = { 8, 16, 64, 128, 256, 1024, 4096 };
+	struct zoropool pool;
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (j = 0; j < ARRAY_SIZE(aligns); j++) {
+			if (run_align(sizes[i], aligns[j]))
+				zorotest_fail("Alignment test failed\n");
+		}
+	}
+
+	zorotest_assert_eq_nums(-EINVAL, zoropool_init(&pool, 16, 24), "%d");
+	zorotest_assert_eq_nums(-EINVAL, zoropool_init(&pool, 16,
+						       ZOROPOOL_SLAB_SIZE),
+				"%d");
+	zorotest_success();
+}
+
+struct node {
+	struct list_head list;
+	struct hlist_node hnode;
+	unsigned int id;
+};
+
+/*
+ * The @n objects allocated next are distinct, and the ones of the sorted
+ * @freed, but for the ones the magazines of the thread held already
+ */
+static int check_reused(struct zoropool *pool, void **freed, size_t n)
+{
+	void **again = calloc(n, sizeof(*again));
+	size_t i, reused = 0;
+
+	if (!again)
+		zorotest_fail("Cannot allocate the objects array\n");
+	zorotest_set_clear_on_fail(free, again);
+	for (i = 0; i < n; i++) {
+		again[i] = zoropool_alloc(pool);
+		zorotest_assert_true(again[i] != NULL);
+	}
+	qsort(again, n, sizeof(*again), cmp_ptrs);
+	for (i = 0; i < n; i++) {
+		if (i)
+			zorotest_assert_true(again[i - 1] != again[i]);
+		reused += !!bsearch(&again[i], freed, n, sizeof(*freed),
+				    cmp_ptrs);
+	}
+	zorotest_verbose("%zu of %zu objects reused\n", reused, n);
+	zorotest_assert_true(reused + 2 * ZOROPOOL_MAGAZINE_SIZE >= n);
+	for (i = 0; i < n; i++)
+		zoropool_free(pool, again[i]);
+	free(again);
+	zorotest_success();
+}
+
+/* A whole list goes back to the pool, and its entries are reused */
+static int test_free_list(void)
+{
+	struct zoropool pool;
+	struct node *n;
+	void **freed;
+	LIST_HEAD(head);
+	HLIST_HEAD(hhead);
+	size_t i;
+
+	zorotest_assert_eq_nums(0, zoropool_init(&pool, sizeof(*n), 0), "%d");
+	zorotest_set_clear_on_fail(destroy_pool, &pool);
+	freed = calloc(NR_OBJS, sizeof(*freed));
+	if (!freed)
+		zorotest_fail("Cannot allocate the objects array\n");
+
+	for (i = 0; i < NR_OBJS; i++) {
+		n = zoropool_alloc(&pool);
+		if (!n)
+			break;
+		n->id = i;
+		list_add_tail(&n->list, &head);
+		freed[i] = n;
+	}
+	if (i < NR_OBJS) {
+		free(freed);
+		zorotest_fail("Cannot allocate the nodes\n");
+	}
+	qsort(freed, NR_OBJS, sizeof(*freed), cmp_ptrs);
+
+	zoropool_free_list(&pool, &head, struct node, list);
+	zorotest_assert_true(list_empty(&head));
+	if (check_reused(&pool, freed, NR_OBJS)) {
+		free(freed);
+		zorotest_fail("List entries not reused\n");
+	}
+
+	/* Same with an hlist */
+	for (i = 0; i < NR_OBJS; i++) {
+		n = zoropool_alloc(&pool);
+		hlist_add_head(&n->hnode, &hhead);
+	}
+	zoropool_free_hlist(&pool, &hhead, struct node, hnode);
+	zorotest_assert_true(hlist_empty(&hhead));
+	if (check_reused(&pool, freed, NR_OBJS)) {
+		free(freed);
+		zorotest_fail("Hlist entries not reused\n");
+	}
+
+	free(freed);
+	zoropool_destroy(&pool);
+	zorotest_success();
+}
+
+struct free_run {
+	struct zoropool pool;
+	void **objs;
+};
+
+static void destroy_free_run(void *arg)
+{
+	struct free_run *r = arg;
+
+	zoropool_destroy(&r->pool);
+	free(r->objs);
+}
+
+/*
+ * A run is given back up to its last object, whatever its first word: the
+ * objects allocated next never include the live one it points to
+ */
+static int test_free_run(void)
+{
+	static const size_t counts[] = {
+		1, 2, ZOROPOOL_MAGAZINE_SIZE, 2 * ZOROPOOL_MAGAZINE_SIZE + 5,
+		NR_RUN_MAX,
+	};
+	/* The longest run, and whatever the magazines held */
+	size_t c, i, n, nr = NR_RUN_MAX + 2 * ZOROPOOL_MAGAZINE_SIZE;
+	struct free_run r;
+	void **objs, *live;
+
+	zorotest_assert_eq_nums(0, zoropool_init(&r.pool, 32, 0), "%d");
+	r.objs = objs = calloc(nr, sizeof(*objs));
+	zorotest_set_clear_on_fail(destroy_free_run, &r);
+	if (!objs)
+		zorotest_fail("Cannot allocate the objects array\n");
+
+	live = zoropool_alloc(&r.pool);
+	zorotest_assert_true(live != NULL);
+	*(void **)live = NULL;
+	for (c = 0; c < ARRAY_SIZE(counts); c++) {
+		n = counts[c];
+		for (i = 0; i < n; i++) {
+			objs[i] = zoropool_alloc(&r.pool);
+			zorotest_assert_true(objs[i] && objs[i] != live);
+		}
+		for (i = 0; i < n; i++)
+			*(void **)objs[i] = i + 1 < n ? objs[i + 1] : live;
+		zoropool_free_run(&r.pool, objs[0], objs[n - 1]);
+
+		for (i = 0; i < nr; i++) {
+			objs[i] = zoropool_alloc(&r.pool);
+			zorotest_assert_true(objs[i] && objs[i] != live);
+		}
+		qsort(objs, nr, sizeof(*objs), cmp_ptrs);
+		for (i = 1; i < nr; i++)
+			zorotest_assert_true(objs[i - 1] != objs[i]);
+		for (i = 0; i < nr; i++)
+			zoropool_free(&r.pool, objs[i]);
+	}
+
+	zoropool_free(&r.pool, live);
+	destroy_free_run(&r);
+	zorotest_success();
+}
+
+struct msg {
+	struct llist_node node;
+	unsigned int state;
+	unsigned int producer;
+	unsigned int seq;
+};
+
+struct pass {
+	struct zoropool pool;
+	struct llist_head queue;
+	unsigned long in_flight;
+	unsigned int producers_done;
+	unsigned long received;
+	unsigned int errors;
+};
+
+/*
+ * Producers allocate messages and pass them to consumers, which free
+ * them: objects move from the magazines of the ones to the ones of the
+ * others through the depot. A message handed out while still in use would
+ * be found live by its producer.
+ */
+static void *producer(void *arg)
+{
+	struct pass *p = arg;
+	struct msg *m;
+	unsigned int i;
+
+	for (i = 0; i < NR_PASSED; i++) {
+		while (__atomic_load_n(&p->in_flight, __ATOMIC_RELAXED) >
+		       MAX_IN_FLIGHT)
+			sched_yield();
+		m = zoropool_alloc(&p->pool);
+		if (!m || m->state == LIVE) {
+			__atomic_add_fetch(&p->errors, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		m->state = LIVE;
+		m->seq = i;
+		__atomic_add_fetch(&p->in_flight, 1, __ATOMIC_RELAXED);
+		llist_add(&m->node, &p->queue);
+	}
+	__atomic_add_fetch(&p->producers_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct pass *p = arg;
+	struct llist_node *batch;
+	struct msg *m, *tmp;
+	unsigned long n;
+	unsigned int done;
+
+	do {
+		done = __atomic_load_n(&p->producers_done, __ATOMIC_ACQUIRE);
+		batch = llist_del_all(&p->queue);
+		if (!batch) {
+			sched_yield();
+			continue;
+		}
+		n = 0;
+		llist_for_each_entry_safe(m, tmp, batch, node) {
+			if (m->state != LIVE)
+				__atomic_add_fetch(&p->errors, 1,
+						   __ATOMIC_RELAXED);
+			m->state = DEAD;
+			zoropool_free(&p->pool, m);
+			n++;
+		}
+		__atomic_sub_fetch(&p->in_flight, n, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&p->received, n, __ATOMIC_RELAXED);
+	} while (done < NR_PAIRS || !llist_empty(&p->queue));
+	return NULL;
+}
+
+static int test_cross_thread(void)
+{
+	pthread_t threads[2 * NR_PAIRS];
+	struct pass *p;
+	unsigned int i, started = 0;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		zorotest_fail("Cannot allocate the test state\n");
+	zorotest_set_clear_on_fail(free, p);
+	zorotest_assert_eq_nums(0, zoropool_init(&p->pool, sizeof(struct msg),
+						 0), "%d");
+	init_llist_head(&p->queue);
+
+	for (i = 0; i < NR_PAIRS; i++) {
+		if (pthread_create(&threads[started], NULL, consumer, p))
+			break;
+		started++;
+		if (pthread_create(&threads[started], NULL, producer, p))
+			break;
+		started++;
+	}
+	if (started < 2 * NR_PAIRS) {
+		/* Let the consumers started so far be done */
+		__atomic_store_n(&p->producers_done, NR_PAIRS,
+				 __ATOMIC_RELEASE);
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	zoropool_destroy(&p->pool);
+	zorotest_assert_eq_nums(2u * NR_PAIRS, started, "%u");
+	zorotest_assert_eq_nums(0u, p->errors, "%u");
+	zorotest_assert_eq_nums((unsigned long)NR_PAIRS * NR_PASSED,
+				p->received, "%lu");
+	free(p);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_align),
+		ZOROTEST_CASE(test_free_list),
+		ZOROTEST_CASE(test_free_run),
+		ZOROTEST_CASE(test_cross_thread),
+	};
+
+	return zorotest_run_suite(tests, "pool", NULL);
+}
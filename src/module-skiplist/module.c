@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zoro/skiplist.h>
+#include <zoro/compiler.h>
+
+#if ZOROSL_MAX_LEVEL < 2
+#error "ZOROSL_MAX_LEVEL must be at least 2"
+#endif
+
+#define ZOROSL_UPPER_LEVELS	(ZOROSL_MAX_LEVEL - 1)
+
+#define __ZOROSL_CMP(_bits)						\
+static int __zorosl_cmp_u##_bits(const void *a, const void *b)		\
+{									\
+	uint##_bits##_t x, y;						\
+									\
+	memcpy(&x, a, sizeof(x));					\
+	memcpy(&y, b, sizeof(y));					\
+	return (x > y) - (x < y);					\
+}
+
+__ZOROSL_CMP(8)
+__ZOROSL_CMP(16)
+__ZOROSL_CMP(32)
+__ZOROSL_CMP(64)
+
+#undef __ZOROSL_CMP
+
+int __zorosl_init(struct zorosl *sl, size_t node_off, size_t key_off,
+		  size_t key_len, zorosl_cmp_t cmp)
+{
+	if (!cmp) {
+		switch (key_len) {
+		case 1:
+			cmp = __zorosl_cmp_u8;
+			break;
+		case 2:
+			cmp = __zorosl_cmp_u16;
+			break;
+		case 4:
+			cmp = __zorosl_cmp_u32;
+			break;
+		case 8:
+			cmp = __zorosl_cmp_u64;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	memset(sl, 0, sizeof(*sl));
+	INIT_LIST_HEAD(&sl->head);
+	/* Any odd value will do: levels only need to look random */
+	sl->seed = (uintptr_t)sl | 1;
+	sl->node_off = node_off;
+	sl->key_off = key_off;
+	sl->key_len = key_len;
+	sl->cmp = cmp;
+	return 0;
+}
+
+/* Number of upper levels of a new node: each one with probability 1/4 */
+static unsigned int __zorosl_random_levels(struct zorosl *sl)
+{
+	uint64_t r;
+	unsigned int levels = 0;
+
+	/* xorshift64* */
+	sl->seed ^= sl->seed >> 12;
+	sl->seed ^= sl->seed << 25;
+	sl->seed ^= sl->seed >> 27;
+	r = sl->seed * 0x2545f4914f6cdd1dULL;
+
+	while (levels < ZOROSL_UPPER_LEVELS && !(r & 3)) {
+		levels++;
+		r >>= 2;
+	}
+	return levels;
+}
+
+/* Next node of level @l after @node, NULL standing for the list itself */
+static inline struct zorosl_node *__zorosl_next(const struct zorosl *sl,
+						const struct zorosl_node *node,
+						unsigned int l)
+{
+	return node ? node->next[l] : sl->first[l];
+}
+
+/*
+ * Walk the upper levels down to the last node with a key before @key on
+ * each one; they are stored in @update, if not NULL. Return where to
+ * continue on level 0.
+ */
+static struct list_head *__zorosl_search(const struct zorosl *sl,
+					 const void *key,
+					 struct zorosl_node **update)
+{
+	struct zorosl_node *pred = NULL, *next;
+	unsigned int l = sl->levels;
+
+	while (l--) {
+		for (next = __zorosl_next(sl, pred, l);
+		     next && sl->cmp(__zorosl_key(sl, next), key) < 0;
+		     next = next->next[l])
+			pred = next;
+		if (update)
+			update[l] = pred;
+	}
+	return pred ? &pred->list : (struct list_head *)&sl->head;
+}
+
+/* The first list_head of level 0 that is head or an entry not before @key */
+static struct list_head *__zorosl_level0(const struct zorosl *sl,
+					 struct list_head *pos,
+					 const void *key)
+{
+	if (pos == &sl->head)
+		pos = pos->next;
+	while (__zorosl_before(sl, pos, key))
+		pos = pos->next;
+	return pos;
+}
+
+struct zorosl_node *__zorosl_lower_bound(const struct zorosl *sl,
+					 const void *key)
+{
+	struct list_head *pos;
+
+	pos = __zorosl_level0(sl, __zorosl_search(sl, key, NULL), key);
+	if (pos == &sl->head)
+		return NULL;
+	return list_entry(pos, struct zorosl_node, list);
+}
+
+int __zorosl_insert(struct zorosl *sl, struct zorosl_node *node)
+{
+	struct zorosl_node *update[ZOROSL_UPPER_LEVELS];
+	const void *key = __zorosl_key(sl, node);
+	struct list_head *pos;
+	unsigned int l;
+
+	pos = __zorosl_level0(sl, __zorosl_search(sl, key, update), key);
+	if (pos != &sl->head &&
+	    !sl->cmp(__zorosl_key(sl, list_entry(pos, struct zorosl_node,
+						 list)), key))
+		return -EEXIST;
+
+	list_add_tail(&node->list, pos);
+
+	node->levels = __zorosl_random_levels(sl);
+	/* New levels start from the list itself */
+	for (l = sl->levels; l < node->levels; l++)
+		update[l] = NULL;
+	if (node->levels > sl->levels)
+		sl->levels = node->levels;
+
+	for (l = 0; l < node->levels; l++) {
+		node->next[l] = __zorosl_next(sl, update[l], l);
+		if (update[l])
+			update[l]->next[l] = node;
+		else
+			sl->first[l] = node;
+	}
+	sl->count++;
+	return 0;
+}
+
+void __zorosl_del(struct zorosl *sl, struct zorosl_node *node)
+{
+	struct zorosl_node *update[ZOROSL_UPPER_LEVELS];
+	unsigned int l;
+
+	if (node->levels)
+		__zorosl_search(sl, __zorosl_key(sl, node), update);
+
+	/* Keys are unique: the predecessors found are those of @node */
+	for (l = 0; l < node->levels; l++) {
+		if (update[l])
+			update[l]->next[l] = node->next[l];
+		else
+			sl->first[l] = node->next[l];
+	}
+	while (sl->levels && !sl->first[sl->levels - 1])
+		sl->levels--;
+
+	list_del_init(&node->list);
+	node->levels = 0;
+	sl->count--;
+}
@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/skiplist.h>
+#include <zoro/test.h>
+
+#define NR_KEYS		4096
+#define NR_READERS	2
+#define NR_WRITERS	2
+#define NR_OPS		100000
+
+struct entry {
+	struct zorosl_node node;
+	uint32_t key;
+};
+
+/*
+ * The list and the model of its keys, only changed together under the write
+ * lock: readers under the read lock find in the list what the model holds
+ */
+struct run {
+	pthread_rwlock_t lock;
+	struct zorosl sl;
+	struct entry entries[NR_KEYS];
+	unsigned char present[NR_KEYS];
+	unsigned int stop;
+	unsigned int seeds;
+	unsigned long reads;
+	unsigned int errors;
+};
+
+static void error(struct run *r)
+{
+	__atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+}
+
+static unsigned int next_rand(unsigned int *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+/*
+ * Every level is in key order, each node is on the levels it says, and
+ * level 0 holds the keys of the model
+ */
+static int check_list(struct run *r)
+{
+	struct zorosl *sl = &r->sl;
+	struct zorosl_node *n;
+	struct entry *e, *prev = NULL;
+	size_t count = 0, below = 0, on;
+	unsigned int l;
+
+	zorosl_for_each_entry(sl, e, node) {
+		if (e->key >= NR_KEYS || !r->present[e->key] ||
+		    (prev && prev->key >= e->key) ||
+		    e->node.levels > sl->levels)
+			return -1;
+		prev = e;
+		count++;
+	}
+	if (count != zorosl_count(sl))
+		return -1;
+	for (below = count, l = 0; l < sl->levels; l++, below = on) {
+		prev = NULL;
+		on = 0;
+		for (n = sl->first[l]; n; n = n->next[l], on++) {
+			e = container_of(n, struct entry, node);
+			if (n->levels <= l || (prev && prev->key >= e->key))
+				return -1;
+			prev = e;
+		}
+		/* The top level is never empty */
+		if (on > below || (l == sl->levels - 1 && !on))
+			return -1;
+	}
+	for (l = 0, on = 0; l < NR_KEYS; l++)
+		on += r->present[l];
+	return on == count ? 0 : -1;
+}
+
+/* Lookups, lower bounds and range walks agree with the model */
+static void check_reads(struct run *r, unsigned int *seed)
+{
+	uint32_t key = next_rand(seed) % NR_KEYS, hi, k;
+	struct entry *e;
+	unsigned int n, exp;
+
+	e = zorosl_find(&r->sl, &key, struct entry, node);
+	if (r->present[key] ? !e || e->key != key : !!e)
+		error(r);
+
+	for (k = key; k < NR_KEYS && !r->present[k]; k++)
+		;
+	e = zorosl_lower_bound(&r->sl, &key, struct entry, node);
+	if (k < NR_KEYS ? !e || e->key != k : !!e)
+		error(r);
+
+	hi = key + next_rand(seed) % 128;
+	for (exp = 0, k = key; k < hi && k < NR_KEYS; k++)
+		exp += r->present[k];
+	n = 0;
+	zorosl_for_each_entry_range(&r->sl, e, &key, &hi, node) {
+		if (e->key < key || e->key >= hi || !r->present[e->key])
+			error(r);
+		n++;
+	}
+	if (n != exp)
+		error(r);
+}
+
+static void *reader(void *arg)
+{
+	struct run *r = arg;
+	unsigned int seed, i;
+
+	seed = 2463534242u * __atomic_add_fetch(&r->seeds, 1, __ATOMIC_RELAXED);
+	while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+		pthread_rwlock_rdlock(&r->lock);
+		for (i = 0; i < 16; i++)
+			check_reads(r, &seed);
+		if (!(seed % 32) && check_list(r))
+			error(r);
+		pthread_rwlock_unlock(&r->lock);
+		__atomic_add_fetch(&r->reads, 16, __ATOMIC_RELAXED);
+		sched_yield();
+	}
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct run *r = arg;
+	struct entry *e, dup;
+	unsigned int seed, i;
+	uint32_t key;
+	int ret;
+
+	seed = 88172645u * __atomic_add_fetch(&r->seeds, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < NR_OPS / NR_WRITERS; i++) {
+		key = next_rand(&seed) % NR_KEYS;
+		e = &r->entries[key];
+
+		pthread_rwlock_wrlock(&r->lock);
+		if (r->present[key]) {
+			zorosl_del(&r->sl, e, node);
+			r->present[key] = 0;
+		} else {
+			ret = zorosl_insert(&r->sl, e, node);
+			if (ret)
+				error(r);
+			r->present[key] = !ret;
+		}
+		/* Another entry with the same key leaves the list as it is */
+		dup.key = key;
+		if (r->present[key] &&
+		    zorosl_insert(&r->sl, &dup, node) != -EEXIST)
+			error(r);
+		pthread_rwlock_unlock(&r->lock);
+
+		if (!(i % 64))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void destroy_run(void *arg)
+{
+	struct run *r = arg;
+
+	pthread_rwlock_destroy(&r->lock);
+	free(r);
+}
+
+/*
+ * Writers insert and remove random keys while readers look them up and walk
+ * ranges, all serialized by a rwlock: readers run along with each other, and
+ * must never change the list
+ */
+static int test_stress(void)
+{
+	pthread_t threads[NR_READERS + NR_WRITERS];
+	unsigned int i, started = 0;
+	struct run *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		zorotest_fail("Cannot allocate the entries\n");
+	zorotest_set_clear_on_fail(free, r);
+	zorotest_assert_eq_nums(0, zorosl_init(&r->sl, struct entry, node, key,
+					       NULL), "%d");
+	pthread_rwlock_init(&r->lock, NULL);
+	zorotest_set_clear_on_fail(destroy_run, r);
+	for (i = 0; i < NR_KEYS; i++)
+		r->entries[i].key = i;
+
+	for (i = 0; i < NR_READERS + NR_WRITERS; i++) {
+		if (pthread_create(&threads[i], NULL,
+				   i < NR_READERS ? reader : writer, r))
+			break;
+		started++;
+	}
+	for (i = NR_READERS; i < started; i++)
+		pthread_join(threads[i], NULL);
+	__atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < started && i < NR_READERS; i++)
+		pthread_join(threads[i], NULL);
+
+	zorotest_verbose("%lu reads, %zu keys left\n", r->reads,
+			 zorosl_count(&r->sl));
+	zorotest_assert_eq_nums(NR_READERS + NR_WRITERS, started, "%u");
+	zorotest_assert_eq_nums(0u, r->errors, "%u");
+	zorotest_assert_true(r->reads > 0);
+	zorotest_assert_eq_nums(0, check_list(r), "%d");
+
+	/* Emptied, the list drops all its upper levels */
+	for (i = 0; i < NR_KEYS; i++) {
+		if (!r->present[i])
+			continue;
+		zorosl_del(&r->sl, &r->entries[i], node);
+		r->present[i] = 0;
+	}
+	zorotest_assert_eq_nums(0, check_list(r), "%d");
+	zorotest_assert_eq_nums((size_t)0, zorosl_count(&r->sl), "%zu");
+	zorotest_assert_eq_nums(0u, r->sl.levels, "%u");
+
+	destroy_run(r);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_stress),
+	};
+
+	return zorotest_run_suite(tests, "skiplist", NULL);
+}
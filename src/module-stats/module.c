@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zoro/log.h>
+#include <zoro/stats.h>
+
+#define ZOROSTATS_CACHE_LINE	SMP_CACHE_BYTES
+#define ZOROSTATS_MAGIC		0x3148535a	/* "ZSH1" */
+
+/* Layout of zorostats_hist_export() */
+struct zorostats_export_hdr {
+	uint32_t magic;
+	uint16_t precision;
+	uint16_t reserved;
+	/* Non-empty buckets that follow */
+	uint32_t nr;
+	uint32_t reserved2;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct zorostats_export_bucket {
+	uint64_t idx;
+	uint64_t count;
+};
+
+/* Thread exit: the shard is left to the next new thread */
+static void __zorostats_shard_destructor(void *arg)
+{
+	struct zorostats_shard *shard = arg;
+	struct zorostats_shards *s = shard->owner;
+
+	pthread_mutex_lock(&s->lock);
+	shard->in_use = 0;
+	pthread_mutex_unlock(&s->lock);
+}
+
+void *__zorostats_shard_slow(struct zorostats_shards *s)
+{
+	struct zorostats_shard *shard;
+
+	pthread_mutex_lock(&s->lock);
+	list_for_each_entry(shard, &s->list, list) {
+		if (!shard->in_use)
+			goto found;
+	}
+	shard = aligned_alloc(ZOROSTATS_CACHE_LINE, s->size);
+	if (!shard) {
+		pthread_mutex_unlock(&s->lock);
+		__atomic_add_fetch(&s->lost, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	memset(shard, 0, s->size);
+	shard->owner = s;
+	if (s->init)
+		s->init(shard);
+	list_add_tail(&shard->list, &s->list);
+found:
+	shard->in_use = 1;
+	pthread_mutex_unlock(&s->lock);
+
+	if (pthread_setspecific(s->key, shard)) {
+		/* Back to the others, not to be lost with its values */
+		__zorostats_shard_destructor(shard);
+		__atomic_add_fetch(&s->lost, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	return shard;
+}
+
+static int __zorostats_shards_init(struct zorostats_shards *s, size_t size,
+				   void (*init)(void *shard))
+{
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	ret = pthread_key_create(&s->key, __zorostats_shard_destructor);
+	if (ret)
+		return -ret;
+	pthread_mutex_init(&s->lock, NULL);
+	s->size = size;
+	s->init = init;
+	INIT_LIST_HEAD(&s->list);
+	return 0;
+}
+
+static void __zorostats_shards_destroy(struct zorostats_shards *s)
+{
+	struct zorostats_shard *shard, *tmp;
+
+	pthread_key_delete(s->key);
+	list_for_each_entry_safe(shard, tmp, &s->list, list)
+		free(shard);
+	INIT_LIST_HEAD(&s->list);
+	pthread_mutex_destroy(&s->lock);
+}
+
+int zorostats_counter_init(struct zorostats_counter *c)
+{
+	return __zorostats_shards_init(&c->shards,
+				       sizeof(struct zorostats_counter_shard),
+				       NULL);
+}
+
+void zorostats_counter_destroy(struct zorostats_counter *c)
+{
+	__zorostats_shards_destroy(&c->shards);
+}
+
+uint64_t zorostats_counter_read(struct zorostats_counter *c)
+{
+	struct zorostats_counter_shard *s;
+	uint64_t sum = 0;
+
+	pthread_mutex_lock(&c->shards.lock);
+	list_for_each_entry(s, &c->shards.list, shard.list)
+		sum += __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&c->shards.lock);
+	return sum;
+}
+
+static void __zorostats_hist_shard_init(void *arg)
+{
+	struct zorostats_hist_shard *s = arg;
+
+	s->min = UINT64_MAX;
+}
+
+int zorostats_hist_init(struct zorostats_hist *h)
+{
+	return __zorostats_shards_init(&h->shards,
+				       sizeof(struct zorostats_hist_shard),
+				       __zorostats_hist_shard_init);
+}
+
+void zorostats_hist_destroy(struct zorostats_hist *h)
+{
+	__zorostats_shards_destroy(&h->shards);
+}
+
+void zorostats_hist_snapshot_init(struct zorostats_hist_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+	snap->min = UINT64_MAX;
+}
+
+void zorostats_hist_snapshot(struct zorostats_hist *h,
+			     struct zorostats_hist_snapshot *snap)
+{
+	struct zorostats_hist_shard *s;
+	uint64_t v;
+	unsigned int i;
+
+	zorostats_hist_snapshot_init(snap);
+	pthread_mutex_lock(&h->shards.lock);
+	list_for_each_entry(s, &h->shards.list, shard.list) {
+		snap->count += __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+		snap->sum += __atomic_load_n(&s->sum, __ATOMIC_RELAXED);
+		v = __atomic_load_n(&s->min, __ATOMIC_RELAXED);
+		if (v < snap->min)
+			snap->min = v;
+		v = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+		if (v > snap->max)
+			snap->max = v;
+		for (i = 0; i < ZOROSTATS_NR_BUCKETS; i++)
+			snap->buckets[i] += __atomic_load_n(&s->buckets[i],
+							    __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&h->shards.lock);
+}
+
+void zorostats_hist_merge(struct zorostats_hist_snapshot *dst,
+			  const struct zorostats_hist_snapshot *src)
+{
+	unsigned int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (i = 0; i < ZOROSTATS_NR_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t zorostats_hist_percentile(const struct zorostats_hist_snapshot *snap,
+				   double p)
+{
+	uint64_t rank, seen = 0, high;
+	unsigned int i;
+	double x;
+
+	if (!snap->count)
+		return 0;
+	if (p <= 0)
+		return snap->min;
+	if (p >= 100)
+		return snap->max;
+	/* Nearest rank, from 1: ceil(p / 100 * count), within [1, count] */
+	x = p * snap->count / 100;
+	rank = (uint64_t)x;
+	if (rank < x)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+	if (rank > snap->count)
+		rank = snap->count;
+
+	for (i = 0; i < ZOROSTATS_NR_BUCKETS; i++) {
+		seen += snap->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	if (i == ZOROSTATS_NR_BUCKETS)
+		return snap->max;
+	high = zorostats_bucket_high(i);
+	return high < snap->max ? high : snap->max;
+}
+
+void zorostats_hist_log(const char *name,
+			const struct zorostats_hist_snapshot *snap)
+{
+	zorolog_info("%s: count %lu min %lu mean %.1f p50 %lu p90 %lu "
+		     "p99 %lu p99.9 %lu max %lu\n", name,
+		     (unsigned long)snap->count,
+		     (unsigned long)(snap->count ? snap->min : 0),
+		     zorostats_hist_mean(snap),
+		     (unsigned long)zorostats_hist_percentile(snap, 50),
+		     (unsigned long)zorostats_hist_percentile(snap, 90),
+		     (unsigned long)zorostats_hist_percentile(snap, 99),
+		     (unsigned long)zorostats_hist_percentile(snap, 99.9),
+		     (unsigned long)snap->max);
+}
+
+size_t zorostats_hist_export(const struct zorostats_hist_snapshot *snap,
+			     void *buf, size_t len)
+{
+	struct zorostats_export_hdr hdr = {
+		.magic = ZOROSTATS_MAGIC,
+		.precision = ZOROSTATS_PRECISION_BITS,
+		.count = snap->count,
+		.sum = snap->sum,
+		.min = snap->min,
+		.max = snap->max,
+	};
+	struct zorostats_export_bucket b;
+	unsigned int i;
+	size_t size;
+	char *p;
+
+	for (i = 0; i < ZOROSTATS_NR_BUCKETS; i++)
+		hdr.nr += !!snap->buckets[i];
+	size = sizeof(hdr) + hdr.nr * sizeof(b);
+	if (!buf || size > len)
+		return size;
+
+	p = buf;
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+	for (i = 0; i < ZOROSTATS_NR_BUCKETS; i++) {
+		if (!snap->buckets[i])
+			continue;
+		b.idx = i;
+		b.count = snap->buckets[i];
+		memcpy(p, &b, sizeof(b));
+		p += sizeof(b);
+	}
+	return size;
+}
+
+int zorostats_hist_import(struct zorostats_hist_snapshot *snap,
+			  const void *buf, size_t len)
+{
+	struct zorostats_hist_snapshot src;
+	struct zorostats_export_hdr hdr;
+	struct zorostats_export_bucket b;
+	const char *p = buf;
+	uint32_t i;
+
+	if (len < sizeof(hdr))
+		return -EINVAL;
+	memcpy(&hdr, p, sizeof(hdr));
+	p += sizeof(hdr);
+	if (hdr.magic != ZOROSTATS_MAGIC ||
+	    hdr.precision != ZOROSTATS_PRECISION_BITS ||
+	    hdr.nr > ZOROSTATS_NR_BUCKETS ||
+	    len < sizeof(hdr) + hdr.nr * sizeof(b))
+		return -EINVAL;
+
+	zorostats_hist_snapshot_init(&src);
+	src.count = hdr.count;
+	src.sum = hdr.sum;
+	src.min = hdr.min;
+	src.max = hdr.max;
+	for (i = 0; i < hdr.nr; i++) {
+		memcpy(&b, p, sizeof(b));
+		p += sizeof(b);
+		if (b.idx >= ZOROSTATS_NR_BUCKETS)
+			return -EINVAL;
+		src.buckets[b.idx] += b.count;
+	}
+	zorostats_hist_merge(snap, &src);
+	return 0;
+}
@@ -0,0 +1,305 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zoro/stats.h>
+#include <zoro/test.h>
+
+#define MAX_SMALL	12
+#define NR_SPREAD	1000
+#define NR_THREADS	4
+#define NR_RECORDS	20000
+
+static const double small_ps[] = { 0, 1, 10, 25, 33.3, 50, 75, 90, 99, 100 };
+
+struct shared {
+	struct zorostats_hist hist;
+	struct zorostats_counter counter;
+};
+
+static void destroy_hist(void *arg)
+{
+	zorostats_hist_destroy(arg);
+}
+
+static void destroy_shared(void *arg)
+{
+	struct shared *sh = arg;
+
+	zorostats_hist_destroy(&sh->hist);
+	zorostats_counter_destroy(&sh->counter);
+	free(sh);
+}
+
+/* Rank from 1 of the nearest rank percentile @p of @n values */
+static uint64_t nearest_rank(double p, uint64_t n)
+{
+	uint64_t rank;
+
+	for (rank = 1; rank < n && rank * 100 < p * n; rank++)
+		;
+	return rank;
+}
+
+/* Value of the bucket of @v reported for it, as the percentile does */
+static uint64_t reported(uint64_t v, uint64_t max)
+{
+	uint64_t high = zorostats_bucket_high(zorostats_bucket(v));
+
+	return high < max ? high : max;
+}
+
+/*
+ * Values below 2^ZOROSTATS_PRECISION_BITS have a bucket of their own: the
+ * percentiles of 1..n are the nearest ranks themselves.
+ */
+static int test_small_counts(void)
+{
+	struct zorostats_hist_snapshot snap;
+	struct zorostats_hist h;
+	uint64_t n, v, rank;
+	unsigned int i;
+
+	zorotest_assert_true(MAX_SMALL < (1 << ZOROSTATS_PRECISION_BITS));
+	for (n = 0; n <= MAX_SMALL; n++) {
+		zorotest_assert_eq_nums(0, zorostats_hist_init(&h), "%d");
+		zorotest_set_clear_on_fail(destroy_hist, &h);
+		/* Recorded backwards, not to depend on the order */
+		for (v = n; v; v--)
+			zorostats_record(&h, v);
+		zorostats_hist_snapshot(&h, &snap);
+		zorostats_hist_destroy(&h);
+		zorotest_unset_clear_on_fail();
+
+		zorotest_assert_eq_nums(n, snap.count, "%lu");
+		if (!n) {
+			zorotest_assert_eq_nums((uint64_t)0,
+						zorostats_hist_percentile(&snap, 50),
+						"%lu");
+			continue;
+		}
+		for (i = 0; i < ARRAY_SIZE(small_ps); i++) {
+			rank = nearest_rank(small_ps[i], n);
+			v = zorostats_hist_percentile(&snap, small_ps[i]);
+			if (v != rank) {
+				zorolog_error("p%g of 1..%lu: %lu instead of %lu\n",
+					      small_ps[i], (unsigned long)n,
+					      (unsigned long)v,
+					      (unsigned long)rank);
+				zorotest_fail("Wrong percentile\n");
+			}
+		}
+	}
+
+	/* Ten values: the median is the 5th one and p99 the 10th */
+	zorotest_assert_eq_nums(0, zorostats_hist_init(&h), "%d");
+	for (v = 1; v <= 10; v++)
+		zorostats_record(&h, v);
+	zorostats_hist_snapshot(&h, &snap);
+	zorostats_hist_destroy(&h);
+	zorotest_assert_eq_nums((uint64_t)1,
+				zorostats_hist_percentile(&snap, 0), "%lu");
+	zorotest_assert_eq_nums((uint64_t)5,
+				zorostats_hist_percentile(&snap, 50), "%lu");
+	zorotest_assert_eq_nums((uint64_t)6,
+				zorostats_hist_percentile(&snap, 50.1), "%lu");
+	zorotest_assert_eq_nums((uint64_t)9,
+				zorostats_hist_percentile(&snap, 90), "%lu");
+	zorotest_assert_eq_nums((uint64_t)10,
+				zorostats_hist_percentile(&snap, 99), "%lu");
+	zorotest_assert_eq_nums((uint64_t)10,
+				zorostats_hist_percentile(&snap, 100), "%lu");
+	zorotest_success();
+}
+
+/*
+ * Values spread over many power of two groups: each percentile is reported
+ * as the top of the bucket of the nearest rank value, capped to the max
+ */
+static int test_log_linear(void)
+{
+	struct zorostats_hist_snapshot snap;
+	struct zorostats_hist h;
+	uint64_t values[NR_SPREAD];
+	uint64_t v, exp, delta;
+	unsigned int i;
+	double p;
+
+	/* Sorted, from 1000 to about 2^36 */
+	for (i = 0; i < NR_SPREAD; i++)
+		values[i] = 1000 + (uint64_t)i * i * i * 67;
+
+	zorotest_assert_eq_nums(0, zorostats_hist_init(&h), "%d");
+	for (i = NR_SPREAD; i; i--)
+		zorostats_record(&h, values[i - 1]);
+	zorostats_hist_snapshot(&h, &snap);
+	zorostats_hist_destroy(&h);
+
+	zorotest_assert_eq_nums(values[0], zorostats_hist_percentile(&snap, 0),
+				"%lu");
+	zorotest_assert_eq_nums(values[NR_SPREAD - 1],
+				zorostats_hist_percentile(&snap, 100), "%lu");
+	v = zorostats_hist_percentile(&snap, 50);
+	zorotest_assert_eq_nums(reported(values[NR_SPREAD / 2 - 1],
+					 snap.max), v, "%lu");
+
+	for (p = 0.1; p < 100; p += 0.7) {
+		exp = values[nearest_rank(p, NR_SPREAD) - 1];
+		v = zorostats_hist_percentile(&snap, p);
+		zorotest_assert_eq_nums(reported(exp, snap.max), v, "%lu");
+		/* Within the precision of the buckets */
+		delta = exp >> (ZOROSTATS_PRECISION_BITS - 1);
+		zorotest_assert_true(v >= exp && v - exp <= delta);
+	}
+	zorotest_success();
+}
+
+struct recorder {
+	struct shared *sh;
+	unsigned int id;
+};
+
+/* Values of different magnitudes, distinct from a thread to the other */
+static uint64_t value_of(unsigned int id, unsigned int i)
+{
+	return ((uint64_t)i * 2654435761u) % (1ULL << (8 + 4 * id)) + id;
+}
+
+static void *record(void *arg)
+{
+	struct recorder *r = arg;
+	unsigned int i;
+
+	for (i = 0; i < NR_RECORDS; i++) {
+		zorostats_record(&r->sh->hist, value_of(r->id, i));
+		zorostats_inc(&r->sh->counter);
+	}
+	return NULL;
+}
+
+/* Record all the values of @a id of NR_THREADS threads, expected in @a exp */
+static int record_wave(struct shared *sh, unsigned int id,
+		       struct zorostats_hist_snapshot *exp)
+{
+	struct recorder r[NR_THREADS];
+	pthread_t threads[NR_THREADS];
+	unsigned int t, i, started;
+	uint64_t v;
+
+	for (started = 0; started < NR_THREADS; started++) {
+		r[started].sh = sh;
+		r[started].id = id + started;
+		if (pthread_create(&threads[started], NULL, record,
+				   &r[started]))
+			break;
+	}
+	for (t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+
+	for (t = 0; t < started; t++) {
+		for (i = 0; i < NR_RECORDS; i++) {
+			v = value_of(id + t, i);
+			exp->buckets[zorostats_bucket(v)]++;
+			exp->count++;
+			exp->sum += v;
+			if (v < exp->min)
+				exp->min = v;
+			if (v > exp->max)
+				exp->max = v;
+		}
+	}
+	return started == NR_THREADS ? 0 : -1;
+}
+
+static unsigned int nr_shards(struct zorostats_shards *s)
+{
+	struct zorostats_shard *shard;
+	unsigned int n = 0;
+
+	pthread_mutex_lock(&s->lock);
+	list_for_each_entry(shard, &s->list, list)
+		n++;
+	pthread_mutex_unlock(&s->lock);
+	return n;
+}
+
+/*
+ * The snapshot adds up the shards of all the threads, exited ones included,
+ * and the shards of exited threads are taken over by the new ones
+ */
+static int test_shard_merge(void)
+{
+	static struct zorostats_hist_snapshot exp, snap, half, merged;
+	struct shared *sh;
+	unsigned int shards, i;
+	char *buf;
+	size_t len;
+
+	sh = calloc(1, sizeof(*sh));
+	if (!sh)
+		zorotest_fail("Cannot allocate the histogram\n");
+	zorotest_set_clear_on_fail(free, sh);
+	zorotest_assert_eq_nums(0, zorostats_hist_init(&sh->hist), "%d");
+	zorotest_assert_eq_nums(0, zorostats_counter_init(&sh->counter), "%d");
+	zorotest_set_clear_on_fail(destroy_shared, sh);
+	zorostats_hist_snapshot_init(&exp);
+
+	if (record_wave(sh, 0, &exp))
+		zorotest_fail("Cannot start the recorders\n");
+	shards = nr_shards(&sh->hist.shards);
+	zorotest_assert_true(shards >= 1 && shards <= NR_THREADS);
+	zorostats_hist_snapshot(&sh->hist, &half);
+	zorotest_assert_true(!memcmp(&exp, &half, sizeof(exp)));
+
+	if (record_wave(sh, NR_THREADS, &exp))
+		zorotest_fail("Cannot start the recorders\n");
+	zorotest_assert_true(nr_shards(&sh->hist.shards) <= NR_THREADS);
+	zorostats_hist_snapshot(&sh->hist, &snap);
+	zorotest_assert_true(!memcmp(&exp, &snap, sizeof(exp)));
+	zorotest_assert_eq_nums(exp.count,
+				zorostats_counter_read(&sh->counter), "%lu");
+	zorotest_assert_eq_nums((uint64_t)0, sh->hist.shards.lost, "%lu");
+
+	/* Merging the first wave with both of them */
+	zorostats_hist_snapshot_init(&merged);
+	zorostats_hist_merge(&merged, &half);
+	zorostats_hist_merge(&merged, &snap);
+	zorotest_assert_eq_nums(half.count + snap.count, merged.count, "%lu");
+	zorotest_assert_eq_nums(half.sum + snap.sum, merged.sum, "%lu");
+	zorotest_assert_eq_nums(snap.min, merged.min, "%lu");
+	zorotest_assert_eq_nums(snap.max, merged.max, "%lu");
+	for (i = 0; i < ZOROSTATS_NR_BUCKETS; i++)
+		zorotest_assert_eq_nums(half.buckets[i] + snap.buckets[i],
+					merged.buckets[i], "%lu");
+
+	/* Same through the serialized form */
+	len = zorostats_hist_export(&snap, NULL, 0);
+	buf = malloc(len);
+	zorotest_assert_true(buf != NULL);
+	zorotest_assert_eq_nums(len, zorostats_hist_export(&snap, buf, len),
+				"%zu");
+	zorostats_hist_snapshot_init(&exp);
+	zorostats_hist_merge(&exp, &half);
+	if (zorostats_hist_import(&exp, buf, len) ||
+	    zorostats_hist_import(&exp, buf, len - 1) != -EINVAL) {
+		free(buf);
+		zorotest_fail("Cannot import the snapshot\n");
+	}
+	free(buf);
+	zorotest_assert_true(!memcmp(&merged, &exp, sizeof(exp)));
+
+	destroy_shared(sh);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_small_counts),
+		ZOROTEST_CASE(test_log_linear),
+		ZOROTEST_CASE(test_shard_merge),
+	};
+
+	return zorotest_run_suite(tests, "stats", NULL);
+}
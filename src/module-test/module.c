@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zoro/test.h>
+
+__thread void *zorotest_to_clear;
+__thread zorotest_cleaner_t zorotest_fail_clean;
+uint8_t zorotest_is_verbose;
+
+struct zltest_result {
+	/* ZOROTEST_SUCCESS, ZOROTEST_FAILURE, or the exit status of a child */
+	int status;
+	/* Signal that killed the child, if any */
+	int signo;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	struct zoroperf_counts perf;
+};
+
+struct zltest_suite {
+	const struct zorotest_case *cases;
+	struct zltest_result *res;
+	size_t num;
+	/* Next test to pick */
+	size_t next;
+	int flags;
+	unsigned int perf;
+};
+
+static uint64_t __zorotest_clock(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Run the test, counting the events of @perf, threads of the test included */
+static int __zorotest_run_counted(const struct zorotest_case *c,
+				  struct zltest_result *r, unsigned int perf)
+{
+	struct zoroperf_group g;
+	int ret;
+
+	if (!perf || zoroperf_open(&g, perf, ZOROPERF_INHERIT))
+		return c->test();
+	zoroperf_start(&g);
+	ret = c->test();
+	zoroperf_stop(&g, &r->perf);
+	zoroperf_close(&g);
+	return ret;
+}
+
+static void __zorotest_run_inline(const struct zorotest_case *c,
+				  struct zltest_result *r, unsigned int perf)
+{
+	uint64_t cpu = __zorotest_clock(CLOCK_THREAD_CPUTIME_ID);
+
+	zorotest_unset_clear_on_fail();
+	r->status = __zorotest_run_counted(c, r, perf) == ZOROTEST_SUCCESS ?
+		    ZOROTEST_SUCCESS : ZOROTEST_FAILURE;
+	zorotest_unset_clear_on_fail();
+	r->cpu_ns = __zorotest_clock(CLOCK_THREAD_CPUTIME_ID) - cpu;
+}
+
+/* @r is shared with the child, which fills its counts */
+static void __zorotest_run_forked(const struct zorotest_case *c,
+				  struct zltest_result *r, unsigned int perf)
+{
+	struct rusage ru;
+	pid_t pid;
+	int st;
+
+	/* Nothing buffered must be printed twice */
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		zorolog_error("Cannot fork test '%s': %s\n", c->name,
+			      strerror(errno));
+		r->status = ZOROTEST_FAILURE;
+		return;
+	}
+	if (!pid) {
+		zorotest_unset_clear_on_fail();
+		st = __zorotest_run_counted(c, r, perf);
+		fflush(NULL);
+		_exit(st == ZOROTEST_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	while (wait4(pid, &st, 0, &ru) < 0) {
+		if (errno != EINTR) {
+			r->status = ZOROTEST_FAILURE;
+			return;
+		}
+	}
+	r->cpu_ns = (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+		    1000000000ULL +
+		    (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+	if (WIFSIGNALED(st)) {
+		r->status = ZOROTEST_FAILURE;
+		r->signo = WTERMSIG(st);
+	} else if (WEXITSTATUS(st) == EXIT_SUCCESS) {
+		r->status = ZOROTEST_SUCCESS;
+	} else if (WEXITSTATUS(st) == EXIT_FAILURE) {
+		r->status = ZOROTEST_FAILURE;
+	} else {
+		r->status = WEXITSTATUS(st);
+	}
+}
+
+static void *__zorotest_worker(void *arg)
+{
+	struct zltest_suite *s = arg;
+	const struct zorotest_case *c;
+	struct zltest_result *r;
+	uint64_t t0;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED)) < s->num) {
+		c = &s->cases[i];
+		r = &s->res[i];
+		t0 = __zorotest_clock(CLOCK_MONOTONIC);
+		if (s->flags & ZOROTEST_FORK)
+			__zorotest_run_forked(c, r, s->perf);
+		else
+			__zorotest_run_inline(c, r, s->perf);
+		r->wall_ns = __zorotest_clock(CLOCK_MONOTONIC) - t0;
+		zorotest_verbose("%s %s\n", r->status == ZOROTEST_SUCCESS ?
+				 "PASS" : "FAIL", c->name);
+	}
+	return NULL;
+}
+
+struct zltest_rank {
+	uint64_t wall_ns;
+	size_t i;
+};
+
+/* Sort by decreasing wall time */
+static int __zorotest_slower(const void *a, const void *b)
+{
+	uint64_t ta = ((const struct zltest_rank *)a)->wall_ns;
+	uint64_t tb = ((const struct zltest_rank *)b)->wall_ns;
+
+	return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+static void __zorotest_report(const char *suite, const struct zltest_suite *s,
+			      unsigned int slowest)
+{
+	const struct zltest_result *r;
+	struct zltest_rank *order;
+	size_t i, failed = 0;
+	unsigned int e;
+	uint64_t wall = 0, cpu = 0;
+
+	for (i = 0; i < s->num; i++) {
+		wall += s->res[i].wall_ns;
+		cpu += s->res[i].cpu_ns;
+	}
+
+	if (slowest > s->num)
+		slowest = s->num;
+	order = malloc(s->num * sizeof(*order));
+	if (order && slowest) {
+		for (i = 0; i < s->num; i++) {
+			order[i].wall_ns = s->res[i].wall_ns;
+			order[i].i = i;
+		}
+		qsort(order, s->num, sizeof(*order), __zorotest_slower);
+		zorolog_info("SLOWEST %u tests of %s (wall, cpu):\n", slowest,
+			     suite);
+		for (i = 0; i < slowest; i++) {
+			r = &s->res[order[i].i];
+			zorolog_info("%12.3f ms %12.3f ms  %s",
+				     r->wall_ns / 1e6, r->cpu_ns / 1e6,
+				     s->cases[order[i].i].name);
+			zoroperf_for_each_event(e, r->perf.mask)
+				zorolog_info_continue("  %s %lu",
+						      zoroperf_event_name(e),
+						      (unsigned long)
+						      r->perf.value[e]);
+			zorolog_info_continue("\n");
+		}
+	}
+	free(order);
+	zorolog_info("%zu tests, %.3f ms of wall time, %.3f ms of cpu time\n",
+		     s->num, wall / 1e6, cpu / 1e6);
+	/* Failures last, after the lines above */
+	fflush(stdout);
+
+	for (i = 0; i < s->num; i++) {
+		r = &s->res[i];
+		if (r->status == ZOROTEST_SUCCESS)
+			continue;
+		failed++;
+		if (r->signo)
+			zorolog_error("TEST '%s' FAILED: killed by signal %d (%s)\n",
+				      s->cases[i].name, r->signo,
+				      strsignal(r->signo));
+		else if (r->status != ZOROTEST_FAILURE)
+			zorolog_error("TEST '%s' FAILED: exit status %d\n",
+				      s->cases[i].name, r->status);
+		else
+			zorolog_error("TEST '%s' FAILED\n", s->cases[i].name);
+	}
+
+	if (failed)
+		zorolog_error("TEST SUITE '%s' FAILED! %zu of %zu tests failed\n",
+			      suite, failed, s->num);
+	else
+		zorolog_info("TEST SUITE %s ...PASS!\n", suite);
+}
+
+/* Unsigned value of the environment variable @name; @def if unset */
+static unsigned int __zorotest_env(const char *name, unsigned int def)
+{
+	const char *v = getenv(name);
+
+	return v && *v ? (unsigned int)strtoul(v, NULL, 0) : def;
+}
+
+int zorotest_run_cases(const char *suite, const struct zorotest_case cases[],
+		       size_t num, const struct zorotest_opts *opts)
+{
+	struct zltest_suite s = {
+		.cases = cases,
+		.num = num,
+	};
+	unsigned int jobs = 0, slowest = 0, i, started;
+	pthread_t *tids;
+	size_t n, size;
+	long cpus;
+	int ret;
+
+	if (opts) {
+		jobs = opts->jobs;
+		slowest = opts->slowest;
+		s.flags = opts->flags;
+		s.perf = opts->perf;
+	}
+	if (!jobs) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = __zorotest_env("ZOROTEST_JOBS", cpus > 0 ? cpus : 1);
+	}
+	if (!jobs)
+		jobs = 1;
+	if (jobs > num)
+		jobs = num ? num : 1;
+	if (!slowest)
+		slowest = __zorotest_env("ZOROTEST_SLOWEST", ZOROTEST_SLOWEST);
+	if (__zorotest_env("ZOROTEST_FORK", 0))
+		s.flags |= ZOROTEST_FORK;
+	if (!s.perf && __zorotest_env("ZOROTEST_PERF", 0))
+		s.perf = ZOROPERF_DEFAULT;
+
+	/* Shared with the children, if forking, zeroed either way */
+	size = (num ? num : 1) * sizeof(*s.res);
+	s.res = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	tids = calloc(jobs, sizeof(*tids));
+	if (s.res == MAP_FAILED || !tids) {
+		zorolog_error("TEST SUITE '%s': out of memory\n", suite);
+		if (s.res != MAP_FAILED)
+			munmap(s.res, size);
+		free(tids);
+		return ZOROTEST_FAILURE;
+	}
+
+	zorolog_info("RUNNING test suite %s: %zu tests, %u jobs%s\n", suite,
+		     num, jobs, s.flags & ZOROTEST_FORK ? ", forked" : "");
+	/* The calling thread is a worker too; fewer workers if out of threads */
+	for (started = 0; started < jobs - 1; started++)
+		if (pthread_create(&tids[started], NULL, __zorotest_worker,
+				   &s))
+			break;
+	__zorotest_worker(&s);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	__zorotest_report(suite, &s, slowest);
+	ret = ZOROTEST_SUCCESS;
+	for (n = 0; n < num; n++)
+		if (s.res[n].status != ZOROTEST_SUCCESS)
+			ret = ZOROTEST_FAILURE;
+	free(tids);
+	munmap(s.res, size);
+	return ret;
+}
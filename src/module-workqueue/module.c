@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <zoro/atomic.h>
+#include <zoro/compiler.h>
+#include <zoro/percpu.h>
+#include <zoro/workqueue.h>
+
+/*
+ * Flush colors, after the kernel's: every item takes the current color
+ * when queued, and a flush switches color, then waits for all the items of
+ * the previous one to have run. Counts are kept per worker, not to share a
+ * cache line among all of them, and by color, so that items queued after
+ * the flush started do not count for it.
+ */
+#define ZOROWQ_NR_COLORS	2
+
+struct zorowq_worker {
+	pthread_spinlock_t lock;
+	struct list_head list;
+	/* Items in @a list */
+	size_t nr;
+	/* Items of each color queued to @a list, wherever they ran */
+	uint64_t queued[ZOROWQ_NR_COLORS];
+	/* Items of each color run by the worker; only written by it */
+	uint64_t done[ZOROWQ_NR_COLORS];
+	struct zorowq *wq;
+	unsigned int idx;
+	pthread_t thread;
+	int started;
+} ____cacheline_aligned;
+
+struct zorowq {
+	/* Bumped to wake idle workers up, and number of them */
+	int events ____cacheline_aligned;
+	int idle;
+	int stopping;
+	/* Bumped to wake flushers up, and number of them */
+	int flush_seq ____cacheline_aligned;
+	int flushers;
+	/* Color of the items queued now; flushes take turns on it */
+	unsigned int color;
+	pthread_mutex_t flush_lock;
+	unsigned int nr;
+	int flags;
+	struct zorowq_worker *workers;
+};
+
+static __thread struct zorowq_worker *__zorowq_self;
+
+static struct {
+	pthread_once_t once;
+	struct zorowq *system;
+	int error;
+} zlwq = {
+	.once = PTHREAD_ONCE_INIT,
+};
+
+static inline void __zorowq_futex_wake(int *uaddr, int nr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, nr, NULL, NULL, 0);
+}
+
+static inline void __zorowq_futex_wait(int *uaddr, int val)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/* Wake up to @nr idle workers, after queuing @nr items */
+static inline void __zorowq_wake(struct zorowq *wq, int nr)
+{
+	/* Pairs with the barrier of the workers going idle */
+	smp_mb();
+	if (__atomic_load_n(&wq->idle, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&wq->events, 1, __ATOMIC_RELEASE);
+		__zorowq_futex_wake(&wq->events, nr);
+	}
+}
+
+/* Worker whose deque new items of the calling thread go to */
+static inline struct zorowq_worker *__zorowq_target(struct zorowq *wq)
+{
+	struct zorowq_worker *self = __zorowq_self;
+
+	if (self && self->wq == wq)
+		return self;
+	return &wq->workers[zoropercpu_cpu() % wq->nr];
+}
+
+static struct zorowork *__zorowq_pop(struct zorowq_worker *w)
+{
+	struct zorowork *work = NULL;
+
+	if (!READ_ONCE(w->nr))
+		return NULL;
+	pthread_spin_lock(&w->lock);
+	if (w->nr) {
+		work = list_first_entry(&w->list, struct zorowork, entry);
+		list_del(&work->entry);
+		w->nr--;
+	}
+	pthread_spin_unlock(&w->lock);
+	return work;
+}
+
+/* Move the last @n entries of @head to the empty @list */
+static void __zorowq_cut_tail(struct list_head *list, struct list_head *head,
+			      size_t n)
+{
+	struct list_head *first = head, *last = head->prev;
+
+	while (n--)
+		first = first->prev;
+	first->prev->next = head;
+	head->prev = first->prev;
+	list->next = first;
+	first->prev = list;
+	list->prev = last;
+	last->next = list;
+}
+
+/*
+ * Steal the newest items of another deque, up to half of them: run the
+ * oldest one of the batch now, put the others in our deque
+ */
+static struct zorowork *__zorowq_steal(struct zorowq_worker *self)
+{
+	struct zorowq *wq = self->wq;
+	struct zorowq_worker *v;
+	struct zorowork *work;
+	LIST_HEAD(batch);
+	unsigned int i;
+	size_t n;
+
+	for (i = 1; i < wq->nr; i++) {
+		v = &wq->workers[(self->idx + i) % wq->nr];
+		if (!READ_ONCE(v->nr))
+			continue;
+
+		pthread_spin_lock(&v->lock);
+		n = (v->nr + 1) / 2;
+		if (n > ZOROWQ_STEAL_BATCH)
+			n = ZOROWQ_STEAL_BATCH;
+		if (n) {
+			__zorowq_cut_tail(&batch, &v->list, n);
+			v->nr -= n;
+		}
+		pthread_spin_unlock(&v->lock);
+		if (!n)
+			continue;
+
+		work = list_first_entry(&batch, struct zorowork, entry);
+		list_del(&work->entry);
+		if (--n) {
+			pthread_spin_lock(&self->lock);
+			list_splice_tail(&batch, &self->list);
+			self->nr += n;
+			pthread_spin_unlock(&self->lock);
+		}
+		return work;
+	}
+	return NULL;
+}
+
+static inline struct zorowork *__zorowq_find(struct zorowq_worker *self)
+{
+	struct zorowork *work = __zorowq_pop(self);
+
+	return work ? work : __zorowq_steal(self);
+}
+
+static void __zorowq_run(struct zorowq_worker *self, struct zorowork *work)
+{
+	struct zorowq *wq = self->wq;
+	unsigned int color = !!(work->flags & __ZOROWORK_COLOR);
+
+	/* Not pending anymore: the function may queue it again */
+	__atomic_store_n(&work->flags, 0, __ATOMIC_RELEASE);
+	work->func(work);
+
+	__atomic_store_n(&self->done[color], self->done[color] + 1,
+			 __ATOMIC_RELEASE);
+	/* Pairs with the barrier of zorowq_flush() */
+	smp_mb();
+	if (unlikely(__atomic_load_n(&wq->flushers, __ATOMIC_RELAXED))) {
+		__atomic_fetch_add(&wq->flush_seq, 1, __ATOMIC_RELEASE);
+		__zorowq_futex_wake(&wq->flush_seq, INT_MAX);
+	}
+}
+
+static void *__zorowq_worker(void *arg)
+{
+	struct zorowq_worker *self = arg;
+	struct zorowq *wq = self->wq;
+	struct zorowork *work;
+	int seq;
+
+	__zorowq_self = self;
+	for (;;) {
+		work = __zorowq_find(self);
+		if (likely(work)) {
+			__zorowq_run(self, work);
+			continue;
+		}
+
+		/*
+		 * Announce we are going idle, then look again: any item
+		 * queued after the first look sees us idle, and bumps the
+		 * events we would sleep on
+		 */
+		seq = __atomic_load_n(&wq->events, __ATOMIC_ACQUIRE);
+		__atomic_fetch_add(&wq->idle, 1, __ATOMIC_SEQ_CST);
+		work = __zorowq_find(self);
+		if (!work) {
+			if (__atomic_load_n(&wq->stopping, __ATOMIC_ACQUIRE)) {
+				__atomic_fetch_sub(&wq->idle, 1,
+						   __ATOMIC_RELAXED);
+				break;
+			}
+			__zorowq_futex_wait(&wq->events, seq);
+		}
+		__atomic_fetch_sub(&wq->idle, 1, __ATOMIC_RELAXED);
+		if (work)
+			__zorowq_run(self, work);
+	}
+	return NULL;
+}
+
+/* Color of the items being queued */
+static inline unsigned int __zorowq_color(struct zorowq *wq)
+{
+	return __atomic_load_n(&wq->color, __ATOMIC_RELAXED);
+}
+
+/* Count @n items of @color queued to @w, with its lock held */
+static inline void __zorowq_count(struct zorowq_worker *w, unsigned int color,
+				  size_t n)
+{
+	/* Read locklessly by zorowq_flush() */
+	__atomic_store_n(&w->queued[color], w->queued[color] + n,
+			 __ATOMIC_RELEASE);
+}
+
+bool zorowq_queue(struct zorowq *wq, struct zorowork *work)
+{
+	struct zorowq_worker *w;
+	unsigned int color;
+
+	if (__atomic_fetch_or(&work->flags, ZOROWORK_PENDING,
+			      __ATOMIC_ACQ_REL) & ZOROWORK_PENDING)
+		return false;
+
+	w = __zorowq_target(wq);
+	pthread_spin_lock(&w->lock);
+	/* Under the lock, for zorowq_flush() to wait for it to be counted */
+	color = __zorowq_color(wq);
+	/* The item is ours until it runs */
+	if (color)
+		__atomic_fetch_or(&work->flags, __ZOROWORK_COLOR,
+				  __ATOMIC_RELAXED);
+	list_add_tail(&work->entry, &w->list);
+	w->nr++;
+	__zorowq_count(w, color, 1);
+	pthread_spin_unlock(&w->lock);
+
+	__zorowq_wake(wq, 1);
+	return true;
+}
+
+size_t zorowq_queue_list(struct zorowq *wq, struct list_head *list)
+{
+	struct zorowq_worker *w;
+	struct zorowork *work;
+	unsigned int color;
+	size_t n = 0;
+
+	if (list_empty(list))
+		return 0;
+
+	w = __zorowq_target(wq);
+	pthread_spin_lock(&w->lock);
+	/* Same as zorowq_queue() */
+	color = __zorowq_color(wq);
+	/* The items are still private to the caller: plain stores do */
+	list_for_each_entry(work, list, entry) {
+		work->flags = ZOROWORK_PENDING | (color ? __ZOROWORK_COLOR : 0);
+		n++;
+	}
+	list_splice_tail_init(list, &w->list);
+	w->nr += n;
+	__zorowq_count(w, color, n);
+	pthread_spin_unlock(&w->lock);
+	__zorowq_wake(wq, n < INT_MAX ? (int)n : INT_MAX);
+	return n;
+}
+
+/*
+ * Whether all the items of @color queued so far have run. Items run are
+ * summed first: each of them was counted as queued before, wherever it was
+ * queued, so an item queued and not run yet cannot be missed, even if later
+ * items, queued and run meanwhile, are.
+ */
+static bool __zorowq_color_done(struct zorowq *wq, unsigned int color)
+{
+	uint64_t queued = 0, done = 0;
+	unsigned int i;
+
+	for (i = 0; i < wq->nr; i++)
+		done += __atomic_load_n(&wq->workers[i].done[color],
+					__ATOMIC_ACQUIRE);
+	for (i = 0; i < wq->nr; i++)
+		queued += __atomic_load_n(&wq->workers[i].queued[color],
+					  __ATOMIC_ACQUIRE);
+	return done == queued;
+}
+
+void zorowq_flush(struct zorowq *wq)
+{
+	unsigned int color, i;
+	int seq;
+
+	/* One flush at a time: the next one waits for the new color */
+	pthread_mutex_lock(&wq->flush_lock);
+	color = __zorowq_color(wq);
+	__atomic_store_n(&wq->color, (color + 1) % ZOROWQ_NR_COLORS,
+			 __ATOMIC_SEQ_CST);
+	/* Items that took the old color, under a worker lock, are counted */
+	for (i = 0; i < wq->nr; i++) {
+		pthread_spin_lock(&wq->workers[i].lock);
+		pthread_spin_unlock(&wq->workers[i].lock);
+	}
+
+	__atomic_fetch_add(&wq->flushers, 1, __ATOMIC_SEQ_CST);
+	for (;;) {
+		seq = __atomic_load_n(&wq->flush_seq, __ATOMIC_ACQUIRE);
+		/* Pairs with the barrier of the workers counting items run */
+		smp_mb();
+		if (__zorowq_color_done(wq, color))
+			break;
+		__zorowq_futex_wait(&wq->flush_seq, seq);
+	}
+	__atomic_fetch_sub(&wq->flushers, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&wq->flush_lock);
+}
+
+unsigned int zorowq_nr_workers(const struct zorowq *wq)
+{
+	return wq->nr;
+}
+
+static void __zorowq_stop(struct zorowq *wq)
+{
+	unsigned int i;
+
+	__atomic_store_n(&wq->stopping, 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&wq->events, 1, __ATOMIC_RELEASE);
+	__zorowq_futex_wake(&wq->events, INT_MAX);
+	for (i = 0; i < wq->nr; i++) {
+		if (wq->workers[i].started)
+			pthread_join(wq->workers[i].thread, NULL);
+		pthread_spin_destroy(&wq->workers[i].lock);
+	}
+	pthread_mutex_destroy(&wq->flush_lock);
+	free(wq->workers);
+	free(wq);
+}
+
+/* Pin @attr to the @idx-th CPU the process may run on, round robin */
+static void __zorowq_affine(pthread_attr_t *attr, unsigned int idx)
+{
+	cpu_set_t allowed, set;
+	int cpu, n, count;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return;
+	count = CPU_COUNT(&allowed);
+	if (!count)
+		return;
+	n = idx % count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && !n--)
+			break;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+struct zorowq *zorowq_create(unsigned int nworkers, int flags)
+{
+	struct zorowq_worker *w;
+	pthread_attr_t attr;
+	struct zorowq *wq;
+	unsigned int i;
+	int ret;
+
+	if (flags & ~ZOROWQ_AFFINE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!nworkers)
+		nworkers = zoropercpu_nr_cpus();
+
+	wq = aligned_alloc(SMP_CACHE_BYTES, L1_CACHE_ALIGN(sizeof(*wq)));
+	if (!wq)
+		return NULL;
+	memset(wq, 0, sizeof(*wq));
+	pthread_mutex_init(&wq->flush_lock, NULL);
+	wq->nr = nworkers;
+	wq->flags = flags;
+	wq->workers = aligned_alloc(SMP_CACHE_BYTES,
+				    nworkers * sizeof(*wq->workers));
+	if (!wq->workers) {
+		free(wq);
+		return NULL;
+	}
+	memset(wq->workers, 0, nworkers * sizeof(*wq->workers));
+	for (i = 0; i < nworkers; i++) {
+		w = &wq->workers[i];
+		pthread_spin_init(&w->lock, PTHREAD_PROCESS_PRIVATE);
+		INIT_LIST_HEAD(&w->list);
+		w->wq = wq;
+		w->idx = i;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		w = &wq->workers[i];
+		pthread_attr_init(&attr);
+		if (flags & ZOROWQ_AFFINE)
+			__zorowq_affine(&attr, i);
+		ret = pthread_create(&w->thread, &attr, __zorowq_worker, w);
+		pthread_attr_destroy(&attr);
+		if (ret) {
+			__zorowq_stop(wq);
+			errno = ret;
+			return NULL;
+		}
+		w->started = 1;
+	}
+	return wq;
+}
+
+void zorowq_destroy(struct zorowq *wq)
+{
+	zorowq_flush(wq);
+	__zorowq_stop(wq);
+}
+
+static void __zorowq_atfork_child(void)
+{
+	/* The workers do not exist in the child: start over */
+	zlwq.system = NULL;
+	zlwq.once = (pthread_once_t)PTHREAD_ONCE_INIT;
+	__zorowq_self = NULL;
+}
+
+static void __zorowq_system_once(void)
+{
+	zlwq.system = zorowq_create(0, 0);
+	if (!zlwq.system)
+		zlwq.error = errno;
+	else
+		pthread_atfork(NULL, NULL, __zorowq_atfork_child);
+}
+
+struct zorowq *zorowq_system(void)
+{
+	pthread_once(&zlwq.once, __zorowq_system_once);
+	if (!zlwq.system)
+		errno = zlwq.error;
+	return zlwq.system;
+}
@@ -0,0 +1,440 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zoro/workqueue.h>
+#include <zoro/test.h>
+
+#define NR_WORKERS	4
+#define NR_ITEMS	100000
+#define NR_REQUEUES	3
+#define NR_SLOW		2000
+#define NR_SORTED	(2 * LIST_SORT_PARALLEL_MIN + 12345)
+
+struct item {
+	struct zorowork work;
+	unsigned long *count;
+	unsigned int requeues;
+	struct zorowq *wq;
+	pthread_t thread;
+};
+
+static void item_count(struct zorowork *work)
+{
+	struct item *it = container_of(work, struct item, work);
+
+	__atomic_add_fetch(it->count, 1, __ATOMIC_RELAXED);
+	if (it->requeues) {
+		it->requeues--;
+		zorowq_queue(it->wq, &it->work);
+	}
+}
+
+static struct item *alloc_items(size_t n, struct zorowq *wq,
+				unsigned long *count, unsigned int requeues,
+				zorowork_fn_t fn)
+{
+	struct item *items = calloc(n, sizeof(*items));
+	size_t i;
+
+	if (!items)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		zorowork_init(&items[i].work, fn);
+		items[i].count = count;
+		items[i].requeues = requeues;
+		items[i].wq = wq;
+	}
+	return items;
+}
+
+static void destroy_wq(void *arg)
+{
+	zorowq_destroy(arg);
+}
+
+/* Items queued one by one and as lists */
+static int test_queue(void)
+{
+	struct zorowq *wq;
+	struct item *items;
+	unsigned long count = 0;
+	LIST_HEAD(list);
+	size_t i, n = 0;
+
+	wq = zorowq_create(NR_WORKERS, 0);
+	if (!wq)
+		zorotest_fail("Cannot create the work queue\n");
+	zorotest_set_clear_on_fail(destroy_wq, wq);
+	zorotest_assert_eq_nums((unsigned int)NR_WORKERS, zorowq_nr_workers(wq),
+				"%u");
+	items = alloc_items(NR_ITEMS, wq, &count, 0, item_count);
+	if (!items)
+		zorotest_fail("Cannot allocate the items\n");
+
+	for (i = 0; i < NR_ITEMS; i++) {
+		if (i & 1) {
+			zorotest_assert_true(zorowq_queue(wq, &items[i].work));
+			continue;
+		}
+		list_add_tail(&items[i].work.entry, &list);
+		if (++n == 64) {
+			zorotest_assert_eq_nums((size_t)64,
+						zorowq_queue_list(wq, &list),
+						"%zu");
+			zorotest_assert_true(list_empty(&list));
+			n = 0;
+		}
+	}
+	zorotest_assert_eq_nums(n, zorowq_queue_list(wq, &list), "%zu");
+
+	zorowq_flush(wq);
+	zorotest_assert_eq_nums((unsigned long)NR_ITEMS,
+				__atomic_load_n(&count, __ATOMIC_RELAXED),
+				"%lu");
+	for (i = 0; i < NR_ITEMS; i++)
+		zorotest_assert_false(zorowork_pending(&items[i].work));
+
+	zorowq_destroy(wq);
+	free(items);
+	zorotest_success();
+}
+
+struct gate {
+	int started;
+	int release;
+	int done;
+};
+
+static void gate_wait(int *flag)
+{
+	while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+		usleep(100);
+}
+
+static void gate_open(int *flag)
+{
+	__atomic_store_n(flag, 1, __ATOMIC_RELEASE);
+}
+
+struct slow_item {
+	struct zorowork work;
+	struct gate gate;
+};
+
+static void slow_run(struct zorowork *work)
+{
+	struct slow_item *s = container_of(work, struct slow_item, work);
+
+	gate_open(&s->gate.started);
+	gate_wait(&s->gate.release);
+	gate_open(&s->gate.done);
+}
+
+/* A pending item is not queued twice */
+static int test_pending(void)
+{
+	struct slow_item s = { 0 };
+	struct zorowq *wq;
+
+	wq = zorowq_create(1, 0);
+	if (!wq)
+		zorotest_fail("Cannot create the work queue\n");
+	zorotest_set_clear_on_fail(destroy_wq, wq);
+
+	/* The worker is kept busy by the first run of the item */
+	zorowork_init(&s.work, slow_run);
+	zorotest_assert_true(zorowq_queue(wq, &s.work));
+	gate_wait(&s.gate.started);
+	zorotest_assert_false(zorowork_pending(&s.work));
+	__atomic_store_n(&s.gate.started, 0, __ATOMIC_RELAXED);
+	zorotest_assert_true(zorowq_queue(wq, &s.work));
+	zorotest_assert_true(zorowork_pending(&s.work));
+	zorotest_assert_false(zorowq_queue(wq, &s.work));
+
+	gate_open(&s.gate.release);
+	zorowq_flush(wq);
+	zorotest_assert_false(zorowork_pending(&s.work));
+	zorowq_destroy(wq);
+	zorotest_success();
+}
+
+struct flusher {
+	struct zorowq *wq;
+	struct slow_item *slow;
+	pthread_t thread;
+	int in_flush;
+	int returned;
+	int slow_done;
+};
+
+/* Let the slow item and the flusher finish, on failure */
+static void release_flusher(void *arg)
+{
+	struct flusher *f = arg;
+
+	gate_open(&f->slow->gate.release);
+	pthread_join(f->thread, NULL);
+	zorowq_destroy(f->wq);
+}
+
+static void *flusher(void *arg)
+{
+	struct flusher *f = arg;
+
+	gate_open(&f->in_flush);
+	zorowq_flush(f->wq);
+	f->slow_done = __atomic_load_n(&f->slow->gate.done, __ATOMIC_ACQUIRE);
+	gate_open(&f->returned);
+	return NULL;
+}
+
+static void fast_run(struct zorowork *work)
+{
+	struct item *it = container_of(work, struct item, work);
+
+	__atomic_add_fetch(it->count, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * A flush waits for the items queued before it, even when items queued
+ * after it, by other threads, run meanwhile and complete first.
+ */
+static int test_flush_order(void)
+{
+	struct slow_item slow = { 0 };
+	struct flusher f = { 0 };
+	unsigned long count = 0;
+	struct item fast = { 0 };
+	struct zorowq *wq;
+
+	wq = zorowq_create(2, 0);
+	if (!wq)
+		zorotest_fail("Cannot create the work queue\n");
+	zorotest_set_clear_on_fail(destroy_wq, wq);
+
+	zorowork_init(&slow.work, slow_run);
+	zorowq_queue(wq, &slow.work);
+	gate_wait(&slow.gate.started);
+
+	f.wq = wq;
+	f.slow = &slow;
+	if (pthread_create(&f.thread, NULL, flusher, &f)) {
+		gate_open(&slow.gate.release);
+		zorotest_fail("Cannot create the flusher\n");
+	}
+	zorotest_set_clear_on_fail(release_flusher, &f);
+	gate_wait(&f.in_flush);
+	/* Let the flusher get into zorowq_flush() */
+	usleep(20000);
+
+	zorowork_init(&fast.work, fast_run);
+	fast.count = &count;
+	zorowq_queue(wq, &fast.work);
+	while (!__atomic_load_n(&count, __ATOMIC_ACQUIRE))
+		usleep(100);
+	usleep(20000);
+	zorotest_assert_false(__atomic_load_n(&f.returned, __ATOMIC_ACQUIRE));
+
+	gate_open(&slow.gate.release);
+	pthread_join(f.thread, NULL);
+	zorotest_set_clear_on_fail(destroy_wq, wq);
+	zorotest_assert_true(f.slow_done);
+	zorowq_destroy(wq);
+	zorotest_success();
+}
+
+static void slow_count(struct zorowork *work)
+{
+	struct item *it = container_of(work, struct item, work);
+
+	it->thread = pthread_self();
+	usleep(50);
+	__atomic_add_fetch(it->count, 1, __ATOMIC_RELAXED);
+}
+
+/* A list queued at once, on one deque, is shared by stealing */
+static int test_steal(void)
+{
+	struct zorowq *wq;
+	struct item *items;
+	unsigned long count = 0;
+	unsigned int others = 0;
+	LIST_HEAD(list);
+	size_t i;
+
+	wq = zorowq_create(NR_WORKERS, 0);
+	if (!wq)
+		zorotest_fail("Cannot create the work queue\n");
+	zorotest_set_clear_on_fail(destroy_wq, wq);
+	items = alloc_items(NR_SLOW, wq, &count, 0, slow_count);
+	if (!items)
+		zorotest_fail("Cannot allocate the items\n");
+
+	for (i = 0; i < NR_SLOW; i++)
+		list_add_tail(&items[i].work.entry, &list);
+	zorotest_assert_eq_nums((size_t)NR_SLOW, zorowq_queue_list(wq, &list),
+				"%zu");
+	zorowq_flush(wq);
+	zorotest_assert_eq_nums((unsigned long)NR_SLOW, count, "%lu");
+
+	for (i = 1; i < NR_SLOW; i++)
+		others += !pthread_equal(items[i].thread, items[0].thread);
+	zorotest_verbose("%u of %u items run by other workers than the first "
+			 "one\n", others, NR_SLOW);
+	zorotest_assert_true(others > 0);
+
+	zorowq_destroy(wq);
+	free(items);
+	zorotest_success();
+}
+
+/* Destroying a queue runs all its items first, requeued ones included */
+static int test_destroy_drains(void)
+{
+	struct zorowq *wq;
+	struct item *items;
+	unsigned long count = 0;
+	size_t i;
+
+	wq = zorowq_create(NR_WORKERS, 0);
+	if (!wq)
+		zorotest_fail("Cannot create the work queue\n");
+	items = alloc_items(NR_ITEMS, wq, &count, NR_REQUEUES, item_count);
+	if (!items) {
+		zorowq_destroy(wq);
+		zorotest_fail("Cannot allocate the items\n");
+	}
+
+	for (i = 0; i < NR_ITEMS; i++)
+		zorowq_queue(wq, &items[i].work);
+	zorowq_destroy(wq);
+
+	zorotest_assert_eq_nums((unsigned long)NR_ITEMS * (NR_REQUEUES + 1),
+				count, "%lu");
+	free(items);
+	zorotest_success();
+}
+
+/* Affine workers run items like the others */
+static int test_affine(void)
+{
+	struct zorowq *wq;
+	struct item *items;
+	unsigned long count = 0;
+	size_t i;
+
+	zorotest_assert_true(zorowq_create(1, ~ZOROWQ_AFFINE) == NULL);
+
+	wq = zorowq_create(NR_WORKERS, ZOROWQ_AFFINE);
+	if (!wq)
+		zorotest_fail("Cannot create the work queue\n");
+	zorotest_set_clear_on_fail(destroy_wq, wq);
+	items = alloc_items(NR_ITEMS, wq, &count, 0, item_count);
+	if (!items)
+		zorotest_fail("Cannot allocate the items\n");
+
+	for (i = 0; i < NR_ITEMS; i++)
+		zorowq_queue(wq, &items[i].work);
+	zorowq_flush(wq);
+	zorotest_assert_eq_nums((unsigned long)NR_ITEMS, count, "%lu");
+
+	zorowq_destroy(wq);
+	free(items);
+	zorotest_success();
+}
+
+struct node {
+	struct list_head list;
+	unsigned int key;
+	unsigned int seq;
+};
+
+static int cmp_nodes(void *priv, const struct list_head *a,
+		     const struct list_head *b)
+{
+	const struct node *x = list_entry(a, struct node, list);
+	const struct node *y = list_entry(b, struct node, list);
+
+	(void)priv;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+struct sort_item {
+	struct zorowork work;
+	struct list_head head;
+	struct node *nodes;
+};
+
+static void sort_run(struct zorowork *work)
+{
+	struct sort_item *s = container_of(work, struct sort_item, work);
+
+	list_sort_parallel(NULL, &s->head, cmp_nodes, NR_WORKERS);
+}
+
+/*
+ * list_sort_parallel() called from a work item of the system queue, which
+ * runs its chunks: it must neither wait for the items queued behind it nor
+ * lose its stability.
+ */
+static int test_sort_in_work(void)
+{
+	struct sort_item s;
+	struct node *prev = NULL, *pos;
+	struct list_head *p;
+	struct zorowq *wq;
+	size_t i, n = 0;
+
+	wq = zorowq_system();
+	if (!wq)
+		zorotest_fail("Cannot create the system work queue\n");
+
+	s.nodes = calloc(NR_SORTED, sizeof(*s.nodes));
+	if (!s.nodes)
+		zorotest_fail("Cannot allocate the nodes\n");
+	zorotest_set_clear_on_fail(free, s.nodes);
+	INIT_LIST_HEAD(&s.head);
+	srand(1);
+	for (i = 0; i < NR_SORTED; i++) {
+		s.nodes[i].key = rand() % 1000;
+		s.nodes[i].seq = i;
+		list_add_tail(&s.nodes[i].list, &s.head);
+	}
+
+	zorowork_init(&s.work, sort_run);
+	zorowq_queue(wq, &s.work);
+	zorowq_flush(wq);
+
+	list_for_each_entry(pos, &s.head, list) {
+		if (prev) {
+			zorotest_assert_true(prev->key <= pos->key);
+			if (prev->key == pos->key)
+				zorotest_assert_true(prev->seq < pos->seq);
+		}
+		prev = pos;
+		n++;
+	}
+	zorotest_assert_eq_nums((size_t)NR_SORTED, n, "%zu");
+	for (p = s.head.prev; p != &s.head; p = p->prev)
+		n--;
+	zorotest_assert_eq_nums((size_t)0, n, "%zu");
+
+	free(s.nodes);
+	zorotest_success();
+}
+
+int main(void)
+{
+	struct zorotest_case tests[] = {
+		ZOROTEST_CASE(test_queue),
+		ZOROTEST_CASE(test_pending),
+		ZOROTEST_CASE(test_flush_order),
+		ZOROTEST_CASE(test_steal),
+		ZOROTEST_CASE(test_destroy_drains),
+		ZOROTEST_CASE(test_affine),
+		ZOROTEST_CASE(test_sort_in_work),
+	};
+
+	return zorotest_run_suite(tests, "workqueue", NULL);
+}